@@ -159,6 +159,16 @@ void SceneViewerApplication::read_config(const std::string &path)
 
 	if (doc.HasMember("timestamps"))
 		config.timestamps = doc["timestamps"].GetBool();
+	if (doc.HasMember("parallelRecording"))
+		config.parallel_recording = doc["parallelRecording"].GetBool();
+	if (doc.HasMember("memoryPacking"))
+		config.memory_packing = doc["memoryPacking"].GetBool();
+	if (doc.HasMember("textureStreaming"))
+		config.texture_streaming = doc["textureStreaming"].GetBool();
+	if (doc.HasMember("textureStreamingBudgetMiB"))
+		config.texture_streaming_budget_mib = doc["textureStreamingBudgetMiB"].GetUint();
+	if (doc.HasMember("asyncTextureUploads"))
+		config.async_texture_uploads = doc["asyncTextureUploads"].GetBool();
 
 	if (doc.HasMember("rescaleScene"))
 		config.rescale_scene = doc["rescaleScene"].GetBool();
@@ -181,6 +191,12 @@ void SceneViewerApplication::read_config(const std::string &path)
 		config.max_point_lights = doc["maxPointLights"].GetUint();
 	if (doc.HasMember("volumetricFog"))
 		config.volumetric_fog = doc["volumetricFog"].GetBool();
+	if (doc.HasMember("bindlessMaterials"))
+		config.bindless_materials = doc["bindlessMaterials"].GetBool();
+	if (doc.HasMember("compactVertices"))
+		config.compact_vertices = doc["compactVertices"].GetBool();
+	if (doc.HasMember("prewarmPipelines"))
+		config.prewarm_pipelines = doc["prewarmPipelines"].GetBool();
 }
 
 SceneViewerApplication::SceneViewerApplication(const std::string &path, const std::string &config_path,
@@ -194,6 +210,13 @@ SceneViewerApplication::SceneViewerApplication(const std::string &path, const st
 	if (!quirks_path.empty())
 		read_quirks(quirks_path);
 
+	forward_renderer.set_bindless_materials(config.bindless_materials);
+	deferred_renderer.set_bindless_materials(config.bindless_materials);
+	depth_renderer.set_bindless_materials(config.bindless_materials);
+
+	// Register before the scene loads, so texture streaming is enabled before materials request their textures.
+	EVENT_MANAGER_REGISTER_LATCH(SceneViewerApplication, on_device_created, on_device_destroyed, DeviceCreatedEvent);
+	scene_loader.set_compact_vertices(config.compact_vertices);
 	scene_loader.load_scene(path);
 
 	// Why not. :D
@@ -323,13 +346,14 @@ SceneViewerApplication::SceneViewerApplication(const std::string &path, const st
 	context.set_camera(*selected_camera);
 
 	graph.enable_timestamps(config.timestamps);
+	graph.enable_parallel_recording(config.parallel_recording);
+	graph.enable_memory_packing(config.memory_packing);
 
 	if (config.rescale_scene)
 		rescale_scene(10.0f);
 
 	EVENT_MANAGER_REGISTER_LATCH(SceneViewerApplication, on_swapchain_changed, on_swapchain_destroyed,
 	                             SwapchainParameterEvent);
-	EVENT_MANAGER_REGISTER_LATCH(SceneViewerApplication, on_device_created, on_device_destroyed, DeviceCreatedEvent);
 	EVENT_MANAGER_REGISTER(SceneViewerApplication, on_key_down, KeyboardEvent);
 }
 
@@ -379,11 +403,18 @@ void SceneViewerApplication::rescale_scene(float radius)
 
 void SceneViewerApplication::on_device_created(const DeviceCreatedEvent &device)
 {
+	auto &texture_manager = device.get_device().get_texture_manager();
+	texture_manager.enable_streaming(config.texture_streaming);
+	texture_manager.enable_async_uploads(config.async_texture_uploads);
+	texture_manager.set_streaming_budget(VkDeviceSize(config.texture_streaming_budget_mib) * 1024 * 1024,
+	                                     16 * 1024 * 1024);
+
 	if (!skydome_reflection.empty())
 		reflection = device.get_device().get_texture_manager().request_texture(skydome_reflection);
 	if (!skydome_irradiance.empty())
 		irradiance = device.get_device().get_texture_manager().request_texture(skydome_irradiance);
 	graph.set_device(&device.get_device());
+	prewarm_pipelines_pending = config.prewarm_pipelines;
 }
 
 void SceneViewerApplication::on_device_destroyed(const DeviceCreatedEvent &)
@@ -566,6 +597,27 @@ void SceneViewerApplication::capture_environment_probe()
 	save_image_buffer_to_gtx(device, buffer, "cache://environment.gtx");
 }
 
+// The first frame on a new device compiles every pipeline the scene can need in the background,
+// not only those of visible objects, so objects coming into view later do not stall on pipeline creation.
+// This runs inside the real render passes, so render pass compatibility and state match the draws exactly.
+void SceneViewerApplication::prewarm_pipelines(Renderer &renderer, CommandBuffer &cmd, bool transparent,
+                                               Renderer::RendererFlushFlags options)
+{
+	if (!prewarm_pipelines_pending)
+		return;
+
+	auto &scene = scene_loader.get_scene();
+	VisibilityList renderables;
+	if (transparent)
+		scene.gather_transparent_renderables(renderables);
+	else
+	{
+		scene.gather_opaque_renderables(renderables);
+		scene.gather_unbounded_renderables(renderables);
+	}
+	renderer.prewarm_pipelines(cmd, context, renderables, options);
+}
+
 void SceneViewerApplication::render_main_pass(CommandBuffer &cmd, const mat4 &proj, const mat4 &view)
 {
 	auto &scene = scene_loader.get_scene();
@@ -578,6 +630,7 @@ void SceneViewerApplication::render_main_pass(CommandBuffer &cmd, const mat4 &pr
 	{
 		if (config.forward_depth_prepass)
 		{
+			prewarm_pipelines(depth_renderer, cmd, false, Renderer::NO_COLOR);
 			depth_renderer.begin();
 			depth_renderer.push_renderables(context, visible);
 			depth_renderer.flush(cmd, context, Renderer::NO_COLOR);
@@ -587,18 +640,20 @@ void SceneViewerApplication::render_main_pass(CommandBuffer &cmd, const mat4 &pr
 
 		forward_renderer.set_mesh_renderer_options_from_lighting(lighting);
 		forward_renderer.set_mesh_renderer_options(forward_renderer.get_mesh_renderer_options() | config.pcf_flags);
-		forward_renderer.begin();
-		forward_renderer.push_renderables(context, visible);
 
 		Renderer::RendererOptionFlags opt = 0;
 		if (config.forward_depth_prepass)
 			opt |= Renderer::DEPTH_STENCIL_READ_ONLY;
 
+		prewarm_pipelines(forward_renderer, cmd, false, opt);
+		forward_renderer.begin();
+		forward_renderer.push_renderables(context, visible);
 		forward_renderer.flush(cmd, context, opt);
 	}
 	else if (config.renderer_type == RendererType::GeneralDeferred)
 	{
 		scene.gather_unbounded_renderables(visible);
+		prewarm_pipelines(deferred_renderer, cmd, false);
 		deferred_renderer.begin();
 		deferred_renderer.push_renderables(context, visible);
 		deferred_renderer.flush(cmd, context);
@@ -613,6 +668,7 @@ void SceneViewerApplication::render_transparent_objects(CommandBuffer &cmd, cons
 	scene.gather_visible_transparent_renderables(context.get_visibility_frustum(), visible);
 	forward_renderer.set_mesh_renderer_options_from_lighting(lighting);
 	forward_renderer.set_mesh_renderer_options(forward_renderer.get_mesh_renderer_options() | config.pcf_flags);
+	prewarm_pipelines(forward_renderer, cmd, true);
 	forward_renderer.begin();
 	forward_renderer.push_renderables(context, visible);
 	forward_renderer.flush(cmd, context);
@@ -1150,11 +1206,14 @@ void SceneViewerApplication::render_scene()
 	graph.enqueue_render_passes(device);
 
 	need_shadow_map_update = false;
+	prewarm_pipelines_pending = false;
 }
 
 void SceneViewerApplication::render_frame(double frame_time, double elapsed_time)
 {
 	update_scene(frame_time, elapsed_time);
+	if (config.texture_streaming)
+		get_wsi().get_device().get_texture_manager().update_streaming(graph.get_backbuffer_dimensions().height);
 	render_scene();
 }
 
@@ -83,6 +83,9 @@ protected:
 	Vulkan::Texture *irradiance = nullptr;
 
 	bool need_shadow_map_update = true;
+	bool prewarm_pipelines_pending = false;
+	void prewarm_pipelines(Renderer &renderer, Vulkan::CommandBuffer &cmd, bool transparent,
+	                       Renderer::RendererFlushFlags options = 0);
 	void update_shadow_map();
 	std::string skydome_reflection;
 	std::string skydome_irradiance;
@@ -143,11 +146,19 @@ private:
 		bool deferred_clustered_stencil_culling = true;
 		bool rt_fp16 = false;
 		bool timestamps = false;
+		bool parallel_recording = true;
+		bool memory_packing = false;
+		bool texture_streaming = false;
+		unsigned texture_streaming_budget_mib = 0;
+		bool async_texture_uploads = false;
 		bool rescale_scene = false;
 		bool force_shadow_map_update = false;
 		bool show_ui = true;
 		bool volumetric_fog = false;
 		bool ssao = true;
+		bool bindless_materials = false;
+		bool compact_vertices = false;
+		bool prewarm_pipelines = true;
 		PostAAType postaa_type = PostAAType::None;
 	};
 	Config config;
@@ -1,4 +1,7 @@
 #version 450
+#if defined(BINDLESS)
+#extension GL_EXT_nonuniform_qualifier : require
+#endif
 precision highp float;
 precision highp int;
 
@@ -6,7 +9,7 @@ precision highp int;
 #include "inc/subgroup_discard.h"
 #endif
 
-#if defined(VARIANT_BIT_0) && VARIANT_BIT_0 && defined(HAVE_BASECOLORMAP) && HAVE_BASECOLORMAP
+#if defined(VARIANT_BIT_0) && VARIANT_BIT_0 && defined(HAVE_BASECOLORMAP) && HAVE_BASECOLORMAP && !defined(BINDLESS)
 #define BANDLIMITED_PIXEL
 #include "inc/bandlimited_pixel_filter.h"
 const int bandlimited_pixel_lod = 0;
@@ -30,6 +33,32 @@ layout(location = 3) in mediump vec4 vTangent;
 layout(location = 4) in mediump vec4 vColor;
 #endif
 
+#if defined(BINDLESS)
+layout(location = 5) flat in highp uint vMaterialIndex;
+layout(set = 2, binding = 0) uniform mediump sampler2D uBindlessTextures[];
+
+struct MaterialData
+{
+    vec4 base_color;
+    vec4 emissive;
+    float roughness;
+    float metallic;
+    float normal_scale;
+    uint textures[5];
+};
+
+layout(std430, set = 3, binding = 4) readonly buffer Materials
+{
+    MaterialData materials[];
+};
+
+#define MATERIAL materials[vMaterialIndex]
+#define uBaseColormap uBindlessTextures[nonuniformEXT(MATERIAL.textures[0])]
+#define uNormalmap uBindlessTextures[nonuniformEXT(MATERIAL.textures[1])]
+#define uMetallicRoughnessmap uBindlessTextures[nonuniformEXT(MATERIAL.textures[2])]
+#define uOcclusionMap uBindlessTextures[nonuniformEXT(MATERIAL.textures[3])]
+#define uEmissiveMap uBindlessTextures[nonuniformEXT(MATERIAL.textures[4])]
+#else
 #if defined(HAVE_BASECOLORMAP) && HAVE_BASECOLORMAP
 layout(set = 2, binding = 0) uniform mediump sampler2D uBaseColormap;
 #endif
@@ -59,6 +88,9 @@ layout(std430, push_constant) uniform Constants
     float normal_scale;
 } registers;
 
+#define MATERIAL registers
+#endif
+
 #include "inc/render_target.h"
 
 void main()
@@ -72,10 +104,10 @@ void main()
     #if defined(BANDLIMITED_PIXEL)
         mediump vec4 base_color = sample_bandlimited_pixel(uBaseColormap, vUV, info, float(bandlimited_pixel_lod));
     #else
-        mediump vec4 base_color = texture(uBaseColormap, vUV) * registers.base_color;
+        mediump vec4 base_color = texture(uBaseColormap, vUV) * MATERIAL.base_color;
     #endif
 #else
-    mediump vec4 base_color = registers.base_color;
+    mediump vec4 base_color = MATERIAL.base_color;
 #endif
 
 #if defined(ALPHA_TEST)
@@ -106,7 +138,7 @@ void main()
 
         // For 2-component compressed textures.
         mediump float tangent_z = sqrt(max(0.0, 1.0 - dot(tangent_space, tangent_space)));
-        tangent_space *= registers.normal_scale;
+        tangent_space *= MATERIAL.normal_scale;
         normal = normalize(mat3(tangent, binormal, normal) * vec3(tangent_space, tangent_z));
     #endif
     if (!gl_FrontFacing)
@@ -121,11 +153,11 @@ void main()
     #else
         mediump vec2 mr = texture(uMetallicRoughnessmap, vUV).bg;
     #endif
-    mediump float metallic = mr.x * registers.metallic;
-    mediump float roughness = mr.y * registers.roughness;
+    mediump float metallic = mr.x * MATERIAL.metallic;
+    mediump float roughness = mr.y * MATERIAL.roughness;
 #else
-    mediump float metallic = registers.metallic;
-    mediump float roughness = registers.roughness;
+    mediump float metallic = MATERIAL.metallic;
+    mediump float roughness = MATERIAL.roughness;
 #endif
 
 #if defined(HAVE_OCCLUSIONMAP) && HAVE_OCCLUSIONMAP
@@ -144,9 +176,9 @@ void main()
     #else
         mediump vec3 emissive = texture(uEmissiveMap, vUV).rgb;
     #endif
-    emissive *= registers.emissive.rgb;
+    emissive *= MATERIAL.emissive.rgb;
 #else
-    mediump vec3 emissive = registers.emissive.rgb;
+    mediump vec3 emissive = MATERIAL.emissive.rgb;
 #endif
 
     // Ideally we want to discard ASAP, but discarding early make derivatives undefined.
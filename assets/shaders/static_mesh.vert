@@ -22,12 +22,20 @@ layout(location = 0) out highp vec3 vPos;
 
 #ifndef RENDERER_DEPTH
 #if HAVE_NORMAL
+#if HAVE_COMPACT_VERTEX
+layout(location = 2) in mediump vec2 Normal;
+#else
 layout(location = 2) in mediump vec3 Normal;
+#endif
 layout(location = 2) out mediump vec3 vNormal;
 #endif
 
 #if HAVE_TANGENT
+#if HAVE_COMPACT_VERTEX
+layout(location = 3) in mediump vec2 Tangent;
+#else
 layout(location = 3) in mediump vec4 Tangent;
+#endif
 layout(location = 3) out mediump vec4 vTangent;
 #endif
 #endif
@@ -66,31 +74,81 @@ layout(set = 3, binding = 0, std140) uniform PerVertexData
 {
     StaticMeshInfo infos[256];
 };
+
+#if defined(BINDLESS)
+layout(set = 3, binding = 3, std140) uniform PerInstanceMaterial
+{
+    uvec4 material_indices[64];
+};
+layout(location = 5) flat out highp uint vMaterialIndex;
+#endif
+#endif
+
+#if HAVE_COMPACT_VERTEX
+layout(std430, push_constant) uniform VertexDecode
+{
+    layout(offset = 48) vec4 position_scale;
+    vec4 position_offset;
+} decode;
+
+// Inverse of the octahedral encoding in SceneFormats::mesh_compact_vertices().
+mediump vec3 decode_octahedral(mediump vec2 e)
+{
+    mediump vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    mediump float t = max(-n.z, 0.0);
+    n.xy += mix(vec2(t), vec2(-t), greaterThanEqual(n.xy, vec2(0.0)));
+    return normalize(n);
+}
 #endif
 
 invariant gl_Position;
 
 void main()
 {
+#if HAVE_COMPACT_VERTEX
+    highp vec3 LocalPosition = Position * decode.position_scale.xyz + decode.position_offset.xyz;
+#else
+    highp vec3 LocalPosition = Position;
+#endif
+
+#ifndef RENDERER_DEPTH
+#if HAVE_NORMAL
+    #if HAVE_COMPACT_VERTEX
+        mediump vec3 LocalNormal = decode_octahedral(Normal);
+    #else
+        mediump vec3 LocalNormal = Normal;
+    #endif
+#endif
+#if HAVE_TANGENT
+    #if HAVE_COMPACT_VERTEX
+        // The sign of w is folded into y.
+        mediump vec4 LocalTangent = vec4(decode_octahedral(vec2(Tangent.x, abs(Tangent.y) * 2.0 - 1.0)),
+                                         Tangent.y < 0.0 ? -1.0 : 1.0);
+    #else
+        mediump vec4 LocalTangent = Tangent;
+    #endif
+#endif
+#endif
+
 #if HAVE_BONE_INDEX && HAVE_BONE_WEIGHT
     vec3 World =
         (
         BoneWorldTransforms[BoneIndices.x][0].xyz * BoneWeights.x +
         BoneWorldTransforms[BoneIndices.y][0].xyz * BoneWeights.y +
         BoneWorldTransforms[BoneIndices.z][0].xyz * BoneWeights.z +
-        BoneWorldTransforms[BoneIndices.w][0].xyz * BoneWeights.w) * Position.x +
+        BoneWorldTransforms[BoneIndices.w][0].xyz * BoneWeights.w) * LocalPosition.x +
 
         (
         BoneWorldTransforms[BoneIndices.x][1].xyz * BoneWeights.x +
         BoneWorldTransforms[BoneIndices.y][1].xyz * BoneWeights.y +
         BoneWorldTransforms[BoneIndices.z][1].xyz * BoneWeights.z +
-        BoneWorldTransforms[BoneIndices.w][1].xyz * BoneWeights.w) * Position.y +
+        BoneWorldTransforms[BoneIndices.w][1].xyz * BoneWeights.w) * LocalPosition.y +
 
         (
         BoneWorldTransforms[BoneIndices.x][2].xyz * BoneWeights.x +
         BoneWorldTransforms[BoneIndices.y][2].xyz * BoneWeights.y +
         BoneWorldTransforms[BoneIndices.z][2].xyz * BoneWeights.z +
-        BoneWorldTransforms[BoneIndices.w][2].xyz * BoneWeights.w) * Position.z +
+        BoneWorldTransforms[BoneIndices.w][2].xyz * BoneWeights.w) * LocalPosition.z +
 
         (
         BoneWorldTransforms[BoneIndices.x][3].xyz * BoneWeights.x +
@@ -99,9 +157,9 @@ void main()
         BoneWorldTransforms[BoneIndices.w][3].xyz * BoneWeights.w);
 #else
     vec3 World =
-        infos[gl_InstanceIndex].Model[0].xyz * Position.x +
-        infos[gl_InstanceIndex].Model[1].xyz * Position.y +
-        infos[gl_InstanceIndex].Model[2].xyz * Position.z +
+        infos[gl_InstanceIndex].Model[0].xyz * LocalPosition.x +
+        infos[gl_InstanceIndex].Model[1].xyz * LocalPosition.y +
+        infos[gl_InstanceIndex].Model[2].xyz * LocalPosition.z +
         infos[gl_InstanceIndex].Model[3].xyz;
 #endif
     gl_Position = global.view_projection * vec4(World, 1.0);
@@ -118,14 +176,14 @@ void main()
             mat3(BoneNormalTransforms[BoneIndices.y]) * BoneWeights.y +
             mat3(BoneNormalTransforms[BoneIndices.z]) * BoneWeights.z +
             mat3(BoneNormalTransforms[BoneIndices.w]) * BoneWeights.w;
-        vNormal = normalize(NormalTransform * Normal);
+        vNormal = normalize(NormalTransform * LocalNormal);
         #if HAVE_TANGENT
-            vTangent = vec4(normalize(NormalTransform * Tangent.xyz), Tangent.w);
+            vTangent = vec4(normalize(NormalTransform * LocalTangent.xyz), LocalTangent.w);
         #endif
     #else
-        vNormal = normalize(mat3(infos[gl_InstanceIndex].Normal) * Normal);
+        vNormal = normalize(mat3(infos[gl_InstanceIndex].Normal) * LocalNormal);
         #if HAVE_TANGENT
-            vTangent = vec4(normalize(mat3(infos[gl_InstanceIndex].Normal) * Tangent.xyz), Tangent.w);
+            vTangent = vec4(normalize(mat3(infos[gl_InstanceIndex].Normal) * LocalTangent.xyz), LocalTangent.w);
         #endif
     #endif
 #endif
@@ -144,4 +202,8 @@ void main()
 #if HAVE_VERTEX_COLOR
     vColor = VertexColor;
 #endif
+
+#if defined(BINDLESS) && !(HAVE_BONE_INDEX && HAVE_BONE_WEIGHT)
+    vMaterialIndex = material_indices[gl_InstanceIndex >> 2][gl_InstanceIndex & 3];
+#endif
 }
@@ -1,7 +1,10 @@
 #version 450
+#if defined(BINDLESS)
+#extension GL_EXT_nonuniform_qualifier : require
+#endif
 precision highp float;
 
-#if defined(VARIANT_BIT_0) && VARIANT_BIT_0 && defined(HAVE_BASECOLORMAP) && HAVE_BASECOLORMAP && defined(ALPHA_TEST)
+#if defined(VARIANT_BIT_0) && VARIANT_BIT_0 && defined(HAVE_BASECOLORMAP) && HAVE_BASECOLORMAP && defined(ALPHA_TEST) && !defined(BINDLESS)
 #define BANDLIMITED_PIXEL
 #include "inc/bandlimited_pixel_filter.h"
 const int bandlimited_pixel_lod = 0;
@@ -12,8 +15,31 @@ layout(location = 1) in highp vec2 vUV;
 #endif
 
 #if (defined(HAVE_BASECOLORMAP) && HAVE_BASECOLORMAP) && defined(ALPHA_TEST)
+#if defined(BINDLESS)
+layout(location = 5) flat in highp uint vMaterialIndex;
+layout(set = 2, binding = 0) uniform mediump sampler2D uBindlessTextures[];
+
+// Only the texture indices of the material, matching the MaterialData layout in static_mesh.frag.
+struct MaterialData
+{
+    vec4 base_color;
+    vec4 emissive;
+    float roughness;
+    float metallic;
+    float normal_scale;
+    uint textures[5];
+};
+
+layout(std430, set = 3, binding = 4) readonly buffer Materials
+{
+    MaterialData materials[];
+};
+
+#define uBaseColormap uBindlessTextures[nonuniformEXT(materials[vMaterialIndex].textures[0])]
+#else
 layout(set = 2, binding = 0) uniform mediump sampler2D uBaseColormap;
 #endif
+#endif
 
 #ifdef ALPHA_TEST_ALPHA_TO_COVERAGE
 layout(location = 0) out highp vec4 FragColor;
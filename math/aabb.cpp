@@ -21,25 +21,20 @@
  */
 
 #include "aabb.hpp"
-#include <float.h>
 
 namespace Granite
 {
 AABB AABB::transform(const mat4 &m) const
 {
-	vec3 m0 = vec3(FLT_MAX);
-	vec3 m1 = vec3(-FLT_MAX);
+	// Arvo's method, transform the center and accumulate the absolute contribution of each extent axis.
+	// This assumes an affine transform, which holds for all node and bone transforms.
+	vec3 center = get_center();
+	vec3 extent = get_extent();
 
-	for (unsigned i = 0; i < 8; i++)
-	{
-		vec3 c = get_corner(i);
-		vec4 t = m * vec4(c, 1.0f);
-		vec3 v = t.xyz();
-		m0 = min(v, m0);
-		m1 = max(v, m1);
-	}
+	vec3 new_center = m[3].xyz() + m[0].xyz() * center.x + m[1].xyz() * center.y + m[2].xyz() * center.z;
+	vec3 new_extent = abs(m[0].xyz()) * extent.x + abs(m[1].xyz()) * extent.y + abs(m[2].xyz()) * extent.z;
 
-	return AABB(m0, m1);
+	return AABB(new_center - new_extent, new_center + new_extent);
 }
 
 vec3 AABB::get_coord(float dx, float dy, float dz) const
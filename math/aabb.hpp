@@ -65,6 +65,11 @@ public:
 		return minimum + (maximum - minimum) * vec3(0.5f);
 	}
 
+	vec3 get_extent() const
+	{
+		return (maximum - minimum) * vec3(0.5f);
+	}
+
 	float get_radius() const
 	{
 		return 0.5f * distance(minimum, maximum);
@@ -74,4 +79,36 @@ private:
 	vec3 minimum;
 	vec3 maximum;
 };
+
+// Center/radius representation of an AABB, cached so that sphere tests
+// do not have to recompute the radius (and its sqrt) on every query.
+class BoundingSphere
+{
+public:
+	BoundingSphere() = default;
+
+	explicit BoundingSphere(const AABB &aabb)
+		: center(aabb.get_center()), radius(aabb.get_radius())
+	{
+	}
+
+	BoundingSphere(vec3 center, float radius)
+		: center(center), radius(radius)
+	{
+	}
+
+	const vec3 &get_center() const
+	{
+		return center;
+	}
+
+	float get_radius() const
+	{
+		return radius;
+	}
+
+private:
+	vec3 center = vec3(0.0f);
+	float radius = 0.0f;
+};
 }
\ No newline at end of file
@@ -27,19 +27,14 @@ namespace Granite
 
 bool Frustum::intersects(const AABB &aabb) const
 {
+	// Test the corner which is furthest along the plane normal, without enumerating all 8 corners.
+	vec3 center = aabb.get_center();
+	vec3 extent = aabb.get_extent();
+
 	for (auto &plane : planes)
 	{
-		bool intersects_plane = false;
-		for (unsigned i = 0; i < 8; i++)
-		{
-			if (dot(vec4(aabb.get_corner(i), 1.0f), plane) >= 0.0f)
-			{
-				intersects_plane = true;
-				break;
-			}
-		}
-
-		if (!intersects_plane)
+		vec3 n = plane.xyz();
+		if (dot(n, center) + dot(abs(n), extent) + plane.w < 0.0f)
 			return false;
 	}
 
@@ -48,8 +43,13 @@ bool Frustum::intersects(const AABB &aabb) const
 
 bool Frustum::intersects_fast(const AABB &aabb) const
 {
-	vec4 center(aabb.get_center(), 1.0f);
-	float radius = aabb.get_radius();
+	return intersects_sphere(BoundingSphere(aabb));
+}
+
+bool Frustum::intersects_sphere(const BoundingSphere &sphere) const
+{
+	vec4 center(sphere.get_center(), 1.0f);
+	float radius = sphere.get_radius();
 
 	for (auto &plane : planes)
 		if (dot(plane, center) < -radius)
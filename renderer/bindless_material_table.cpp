@@ -0,0 +1,169 @@
+/* Copyright (c) 2017-2018 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include "bindless_material_table.hpp"
+#include "device.hpp"
+
+using namespace std;
+using namespace Vulkan;
+using namespace Util;
+
+namespace Granite
+{
+void BindlessMaterialTable::init(Device *device)
+{
+	reset();
+	this->device = device;
+	textures = device->get_bindless_texture_table();
+}
+
+void BindlessMaterialTable::reset()
+{
+	lock_guard<mutex> holder{lock};
+	device = nullptr;
+	textures = nullptr;
+	entries.clear();
+	materials.clear();
+	free_indices.clear();
+	buffer.reset();
+	dirty = false;
+}
+
+void BindlessMaterialTable::begin()
+{
+	lock_guard<mutex> holder{lock};
+	counter++;
+
+	// Recycling is rare, so only sweep once in a while.
+	if ((counter % RecycleFrames) != 0)
+		return;
+
+	for (auto itr = entries.begin(); itr != entries.end(); )
+	{
+		if (itr->second.last_used + RecycleFrames < counter)
+		{
+			free_indices.push_back(itr->second.index);
+			itr = entries.erase(itr);
+		}
+		else
+			++itr;
+	}
+}
+
+bool BindlessMaterialTable::update_textures(BindlessMaterialData &data, const Material &material)
+{
+	bool changed = false;
+	for (unsigned i = 0; i < ecast(Material::Textures::Count); i++)
+	{
+		uint32_t index = 0;
+		if (material.textures[i])
+		{
+			index = textures->register_texture(material.textures[i]->get_image()->get_view(), material.sampler);
+			if (index == ~0u)
+				return false;
+		}
+
+		if (data.textures[i] != index)
+		{
+			data.textures[i] = index;
+			changed = true;
+		}
+	}
+
+	dirty |= changed;
+	return true;
+}
+
+uint32_t BindlessMaterialTable::get_material_index(const Material &material)
+{
+	if (!textures)
+		return ~0u;
+
+	lock_guard<mutex> holder{lock};
+	auto itr = entries.find(material.get_hash());
+	if (itr != end(entries))
+	{
+		// Texture indices are revalidated once per frame, since textures can be reloaded.
+		auto &entry = itr->second;
+		if (entry.last_used != counter)
+		{
+			if (!update_textures(materials[entry.index], material))
+				return ~0u;
+			entry.last_used = counter;
+		}
+		return entry.index;
+	}
+
+	BindlessMaterialData data = {};
+	data.base_color = material.base_color;
+	data.emissive = vec4(material.emissive, 0.0f);
+	data.roughness = material.roughness;
+	data.metallic = material.metallic;
+	data.normal_scale = material.normal_scale;
+	if (!update_textures(data, material))
+		return ~0u;
+
+	uint32_t index;
+	if (!free_indices.empty())
+	{
+		index = free_indices.back();
+		free_indices.pop_back();
+		materials[index] = data;
+	}
+	else
+	{
+		index = uint32_t(materials.size());
+		materials.push_back(data);
+	}
+
+	entries[material.get_hash()] = { index, counter };
+	dirty = true;
+	return index;
+}
+
+void BindlessMaterialTable::bind(CommandBuffer &cmd, unsigned set, unsigned binding)
+{
+	lock_guard<mutex> holder{lock};
+	if (materials.empty())
+		return;
+
+	// Destroying the old buffer is deferred until the GPU is done with this frame, so it is safe to replace.
+	if (dirty || !buffer)
+	{
+		BufferCreateInfo info = {};
+		info.domain = BufferDomain::Device;
+		info.size = materials.size() * sizeof(BindlessMaterialData);
+		info.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+		buffer = device->create_buffer(info, materials.data());
+		dirty = false;
+	}
+
+	cmd.set_storage_buffer(set, binding, *buffer);
+}
+
+unsigned BindlessMaterialTable::get_num_materials()
+{
+	lock_guard<mutex> holder{lock};
+	return unsigned(entries.size());
+}
+}
@@ -0,0 +1,98 @@
+/* Copyright (c) 2017-2018 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#pragma once
+
+#include "material.hpp"
+#include "buffer.hpp"
+#include "hashmap.hpp"
+#include <mutex>
+#include <vector>
+
+namespace Vulkan
+{
+class BindlessTextureTable;
+class CommandBuffer;
+class Device;
+}
+
+namespace Granite
+{
+// std430 layout of MaterialData in static_mesh.frag.
+struct BindlessMaterialData
+{
+	vec4 base_color;
+	vec4 emissive;
+	float roughness;
+	float metallic;
+	float normal_scale;
+	uint32_t textures[Util::ecast(Material::Textures::Count)];
+};
+
+// Gives each material an index into a storage buffer of material parameters and bindless texture indices.
+// Meshes which only differ in material can then share a pipeline, descriptor sets and instanced draws.
+class BindlessMaterialTable
+{
+public:
+	enum { RecycleFrames = 64 };
+
+	// Does nothing if the device does not support descriptor indexing.
+	void init(Vulkan::Device *device);
+	void reset();
+
+	bool is_supported() const
+	{
+		return textures != nullptr;
+	}
+
+	// Called from Renderer::begin(). Materials which were not used for RecycleFrames begins give up their index.
+	void begin();
+
+	// Returns ~0u if the material has to use the regular descriptor set path.
+	uint32_t get_material_index(const Material &material);
+
+	// Uploads the material buffer if materials were added since the last call, and binds it.
+	void bind(Vulkan::CommandBuffer &cmd, unsigned set, unsigned binding);
+
+	unsigned get_num_materials();
+
+private:
+	Vulkan::Device *device = nullptr;
+	Vulkan::BindlessTextureTable *textures = nullptr;
+
+	struct Entry
+	{
+		uint32_t index;
+		uint64_t last_used;
+	};
+	Util::HashMap<Entry> entries;
+	std::vector<BindlessMaterialData> materials;
+	std::vector<uint32_t> free_indices;
+	Vulkan::BufferHandle buffer;
+	uint64_t counter = 0;
+	bool dirty = false;
+	std::mutex lock;
+
+	bool update_textures(BindlessMaterialData &data, const Material &material);
+};
+}
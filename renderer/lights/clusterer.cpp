@@ -465,7 +465,7 @@ void LightClusterer::render_atlas_point(RenderContext &context)
 	}
 
 	RenderContext depth_context;
-	VisibilityList visible;
+	VisibilityList visible(Util::thread_frame_allocator<RenderableInfo>());
 
 	for (unsigned i = 0; i < points.count; i++)
 	{
@@ -608,7 +608,7 @@ void LightClusterer::render_atlas_spot(RenderContext &context)
 	}
 
 	RenderContext depth_context;
-	VisibilityList visible;
+	VisibilityList visible(Util::thread_frame_allocator<RenderableInfo>());
 
 	for (unsigned i = 0; i < spots.count; i++)
 	{
@@ -892,10 +892,13 @@ void LightClusterer::build_cluster_cpu(Vulkan::CommandBuffer &cmd, Vulkan::Image
 				uint32_t cached_point_mask = 0;
 				uvec4 cached_node = uvec4(0);
 
-				vector<uint32_t> tmp_list_buffer;
-				vector<uvec4> image_base;
+				// Scratch data for this task. There are well over a hundred tasks per frame,
+				// so reuse one allocation per worker thread rather than growing the frame arena by the sum of all tasks.
+				static thread_local vector<uint32_t> tmp_list_buffer;
+				static thread_local vector<uvec4> image_base;
+				tmp_list_buffer.clear();
 				if (ImplementationQuirks::get().clustering_list_iteration)
-					image_base.resize(ClusterPrepassDownsample * res_x * res_y);
+					image_base.assign(ClusterPrepassDownsample * res_x * res_y, uvec4(0u));
 
 				auto *image_output_base = &image_data[slice * res_z * res_y * res_x + cz * res_y * res_x];
 
@@ -1105,10 +1108,10 @@ void LightClusterer::add_render_passes(RenderGraph &graph)
 	if (ImplementationQuirks::get().clustering_list_iteration || ImplementationQuirks::get().clustering_force_cpu)
 	{
 #ifdef CLUSTERER_FORCE_TRANSFER_UPDATE
-		auto &pass = graph.add_pass("clustering", RENDER_GRAPH_QUEUE_COMPUTE_BIT);
+		auto &pass = graph.add_pass("clustering", RenderGraph::get_default_compute_queue());
 		pass.add_blit_texture_output("light-cluster", att);
 #else
-		auto &pass = graph.add_pass("clustering", RENDER_GRAPH_QUEUE_COMPUTE_BIT);
+		auto &pass = graph.add_pass("clustering", RenderGraph::get_default_compute_queue());
 		pass.add_storage_texture_output("light-cluster", att);
 #endif
 		pass.set_build_render_pass([this](Vulkan::CommandBuffer &cmd) {
@@ -1132,7 +1135,7 @@ void LightClusterer::add_render_passes(RenderGraph &graph)
 		att_prepass.size_y /= ClusterPrepassDownsample;
 		att_prepass.size_z /= ClusterPrepassDownsample;
 
-		auto &pass = graph.add_pass("clustering", RENDER_GRAPH_QUEUE_COMPUTE_BIT);
+		auto &pass = graph.add_pass("clustering", RenderGraph::get_default_compute_queue());
 		pass.add_storage_texture_output("light-cluster", att);
 		pass.add_storage_texture_output("light-cluster-prepass", att_prepass);
 		pass.set_build_render_pass([this](Vulkan::CommandBuffer &cmd) {
@@ -61,8 +61,8 @@ void DeferredLights::refresh(RenderContext &context)
 	float cluster_max = 0.0f;
 	for (auto &light : visible)
 	{
-		auto &aabb = light.transform->world_aabb;
-		float to_center = dot(aabb.get_center() - params.camera_position, params.camera_front);
+		auto &sphere = light.transform->world_sphere;
+		float to_center = dot(sphere.get_center() - params.camera_position, params.camera_front);
 		cluster_min = min(to_center, cluster_min);
 		cluster_max = max(to_center, cluster_max);
 	}
@@ -74,8 +74,8 @@ void DeferredLights::refresh(RenderContext &context)
 	// Assign each renderable to a cluster index based on their position.
 	for (auto &light : visible)
 	{
-		auto &aabb = light.transform->world_aabb;
-		float to_center = dot(aabb.get_center() - params.camera_position, params.camera_front);
+		auto &sphere = light.transform->world_sphere;
+		float to_center = dot(sphere.get_center() - params.camera_position, params.camera_front);
 		int cluster_index = clamp(int((to_center - cluster_min) * cluster_inv_range), 0, NumClusters - 1);
 		clusters[cluster_index].push_back(light);
 	}
@@ -98,7 +98,9 @@ enum MaterialTextureFlagBits
 	MATERIAL_TEXTURE_EMISSIVE_BIT = 1u << Util::ecast(Material::Textures::Emissive),
 	MATERIAL_EMISSIVE_BIT = 1u << 5,
 	MATERIAL_EMISSIVE_REFRACTION_BIT = 1u << 6,
-	MATERIAL_EMISSIVE_REFLECTION_BIT = 1u << 7
+	MATERIAL_EMISSIVE_REFLECTION_BIT = 1u << 7,
+	// Textures and material parameters are fetched from the BindlessMaterialTable.
+	MATERIAL_BINDLESS_BIT = 1u << 8
 };
 
 enum MaterialShaderVariantFlagBits
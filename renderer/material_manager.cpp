@@ -175,7 +175,7 @@ void MaterialFile::init_textures()
 		}
 
 		if (!paths[i].empty())
-			textures[i] = device->get_texture_manager().request_texture(paths[i], default_format, swizzle[i]);
+			textures[i] = device->get_texture_manager().request_streamed_texture(paths[i], default_format, swizzle[i]);
 		else
 			textures[i] = nullptr;
 	}
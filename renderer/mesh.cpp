@@ -31,7 +31,7 @@ using namespace Vulkan;
 
 namespace Granite
 {
-Hash StaticMesh::get_instance_key() const
+Hash StaticMesh::get_geometry_key() const
 {
 	Hasher h;
 	h.u64(vbo_position->get_cookie());
@@ -52,12 +52,28 @@ Hash StaticMesh::get_instance_key() const
 	h.u32(count);
 	h.u32(vertex_offset);
 	h.u32(position_stride);
-	h.u64(material->get_hash());
 	for (auto &attr : attributes)
 	{
 		h.u32(attr.format);
 		h.u32(attr.offset);
 	}
+	h.u32(compact_vertices);
+	if (compact_vertices)
+	{
+		for (unsigned i = 0; i < 3; i++)
+		{
+			h.f32(position_scale[i]);
+			h.f32(position_offset[i]);
+		}
+	}
+	return h.get();
+}
+
+Hash StaticMesh::get_instance_key() const
+{
+	Hasher h;
+	h.u64(get_geometry_key());
+	h.u64(material->get_hash());
 	return h.get();
 }
 
@@ -90,12 +106,22 @@ void mesh_set_state(CommandBuffer &cmd, const StaticMeshInfo &info)
 		if (info.attributes[i].format != VK_FORMAT_UNDEFINED)
 			cmd.set_vertex_attrib(i, i == 0 ? 0 : 1, info.attributes[i].format, info.attributes[i].offset);
 
-	auto &sampler = cmd.get_device().get_stock_sampler(info.sampler);
-	for (unsigned i = 0; i < ecast(Material::Textures::Count); i++)
-		if (info.views[i])
-			cmd.set_texture(2, i, *info.views[i], sampler);
+	if (!info.bindless)
+	{
+		auto &sampler = cmd.get_device().get_stock_sampler(info.sampler);
+		for (unsigned i = 0; i < ecast(Material::Textures::Count); i++)
+			if (info.views[i])
+				cmd.set_texture(2, i, *info.views[i], sampler);
+
+		cmd.push_constants(&info.fragment, 0, sizeof(info.fragment));
+	}
+
+	if (info.compact_vertices)
+	{
+		cmd.push_constants(&info.vertex_decode, StaticMeshVertexDecode::push_constant_offset,
+		                   sizeof(info.vertex_decode));
+	}
 
-	cmd.push_constants(&info.fragment, 0, sizeof(info.fragment));
 	cmd.set_primitive_topology(info.topology);
 	cmd.set_primitive_restart(info.primitive_restart);
 
@@ -149,6 +175,14 @@ void static_mesh_render(CommandBuffer &cmd, const RenderQueueData *infos, unsign
 		for (unsigned j = 0; j < to_render; j++)
 			vertex_data[j] = static_cast<const StaticMeshInstanceInfo *>(infos[i + j].instance_data)->vertex;
 
+		if (info->bindless)
+		{
+			// Declared as an array of uvec4 in the shader.
+			auto *material_indices = static_cast<uint32_t *>(cmd.allocate_constant_data(3, 3, ((to_render + 3) & ~3u) * sizeof(uint32_t)));
+			for (unsigned j = 0; j < to_render; j++)
+				material_indices[j] = static_cast<const StaticMeshInstanceInfo *>(infos[i + j].instance_data)->material_index;
+		}
+
 		if (info->ibo)
 			cmd.draw_indexed(info->count, to_render, info->ibo_offset, info->vertex_offset, 0);
 		else
@@ -199,8 +233,12 @@ void StaticMesh::fill_render_info(StaticMeshInfo &info) const
 
 	info.topology = topology;
 	info.primitive_restart = primitive_restart;
+	info.compact_vertices = compact_vertices;
+	info.vertex_decode.position_scale = vec4(position_scale, 0.0f);
+	info.vertex_decode.position_offset = vec4(position_offset, 0.0f);
 	info.two_sided = material->two_sided;
 	info.alpha_test = material->pipeline == DrawPipeline::AlphaTest;
+	info.bindless = false;
 
 	memcpy(info.attributes, attributes, sizeof(attributes));
 	for (unsigned i = 0; i < ecast(Material::Textures::Count); i++)
@@ -209,7 +247,7 @@ void StaticMesh::fill_render_info(StaticMeshInfo &info) const
 
 void StaticMesh::bake()
 {
-	cached_hash = get_instance_key();
+	cached_hash = get_geometry_key();
 }
 
 static Queue material_to_queue(const Material &mat)
@@ -222,31 +260,76 @@ static Queue material_to_queue(const Material &mat)
 		return Queue::Opaque;
 }
 
+// Streamed textures need to know how large they appear on screen to pick which mips to keep resident.
+static void report_texture_coverage(const RenderContext &context, const Material &material, const BoundingSphere &sphere)
+{
+	auto &params = context.get_render_parameters();
+	float coverage = sphere.get_radius() * muglm::abs(params.projection[1][1]);
+	if (params.projection[2][3] != 0.0f)
+		coverage /= muglm::max(distance(sphere.get_center(), params.camera_position), params.z_near);
+
+	for (auto &texture : material.textures)
+		if (texture)
+			texture->report_screen_coverage(coverage);
+}
+
 void StaticMesh::get_render_info(const RenderContext &context, const CachedSpatialTransformComponent *transform, RenderQueue &queue) const
 {
 	auto type = material_to_queue(*material);
+	report_texture_coverage(context, *material, transform->world_sphere);
 	uint32_t attrs = 0;
+	uint32_t textures = 0;
 
 	for (unsigned i = 0; i < ecast(MeshAttribute::Count); i++)
 		if (attributes[i].format != VK_FORMAT_UNDEFINED)
 			attrs |= 1u << i;
+	if (compact_vertices)
+		attrs |= MESH_ATTRIBUTE_COMPACT_BIT;
+
+	for (unsigned i = 0; i < ecast(Material::Textures::Count); i++)
+		if (material->textures[i])
+			textures |= 1u << i;
+
+	if (type == Queue::OpaqueEmissive)
+		textures |= MATERIAL_EMISSIVE_BIT;
+
+	// Shader variants sample textures in ways the bindless path does not support.
+	uint32_t material_index = ~0u;
+	auto *bindless = queue.get_bindless_materials();
+	if (bindless && material->shader_variant == 0)
+		material_index = bindless->get_material_index(*material);
 
 	Hasher h;
 	h.u32(attrs);
 	h.u32(ecast(material->pipeline));
 	h.u32(material->shader_variant);
-	auto pipe_hash = h.get();
 
-	h.u64(material->get_hash());
+	Hash instance_key;
+	if (material_index != ~0u)
+	{
+		// Only material state which affects the program or render state splits batches.
+		textures |= MATERIAL_BINDLESS_BIT;
+		h.u32(textures);
+		h.u32(material->two_sided);
+		Hasher instance(h.get());
+		instance.u64(cached_hash);
+		instance_key = instance.get();
+	}
+	else
+		instance_key = get_baked_instance_key();
+
+	auto pipe_hash = h.get();
+	if (material_index == ~0u)
+		h.u64(material->get_hash());
 	h.u64(vbo_position->get_cookie());
 
-	auto instance_key = get_baked_instance_key();
-	auto sorting_key = RenderInfo::get_sort_key(context, type, pipe_hash, h.get(), transform->world_aabb.get_center());
+	auto sorting_key = RenderInfo::get_sort_key(context, type, pipe_hash, h.get(), transform->world_sphere.get_center());
 
 	auto *t = transform->transform;
 	auto *instance_data = queue.allocate_one<StaticMeshInstanceInfo>();
 	instance_data->vertex.Model = t->world_transform;
 	instance_data->vertex.Normal = t->normal_transform;
+	instance_data->material_index = material_index;
 
 	auto *mesh_info = queue.push<StaticMeshInfo>(type, instance_key, sorting_key,
 	                                             RenderFunctions::static_mesh_render,
@@ -254,15 +337,8 @@ void StaticMesh::get_render_info(const RenderContext &context, const CachedSpati
 
 	if (mesh_info)
 	{
-		uint32_t textures = 0;
-		for (unsigned i = 0; i < ecast(Material::Textures::Count); i++)
-			if (material->textures[i])
-				textures |= 1u << i;
-
-		if (type == Queue::OpaqueEmissive)
-			textures |= MATERIAL_EMISSIVE_BIT;
-
 		fill_render_info(*mesh_info);
+		mesh_info->bindless = material_index != ~0u;
 		mesh_info->program = queue.get_shader_suites()[ecast(RenderableType::Mesh)].get_program(material->pipeline, attrs,
 		                                                                                        textures, material->shader_variant);
 	}
@@ -271,12 +347,15 @@ void StaticMesh::get_render_info(const RenderContext &context, const CachedSpati
 void SkinnedMesh::get_render_info(const RenderContext &context, const CachedSpatialTransformComponent *transform, RenderQueue &queue) const
 {
 	auto type = material_to_queue(*material);
+	report_texture_coverage(context, *material, transform->world_sphere);
 	uint32_t attrs = 0;
 	uint32_t textures = 0;
 
 	for (unsigned i = 0; i < ecast(MeshAttribute::Count); i++)
 		if (attributes[i].format != VK_FORMAT_UNDEFINED)
 			attrs |= 1u << i;
+	if (compact_vertices)
+		attrs |= MESH_ATTRIBUTE_COMPACT_BIT;
 
 	for (unsigned i = 0; i < ecast(Material::Textures::Count); i++)
 		if (material->textures[i])
@@ -293,7 +372,7 @@ void SkinnedMesh::get_render_info(const RenderContext &context, const CachedSpat
 	h.u64(vbo_position->get_cookie());
 
 	auto instance_key = get_baked_instance_key() ^ 1;
-	auto sorting_key = RenderInfo::get_sort_key(context, type, pipe_hash, h.get(), transform->world_aabb.get_center());
+	auto sorting_key = RenderInfo::get_sort_key(context, type, pipe_hash, h.get(), transform->world_sphere.get_center());
 
 	auto *instance_data = queue.allocate_one<SkinnedMeshInstanceInfo>();
 
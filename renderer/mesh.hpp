@@ -54,7 +54,9 @@ enum MeshAttributeFlagBits
 	MESH_ATTRIBUTE_TANGENT_BIT = 1u << Util::ecast(MeshAttribute::Tangent),
 	MESH_ATTRIBUTE_BONE_INDEX_BIT = 1u << Util::ecast(MeshAttribute::BoneIndex),
 	MESH_ATTRIBUTE_BONE_WEIGHTS_BIT = 1u << Util::ecast(MeshAttribute::BoneWeights),
-	MESH_ATTRIBUTE_VERTEX_COLOR_BIT = 1u << Util::ecast(MeshAttribute::VertexColor)
+	MESH_ATTRIBUTE_VERTEX_COLOR_BIT = 1u << Util::ecast(MeshAttribute::VertexColor),
+	// Not an attribute, selects the HAVE_COMPACT_VERTEX decode path in static_mesh.vert.
+	MESH_ATTRIBUTE_COMPACT_BIT = 1u << 16
 };
 
 struct MeshAttributeLayout
@@ -82,6 +84,17 @@ struct StaticMeshFragment
 	float normal_scale;
 };
 
+// Push constants for meshes with compact vertices, placed after StaticMeshFragment.
+struct StaticMeshVertexDecode
+{
+	vec4 position_scale;
+	vec4 position_offset;
+	enum
+	{
+		push_constant_offset = 48
+	};
+};
+
 struct DebugMeshInstanceInfo
 {
 	vec3 *positions;
@@ -98,6 +111,8 @@ struct DebugMeshInfo
 struct StaticMeshInstanceInfo
 {
 	StaticMeshVertex vertex;
+	// Index into the BindlessMaterialTable when StaticMeshInfo::bindless is set.
+	uint32_t material_index;
 };
 
 struct SkinnedMeshInstanceInfo
@@ -120,6 +135,7 @@ struct StaticMeshInfo
 	MeshAttributeLayout attributes[Util::ecast(MeshAttribute::Count)];
 
 	StaticMeshFragment fragment;
+	StaticMeshVertexDecode vertex_decode;
 
 	uint32_t ibo_offset = 0;
 	int32_t vertex_offset = 0;
@@ -131,6 +147,9 @@ struct StaticMeshInfo
 	bool two_sided;
 	bool alpha_test;
 	bool primitive_restart;
+	bool compact_vertices;
+	// Textures and fragment constants come from the material table instead of views and fragment.
+	bool bindless;
 };
 
 namespace RenderFunctions
@@ -158,8 +177,15 @@ struct StaticMesh : AbstractRenderable
 
 	MeshAttributeLayout attributes[Util::ecast(MeshAttribute::Count)];
 
+	// Vertices are in the layout produced by SceneFormats::mesh_compact_vertices().
+	bool compact_vertices = false;
+	vec3 position_scale = vec3(1.0f);
+	vec3 position_offset = vec3(0.0f);
+
 	MaterialHandle material;
 
+	// Everything which makes up a draw except the material.
+	Util::Hash get_geometry_key() const;
 	Util::Hash get_instance_key() const;
 	Util::Hash get_baked_instance_key() const;
 
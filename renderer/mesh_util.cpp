@@ -38,12 +38,20 @@ using namespace Granite::SceneFormats;
 
 namespace Granite
 {
-ImportedSkinnedMesh::ImportedSkinnedMesh(const Mesh &mesh, const MaterialInfo &info)
-	: mesh(mesh), info(info)
+ImportedSkinnedMesh::ImportedSkinnedMesh(const Mesh &mesh, const MaterialInfo &info, bool compact)
+	: ImportedSkinnedMesh(Mesh(mesh), info, compact)
+{
+}
+
+ImportedSkinnedMesh::ImportedSkinnedMesh(Mesh &&mesh_, const MaterialInfo &info, bool compact)
+	: mesh(std::move(mesh_)), info(info)
 {
 	topology = mesh.topology;
 	index_type = mesh.index_type;
 
+	if (compact)
+		compact_vertices = mesh_compact_vertices(mesh, position_scale, position_offset);
+
 	position_stride = mesh.position_stride;
 	attribute_stride = mesh.attribute_stride;
 	memcpy(attributes, mesh.attribute_layout, sizeof(mesh.attribute_layout));
@@ -64,22 +72,26 @@ void ImportedSkinnedMesh::on_device_created(const DeviceCreatedEvent &created)
 
 	BufferCreateInfo info = {};
 	info.domain = BufferDomain::Device;
+	info.misc = BUFFER_MISC_RELOCATABLE_BIT;
 	info.usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT;
 
+	// Scenes can have a lot of meshes, so batch their uploads instead of submitting per buffer.
+	auto &uploads = device.get_upload_manager();
+
 	info.size = mesh.positions.size();
-	vbo_position = device.create_buffer(info, mesh.positions.data());
+	vbo_position = uploads.create_buffer(info, mesh.positions.data());
 
 	if (!mesh.attributes.empty())
 	{
 		info.size = mesh.attributes.size();
-		vbo_attributes = device.create_buffer(info, mesh.attributes.data());
+		vbo_attributes = uploads.create_buffer(info, mesh.attributes.data());
 	}
 
 	if (!mesh.indices.empty())
 	{
 		info.usage = VK_BUFFER_USAGE_INDEX_BUFFER_BIT;
 		info.size = mesh.indices.size();
-		ibo = device.create_buffer(info, mesh.indices.data());
+		ibo = uploads.create_buffer(info, mesh.indices.data());
 	}
 
 	bake();
@@ -92,13 +104,21 @@ void ImportedSkinnedMesh::on_device_destroyed(const DeviceCreatedEvent &)
 	ibo.reset();
 }
 
-ImportedMesh::ImportedMesh(const Mesh &mesh, const MaterialInfo &info)
-	: mesh(mesh), info(info)
+ImportedMesh::ImportedMesh(const Mesh &mesh, const MaterialInfo &info, bool compact)
+	: ImportedMesh(Mesh(mesh), info, compact)
+{
+}
+
+ImportedMesh::ImportedMesh(Mesh &&mesh_, const MaterialInfo &info, bool compact)
+	: mesh(std::move(mesh_)), info(info)
 {
 	topology = mesh.topology;
 	primitive_restart = mesh.primitive_restart;
 	index_type = mesh.index_type;
 
+	if (compact)
+		compact_vertices = mesh_compact_vertices(mesh, position_scale, position_offset);
+
 	position_stride = mesh.position_stride;
 	attribute_stride = mesh.attribute_stride;
 	memcpy(attributes, mesh.attribute_layout, sizeof(mesh.attribute_layout));
@@ -119,22 +139,26 @@ void ImportedMesh::on_device_created(const DeviceCreatedEvent &created)
 
 	BufferCreateInfo info = {};
 	info.domain = BufferDomain::Device;
+	info.misc = BUFFER_MISC_RELOCATABLE_BIT;
 	info.usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT;
 
+	// Scenes can have a lot of meshes, so batch their uploads instead of submitting per buffer.
+	auto &uploads = device.get_upload_manager();
+
 	info.size = mesh.positions.size();
-	vbo_position = device.create_buffer(info, mesh.positions.data());
+	vbo_position = uploads.create_buffer(info, mesh.positions.data());
 
 	if (!mesh.attributes.empty())
 	{
 		info.size = mesh.attributes.size();
-		vbo_attributes = device.create_buffer(info, mesh.attributes.data());
+		vbo_attributes = uploads.create_buffer(info, mesh.attributes.data());
 	}
 
 	if (!mesh.indices.empty())
 	{
 		info.usage = VK_BUFFER_USAGE_INDEX_BUFFER_BIT;
 		info.size = mesh.indices.size();
-		ibo = device.create_buffer(info, mesh.indices.data());
+		ibo = uploads.create_buffer(info, mesh.indices.data());
 	}
 
 	bake();
@@ -34,7 +34,9 @@ class FrameTickEvent;
 class ImportedMesh : public StaticMesh, public EventHandler
 {
 public:
-	ImportedMesh(const SceneFormats::Mesh &mesh, const SceneFormats::MaterialInfo &info);
+	// If compact_vertices is set, vertex streams are converted with SceneFormats::mesh_compact_vertices() where possible.
+	ImportedMesh(const SceneFormats::Mesh &mesh, const SceneFormats::MaterialInfo &info, bool compact_vertices = false);
+	ImportedMesh(SceneFormats::Mesh &&mesh, const SceneFormats::MaterialInfo &info, bool compact_vertices = false);
 
 private:
 	SceneFormats::Mesh mesh;
@@ -47,7 +49,9 @@ private:
 class ImportedSkinnedMesh : public SkinnedMesh, public EventHandler
 {
 public:
-	ImportedSkinnedMesh(const SceneFormats::Mesh &mesh, const SceneFormats::MaterialInfo &info);
+	// If compact_vertices is set, vertex streams are converted with SceneFormats::mesh_compact_vertices() where possible.
+	ImportedSkinnedMesh(const SceneFormats::Mesh &mesh, const SceneFormats::MaterialInfo &info, bool compact_vertices = false);
+	ImportedSkinnedMesh(SceneFormats::Mesh &&mesh, const SceneFormats::MaterialInfo &info, bool compact_vertices = false);
 
 private:
 	SceneFormats::Mesh mesh;
@@ -592,7 +592,7 @@ void Ocean::update_fft_pass(Vulkan::CommandBuffer &cmd)
 
 void Ocean::add_lod_update_pass(RenderGraph &graph)
 {
-	auto &update_lod = graph.add_pass("ocean-update-lods", RENDER_GRAPH_QUEUE_COMPUTE_BIT);
+	auto &update_lod = graph.add_pass("ocean-update-lods", RenderGraph::get_default_compute_queue());
 	AttachmentInfo lod_attachment;
 	lod_attachment.format = VK_FORMAT_R16_SFLOAT;
 	lod_attachment.size_x = float(config.grid_count);
@@ -647,7 +647,7 @@ void Ocean::add_fft_update_pass(RenderGraph &graph)
 	normal_map.aux_usage = VK_IMAGE_USAGE_SAMPLED_BIT;
 	normal_map.levels = 0;
 
-	auto &update_fft = graph.add_pass("ocean-update-fft", RENDER_GRAPH_QUEUE_COMPUTE_BIT);
+	auto &update_fft = graph.add_pass("ocean-update-fft", RenderGraph::get_default_compute_queue());
 
 	height_fft_input = &update_fft.add_storage_output("ocean-height-fft-input",
 	                                                  height_info);
@@ -320,6 +320,7 @@ void setup_hdr_postprocess_compute(RenderGraph &graph, const std::string &input,
 	downsample_info3.size_y = 0.03125f;
 
 	auto &bloom_pass = graph.add_pass("bloom-compute", RenderGraph::get_default_compute_queue());
+	bloom_pass.set_parallel_recording(true);
 	// Workaround a cache invalidation driver bug by not aliasing.
 	auto &t = bloom_pass.add_storage_texture_output("threshold", downsample_info);
 	auto &d0 = bloom_pass.add_storage_texture_output("downsample-0", downsample_info0);
@@ -387,6 +388,7 @@ void setup_hdr_postprocess(RenderGraph &graph, const std::string &input, const s
 
 	{
 		auto &adapt_pass = graph.add_pass("adapt-luminance", RenderGraph::get_default_compute_queue());
+		adapt_pass.set_parallel_recording(true);
 		auto &output_res = adapt_pass.add_storage_output("average-luminance-updated", buffer_info, "average-luminance");
 		auto &input_res = adapt_pass.add_texture_input("bloom-downsample-3");
 		adapt_pass.set_build_render_pass([&](Vulkan::CommandBuffer &cmd)
@@ -397,6 +399,7 @@ void setup_hdr_postprocess(RenderGraph &graph, const std::string &input, const s
 
 	{
 		auto &threshold = graph.add_pass("bloom-threshold", RenderGraph::get_default_post_graphics_queue());
+		threshold.set_parallel_recording(true);
 		AttachmentInfo threshold_info;
 		threshold_info.format = VK_FORMAT_R16G16B16A16_SFLOAT;
 		threshold_info.size_x = 0.5f;
@@ -420,6 +423,7 @@ void setup_hdr_postprocess(RenderGraph &graph, const std::string &input, const s
 		blur_info.size_class = SizeClass::InputRelative;
 		blur_info.size_relative_name = input;
 		auto &blur0 = graph.add_pass("bloom-downsample-0", RenderGraph::get_default_post_graphics_queue());
+		blur0.set_parallel_recording(true);
 		blur0.add_color_output("bloom-downsample-0", blur_info);
 		auto &input_res = blur0.add_texture_input("threshold");
 		blur0.set_build_render_pass([&](Vulkan::CommandBuffer &cmd)
@@ -433,6 +437,7 @@ void setup_hdr_postprocess(RenderGraph &graph, const std::string &input, const s
 		blur_info.size_y = 0.125f;
 		blur_info.format = VK_FORMAT_R16G16B16A16_SFLOAT;
 		auto &blur1 = graph.add_pass("bloom-downsample-1", RenderGraph::get_default_post_graphics_queue());
+		blur1.set_parallel_recording(true);
 		blur1.add_color_output("bloom-downsample-1", blur_info);
 		auto &input_res = blur1.add_texture_input("bloom-downsample-0");
 		blur1.set_build_render_pass([&](Vulkan::CommandBuffer &cmd)
@@ -446,6 +451,7 @@ void setup_hdr_postprocess(RenderGraph &graph, const std::string &input, const s
 		blur_info.size_y = 0.0625f;
 		blur_info.format = VK_FORMAT_R16G16B16A16_SFLOAT;
 		auto &blur2 = graph.add_pass("bloom-downsample-2", RenderGraph::get_default_post_graphics_queue());
+		blur2.set_parallel_recording(true);
 		blur2.add_color_output("bloom-downsample-2", blur_info);
 		auto &input_res = blur2.add_texture_input("bloom-downsample-1");
 		blur2.set_build_render_pass([&](Vulkan::CommandBuffer &cmd)
@@ -459,6 +465,7 @@ void setup_hdr_postprocess(RenderGraph &graph, const std::string &input, const s
 		blur_info.size_y = 0.03125f;
 		blur_info.format = VK_FORMAT_R16G16B16A16_SFLOAT;
 		auto &blur3 = graph.add_pass("bloom-downsample-3", RenderGraph::get_default_post_graphics_queue());
+		blur3.set_parallel_recording(true);
 		blur3.add_color_output("bloom-downsample-3", blur_info);
 		auto &input_res = blur3.add_texture_input("bloom-downsample-2");
 		auto &feedback = blur3.add_history_input("bloom-downsample-3");
@@ -473,6 +480,7 @@ void setup_hdr_postprocess(RenderGraph &graph, const std::string &input, const s
 		blur_info.size_y = 0.0625f;
 		blur_info.format = VK_FORMAT_R16G16B16A16_SFLOAT;
 		auto &blur4 = graph.add_pass("bloom-upsample-0", RenderGraph::get_default_post_graphics_queue());
+		blur4.set_parallel_recording(true);
 		blur4.add_color_output("bloom-upsample-0", blur_info);
 		auto &input_res = blur4.add_texture_input("bloom-downsample-3");
 		blur4.set_build_render_pass([&](Vulkan::CommandBuffer &cmd)
@@ -486,6 +494,7 @@ void setup_hdr_postprocess(RenderGraph &graph, const std::string &input, const s
 		blur_info.size_y = 0.125f;
 		blur_info.format = VK_FORMAT_R16G16B16A16_SFLOAT;
 		auto &blur5 = graph.add_pass("bloom-upsample-1", RenderGraph::get_default_post_graphics_queue());
+		blur5.set_parallel_recording(true);
 		blur5.add_color_output("bloom-upsample-1", blur_info);
 		auto &input_res = blur5.add_texture_input("bloom-upsample-0");
 		blur5.set_build_render_pass([&](Vulkan::CommandBuffer &cmd)
@@ -499,6 +508,7 @@ void setup_hdr_postprocess(RenderGraph &graph, const std::string &input, const s
 		blur_info.size_y = 0.25f;
 		blur_info.format = VK_FORMAT_R16G16B16A16_SFLOAT;
 		auto &blur6 = graph.add_pass("bloom-upsample-2", RenderGraph::get_default_post_graphics_queue());
+		blur6.set_parallel_recording(true);
 		blur6.add_color_output("bloom-upsample-2", blur_info);
 		auto &input_res = blur6.add_texture_input("bloom-upsample-1");
 		blur6.set_build_render_pass([&](Vulkan::CommandBuffer &cmd)
@@ -44,6 +44,7 @@ void setup_ssao(RenderGraph &graph, const RenderContext &context,
 	info_blurred.size_y = 0.25f;
 
 	auto &ssao_first = graph.add_pass(output + "-first", RENDER_GRAPH_QUEUE_GRAPHICS_BIT);
+	ssao_first.set_parallel_recording(true);
 	auto &depth = ssao_first.add_texture_input(input_depth);
 	auto &normal = ssao_first.add_texture_input(input_normal);
 	auto &noisy_output = ssao_first.add_color_output(output + "-noise", info);
@@ -87,6 +88,7 @@ void setup_ssao(RenderGraph &graph, const RenderContext &context,
 	});
 
 	auto &ssao_blur = graph.add_pass(output + "-blur", RENDER_GRAPH_QUEUE_GRAPHICS_BIT);
+	ssao_blur.set_parallel_recording(true);
 	ssao_blur.add_texture_input(output + "-noise");
 	ssao_blur.add_color_output(output, info_blurred);
 	ssao_blur.set_build_render_pass([&](Vulkan::CommandBuffer &cmd) {
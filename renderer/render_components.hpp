@@ -172,6 +172,7 @@ struct CachedSpatialTransformComponent : ComponentBase
 {
 	GRANITE_COMPONENT_TYPE_DECL(CachedSpatialTransformComponent)
 	AABB world_aabb;
+	BoundingSphere world_sphere;
 	CachedTransform *transform = nullptr;
 	CachedSkinTransform *skin_transform = nullptr;
 };
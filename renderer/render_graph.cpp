@@ -24,6 +24,10 @@
 #include "type_to_string.hpp"
 #include "format.hpp"
 #include "quirks.hpp"
+#include "frame_allocator.hpp"
+#include "timer.hpp"
+#include "thread_group.hpp"
+#include "global_managers.hpp"
 #include <algorithm>
 
 using namespace std;
@@ -322,6 +326,11 @@ void RenderGraph::on_swapchain_destroyed(const Vulkan::SwapchainParameterEvent &
 	physical_history_image_attachments.clear();
 	physical_events.clear();
 	physical_history_events.clear();
+	bake_cache.physical_image_attachments.clear();
+	bake_cache.physical_history_image_attachments.clear();
+	bake_cache.physical_events.clear();
+	bake_cache.physical_history_events.clear();
+	release_memory_packing();
 }
 
 void RenderGraph::on_swapchain_changed(const Vulkan::SwapchainParameterEvent &)
@@ -335,6 +344,8 @@ void RenderGraph::on_device_created(const Vulkan::DeviceCreatedEvent &)
 void RenderGraph::on_device_destroyed(const Vulkan::DeviceCreatedEvent &)
 {
 	physical_buffers.clear();
+	bake_cache.physical_buffers.clear();
+	release_memory_packing();
 }
 
 RenderTextureResource &RenderGraph::get_texture_resource(const std::string &name)
@@ -935,7 +946,7 @@ void RenderGraph::build_render_pass_info()
 						if (pass.get_clear_color(i))
 						{
 							rp.clear_attachments |= 1u << res.first;
-							physical_pass.color_clear_requests.push_back({ &pass, &rp.clear_color[res.first], i });
+							physical_pass.color_clear_requests.push_back({ subpass, &rp.clear_color[res.first], i });
 						}
 					}
 					else
@@ -990,7 +1001,7 @@ void RenderGraph::build_render_pass_info()
 				if (res.second && pass.get_clear_depth_stencil())
 				{
 					rp.op_flags |= Vulkan::RENDER_PASS_OP_CLEAR_DEPTH_STENCIL_BIT;
-					physical_pass.depth_clear_request.pass = &pass;
+					physical_pass.depth_clear_request.pass = subpass;
 					physical_pass.depth_clear_request.target = &rp.clear_depth_stencil;
 				}
 
@@ -1246,6 +1257,35 @@ void RenderGraph::build_physical_passes()
 
 void RenderGraph::log()
 {
+	static const char *bake_modes[] = { "full", "reused", "patched dimensions" };
+	LOGI("Bake: %s, %.3f ms total, %.3f ms hashing (full: %llu, reused: %llu, patched: %llu).\n",
+	     bake_modes[unsigned(bake_stats.mode)], 1e3 * bake_stats.total_time, 1e3 * bake_stats.hash_time,
+	     static_cast<unsigned long long>(bake_stats.full_bakes),
+	     static_cast<unsigned long long>(bake_stats.reused_bakes),
+	     static_cast<unsigned long long>(bake_stats.patched_bakes));
+
+	if (bake_stats.mode == RenderGraphBakeStats::Mode::Full)
+	{
+		LOGI("  Dependencies: %8.3f ms\n", 1e3 * bake_stats.dependency_time);
+		LOGI("  Reorder: %8.3f ms\n", 1e3 * bake_stats.reorder_time);
+		LOGI("  Physical resources: %8.3f ms\n", 1e3 * bake_stats.physical_resource_time);
+		LOGI("  Physical passes: %8.3f ms\n", 1e3 * bake_stats.physical_pass_time);
+		LOGI("  Transients: %8.3f ms\n", 1e3 * bake_stats.transient_time);
+		LOGI("  Render pass info: %8.3f ms\n", 1e3 * bake_stats.render_pass_info_time);
+		LOGI("  Barriers: %8.3f ms\n", 1e3 * bake_stats.barrier_time);
+		LOGI("  Physical barriers: %8.3f ms\n", 1e3 * bake_stats.physical_barrier_time);
+		LOGI("  Aliases: %8.3f ms\n", 1e3 * bake_stats.alias_time);
+	}
+
+	if (enabled_memory_packing)
+	{
+		LOGI("Memory packing: %u images in %u slots, %.3f MiB unpacked, %.3f MiB peak live, %.3f MiB packed.\n",
+		     memory_stats.packed_images, memory_stats.slots,
+		     memory_stats.unpacked_size / (1024.0 * 1024.0),
+		     memory_stats.peak_live_size / (1024.0 * 1024.0),
+		     memory_stats.packed_size / (1024.0 * 1024.0));
+	}
+
 	for (auto &resource : physical_dimensions)
 	{
 		if (resource.buffer_info.size)
@@ -1527,12 +1567,25 @@ void RenderGraph::build_aliases()
 			register_writer(output, subpass.get_physical_pass_index(), true);
 	}
 
+	physical_lifetimes.clear();
+	physical_lifetimes.resize(physical_dimensions.size());
+	for (unsigned i = 0; i < physical_dimensions.size(); i++)
+	{
+		auto &range = pass_range[i];
+		if (range.is_used())
+			physical_lifetimes[i] = { range.first_used_pass(), range.last_used_pass(), range.can_alias() };
+	}
+
 	vector<vector<unsigned>> alias_chains(physical_dimensions.size());
 
 	physical_aliases.resize(physical_dimensions.size());
 	for (auto &v : physical_aliases)
 		v = RenderResource::Unused;
 
+	// Memory packing sets up its own alias chains once memory requirements are known.
+	if (enabled_memory_packing)
+		return;
+
 	for (unsigned i = 0; i < physical_dimensions.size(); i++)
 	{
 		// No aliases for buffers.
@@ -1584,6 +1637,266 @@ void RenderGraph::build_aliases()
 	}
 }
 
+void RenderGraph::build_flush_consumers()
+{
+	// Aliased resources hand their events over to other resources,
+	// and history resources are consumed next frame, so we cannot reason about their consumers.
+	vector<bool> unknown_consumers(physical_dimensions.size());
+	for (unsigned i = 0; i < physical_dimensions.size(); i++)
+	{
+		if (physical_image_has_history[i])
+			unknown_consumers[i] = true;
+
+		if (physical_aliases[i] != RenderResource::Unused)
+		{
+			unknown_consumers[i] = true;
+			unknown_consumers[physical_aliases[i]] = true;
+		}
+
+		// We don't know yet which images memory packing will chain together.
+		if (enabled_memory_packing && physical_lifetimes[i].can_alias)
+			unknown_consumers[i] = true;
+	}
+
+	for (auto &physical_pass : physical_passes)
+	{
+		unsigned physical_pass_index = unsigned(&physical_pass - physical_passes.data());
+		physical_pass.flush_consumer_queues.clear();
+
+		for (auto &barrier : physical_pass.flush)
+		{
+			RenderGraphQueueFlags consumers = ~0u;
+			if (!barrier.history &&
+			    !unknown_consumers[barrier.resource_index] &&
+			    physical_dimensions[barrier.resource_index].uses_semaphore())
+			{
+				// Every pass which touches a resource also flushes it, so the next pass which touches it is the only consumer.
+				for (unsigned i = physical_pass_index + 1; i < physical_passes.size(); i++)
+				{
+					auto &next_pass = physical_passes[i];
+					bool touches = any_of(begin(next_pass.invalidate), end(next_pass.invalidate), [&](const Barrier &b) {
+						return !b.history && b.resource_index == barrier.resource_index;
+					});
+
+					if (!touches)
+						continue;
+
+					// If the consumer might be skipped, the write is consumed by some later pass on any queue.
+					bool may_skip = any_of(begin(next_pass.passes), end(next_pass.passes), [this](unsigned pass) {
+						return passes[pass]->may_not_need_render_pass();
+					});
+
+					if (!may_skip)
+						consumers = passes[next_pass.passes.front()]->get_queue();
+					break;
+				}
+			}
+
+			physical_pass.flush_consumer_queues.push_back(consumers);
+		}
+	}
+}
+
+void RenderGraph::release_memory_packing()
+{
+	// Placed images do not own their memory, so they must go before the heap does.
+	for (unsigned i = 0; i < memory_packing.packed.size(); i++)
+	{
+		if (!memory_packing.packed[i])
+			continue;
+
+		if (i < physical_image_attachments.size())
+			physical_image_attachments[i].reset();
+		if (i < bake_cache.physical_image_attachments.size())
+			bake_cache.physical_image_attachments[i].reset();
+	}
+
+	if (memory_packing.device && memory_packing.heap.get_memory())
+		memory_packing.device->free_placement_memory(memory_packing.heap);
+
+	memory_packing.device = nullptr;
+	memory_packing.heap = {};
+	memory_packing.packed.clear();
+	memory_packing.dirty = true;
+}
+
+void RenderGraph::build_memory_packing(Vulkan::Device &device)
+{
+	release_memory_packing();
+	memory_packing.dirty = false;
+	memory_stats = {};
+
+	// All alias chains come from packing, so start over.
+	for (auto &physical_pass : physical_passes)
+		physical_pass.alias_transfer.clear();
+
+	struct Candidate
+	{
+		unsigned index;
+		Vulkan::ImageCreateInfo info;
+		VkMemoryRequirements reqs;
+	};
+	vector<Candidate> candidates;
+	uint32_t memory_type_bits = ~0u;
+
+	for (unsigned i = 0; i < physical_dimensions.size(); i++)
+	{
+		auto &att = physical_dimensions[i];
+
+		// Buffers and storage images are implicitly preserved, history is needed next frame,
+		// and transient attachments are lazily allocated anyways.
+		if (att.buffer_info.size || att.is_storage_image() || att.transient)
+			continue;
+		if (physical_image_has_history[i] || i == swapchain_physical_index)
+			continue;
+		if (!physical_lifetimes[i].can_alias)
+			continue;
+
+		Candidate candidate = { i, get_physical_image_create_info(i), {} };
+		if (!device.get_image_memory_requirements(candidate.info, &candidate.reqs))
+			continue;
+
+		// Every image in the heap must agree on a memory type.
+		if ((memory_type_bits & candidate.reqs.memoryTypeBits) == 0)
+			continue;
+		memory_type_bits &= candidate.reqs.memoryTypeBits;
+		candidates.push_back(candidate);
+	}
+
+	if (candidates.size() < 2)
+		return;
+
+	for (auto &candidate : candidates)
+		memory_stats.unpacked_size += candidate.reqs.size;
+
+	for (unsigned pass = 0; pass < physical_passes.size(); pass++)
+	{
+		VkDeviceSize live_size = 0;
+		for (auto &candidate : candidates)
+		{
+			auto &lifetime = physical_lifetimes[candidate.index];
+			if (lifetime.first_pass <= pass && pass <= lifetime.last_pass)
+				live_size += candidate.reqs.size;
+		}
+		memory_stats.peak_live_size = std::max(memory_stats.peak_live_size, live_size);
+	}
+
+	// Greedy colouring of the interval graph of lifetimes in order of first use.
+	// Every colour is a slot in the heap, and the images in a slot form an alias chain.
+	sort(begin(candidates), end(candidates), [this](const Candidate &a, const Candidate &b) -> bool {
+		unsigned first_a = physical_lifetimes[a.index].first_pass;
+		unsigned first_b = physical_lifetimes[b.index].first_pass;
+		if (first_a != first_b)
+			return first_a < first_b;
+		return a.reqs.size > b.reqs.size;
+	});
+
+	struct Slot
+	{
+		unsigned last_pass;
+		VkDeviceSize size;
+		VkDeviceSize alignment;
+		VkDeviceSize offset;
+		vector<unsigned> chain;
+	};
+	vector<Slot> slots;
+
+	for (unsigned i = 0; i < candidates.size(); i++)
+	{
+		auto &candidate = candidates[i];
+		auto &lifetime = physical_lifetimes[candidate.index];
+		VkDeviceSize size = candidate.reqs.size;
+
+		// Prefer the smallest free slot which fits, otherwise the largest free slot, so the heap grows the least.
+		unsigned best = ~0u;
+		for (unsigned j = 0; j < slots.size(); j++)
+		{
+			auto &slot = slots[j];
+			if (slot.last_pass >= lifetime.first_pass)
+				continue;
+
+			if (best == ~0u)
+				best = j;
+			else if (slot.size >= size)
+			{
+				if (slots[best].size < size || slot.size < slots[best].size)
+					best = j;
+			}
+			else if (slots[best].size < size && slot.size > slots[best].size)
+				best = j;
+		}
+
+		if (best == ~0u)
+		{
+			best = unsigned(slots.size());
+			slots.push_back({ 0, 0, 1, 0, {} });
+		}
+
+		auto &slot = slots[best];
+		slot.last_pass = lifetime.last_pass;
+		slot.size = std::max(slot.size, size);
+		slot.alignment = std::max(slot.alignment, candidate.reqs.alignment);
+		slot.chain.push_back(i);
+	}
+
+	VkDeviceSize heap_size = 0;
+	for (auto &slot : slots)
+	{
+		slot.offset = (heap_size + slot.alignment - 1) & ~(slot.alignment - 1);
+		heap_size = slot.offset + slot.size;
+	}
+
+	if (!device.allocate_placement_memory(heap_size, memory_type_bits, &memory_packing.heap))
+		return;
+	memory_packing.device = &device;
+	memory_packing.packed.resize(physical_dimensions.size());
+
+	for (auto &slot : slots)
+	{
+		for (auto i : slot.chain)
+		{
+			auto &candidate = candidates[i];
+			auto image = device.create_placed_image(candidate.info, memory_packing.heap, slot.offset);
+			if (!image)
+			{
+				LOGE("Failed to place render graph image, falling back to separate allocations.\n");
+				release_memory_packing();
+				memory_stats = {};
+				memory_packing.dirty = false;
+				for (auto &physical_pass : physical_passes)
+					physical_pass.alias_transfer.clear();
+				return;
+			}
+
+			device.set_name(*image, physical_dimensions[candidate.index].name.c_str());
+			physical_image_attachments[candidate.index] = move(image);
+			physical_events[candidate.index] = {};
+			memory_packing.packed[candidate.index] = true;
+		}
+
+		// Hand over events along the chain in order of use, and from the last image back to the first for the next frame.
+		if (slot.chain.size() > 1)
+		{
+			for (unsigned i = 0; i < slot.chain.size(); i++)
+			{
+				unsigned from = candidates[slot.chain[i]].index;
+				unsigned to = candidates[slot.chain[(i + 1) % slot.chain.size()]].index;
+				physical_passes[physical_lifetimes[from].last_pass].alias_transfer.push_back(make_pair(from, to));
+			}
+		}
+	}
+
+	memory_stats.packed_images = unsigned(candidates.size());
+	memory_stats.slots = unsigned(slots.size());
+	memory_stats.packed_size = heap_size;
+
+	LOGI("Render graph memory packing: %u images in %u slots, %.3f MiB -> %.3f MiB (peak live %.3f MiB).\n",
+	     memory_stats.packed_images, memory_stats.slots,
+	     memory_stats.unpacked_size / (1024.0 * 1024.0),
+	     memory_stats.packed_size / (1024.0 * 1024.0),
+	     memory_stats.peak_live_size / (1024.0 * 1024.0));
+}
+
 bool RenderGraph::need_invalidate(const Barrier &barrier, const PipelineEvent &event)
 {
 	bool need_invalidate = false;
@@ -1594,22 +1907,119 @@ bool RenderGraph::need_invalidate(const Barrier &barrier, const PipelineEvent &e
 	return need_invalidate;
 }
 
+void RenderGraph::record_physical_pass(Vulkan::CommandBuffer &cmd, PhysicalPass &physical_pass, bool graphics)
+{
+	auto physical_pass_index = unsigned(&physical_pass - physical_passes.data());
+	auto &timestamps = physical_timestamps[physical_timestamp_index];
+
+	if (graphics)
+	{
+		if (enabled_timestamps)
+		{
+			timestamps.timestamps_vertex_begin[physical_pass_index] = cmd.write_timestamp(VK_PIPELINE_STAGE_VERTEX_SHADER_BIT);
+			timestamps.timestamps_fragment_begin[physical_pass_index] = cmd.write_timestamp(VK_PIPELINE_STAGE_ALL_GRAPHICS_BIT);
+		}
+
+		VK_ASSERT(physical_pass.layers != ~0u);
+		for (unsigned layer = 0; layer < physical_pass.layers; layer++)
+		{
+			physical_pass.render_pass_info.layer = layer;
+			cmd.begin_region("begin-render-pass");
+			cmd.begin_render_pass(physical_pass.render_pass_info);
+			cmd.end_region();
+
+			for (auto &subpass : physical_pass.passes)
+			{
+				auto subpass_index = unsigned(&subpass - physical_pass.passes.data());
+				auto &scaled_requests = physical_pass.scaled_clear_requests[subpass_index];
+				enqueue_scaled_requests(cmd, scaled_requests);
+
+				auto &pass = *passes[subpass];
+
+				// If we have started the render pass, we have to do it, even if a lone subpass might not be required,
+				// due to clearing and so on.
+				// This should be an extremely unlikely scenario.
+				// Either you need all subpasses or none.
+				cmd.begin_region(pass.get_name().c_str());
+				pass.build_render_pass(cmd, layer);
+				cmd.end_region();
+
+				if (&subpass != &physical_pass.passes.back())
+					cmd.next_subpass();
+			}
+
+			cmd.begin_region("end-render-pass");
+			cmd.end_render_pass();
+			cmd.end_region();
+		}
+
+		if (enabled_timestamps)
+		{
+			timestamps.timestamps_vertex_end[physical_pass_index] = cmd.write_timestamp(VK_PIPELINE_STAGE_VERTEX_SHADER_BIT);
+			timestamps.timestamps_fragment_end[physical_pass_index] = cmd.write_timestamp(VK_PIPELINE_STAGE_ALL_GRAPHICS_BIT);
+		}
+		enqueue_mipmap_requests(cmd, physical_pass.mipmap_requests);
+	}
+	else
+	{
+		assert(physical_pass.passes.size() == 1);
+		auto &pass = *passes[physical_pass.passes.front()];
+		if (enabled_timestamps)
+			timestamps.timestamps_compute_begin[physical_pass_index] = cmd.write_timestamp(VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+		cmd.begin_region(pass.get_name().c_str());
+		pass.build_render_pass(cmd, 0);
+		cmd.end_region();
+		if (enabled_timestamps)
+			timestamps.timestamps_compute_end[physical_pass_index] = cmd.write_timestamp(VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+	}
+}
+
+bool RenderGraph::flush_needs_semaphore(const PhysicalPass &physical_pass, unsigned flush_index,
+                                        Vulkan::CommandBuffer::Type physical_queue) const
+{
+	auto &barrier = physical_pass.flush[flush_index];
+	if (!physical_dimensions[barrier.resource_index].uses_semaphore())
+		return false;
+
+	// If the next pass to touch the resource runs on the same physical queue, an event is enough.
+	auto consumers = physical_pass.flush_consumer_queues[flush_index];
+	if (consumers == ~0u)
+		return true;
+
+	bool need_semaphore = false;
+	Util::for_each_bit(consumers, [&](uint32_t bit) {
+		if (physical_queue_types[bit] != physical_queue)
+			need_semaphore = true;
+	});
+	return need_semaphore;
+}
+
+VkPipelineStageFlags RenderGraph::get_event_wait_stages(const PhysicalPass &physical_pass,
+                                                        Vulkan::CommandBuffer::Type physical_queue) const
+{
+	VkPipelineStageFlags wait_stages = 0;
+	for (unsigned i = 0; i < physical_pass.flush.size(); i++)
+		if (!flush_needs_semaphore(physical_pass, i, physical_queue))
+			wait_stages |= physical_pass.flush[i].stages;
+	return wait_stages;
+}
+
 void RenderGraph::enqueue_render_passes(Vulkan::Device &device)
 {
-	vector<VkBufferMemoryBarrier> buffer_barriers;
-	vector<VkImageMemoryBarrier> image_barriers;
+	Util::FrameVector<VkBufferMemoryBarrier> buffer_barriers(Util::thread_frame_allocator<VkBufferMemoryBarrier>());
+	Util::FrameVector<VkImageMemoryBarrier> image_barriers(Util::thread_frame_allocator<VkImageMemoryBarrier>());
 
 	// Immediate buffer barriers are useless because they don't need any layout transition,
 	// and the API guarantees that submitting a batch makes memory visible to GPU resources.
 	// Immediate image barriers are purely for doing layout transitions without waiting (srcStage = TOP_OF_PIPE).
-	vector<VkImageMemoryBarrier> immediate_image_barriers;
+	Util::FrameVector<VkImageMemoryBarrier> immediate_image_barriers(Util::thread_frame_allocator<VkImageMemoryBarrier>());
 
 	// Barriers which are used when waiting for a semaphore, and then doing a transition.
 	// We need to use pipeline barriers here so we can have srcStage = dstStage,
 	// and hand over while not breaking the pipeline.
-	vector<VkImageMemoryBarrier> semaphore_handover_barriers;
+	Util::FrameVector<VkImageMemoryBarrier> semaphore_handover_barriers(Util::thread_frame_allocator<VkImageMemoryBarrier>());
 
-	vector<VkEvent> events;
+	Util::FrameVector<VkEvent> events(Util::thread_frame_allocator<VkEvent>());
 
 	const auto transfer_ownership = [this](PhysicalPass &pass) {
 		// Need to wait on this event before we can transfer ownership to another alias.
@@ -1632,52 +2042,128 @@ void RenderGraph::enqueue_render_passes(Vulkan::Device &device)
 	};
 
 	physical_timestamp_index = (physical_timestamp_index + 1) & unsigned(physical_timestamps.size() - 1);
+
+	bool parallel_recording = false;
+#ifdef GRANITE_VULKAN_MT
+	auto &workers = *Global::thread_group();
+	parallel_recording = enabled_parallel_recording && workers.get_num_threads() != 0;
+#endif
+
+	physical_queue_types[trailing_zeroes(RENDER_GRAPH_QUEUE_GRAPHICS_BIT)] = Vulkan::CommandBuffer::Type::Generic;
+	physical_queue_types[trailing_zeroes(RENDER_GRAPH_QUEUE_COMPUTE_BIT)] = Vulkan::CommandBuffer::Type::Generic;
+	physical_queue_types[trailing_zeroes(RENDER_GRAPH_QUEUE_ASYNC_COMPUTE_BIT)] =
+			device.get_physical_queue_type(Vulkan::CommandBuffer::Type::AsyncCompute);
+	physical_queue_types[trailing_zeroes(RENDER_GRAPH_QUEUE_ASYNC_GRAPHICS_BIT)] =
+			device.get_physical_queue_type(Vulkan::CommandBuffer::Type::AsyncGraphics);
+
 	auto &timestamps = physical_timestamps[physical_timestamp_index];
 
+	pass_recordings.clear();
+	pass_recordings.resize(physical_passes.size());
+
 	for (auto &physical_pass : physical_passes)
 	{
-		bool require_pass = false;
+		auto &recording = pass_recordings[&physical_pass - physical_passes.data()];
 		for (auto &pass : physical_pass.passes)
 		{
 			if (passes[pass]->need_render_pass())
-				require_pass = true;
+				recording.required = true;
 		}
 
-		if (!require_pass)
-		{
-			transfer_ownership(physical_pass);
+		if (!recording.required)
 			continue;
-		}
 
-		bool graphics;
-		Vulkan::CommandBuffer::Type queue_type;
 		switch (passes[physical_pass.passes.front()]->get_queue())
 		{
 		default:
 		case RENDER_GRAPH_QUEUE_GRAPHICS_BIT:
-			graphics = true;
-			queue_type = Vulkan::CommandBuffer::Type::Generic;
+			recording.graphics = true;
+			recording.queue_type = Vulkan::CommandBuffer::Type::Generic;
 			break;
 
 		case RENDER_GRAPH_QUEUE_COMPUTE_BIT:
-			graphics = false;
-			queue_type = Vulkan::CommandBuffer::Type::Generic;
+			recording.graphics = false;
+			recording.queue_type = Vulkan::CommandBuffer::Type::Generic;
 			break;
 
 		case RENDER_GRAPH_QUEUE_ASYNC_COMPUTE_BIT:
-			graphics = false;
-			queue_type = Vulkan::CommandBuffer::Type::AsyncCompute;
+			recording.graphics = false;
+			recording.queue_type = Vulkan::CommandBuffer::Type::AsyncCompute;
 			break;
 
 		case RENDER_GRAPH_QUEUE_ASYNC_GRAPHICS_BIT:
-			graphics = true;
-			queue_type = Vulkan::CommandBuffer::Type::AsyncGraphics;
+			recording.graphics = true;
+			recording.queue_type = Vulkan::CommandBuffer::Type::AsyncGraphics;
 			break;
 		}
 
-		auto cmd = device.request_command_buffer(queue_type);
-		cmd->begin_region("render-graph-sync-pre");
+		recording.physical_queue = device.get_physical_queue_type(recording.queue_type);
+		if (enabled_timestamps)
+			timestamps.physical_queues[&physical_pass - physical_passes.data()] = recording.physical_queue;
+
+		if (recording.graphics)
+		{
+			for (auto &clear_req : physical_pass.color_clear_requests)
+				passes[clear_req.pass]->get_clear_color(clear_req.index, clear_req.target);
+
+			if (physical_pass.depth_clear_request.pass != RenderPass::Unused)
+			{
+				passes[physical_pass.depth_clear_request.pass]->get_clear_depth_stencil(
+					physical_pass.depth_clear_request.target);
+			}
+		}
+
+		recording.parallel = parallel_recording &&
+		                     all_of(begin(physical_pass.passes), end(physical_pass.passes), [this](unsigned pass) {
+			                     return passes[pass]->get_parallel_recording();
+		                     });
+	}
+
+	// Kick off recording of the pass bodies up front. The pre-pass barriers for a pass are
+	// computed below while the workers are busy, and are submitted in a separate command buffer.
+	Util::FrameVector<TaskGroup> recording_tasks(Util::thread_frame_allocator<TaskGroup>());
+	recording_tasks.resize(physical_passes.size());
+
+#ifdef GRANITE_VULKAN_MT
+	for (unsigned i = 0; i < physical_passes.size(); i++)
+	{
+		if (!pass_recordings[i].parallel)
+			continue;
+
+		recording_tasks[i] = workers.create_task([this, &device, i]() {
+			auto &recording = pass_recordings[i];
+			auto &physical_pass = physical_passes[i];
+			recording.cmd = device.request_command_buffer_for_thread(ThreadGroup::get_current_thread_index(),
+			                                                         recording.queue_type);
+			record_physical_pass(*recording.cmd, physical_pass, recording.graphics);
+
+			recording.cmd->begin_region("render-graph-sync-post");
+			VkPipelineStageFlags wait_stages = get_event_wait_stages(physical_pass, recording.physical_queue);
+			if (wait_stages != 0)
+				recording.event = recording.cmd->signal_event(wait_stages);
+			recording.cmd->end_region();
+		});
+		recording_tasks[i]->flush();
+	}
+#endif
+
+	for (auto &physical_pass : physical_passes)
+	{
 		auto physical_pass_index = unsigned(&physical_pass - physical_passes.data());
+		auto &recording = pass_recordings[physical_pass_index];
+
+		if (!recording.required)
+		{
+			transfer_ownership(physical_pass);
+			continue;
+		}
+
+		bool graphics = recording.graphics;
+		auto queue_type = recording.queue_type;
+
+		Vulkan::CommandBufferHandle cmd;
+		if (!recording.parallel)
+			cmd = device.request_command_buffer(queue_type);
 
 		const auto wait_for_semaphore_in_queue = [&](Vulkan::Semaphore sem, VkPipelineStageFlags stages) {
 			if (sem->get_semaphore() != VK_NULL_HANDLE && !sem->is_pending_wait())
@@ -1856,112 +2342,65 @@ void RenderGraph::enqueue_render_passes(Vulkan::Device &device)
 		}
 
 		// Submit barriers.
-		if (!semaphore_handover_barriers.empty())
-		{
-			cmd->barrier(handover_stages, handover_stages,
-			             0, nullptr, 0, nullptr,
-			             semaphore_handover_barriers.size(),
-			             semaphore_handover_barriers.empty() ? nullptr : semaphore_handover_barriers.data());
-		}
-
-		if (!image_barriers.empty() || !buffer_barriers.empty())
-		{
-			cmd->wait_events(events.size(), events.data(),
-			                 src_stages, dst_stages,
-			                 0, nullptr,
-			                 buffer_barriers.size(), buffer_barriers.empty() ? nullptr : buffer_barriers.data(),
-			                 image_barriers.size(), image_barriers.empty() ? nullptr : image_barriers.data());
-		}
-
-		if (!immediate_image_barriers.empty())
-		{
-			cmd->barrier(VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, immediate_dst_stages,
-			             0, nullptr, 0, nullptr, immediate_image_barriers.size(), immediate_image_barriers.data());
-		}
+		bool need_barriers = !semaphore_handover_barriers.empty() ||
+		                     !image_barriers.empty() || !buffer_barriers.empty() ||
+		                     !immediate_image_barriers.empty();
 
-		cmd->end_region();
+		if (!cmd && need_barriers)
+			cmd = device.request_command_buffer(queue_type);
 
-		if (graphics)
+		if (cmd)
 		{
-			for (auto &clear_req : physical_pass.color_clear_requests)
-				clear_req.pass->get_clear_color(clear_req.index, clear_req.target);
+			cmd->begin_region("render-graph-sync-pre");
 
-			if (physical_pass.depth_clear_request.pass)
+			if (!semaphore_handover_barriers.empty())
 			{
-				physical_pass.depth_clear_request.pass->get_clear_depth_stencil(
-					physical_pass.depth_clear_request.target);
+				cmd->barrier(handover_stages, handover_stages,
+				             0, nullptr, 0, nullptr,
+				             semaphore_handover_barriers.size(),
+				             semaphore_handover_barriers.empty() ? nullptr : semaphore_handover_barriers.data());
 			}
 
-			if (enabled_timestamps)
+			if (!image_barriers.empty() || !buffer_barriers.empty())
 			{
-				timestamps.timestamps_vertex_begin[physical_pass_index] = cmd->write_timestamp(VK_PIPELINE_STAGE_VERTEX_SHADER_BIT);
-				timestamps.timestamps_fragment_begin[physical_pass_index] = cmd->write_timestamp(VK_PIPELINE_STAGE_ALL_GRAPHICS_BIT);
+				cmd->wait_events(events.size(), events.data(),
+				                 src_stages, dst_stages,
+				                 0, nullptr,
+				                 buffer_barriers.size(), buffer_barriers.empty() ? nullptr : buffer_barriers.data(),
+				                 image_barriers.size(), image_barriers.empty() ? nullptr : image_barriers.data());
 			}
 
-			VK_ASSERT(physical_pass.layers != ~0u);
-			for (unsigned layer = 0; layer < physical_pass.layers; layer++)
+			if (!immediate_image_barriers.empty())
 			{
-				physical_pass.render_pass_info.layer = layer;
-				cmd->begin_region("begin-render-pass");
-				cmd->begin_render_pass(physical_pass.render_pass_info);
-				cmd->end_region();
+				cmd->barrier(VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, immediate_dst_stages,
+				             0, nullptr, 0, nullptr, immediate_image_barriers.size(), immediate_image_barriers.data());
+			}
 
-				for (auto &subpass : physical_pass.passes)
-				{
-					auto subpass_index = unsigned(&subpass - physical_pass.passes.data());
-					auto &scaled_requests = physical_pass.scaled_clear_requests[subpass_index];
-					enqueue_scaled_requests(*cmd, scaled_requests);
-
-					auto &pass = *passes[subpass];
-
-					// If we have started the render pass, we have to do it, even if a lone subpass might not be required,
-					// due to clearing and so on.
-					// This should be an extremely unlikely scenario.
-					// Either you need all subpasses or none.
-					cmd->begin_region(pass.get_name().c_str());
-					pass.build_render_pass(*cmd, layer);
-					cmd->end_region();
-
-					if (&subpass != &physical_pass.passes.back())
-						cmd->next_subpass();
-				}
+			cmd->end_region();
+		}
 
-				cmd->begin_region("end-render-pass");
-				cmd->end_render_pass();
-				cmd->end_region();
-			}
+		Vulkan::PipelineEvent pipeline_event;
+		if (recording.parallel)
+		{
+			// The barriers must land in the queue before the pass itself.
+			if (cmd)
+				device.submit(cmd);
 
-			if (enabled_timestamps)
-			{
-				timestamps.timestamps_vertex_end[physical_pass_index] = cmd->write_timestamp(VK_PIPELINE_STAGE_VERTEX_SHADER_BIT);
-				timestamps.timestamps_fragment_end[physical_pass_index] = cmd->write_timestamp(VK_PIPELINE_STAGE_ALL_GRAPHICS_BIT);
-			}
-			enqueue_mipmap_requests(*cmd, physical_pass.mipmap_requests);
+			recording_tasks[physical_pass_index]->wait();
+			cmd = move(recording.cmd);
+			pipeline_event = move(recording.event);
 		}
 		else
 		{
-			assert(physical_pass.passes.size() == 1);
-			auto &pass = *passes[physical_pass.passes.front()];
-			if (enabled_timestamps)
-				timestamps.timestamps_compute_begin[physical_pass_index] = cmd->write_timestamp(VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
-			cmd->begin_region(pass.get_name().c_str());
-			pass.build_render_pass(*cmd, 0);
+			record_physical_pass(*cmd, physical_pass, graphics);
+
+			cmd->begin_region("render-graph-sync-post");
+			VkPipelineStageFlags wait_stages = get_event_wait_stages(physical_pass, recording.physical_queue);
+			if (wait_stages != 0)
+				pipeline_event = cmd->signal_event(wait_stages);
 			cmd->end_region();
-			if (enabled_timestamps)
-				timestamps.timestamps_compute_end[physical_pass_index] = cmd->write_timestamp(VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
 		}
 
-		cmd->begin_region("render-graph-sync-post");
-
-		VkPipelineStageFlags wait_stages = 0;
-		for (auto &barrier : physical_pass.flush)
-			if (!physical_dimensions[barrier.resource_index].uses_semaphore())
-				wait_stages |= barrier.stages;
-
-		Vulkan::PipelineEvent pipeline_event;
-		if (wait_stages != 0)
-			pipeline_event = cmd->signal_event(wait_stages);
-
 		bool need_submission_semaphore = false;
 
 		for (auto &barrier : physical_pass.flush)
@@ -1986,17 +2425,19 @@ void RenderGraph::enqueue_render_passes(Vulkan::Device &device)
 			// Mark if there are pending writes from this pass.
 			event.to_flush_access = barrier.access;
 
-			if (physical_dimensions[barrier.resource_index].uses_semaphore())
+			if (flush_needs_semaphore(physical_pass, unsigned(&barrier - physical_pass.flush.data()), recording.physical_queue))
 			{
 				need_submission_semaphore = true;
 				// Actual semaphore will be set on submission.
 			}
 			else
+			{
 				event.event = pipeline_event;
+				event.wait_graphics_semaphore = {};
+				event.wait_compute_semaphore = {};
+			}
 		}
 
-		cmd->end_region();
-
 		Vulkan::Semaphore semaphores[2];
 		Vulkan::Semaphore compute_semaphore;
 		if (need_submission_semaphore)
@@ -2016,8 +2457,9 @@ void RenderGraph::enqueue_render_passes(Vulkan::Device &device)
 				              physical_history_events[barrier.resource_index] :
 				              physical_events[barrier.resource_index];
 
-				if (physical_dimensions[barrier.resource_index].uses_semaphore())
+				if (flush_needs_semaphore(physical_pass, unsigned(&barrier - physical_pass.flush.data()), recording.physical_queue))
 				{
+					event.event = {};
 					event.wait_graphics_semaphore = semaphores[0];
 					event.wait_compute_semaphore = semaphores[1];
 				}
@@ -2161,6 +2603,38 @@ void RenderGraph::setup_physical_buffer(Vulkan::Device &device, unsigned attachm
 	}
 }
 
+Vulkan::ImageCreateInfo RenderGraph::get_physical_image_create_info(unsigned attachment) const
+{
+	auto &att = physical_dimensions[attachment];
+
+	Vulkan::ImageCreateInfo info;
+	info.format = att.format;
+	info.type = att.depth > 1 ? VK_IMAGE_TYPE_3D : VK_IMAGE_TYPE_2D;
+	info.width = att.width;
+	info.height = att.height;
+	info.depth = att.depth;
+	info.domain = Vulkan::ImageDomain::Physical;
+	info.levels = att.levels;
+	info.layers = att.layers;
+	info.usage = att.image_usage;
+	info.initial_layout = VK_IMAGE_LAYOUT_UNDEFINED;
+	info.samples = static_cast<VkSampleCountFlagBits>(att.samples);
+
+	if (att.is_storage_image())
+		info.flags |= VK_IMAGE_CREATE_MUTABLE_FORMAT_BIT;
+
+	if (att.unorm_srgb)
+		info.misc |= Vulkan::IMAGE_MISC_MUTABLE_SRGB_BIT;
+	if (att.queues & (RENDER_GRAPH_QUEUE_GRAPHICS_BIT | RENDER_GRAPH_QUEUE_COMPUTE_BIT))
+		info.misc |= Vulkan::IMAGE_MISC_CONCURRENT_QUEUE_GRAPHICS_BIT;
+	if (att.queues & RENDER_GRAPH_QUEUE_ASYNC_COMPUTE_BIT)
+		info.misc |= Vulkan::IMAGE_MISC_CONCURRENT_QUEUE_ASYNC_COMPUTE_BIT;
+	if (att.queues & RENDER_GRAPH_QUEUE_ASYNC_GRAPHICS_BIT)
+		info.misc |= Vulkan::IMAGE_MISC_CONCURRENT_QUEUE_ASYNC_GRAPHICS_BIT;
+
+	return info;
+}
+
 void RenderGraph::setup_physical_image(Vulkan::Device &device, unsigned attachment)
 {
 	auto &att = physical_dimensions[attachment];
@@ -2173,13 +2647,16 @@ void RenderGraph::setup_physical_image(Vulkan::Device &device, unsigned attachme
 		return;
 	}
 
+	// Packed images were already placed by build_memory_packing().
+	if (attachment < memory_packing.packed.size() && memory_packing.packed[attachment])
+	{
+		physical_attachments[attachment] = &physical_image_attachments[attachment]->get_view();
+		return;
+	}
+
 	bool need_image = true;
 	VkImageUsageFlags usage = att.image_usage;
-	Vulkan::ImageMiscFlags misc = 0;
 	VkImageCreateFlags flags = 0;
-
-	if (att.unorm_srgb)
-		misc |= Vulkan::IMAGE_MISC_MUTABLE_SRGB_BIT;
 	if (att.is_storage_image())
 		flags |= VK_IMAGE_CREATE_MUTABLE_FORMAT_BIT;
 
@@ -2200,28 +2677,7 @@ void RenderGraph::setup_physical_image(Vulkan::Device &device, unsigned attachme
 
 	if (need_image)
 	{
-		Vulkan::ImageCreateInfo info;
-		info.format = att.format;
-		info.type = att.depth > 1 ? VK_IMAGE_TYPE_3D : VK_IMAGE_TYPE_2D;
-		info.width = att.width;
-		info.height = att.height;
-		info.depth = att.depth;
-		info.domain = Vulkan::ImageDomain::Physical;
-		info.levels = att.levels;
-		info.layers = att.layers;
-		info.usage = usage;
-		info.initial_layout = VK_IMAGE_LAYOUT_UNDEFINED;
-		info.samples = static_cast<VkSampleCountFlagBits>(att.samples);
-		info.flags = flags;
-
-		info.misc = misc;
-		if (att.queues & (RENDER_GRAPH_QUEUE_GRAPHICS_BIT | RENDER_GRAPH_QUEUE_COMPUTE_BIT))
-			info.misc |= Vulkan::IMAGE_MISC_CONCURRENT_QUEUE_GRAPHICS_BIT;
-		if (att.queues & RENDER_GRAPH_QUEUE_ASYNC_COMPUTE_BIT)
-			info.misc |= Vulkan::IMAGE_MISC_CONCURRENT_QUEUE_ASYNC_COMPUTE_BIT;
-		if (att.queues & RENDER_GRAPH_QUEUE_ASYNC_GRAPHICS_BIT)
-			info.misc |= Vulkan::IMAGE_MISC_CONCURRENT_QUEUE_ASYNC_GRAPHICS_BIT;
-
+		auto info = get_physical_image_create_info(attachment);
 		physical_image_attachments[attachment] = device.create_image(info, nullptr);
 		// Just keep storage images in GENERAL layout.
 		// There is no reason to try enabling compression.
@@ -2252,6 +2708,14 @@ void RenderGraph::setup_attachments(Vulkan::Device &device, Vulkan::ImageView *s
 
 	swapchain_attachment = swapchain;
 
+	if (enabled_memory_packing)
+	{
+		if (memory_packing.dirty)
+			build_memory_packing(device);
+	}
+	else if (memory_packing.device)
+		release_memory_packing();
+
 	unsigned num_attachments = physical_dimensions.size();
 	for (unsigned i = 0; i < num_attachments; i++)
 	{
@@ -2528,15 +2992,336 @@ bool RenderGraph::depends_on_pass(unsigned dst_pass, unsigned src_pass)
 	return false;
 }
 
+template <typename T>
+static void hash_resource_list(Util::Hasher &h, const vector<T *> &list)
+{
+	h.u32(list.size());
+	for (auto *resource : list)
+		h.u32(resource ? resource->get_index() : RenderResource::Unused);
+}
+
+Util::Hash RenderGraph::compute_structure_hash()
+{
+	// Everything bake() looks at, except for resource sizes.
+	// Passes and resources are hashed in declaration order, so equal hashes imply equal indices.
+	Util::Hasher h;
+	h.string(backbuffer_source);
+	h.u32(enabled_memory_packing);
+
+	h.u32(resources.size());
+	for (auto &resource : resources)
+	{
+		h.u32(uint32_t(resource->get_type()));
+		h.string(resource->get_name());
+		h.u32(resource->get_used_queues());
+
+		if (resource->get_type() == RenderResource::Type::Buffer)
+		{
+			auto &buffer = static_cast<RenderBufferResource &>(*resource);
+			auto &info = buffer.get_buffer_info();
+			h.u32(info.usage);
+			h.u32(info.persistent);
+			h.u32(buffer.get_buffer_usage());
+		}
+		else
+		{
+			auto &texture = static_cast<RenderTextureResource &>(*resource);
+			auto &info = texture.get_attachment_info();
+			h.u32(info.size_class);
+			h.string(info.size_relative_name);
+			h.u32(info.format);
+			h.u32(info.samples);
+			h.u32(info.levels);
+			h.u32(info.layers);
+			h.u32(info.aux_usage);
+			h.u32(info.persistent);
+			h.u32(info.unorm_srgb_alias);
+			h.u32(texture.get_image_usage());
+			h.u32(texture.get_transient_state());
+		}
+	}
+
+	h.u32(passes.size());
+	for (auto &pass : passes)
+	{
+		h.string(pass->get_name());
+		h.u32(pass->get_queue());
+		h.u32(pass->may_not_need_render_pass());
+
+		hash_resource_list(h, pass->get_color_outputs());
+		hash_resource_list(h, pass->get_resolve_outputs());
+		hash_resource_list(h, pass->get_color_inputs());
+		hash_resource_list(h, pass->get_color_scale_inputs());
+		hash_resource_list(h, pass->get_storage_texture_outputs());
+		hash_resource_list(h, pass->get_storage_texture_inputs());
+		hash_resource_list(h, pass->get_blit_texture_inputs());
+		hash_resource_list(h, pass->get_blit_texture_outputs());
+		hash_resource_list(h, pass->get_attachment_inputs());
+		hash_resource_list(h, pass->get_history_inputs());
+		hash_resource_list(h, pass->get_storage_inputs());
+		hash_resource_list(h, pass->get_storage_outputs());
+
+		h.u32(pass->get_generic_texture_inputs().size());
+		for (auto &input : pass->get_generic_texture_inputs())
+		{
+			h.u32(input.texture->get_index());
+			h.u32(input.stages);
+			h.u32(input.access);
+			h.u32(input.layout);
+		}
+
+		h.u32(pass->get_generic_buffer_inputs().size());
+		for (auto &input : pass->get_generic_buffer_inputs())
+		{
+			h.u32(input.buffer->get_index());
+			h.u32(input.stages);
+			h.u32(input.access);
+			h.u32(input.layout);
+		}
+
+		h.u32(pass->get_fake_resource_aliases().size());
+		for (auto &alias : pass->get_fake_resource_aliases())
+		{
+			h.u32(alias.first->get_index());
+			h.u32(alias.second->get_index());
+		}
+
+		auto *ds_input = pass->get_depth_stencil_input();
+		auto *ds_output = pass->get_depth_stencil_output();
+		h.u32(ds_input ? ds_input->get_index() : RenderResource::Unused);
+		h.u32(ds_output ? ds_output->get_index() : RenderResource::Unused);
+
+		// Load/clear ops are decided while baking render pass info.
+		for (unsigned i = 0; i < pass->get_color_outputs().size(); i++)
+			h.u32(pass->get_clear_color(i));
+		h.u32(pass->get_clear_depth_stencil());
+	}
+
+	return h.get();
+}
+
+Util::Hash RenderGraph::compute_dimension_hash() const
+{
+	Util::Hasher h;
+	h.u32(swapchain_dimensions.format);
+	h.u32(swapchain_dimensions.width);
+	h.u32(swapchain_dimensions.height);
+	h.u32(swapchain_dimensions.depth);
+	h.u32(swapchain_dimensions.layers);
+	h.u32(swapchain_dimensions.levels);
+	h.u64(swapchain_dimensions.buffer_info.size);
+	h.u32(swapchain_dimensions.transient);
+	h.u32(swapchain_dimensions.persistent);
+	h.u32(swapchain_dimensions.unorm_srgb);
+
+	for (auto &resource : resources)
+	{
+		if (resource->get_type() == RenderResource::Type::Buffer)
+		{
+			auto dim = get_resource_dimensions(static_cast<const RenderBufferResource &>(*resource));
+			h.u64(dim.buffer_info.size);
+		}
+		else
+		{
+			auto dim = get_resource_dimensions(static_cast<const RenderTextureResource &>(*resource));
+			h.u32(dim.format);
+			h.u32(dim.width);
+			h.u32(dim.height);
+			h.u32(dim.depth);
+			h.u32(dim.levels);
+		}
+	}
+
+	return h.get();
+}
+
+void RenderGraph::stash_bake()
+{
+	bake_cache.structure_hash = structure_hash;
+	bake_cache.dimension_hash = dimension_hash;
+	bake_cache.can_alias_backbuffer = can_alias_backbuffer;
+	bake_cache.swapchain_physical_index = swapchain_physical_index;
+	bake_cache.pass_stack = move(pass_stack);
+	bake_cache.pass_barriers = move(pass_barriers);
+	bake_cache.physical_passes = move(physical_passes);
+	bake_cache.physical_dimensions = move(physical_dimensions);
+	bake_cache.physical_image_has_history = move(physical_image_has_history);
+	bake_cache.physical_aliases = move(physical_aliases);
+
+	bake_cache.resource_physical_indices.clear();
+	for (auto &resource : resources)
+		bake_cache.resource_physical_indices.push_back(resource->get_physical_index());
+	bake_cache.pass_physical_indices.clear();
+	for (auto &pass : passes)
+		bake_cache.pass_physical_indices.push_back(pass->get_physical_pass_index());
+
+	bake_cache.physical_buffers = move(physical_buffers);
+	bake_cache.physical_image_attachments = move(physical_image_attachments);
+	bake_cache.physical_history_image_attachments = move(physical_history_image_attachments);
+	bake_cache.physical_events = move(physical_events);
+	bake_cache.physical_history_events = move(physical_history_events);
+	has_bake_cache = true;
+}
+
+void RenderGraph::restore_bake()
+{
+	can_alias_backbuffer = bake_cache.can_alias_backbuffer;
+	swapchain_physical_index = bake_cache.swapchain_physical_index;
+	pass_stack = move(bake_cache.pass_stack);
+	pass_barriers = move(bake_cache.pass_barriers);
+	physical_passes = move(bake_cache.physical_passes);
+	physical_dimensions = move(bake_cache.physical_dimensions);
+	physical_image_has_history = move(bake_cache.physical_image_has_history);
+	physical_aliases = move(bake_cache.physical_aliases);
+
+	for (unsigned i = 0; i < resources.size(); i++)
+		resources[i]->set_physical_index(bake_cache.resource_physical_indices[i]);
+	for (unsigned i = 0; i < passes.size(); i++)
+		passes[i]->set_physical_pass_index(bake_cache.pass_physical_indices[i]);
+
+	physical_buffers = move(bake_cache.physical_buffers);
+	physical_image_attachments = move(bake_cache.physical_image_attachments);
+	physical_history_image_attachments = move(bake_cache.physical_history_image_attachments);
+	physical_events = move(bake_cache.physical_events);
+	physical_history_events = move(bake_cache.physical_history_events);
+	has_bake_cache = false;
+}
+
+bool RenderGraph::patch_dimensions()
+{
+	// Only sizes changed, so passes and barriers are still valid as long as
+	// nothing which depends on the sizes would bake differently.
+	auto patched = physical_dimensions;
+	for (auto &resource : resources)
+	{
+		unsigned physical_index = resource->get_physical_index();
+		if (physical_index == RenderResource::Unused)
+			continue;
+
+		auto &dim = patched[physical_index];
+		if (resource->get_type() == RenderResource::Type::Buffer)
+		{
+			auto new_dim = get_resource_dimensions(static_cast<RenderBufferResource &>(*resource));
+			if ((new_dim.buffer_info.size == 0) != (dim.buffer_info.size == 0))
+				return false;
+			dim.buffer_info.size = new_dim.buffer_info.size;
+		}
+		else
+		{
+			auto new_dim = get_resource_dimensions(static_cast<RenderTextureResource &>(*resource));
+			// Mipmap requests and formats are baked into the physical passes.
+			if (new_dim.levels != dim.levels || new_dim.format != dim.format)
+				return false;
+			dim.width = new_dim.width;
+			dim.height = new_dim.height;
+			dim.depth = new_dim.depth;
+		}
+	}
+
+	// Aliasing is decided by which physical resources have equal dimensions.
+	for (unsigned i = 0; i < patched.size(); i++)
+		for (unsigned j = 0; j < i; j++)
+			if ((physical_dimensions[i] == physical_dimensions[j]) != (patched[i] == patched[j]))
+				return false;
+
+	// Blitting to the swapchain instead of rendering to it directly changes the physical passes.
+	unsigned backbuffer_index = resources[resource_to_index[backbuffer_source]]->get_physical_index();
+	patched[backbuffer_index].persistent = swapchain_dimensions.persistent;
+	if (!can_alias_backbuffer)
+	{
+		auto backbuffer_dim = patched[backbuffer_index];
+		backbuffer_dim.transient = false;
+		bool need_blit = backbuffer_dim != swapchain_dimensions;
+		if (need_blit != (swapchain_physical_index == RenderResource::Unused))
+			return false;
+	}
+
+	physical_dimensions = move(patched);
+	return true;
+}
+
 void RenderGraph::bake()
 {
-	// First, validate that the graph is sane.
-	validate_passes();
+	Util::Timer total_timer;
+	total_timer.start();
 
 	auto itr = resource_to_index.find(backbuffer_source);
 	if (itr == end(resource_to_index))
 		throw logic_error("Backbuffer source does not exist.");
 
+	RenderGraphBakeStats stats;
+	stats.full_bakes = bake_stats.full_bakes;
+	stats.reused_bakes = bake_stats.reused_bakes;
+	stats.patched_bakes = bake_stats.patched_bakes;
+	bake_stats = stats;
+
+	Util::Timer timer;
+	timer.start();
+	structure_hash = compute_structure_hash();
+	dimension_hash = compute_dimension_hash();
+	bake_stats.hash_time = timer.end();
+
+	bool done = false;
+	if (has_bake_cache && bake_cache.structure_hash == structure_hash)
+	{
+		bool same_dimensions = bake_cache.dimension_hash == dimension_hash;
+		restore_bake();
+
+		if (same_dimensions)
+		{
+			bake_stats.mode = RenderGraphBakeStats::Mode::Reused;
+			bake_stats.reused_bakes++;
+			done = true;
+		}
+		else
+		{
+			validate_passes();
+			if (patch_dimensions())
+			{
+				bake_stats.mode = RenderGraphBakeStats::Mode::PatchedDimensions;
+				bake_stats.patched_bakes++;
+				done = true;
+			}
+		}
+	}
+
+	if (!done)
+	{
+		// Physical indices are not stable across a full bake, so start from scratch like a plain reset() would.
+		bake_cache = {};
+		has_bake_cache = false;
+		physical_passes.clear();
+		physical_dimensions.clear();
+		physical_image_has_history.clear();
+		physical_aliases.clear();
+		pass_barriers.clear();
+		physical_buffers.clear();
+		physical_image_attachments.clear();
+		physical_history_image_attachments.clear();
+		physical_events.clear();
+		physical_history_events.clear();
+
+		bake_full();
+		bake_stats.mode = RenderGraphBakeStats::Mode::Full;
+		bake_stats.full_bakes++;
+	}
+
+	// Packing depends on the exact sizes of resources.
+	if (bake_stats.mode != RenderGraphBakeStats::Mode::Reused)
+		memory_packing.dirty = true;
+
+	baked = true;
+	bake_stats.total_time = total_timer.end();
+}
+
+void RenderGraph::bake_full()
+{
+	Util::Timer timer;
+	timer.start();
+
+	// First, validate that the graph is sane.
+	validate_passes();
+
 	pass_stack.clear();
 
 	pass_dependencies.clear();
@@ -2545,7 +3330,7 @@ void RenderGraph::bake()
 	pass_merge_dependencies.resize(passes.size());
 
 	// Work our way back from the backbuffer, and sort out all the dependencies.
-	auto &backbuffer_resource = *resources[itr->second];
+	auto &backbuffer_resource = *resources[resource_to_index[backbuffer_source]];
 
 	if (backbuffer_resource.get_write_passes().empty())
 		throw logic_error("No pass exists which writes to resource.");
@@ -2562,27 +3347,40 @@ void RenderGraph::bake()
 
 	reverse(begin(pass_stack), end(pass_stack));
 	filter_passes(pass_stack);
+	bake_stats.dependency_time = timer.end();
 
 	// Now, reorder passes to extract better pipelining.
+	timer.start();
 	reorder_passes(pass_stack);
+	bake_stats.reorder_time = timer.end();
 
 	// Now, we have a linear list of passes to submit in-order which would obey the dependencies.
 
 	// Figure out which physical resources we need. Here we will alias resources which can trivially alias via renaming.
 	// E.g. depth input -> depth output is just one physical attachment, similar with color.
+	timer.start();
 	build_physical_resources();
+	bake_stats.physical_resource_time = timer.end();
 
 	// Next, try to merge adjacent passes together.
+	timer.start();
 	build_physical_passes();
+	bake_stats.physical_pass_time = timer.end();
 
 	// After merging physical passes and resources, if an image resource is only used in a single physical pass, make it transient.
+	timer.start();
 	build_transients();
+	bake_stats.transient_time = timer.end();
 
 	// Now that we are done, we can make render passes.
+	timer.start();
 	build_render_pass_info();
+	bake_stats.render_pass_info_time = timer.end();
 
 	// For each render pass in isolation, figure out the barriers required.
+	timer.start();
 	build_barriers();
+	bake_stats.barrier_time = timer.end();
 
 	// Check if the swapchain needs to be blitted to in case the geometry does not match the backbuffer,
 	// or the usage of the image makes that impossible.
@@ -2593,8 +3391,8 @@ void RenderGraph::bake()
 	// If resource is touched in async-compute, we cannot alias with swapchain.
 	// If resource is not transient, it's being used in multiple physical passes,
 	// we can't use the implicit subpass dependencies for dealing with swapchain.
-	bool can_alias_backbuffer = (backbuffer_dim.queues & compute_queues) == 0 &&
-	                            backbuffer_dim.transient;
+	can_alias_backbuffer = (backbuffer_dim.queues & compute_queues) == 0 &&
+	                       backbuffer_dim.transient;
 
 	backbuffer_dim.transient = false;
 	backbuffer_dim.persistent = swapchain_dimensions.persistent;
@@ -2611,11 +3409,18 @@ void RenderGraph::bake()
 
 	// Based on our render graph, figure out the barriers we actually need.
 	// Some barriers are implicit (transients), and some are redundant, i.e. same texture read in multiple passes.
+	timer.start();
 	build_physical_barriers();
+	bake_stats.physical_barrier_time = timer.end();
 
 	// Figure out which images can alias with each other.
 	// Also build virtual "transfer" barriers. These things only copy events over to other physical resources.
+	timer.start();
 	build_aliases();
+	bake_stats.alias_time = timer.end();
+
+	// Figure out where cross-queue resources are consumed, so semaphores are only signalled when another queue waits.
+	build_flush_consumers();
 
 	setup_timestamps();
 }
@@ -3227,6 +4032,8 @@ void RenderGraph::setup_timestamps()
 		timestamps.timestamps_fragment_end.resize(physical_passes.size());
 		timestamps.timestamps_compute_end.clear();
 		timestamps.timestamps_compute_end.resize(physical_passes.size());
+		timestamps.physical_queues.clear();
+		timestamps.physical_queues.resize(physical_passes.size());
 	}
 }
 
@@ -3235,6 +4042,61 @@ void RenderGraph::enable_timestamps(bool enable)
 	enabled_timestamps = enable;
 }
 
+void RenderGraph::enable_memory_packing(bool enable)
+{
+	enabled_memory_packing = enable;
+}
+
+void RenderGraph::enable_parallel_recording(bool enable)
+{
+	enabled_parallel_recording = enable;
+}
+
+using TimeInterval = pair<double, double>;
+
+static void merge_intervals(vector<TimeInterval> &intervals)
+{
+	sort(begin(intervals), end(intervals));
+	vector<TimeInterval> merged;
+	for (auto &interval : intervals)
+	{
+		if (!merged.empty() && interval.first <= merged.back().second)
+			merged.back().second = std::max(merged.back().second, interval.second);
+		else
+			merged.push_back(interval);
+	}
+	intervals = move(merged);
+}
+
+static double get_intervals_length(const vector<TimeInterval> &intervals)
+{
+	double length = 0.0;
+	for (auto &interval : intervals)
+		length += interval.second - interval.first;
+	return length;
+}
+
+// Both lists must be merged.
+static double get_intervals_overlap(const vector<TimeInterval> &a, const vector<TimeInterval> &b)
+{
+	double overlap = 0.0;
+	auto a_itr = begin(a);
+	auto b_itr = begin(b);
+	while (a_itr != end(a) && b_itr != end(b))
+	{
+		double start = std::max(a_itr->first, b_itr->first);
+		double finish = std::min(a_itr->second, b_itr->second);
+		if (finish > start)
+			overlap += finish - start;
+
+		if (a_itr->second < b_itr->second)
+			++a_itr;
+		else
+			++b_itr;
+	}
+	return overlap;
+}
+
 void RenderGraph::report_timestamps()
 {
 	std::vector<double> total_time_vertex(physical_passes.size());
@@ -3305,10 +4167,76 @@ void RenderGraph::report_timestamps()
 		if (frame_count_compute[pass])
 			LOGI("    Compute time: %10.3f us\n", 1e6 * total_time_compute[pass] / frame_count_compute[pass]);
 	}
+
+	// Measure how much of the async compute work ran concurrently with the graphics queue.
+	// This assumes timestamps are comparable across queues, which holds on all relevant implementations.
+	double total_async_time = 0.0;
+	double total_overlap_time = 0.0;
+	unsigned overlap_frame_count = 0;
+	vector<TimeInterval> graphics_intervals;
+	vector<TimeInterval> async_intervals;
+
+	for (auto &timestamp : physical_timestamps)
+	{
+		graphics_intervals.clear();
+		async_intervals.clear();
+
+		for (unsigned pass = 0; pass < physical_passes.size(); pass++)
+		{
+			TimeInterval interval;
+			if (timestamp.timestamps_fragment_begin[pass] &&
+			    timestamp.timestamps_fragment_end[pass] &&
+			    timestamp.timestamps_fragment_begin[pass]->is_signalled() &&
+			    timestamp.timestamps_fragment_end[pass]->is_signalled())
+			{
+				interval = { timestamp.timestamps_fragment_begin[pass]->get_timestamp(),
+				             timestamp.timestamps_fragment_end[pass]->get_timestamp() };
+			}
+			else if (timestamp.timestamps_compute_begin[pass] &&
+			         timestamp.timestamps_compute_end[pass] &&
+			         timestamp.timestamps_compute_begin[pass]->is_signalled() &&
+			         timestamp.timestamps_compute_end[pass]->is_signalled())
+			{
+				interval = { timestamp.timestamps_compute_begin[pass]->get_timestamp(),
+				             timestamp.timestamps_compute_end[pass]->get_timestamp() };
+			}
+			else
+				continue;
+
+			if (interval.second < interval.first) // Non-monotonic, discard.
+				continue;
+
+			if (timestamp.physical_queues[pass] == Vulkan::CommandBuffer::Type::AsyncCompute)
+				async_intervals.push_back(interval);
+			else
+				graphics_intervals.push_back(interval);
+		}
+
+		if (async_intervals.empty() || graphics_intervals.empty())
+			continue;
+
+		merge_intervals(graphics_intervals);
+		merge_intervals(async_intervals);
+		total_async_time += get_intervals_length(async_intervals);
+		total_overlap_time += get_intervals_overlap(async_intervals, graphics_intervals);
+		overlap_frame_count++;
+	}
+
+	if (overlap_frame_count)
+	{
+		LOGI("Async compute: %10.3f us / frame, overlapped with graphics: %10.3f us / frame (%.1f %%)\n",
+		     1e6 * total_async_time / overlap_frame_count,
+		     1e6 * total_overlap_time / overlap_frame_count,
+		     total_async_time > 0.0 ? 100.0 * total_overlap_time / total_async_time : 0.0);
+	}
 }
 
 void RenderGraph::reset()
 {
+	if (baked)
+		stash_bake();
+	baked = false;
+
 	passes.clear();
 	resources.clear();
 	pass_to_index.clear();
@@ -34,6 +34,7 @@
 #include "stack_allocator.hpp"
 #include "application_wsi_events.hpp"
 #include "quirks.hpp"
+#include "hash.hpp"
 
 namespace Granite
 {
@@ -573,11 +574,24 @@ public:
 		return name;
 	}
 
+	// Opt-in for passes whose callbacks do not touch state shared with other passes.
+	// Such passes may be recorded on worker threads if the graph enables parallel recording.
+	void set_parallel_recording(bool enable)
+	{
+		parallel_recording = enable;
+	}
+
+	bool get_parallel_recording() const
+	{
+		return parallel_recording;
+	}
+
 private:
 	RenderGraph &graph;
 	unsigned index;
 	unsigned physical_pass = Unused;
 	RenderGraphQueueFlagBits queue;
+	bool parallel_recording = false;
 
 	std::function<void (Vulkan::CommandBuffer &)> build_render_pass_cb;
 	std::function<void (unsigned, Vulkan::CommandBuffer &)> build_render_pass_layered_cb;
@@ -611,6 +625,50 @@ private:
 	                                               VkBufferUsageFlags usage);
 };
 
+struct RenderGraphBakeStats
+{
+	enum class Mode
+	{
+		Full,
+		Reused,
+		PatchedDimensions
+	};
+
+	// How the last bake() was resolved.
+	Mode mode = Mode::Full;
+
+	// CPU time in seconds spent in each stage of the last bake().
+	double hash_time = 0.0;
+	double dependency_time = 0.0;
+	double reorder_time = 0.0;
+	double physical_resource_time = 0.0;
+	double physical_pass_time = 0.0;
+	double transient_time = 0.0;
+	double render_pass_info_time = 0.0;
+	double barrier_time = 0.0;
+	double physical_barrier_time = 0.0;
+	double alias_time = 0.0;
+	double total_time = 0.0;
+
+	uint64_t full_bakes = 0;
+	uint64_t reused_bakes = 0;
+	uint64_t patched_bakes = 0;
+};
+
+struct RenderGraphMemoryStats
+{
+	// Physical images which were placed in the shared heap by memory packing.
+	unsigned packed_images = 0;
+	// Lifetime slots the packed images were coloured into. Images in the same slot share memory.
+	unsigned slots = 0;
+	// Bytes needed if every packed image had memory of its own.
+	VkDeviceSize unpacked_size = 0;
+	// Largest sum of image sizes alive in the same physical pass. No packing can do better than this.
+	VkDeviceSize peak_live_size = 0;
+	// Size of the shared heap.
+	VkDeviceSize packed_size = 0;
+};
+
 class RenderGraph : public Vulkan::NoCopyNoMove, public EventHandler
 {
 public:
@@ -642,9 +700,29 @@ public:
 	void enable_timestamps(bool enable);
 	void report_timestamps();
 
+	// Records physical passes where every subpass opted in with RenderPass::set_parallel_recording()
+	// on the global thread group. Barriers and events are still resolved serially, in submission order.
+	void enable_parallel_recording(bool enable);
+
+	// Places physical images with disjoint lifetimes in one shared heap, even if their dimensions differ,
+	// instead of only aliasing images with identical dimensions.
+	void enable_memory_packing(bool enable);
+
+	const RenderGraphMemoryStats &get_memory_stats() const
+	{
+		return memory_stats;
+	}
+
+	// If the declared passes and resources are identical to the last bake() before reset(),
+	// the previous bake is reused, and if only resource sizes changed, it is patched in place.
 	void bake();
 	void reset();
 	void log();
+
+	const RenderGraphBakeStats &get_bake_stats() const
+	{
+		return bake_stats;
+	}
 	void setup_attachments(Vulkan::Device &device, Vulkan::ImageView *swapchain);
 	void enqueue_render_passes(Vulkan::Device &device);
 
@@ -770,17 +848,18 @@ private:
 	ResourceDimensions get_resource_dimensions(const RenderTextureResource &resource) const;
 	ResourceDimensions swapchain_dimensions;
 
+	// Passes are referred to by index, so requests survive a reset() when the bake is reused.
 	struct ColorClearRequest
 	{
-		RenderPass *pass;
+		unsigned pass;
 		VkClearColorValue *target;
 		unsigned index;
 	};
 
 	struct DepthClearRequest
 	{
-		RenderPass *pass;
-		VkClearDepthStencilValue *target;
+		unsigned pass = RenderPass::Unused;
+		VkClearDepthStencilValue *target = nullptr;
 	};
 
 	struct ScaledClearRequests
@@ -817,6 +896,9 @@ private:
 		std::vector<std::vector<ScaledClearRequests>> scaled_clear_requests;
 		std::vector<MipmapRequests> mipmap_requests;
 		unsigned layers = 1;
+
+		// For each flush barrier, the queue of the next pass which touches the resource, or ~0u if unknown.
+		std::vector<RenderGraphQueueFlags> flush_consumer_queues;
 	};
 	std::vector<PhysicalPass> physical_passes;
 	void build_physical_passes();
@@ -825,6 +907,9 @@ private:
 	void build_physical_barriers();
 	void build_render_pass_info();
 	void build_aliases();
+	void build_flush_consumers();
+	void build_memory_packing(Vulkan::Device &device);
+	void release_memory_packing();
 	void setup_timestamps();
 
 	struct Timestamps
@@ -835,10 +920,26 @@ private:
 		std::vector<Vulkan::QueryPoolHandle> timestamps_vertex_end;
 		std::vector<Vulkan::QueryPoolHandle> timestamps_fragment_end;
 		std::vector<Vulkan::QueryPoolHandle> timestamps_compute_end;
+		std::vector<Vulkan::CommandBuffer::Type> physical_queues;
 	};
 	std::vector<Timestamps> physical_timestamps;
 	unsigned physical_timestamp_index = 0;
 	bool enabled_timestamps = false;
+	bool enabled_parallel_recording = false;
+
+	struct PassRecording
+	{
+		// Only set for passes recorded on worker threads.
+		Vulkan::CommandBufferHandle cmd;
+		Vulkan::PipelineEvent event;
+
+		Vulkan::CommandBuffer::Type queue_type = Vulkan::CommandBuffer::Type::Generic;
+		Vulkan::CommandBuffer::Type physical_queue = Vulkan::CommandBuffer::Type::Generic;
+		bool graphics = true;
+		bool required = false;
+		bool parallel = false;
+	};
+	std::vector<PassRecording> pass_recordings;
 
 	std::vector<ResourceDimensions> physical_dimensions;
 	std::vector<Vulkan::ImageView *> physical_attachments;
@@ -865,11 +966,40 @@ private:
 	std::vector<bool> physical_image_has_history;
 	std::vector<unsigned> physical_aliases;
 
+	// First and last physical pass which uses each physical resource, recorded by build_aliases().
+	struct PhysicalLifetime
+	{
+		unsigned first_pass = ~0u;
+		unsigned last_pass = 0;
+		bool can_alias = false;
+	};
+	std::vector<PhysicalLifetime> physical_lifetimes;
+
+	struct MemoryPacking
+	{
+		Vulkan::Device *device = nullptr;
+		Vulkan::DeviceAllocation heap;
+		// Physical resources which are placed in the heap.
+		std::vector<bool> packed;
+		bool dirty = true;
+	};
+	MemoryPacking memory_packing;
+	RenderGraphMemoryStats memory_stats;
+	bool enabled_memory_packing = false;
+
 	Vulkan::ImageView *swapchain_attachment = nullptr;
 	unsigned swapchain_physical_index = RenderResource::Unused;
 
 	void enqueue_scaled_requests(Vulkan::CommandBuffer &cmd, const std::vector<ScaledClearRequests> &requests);
 	void enqueue_mipmap_requests(Vulkan::CommandBuffer &cmd, const std::vector<MipmapRequests> &requests);
+	void record_physical_pass(Vulkan::CommandBuffer &cmd, PhysicalPass &physical_pass, bool graphics);
+	VkPipelineStageFlags get_event_wait_stages(const PhysicalPass &physical_pass,
+	                                           Vulkan::CommandBuffer::Type physical_queue) const;
+	bool flush_needs_semaphore(const PhysicalPass &physical_pass, unsigned flush_index,
+	                           Vulkan::CommandBuffer::Type physical_queue) const;
+
+	// Physical queue for each RenderGraphQueueFlagBits, resolved in enqueue_render_passes().
+	Vulkan::CommandBuffer::Type physical_queue_types[4] = {};
 
 	void on_swapchain_changed(const Vulkan::SwapchainParameterEvent &e);
 	void on_swapchain_destroyed(const Vulkan::SwapchainParameterEvent &e);
@@ -878,6 +1008,7 @@ private:
 
 	void setup_physical_buffer(Vulkan::Device &device, unsigned attachment);
 	void setup_physical_image(Vulkan::Device &device, unsigned attachment);
+	Vulkan::ImageCreateInfo get_physical_image_create_info(unsigned attachment) const;
 
 	void depend_passes_recursive(const RenderPass &pass, const std::unordered_set<unsigned> &passes,
 	                             unsigned stack_count, bool no_check, bool ignore_self, bool merge_dependency);
@@ -890,5 +1021,42 @@ private:
 
 	void reorder_passes(std::vector<unsigned> &passes);
 	static bool need_invalidate(const Barrier &barrier, const PipelineEvent &event);
+
+	// Everything bake() produces, stashed away by reset() so an identical graph can skip baking.
+	struct BakeCache
+	{
+		Util::Hash structure_hash = 0;
+		Util::Hash dimension_hash = 0;
+		bool can_alias_backbuffer = false;
+		unsigned swapchain_physical_index = RenderResource::Unused;
+		std::vector<unsigned> pass_stack;
+		std::vector<Barriers> pass_barriers;
+		std::vector<PhysicalPass> physical_passes;
+		std::vector<ResourceDimensions> physical_dimensions;
+		std::vector<bool> physical_image_has_history;
+		std::vector<unsigned> physical_aliases;
+		std::vector<unsigned> resource_physical_indices;
+		std::vector<unsigned> pass_physical_indices;
+
+		std::vector<Vulkan::BufferHandle> physical_buffers;
+		std::vector<Vulkan::ImageHandle> physical_image_attachments;
+		std::vector<Vulkan::ImageHandle> physical_history_image_attachments;
+		std::vector<PipelineEvent> physical_events;
+		std::vector<PipelineEvent> physical_history_events;
+	};
+	BakeCache bake_cache;
+	bool baked = false;
+	bool has_bake_cache = false;
+	Util::Hash structure_hash = 0;
+	Util::Hash dimension_hash = 0;
+	bool can_alias_backbuffer = false;
+	RenderGraphBakeStats bake_stats;
+
+	Util::Hash compute_structure_hash();
+	Util::Hash compute_dimension_hash() const;
+	void stash_bake();
+	void restore_bake();
+	bool patch_dimensions();
+	void bake_full();
 };
 }
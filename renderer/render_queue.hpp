@@ -29,13 +29,14 @@
 #include <command_buffer.hpp>
 #include "hash.hpp"
 #include "enum_cast.hpp"
-#include "intrusive_hash_map.hpp"
+#include "flat_hash_map.hpp"
 #include "math.hpp"
 
 namespace Granite
 {
 class ShaderSuite;
 class RenderContext;
+class BindlessMaterialTable;
 
 enum class Queue : unsigned
 {
@@ -178,6 +179,17 @@ public:
 		return shader_suites;
 	}
 
+	// nullptr unless the renderer uses bindless materials.
+	void set_bindless_materials(BindlessMaterialTable *table)
+	{
+		bindless_materials = table;
+	}
+
+	BindlessMaterialTable *get_bindless_materials() const
+	{
+		return bindless_materials;
+	}
+
 private:
 	void enqueue_queue_data(Queue queue, const RenderQueueData &data);
 
@@ -219,6 +231,7 @@ private:
 	Chain::iterator insert_large_block(size_t size, size_t alignment);
 
 	ShaderSuite *shader_suites = nullptr;
-	Util::IntrusiveHashMapHolder<QueueDataWrappedErased> render_infos;
+	BindlessMaterialTable *bindless_materials = nullptr;
+	Util::FlatHashMapHolder<QueueDataWrappedErased> render_infos;
 };
 }
@@ -249,16 +249,36 @@ void Renderer::on_device_created(const DeviceCreatedEvent &created)
 	set_mesh_renderer_options_internal(renderer_options);
 	for (auto &s : suite)
 		s.bake_base_defines();
+	bindless_materials.init(&device);
 }
 
 void Renderer::on_device_destroyed(const DeviceCreatedEvent &)
 {
+	bindless_materials.reset();
+}
+
+void Renderer::set_bindless_materials(bool enable)
+{
+	bindless_enable = enable;
+}
+
+bool Renderer::uses_bindless_materials() const
+{
+	return bindless_enable && bindless_materials.is_supported();
 }
 
 void Renderer::begin()
 {
 	queue.reset();
 	queue.set_shader_suites(suite);
+
+	if (uses_bindless_materials())
+	{
+		bindless_materials.begin();
+		queue.set_bindless_materials(&bindless_materials);
+	}
+	else
+		queue.set_bindless_materials(nullptr);
 }
 
 static void set_cluster_parameters(Vulkan::CommandBuffer &cmd, const LightClusterer &cluster)
@@ -383,6 +403,9 @@ void Renderer::flush(Vulkan::CommandBuffer &cmd, RenderContext &context, Rendere
 			bind_lighting_parameters(cmd, context);
 	}
 
+	if (queue.get_bindless_materials())
+		queue.get_bindless_materials()->bind(cmd, 3, 4);
+
 	if ((options & SKIP_SORTING_BIT) == 0)
 		queue.sort();
 
@@ -459,6 +482,17 @@ void Renderer::flush(Vulkan::CommandBuffer &cmd, RenderContext &context, Rendere
 	}
 }
 
+void Renderer::prewarm_pipelines(Vulkan::CommandBuffer &cmd, RenderContext &context, const VisibilityList &renderables,
+                                 RendererFlushFlags options)
+{
+	begin();
+	push_renderables(context, renderables);
+	cmd.set_pipeline_prewarm(true);
+	flush(cmd, context, options);
+	cmd.set_pipeline_prewarm(false);
+	queue.reset();
+}
+
 DebugMeshInstanceInfo &Renderer::render_debug(RenderContext &context, unsigned count)
 {
 	DebugMeshInfo debug;
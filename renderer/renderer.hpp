@@ -26,6 +26,7 @@
 #include "scene.hpp"
 #include "shader_suite.hpp"
 #include "renderer_enums.hpp"
+#include "bindless_material_table.hpp"
 
 namespace Granite
 {
@@ -104,6 +105,12 @@ public:
 
 	void flush(Vulkan::CommandBuffer &cmd, RenderContext &context, RendererFlushFlags options = 0);
 
+	// Runs flush() for the renderables with CommandBuffer::set_pipeline_prewarm() enabled,
+	// so every pipeline they need in the current render pass is compiled in the background without drawing.
+	// Mesh renderer options must already be set. The render queue is left empty.
+	void prewarm_pipelines(Vulkan::CommandBuffer &cmd, RenderContext &context, const VisibilityList &renderables,
+	                       RendererFlushFlags options = 0);
+
 	void render_debug_aabb(RenderContext &context, const AABB &aabb, const vec4 &color);
 
 	void render_debug_frustum(RenderContext &context, const Frustum &frustum, const vec4 &color);
@@ -120,6 +127,12 @@ public:
 
 	void set_render_context_parameter_binder(RenderContextParameterBinder *binder);
 
+	// Static meshes fetch textures and material parameters by index on devices with descriptor indexing,
+	// so draws no longer need per-material descriptor sets and instance across materials.
+	// Custom shader suites must support the BINDLESS define when this is enabled.
+	void set_bindless_materials(bool enable);
+	bool uses_bindless_materials() const;
+
 protected:
 	ShaderSuite suite[Util::ecast(RenderableType::Count)];
 
@@ -137,6 +150,8 @@ private:
 	RendererType type;
 	const ShaderSuiteResolver *resolver = nullptr;
 	RenderContextParameterBinder *render_context_parameter_binder = nullptr;
+	BindlessMaterialTable bindless_materials;
+	bool bindless_enable = false;
 	uint32_t renderer_options = ~0u;
 	uint8_t stencil_compare_mask = 0;
 	uint8_t stencil_write_mask = 0;
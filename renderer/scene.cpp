@@ -68,7 +68,7 @@ static void gather_visible_renderables(const Frustum &frustum, VisibilityList &l
 		if (transform->transform)
 		{
 			if ((renderable->renderable->flags & RENDERABLE_FORCE_VISIBLE_BIT) != 0 ||
-			    frustum.intersects_fast(transform->world_aabb))
+			    frustum.intersects_sphere(transform->world_sphere))
 			{
 				list.push_back({ renderable->renderable.get(), transform });
 			}
@@ -78,6 +78,17 @@ static void gather_visible_renderables(const Frustum &frustum, VisibilityList &l
 	}
 }
 
+template <typename T>
+static void gather_renderables(VisibilityList &list, const T &objects)
+{
+	for (auto &o : objects)
+	{
+		auto *transform = get_component<CachedSpatialTransformComponent>(o);
+		auto *renderable = get_component<RenderableComponent>(o);
+		list.push_back({ renderable->renderable.get(), transform->transform ? transform : nullptr });
+	}
+}
+
 void Scene::add_render_passes(RenderGraph &graph)
 {
 	for (auto &pass : render_pass_creators)
@@ -173,6 +184,16 @@ void Scene::gather_visible_transparent_renderables(const Frustum &frustum, Visib
 	gather_visible_renderables(frustum, list, transparent);
 }
 
+void Scene::gather_opaque_renderables(VisibilityList &list)
+{
+	gather_renderables(list, opaque);
+}
+
+void Scene::gather_transparent_renderables(VisibilityList &list)
+{
+	gather_renderables(list, transparent);
+}
+
 void Scene::gather_visible_static_shadow_renderables(const Frustum &frustum, VisibilityList &list)
 {
 	gather_visible_renderables(frustum, list, static_shadowing);
@@ -191,7 +212,7 @@ void Scene::gather_visible_positional_lights(const Frustum &frustum, VisibilityL
 
 		if (transform->transform)
 		{
-			if (frustum.intersects_fast(transform->world_aabb))
+			if (frustum.intersects_sphere(transform->world_sphere))
 			{
 				const auto *light = static_cast<const PositionalLight *>(renderable->renderable.get());
 				if (light->get_type() == PositionalLight::Type::Point)
@@ -318,6 +339,8 @@ void Scene::update_cached_transforms()
 					cached_transform->world_aabb = aabb->aabb->transform(
 						cached_transform->transform->world_transform);
 				}
+
+				cached_transform->world_sphere = BoundingSphere(cached_transform->world_aabb);
 			}
 			timestamp->last_timestamp = *timestamp->current_timestamp;
 		}
@@ -27,6 +27,7 @@
 #include "frustum.hpp"
 #include <tuple>
 #include "scene_formats.hpp"
+#include "frame_allocator.hpp"
 
 namespace Granite
 {
@@ -35,7 +36,9 @@ struct RenderableInfo
 	AbstractRenderable *renderable;
 	const CachedSpatialTransformComponent *transform;
 };
-using VisibilityList = std::vector<RenderableInfo>;
+// Default constructed lists are heap backed and persistent.
+// Lists which only live within a frame can be constructed with Util::thread_frame_allocator().
+using VisibilityList = Util::FrameVector<RenderableInfo>;
 
 class RenderContext;
 struct EnvironmentComponent;
@@ -57,6 +60,9 @@ public:
 	                                      unsigned max_point_lights = std::numeric_limits<unsigned>::max());
 	void gather_visible_render_pass_sinks(const vec3 &camera_pos, VisibilityList &list);
 	void gather_unbounded_renderables(VisibilityList &list);
+	// Every renderable regardless of visibility, e.g. to prewarm pipelines.
+	void gather_opaque_renderables(VisibilityList &list);
+	void gather_transparent_renderables(VisibilityList &list);
 	EnvironmentComponent *get_environment() const;
 	EntityPool &get_entity_pool();
 
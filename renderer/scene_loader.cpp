@@ -22,11 +22,14 @@
 
 #include "scene_loader.hpp"
 #include "gltf.hpp"
+#include "cooked_scene.hpp"
 #include "scene_formats.hpp"
 #include "rapidjson_wrapper.hpp"
 #include "mesh_util.hpp"
 #include "enum_cast.hpp"
 #include "ground.hpp"
+#include "timer.hpp"
+#include "thread_group.hpp"
 
 using namespace std;
 using namespace rapidjson;
@@ -51,12 +54,17 @@ AnimationSystem &SceneLoader::get_animation_system()
 	return *animation_system;
 }
 
+void SceneLoader::set_compact_vertices(bool enable)
+{
+	compact_vertices = enable;
+}
+
 Scene::NodeHandle SceneLoader::load_scene_to_root_node(const std::string &path)
 {
 	auto ext = Path::ext(path);
-	if (ext == "gltf" || ext == "glb")
+	if (ext == "gltf" || ext == "glb" || ext == "gscene")
 	{
-		return parse_gltf(path);
+		return parse_scene_file(path);
 	}
 	else
 	{
@@ -75,26 +83,26 @@ void SceneLoader::load_scene(const std::string &path)
 
 Scene::NodeHandle SceneLoader::build_tree_for_subscene(const SubsceneData &subscene)
 {
-	auto &parser = *subscene.parser;
+	auto &info = subscene.info;
 	std::vector<Scene::NodeHandle> nodes;
-	nodes.reserve(parser.get_nodes().size());
+	nodes.reserve(info.nodes.size());
 
-	auto &scene_nodes = parser.get_scenes()[parser.get_default_scene()];
-	auto touched = build_used_nodes_in_scene(scene_nodes, parser.get_nodes());
+	auto &scene_nodes = *info.scene_nodes;
+	auto touched = build_used_nodes_in_scene(scene_nodes, info.nodes);
 
 	unsigned node_index = 0;
-	for (auto &node : parser.get_nodes())
+	for (auto &node : info.nodes)
 	{
 		if (!node.joint && touched.count(node_index))
 		{
 			Scene::NodeHandle nodeptr;
 			if (node.has_skin)
 			{
-				nodeptr = scene->create_skinned_node(parser.get_skins()[node.skin]);
+				nodeptr = scene->create_skinned_node(info.skins[node.skin]);
 
 #if 1
-				auto skin_compat = parser.get_skins()[node.skin].skin_compat;
-				for (auto &animation : parser.get_animations())
+				auto skin_compat = info.skins[node.skin].skin_compat;
+				for (auto &animation : info.animations)
 				{
 					if (animation.skin_compat == skin_compat)
 					{
@@ -118,7 +126,7 @@ Scene::NodeHandle SceneLoader::build_tree_for_subscene(const SubsceneData &subsc
 		node_index++;
 	}
 
-	for (auto &animation : parser.get_animations())
+	for (auto &animation : info.animations)
 	{
 		if (!animation.skinning)
 		{
@@ -128,7 +136,7 @@ Scene::NodeHandle SceneLoader::build_tree_for_subscene(const SubsceneData &subsc
 	}
 
 	unsigned i = 0;
-	for (auto &node : parser.get_nodes())
+	for (auto &node : info.nodes)
 	{
 		if (nodes[i])
 		{
@@ -142,7 +150,7 @@ Scene::NodeHandle SceneLoader::build_tree_for_subscene(const SubsceneData &subsc
 		i++;
 	}
 
-	for (auto &camera : parser.get_cameras())
+	for (auto &camera : info.cameras)
 	{
 		auto cam_entity = this->scene->create_entity();
 
@@ -159,7 +167,7 @@ Scene::NodeHandle SceneLoader::build_tree_for_subscene(const SubsceneData &subsc
 		}
 	}
 
-	for (auto &light : parser.get_lights())
+	for (auto &light : info.lights)
 	{
 		if (light.attached_to_node && touched.count(light.node_index))
 			scene->create_light(light, nodes[light.node_index].get());
@@ -261,42 +269,111 @@ void SceneLoader::load_animation(const std::string &path, SceneFormats::Animatio
 	animation.update_length();
 }
 
-Scene::NodeHandle SceneLoader::parse_gltf(const std::string &path)
+static AbstractRenderableHandle create_imported_mesh(SceneFormats::Mesh &&mesh,
+                                                     const vector<SceneFormats::MaterialInfo> &materials,
+                                                     bool compact_vertices)
 {
-	SubsceneData scene;
-	scene.parser = make_unique<GLTF::Parser>(path);
+	SceneFormats::MaterialInfo default_material;
+	default_material.uniform_base_color = vec4(0.3f, 1.0f, 0.3f, 1.0f);
+	default_material.uniform_metallic = 0.0f;
+	default_material.uniform_roughness = 1.0f;
+
+	auto &material = mesh.has_material ? materials[mesh.material_index] : default_material;
+	bool skinned = mesh.attribute_layout[ecast(MeshAttribute::BoneIndex)].format != VK_FORMAT_UNDEFINED;
+	if (skinned)
+		return Util::make_handle<ImportedSkinnedMesh>(move(mesh), material, compact_vertices);
+	else
+		return Util::make_handle<ImportedMesh>(move(mesh), material, compact_vertices);
+}
+
+void SceneLoader::load_gltf_subscene(SubsceneData &subscene, const std::string &path)
+{
+	// Primitives are built on the thread group, but renderables are created here as each primitive completes,
+	// since registering for device events is not thread safe.
+	// If the device already exists, this is also where their uploads are queued,
+	// so uploading overlaps with building the remaining primitives.
+	// The parser has no further use for the mesh data, so it's moved into the renderable.
+	Timer timer;
+	double renderable_time = 0.0;
+	subscene.parser = make_unique<GLTF::Parser>(path, [&](const GLTF::Parser &parser, uint32_t index, SceneFormats::Mesh &mesh) {
+		timer.start();
+		if (index >= subscene.meshes.size())
+			subscene.meshes.resize(index + 1);
+		subscene.meshes[index] = create_imported_mesh(move(mesh), parser.get_materials(), compact_vertices);
+		renderable_time += timer.end();
+	});
 
-	for (auto &mesh : scene.parser->get_meshes())
+	auto &parser = *subscene.parser;
+	subscene.info.materials = parser.get_materials();
+	subscene.info.nodes = parser.get_nodes();
+	subscene.info.skins = parser.get_skins();
+	subscene.info.animations = parser.get_animations();
+	subscene.info.cameras = parser.get_cameras();
+	subscene.info.lights = parser.get_lights();
+	subscene.info.scene_nodes = &parser.get_scenes()[parser.get_default_scene()];
+	subscene.environments = parser.get_environments();
+
+	auto &timings = parser.get_load_timings();
+	LOGI("Loaded %s: read %.3f ms, parse %.3f ms, primitives %.3f ms (%.3f ms of which creating renderables).\n",
+	     path.c_str(), timings.read * 1e3, timings.parse * 1e3, timings.meshes * 1e3, renderable_time * 1e3);
+}
+
+void SceneLoader::load_cooked_subscene(SubsceneData &subscene, const std::string &path)
+{
+	Timer timer;
+	timer.start();
+	subscene.cooked = make_unique<SceneFormats::CookedScene>(path);
+	auto &cooked = *subscene.cooked;
+	double table_time = timer.end();
+
+	// Streams are already in the layout they are uploaded in, so they only need to be copied out of the mapping.
+	timer.start();
+	vector<SceneFormats::Mesh> meshes(cooked.get_mesh_count());
+	auto task = Global::thread_group()->create_task();
+	for (uint32_t i = 0; i < meshes.size(); i++)
 	{
-		SceneFormats::MaterialInfo default_material;
-		default_material.uniform_base_color = vec4(0.3f, 1.0f, 0.3f, 1.0f);
-		default_material.uniform_metallic = 0.0f;
-		default_material.uniform_roughness = 1.0f;
-		AbstractRenderableHandle renderable;
-
-		bool skinned = mesh.attribute_layout[ecast(MeshAttribute::BoneIndex)].format != VK_FORMAT_UNDEFINED;
-		if (skinned)
-		{
-			if (mesh.has_material)
-				renderable = Util::make_handle<ImportedSkinnedMesh>(mesh,
-				                                                    scene.parser->get_materials()[mesh.material_index]);
-			else
-				renderable = Util::make_handle<ImportedSkinnedMesh>(mesh, default_material);
-		}
-		else
-		{
-			if (mesh.has_material)
-				renderable = Util::make_handle<ImportedMesh>(mesh,
-				                                             scene.parser->get_materials()[mesh.material_index]);
-			else
-				renderable = Util::make_handle<ImportedMesh>(mesh, default_material);
-		}
-		scene.meshes.push_back(renderable);
+		task->enqueue_task([&, i]() {
+			meshes[i] = cooked.get_mesh(i);
+		});
 	}
+	task->wait();
+	double stream_time = timer.end();
+
+	timer.start();
+	subscene.meshes.reserve(meshes.size());
+	for (auto &mesh : meshes)
+		subscene.meshes.push_back(create_imported_mesh(move(mesh), cooked.get_materials(), compact_vertices));
+	double renderable_time = timer.end();
+
+	subscene.info.materials = cooked.get_materials();
+	subscene.info.nodes = cooked.get_nodes();
+	subscene.info.skins = cooked.get_skins();
+	subscene.info.animations = cooked.get_animations();
+	subscene.info.cameras = cooked.get_cameras();
+	subscene.info.lights = cooked.get_lights();
+	subscene.info.scene_nodes = &cooked.get_scene_nodes();
+	subscene.environments = cooked.get_environments();
+
+	LOGI("Loaded %s: tables %.3f ms, streams %.3f ms, renderables %.3f ms.\n",
+	     path.c_str(), table_time * 1e3, stream_time * 1e3, renderable_time * 1e3);
+}
 
-	if (!scene.parser->get_environments().empty())
+void SceneLoader::load_subscene(SubsceneData &subscene, const std::string &path)
+{
+	if (Path::ext(path) == "gscene")
+		load_cooked_subscene(subscene, path);
+	else
+		load_gltf_subscene(subscene, path);
+}
+
+Scene::NodeHandle SceneLoader::parse_scene_file(const std::string &path)
+{
+	SubsceneData scene;
+	load_subscene(scene, path);
+
+	if (!scene.environments.empty())
 	{
-		auto &env = scene.parser->get_environments().front();
+		auto &env = scene.environments[0];
 
 		EntityHandle entity;
 		Util::IntrusivePtr<Skybox> skybox;
@@ -330,7 +407,11 @@ Scene::NodeHandle SceneLoader::parse_gltf(const std::string &path)
 		}
 	}
 
-	return build_tree_for_subscene(scene);
+	Timer timer;
+	timer.start();
+	auto root = build_tree_for_subscene(scene);
+	LOGI("Built node tree for %s in %.3f ms.\n", path.c_str(), timer.end() * 1e3);
+	return root;
 }
 
 Scene::NodeHandle SceneLoader::parse_scene_format(const std::string &path, const std::string &json)
@@ -346,36 +427,7 @@ Scene::NodeHandle SceneLoader::parse_scene_format(const std::string &path, const
 	{
 		auto gltf_path = Path::relpath(path, itr->value.GetString());
 		auto &subscene = subscenes[itr->name.GetString()];
-		subscene.parser.reset(new GLTF::Parser(gltf_path));
-		auto &parser = *subscene.parser;
-
-		for (auto &mesh : parser.get_meshes())
-		{
-			SceneFormats::MaterialInfo default_material;
-			default_material.uniform_base_color = vec4(0.3f, 1.0f, 0.3f, 1.0f);
-			default_material.uniform_metallic = 0.0f;
-			default_material.uniform_roughness = 1.0f;
-			AbstractRenderableHandle renderable;
-
-			bool skinned = mesh.attribute_layout[ecast(MeshAttribute::BoneIndex)].format != VK_FORMAT_UNDEFINED;
-			if (skinned)
-			{
-				if (mesh.has_material)
-					renderable = Util::make_handle<ImportedSkinnedMesh>(mesh,
-					                                                    parser.get_materials()[mesh.material_index]);
-				else
-					renderable = Util::make_handle<ImportedSkinnedMesh>(mesh, default_material);
-			}
-			else
-			{
-				if (mesh.has_material)
-					renderable = Util::make_handle<ImportedMesh>(mesh,
-					                                             parser.get_materials()[mesh.material_index]);
-				else
-					renderable = Util::make_handle<ImportedMesh>(mesh, default_material);
-			}
-			subscene.meshes.push_back(renderable);
-		}
+		load_subscene(subscene, gltf_path);
 	}
 
 	vector<Scene::NodeHandle> hierarchy;
@@ -24,6 +24,7 @@
 
 #include "scene.hpp"
 #include "gltf.hpp"
+#include "cooked_scene.hpp"
 #include "animation_system.hpp"
 #include <memory>
 #include <string>
@@ -50,18 +51,31 @@ public:
 	std::unique_ptr<AnimationSystem> consume_animation_system();
 	AnimationSystem &get_animation_system();
 
+	// Meshes loaded after this call use the compact vertex layout where possible.
+	// Custom shader suites must then handle HAVE_COMPACT_VERTEX.
+	void set_compact_vertices(bool enable);
+
 private:
 	struct SubsceneData
 	{
+		// Only one of these is used, depending on the file type. The views below point into it.
 		std::unique_ptr<GLTF::Parser> parser;
+		std::unique_ptr<SceneFormats::CookedScene> cooked;
+
+		SceneFormats::SceneInformation info;
+		Util::ArrayView<const SceneFormats::EnvironmentInfo> environments;
 		std::vector<AbstractRenderableHandle> meshes;
 	};
 	std::unordered_map<std::string, SubsceneData> subscenes;
 
 	std::unique_ptr<Scene> scene;
 	std::unique_ptr<AnimationSystem> animation_system;
+	bool compact_vertices = false;
 	Scene::NodeHandle parse_scene_format(const std::string &path, const std::string &json);
-	Scene::NodeHandle parse_gltf(const std::string &path);
+	Scene::NodeHandle parse_scene_file(const std::string &path);
+	void load_subscene(SubsceneData &subscene, const std::string &path);
+	void load_gltf_subscene(SubsceneData &subscene, const std::string &path);
+	void load_cooked_subscene(SubsceneData &subscene, const std::string &path);
 
 	Scene::NodeHandle build_tree_for_subscene(const SubsceneData &subscene);
 	void load_animation(const std::string &path, SceneFormats::Animation &animation);
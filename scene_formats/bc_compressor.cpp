@@ -0,0 +1,499 @@
+/* Copyright (c) 2017-2018 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include "bc_compressor.hpp"
+#include "rgtc_compressor.hpp"
+#include <algorithm>
+#include <float.h>
+#include <math.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+using namespace std;
+
+namespace Granite
+{
+// Texels in SoA layout so index fitting can work on 4 texels at a time.
+struct ColorBlock
+{
+	alignas(16) float r[16];
+	alignas(16) float g[16];
+	alignas(16) float b[16];
+	// 0 for texels which are encoded as transparent and do not contribute to the color fit.
+	alignas(16) float w[16];
+};
+
+static int clamp_int(int v, int lo, int hi)
+{
+	return min(max(v, lo), hi);
+}
+
+static uint16_t pack_565(const float *color)
+{
+	int r = clamp_int(int(color[0] * (31.0f / 255.0f) + 0.5f), 0, 31);
+	int g = clamp_int(int(color[1] * (63.0f / 255.0f) + 0.5f), 0, 63);
+	int b = clamp_int(int(color[2] * (31.0f / 255.0f) + 0.5f), 0, 31);
+	return uint16_t((r << 11) | (g << 5) | b);
+}
+
+static void unpack_565(int *color, uint16_t c)
+{
+	int r = (c >> 11) & 31;
+	int g = (c >> 5) & 63;
+	int b = c & 31;
+	color[0] = (r << 3) | (r >> 2);
+	color[1] = (g << 2) | (g >> 4);
+	color[2] = (b << 3) | (b >> 2);
+}
+
+static void build_bc1_palette(int (*palette)[3], uint16_t c0, uint16_t c1, bool four_color)
+{
+	unpack_565(palette[0], c0);
+	unpack_565(palette[1], c1);
+
+	for (int c = 0; c < 3; c++)
+	{
+		if (four_color)
+		{
+			palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+			palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+		}
+		else
+		{
+			palette[2][c] = (palette[0][c] + palette[1][c]) / 2;
+			palette[3][c] = 0;
+		}
+	}
+}
+
+// Assigns every texel to its nearest palette entry and returns the weighted squared error.
+static float fit_indices(const ColorBlock &block, const int (*palette)[3], unsigned count, uint32_t *indices)
+{
+#if defined(__SSE2__)
+	__m128 total = _mm_setzero_ps();
+	for (unsigned i = 0; i < 16; i += 4)
+	{
+		__m128 r = _mm_load_ps(block.r + i);
+		__m128 g = _mm_load_ps(block.g + i);
+		__m128 b = _mm_load_ps(block.b + i);
+		__m128 best = _mm_set1_ps(FLT_MAX);
+		__m128i best_index = _mm_setzero_si128();
+
+		for (unsigned k = 0; k < count; k++)
+		{
+			__m128 dr = _mm_sub_ps(r, _mm_set1_ps(float(palette[k][0])));
+			__m128 dg = _mm_sub_ps(g, _mm_set1_ps(float(palette[k][1])));
+			__m128 db = _mm_sub_ps(b, _mm_set1_ps(float(palette[k][2])));
+			__m128 dist = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dr, dr), _mm_mul_ps(dg, dg)), _mm_mul_ps(db, db));
+			__m128i mask = _mm_castps_si128(_mm_cmplt_ps(dist, best));
+			best = _mm_min_ps(dist, best);
+			best_index = _mm_or_si128(_mm_andnot_si128(mask, best_index),
+			                          _mm_and_si128(mask, _mm_set1_epi32(int(k))));
+		}
+
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(indices + i), best_index);
+		total = _mm_add_ps(total, _mm_mul_ps(best, _mm_load_ps(block.w + i)));
+	}
+
+	total = _mm_add_ps(total, _mm_movehl_ps(total, total));
+	total = _mm_add_ss(total, _mm_shuffle_ps(total, total, _MM_SHUFFLE(1, 1, 1, 1)));
+	return _mm_cvtss_f32(total);
+#else
+	float total = 0.0f;
+	for (unsigned i = 0; i < 16; i++)
+	{
+		float best = FLT_MAX;
+		uint32_t best_index = 0;
+		for (unsigned k = 0; k < count; k++)
+		{
+			float dr = block.r[i] - float(palette[k][0]);
+			float dg = block.g[i] - float(palette[k][1]);
+			float db = block.b[i] - float(palette[k][2]);
+			float dist = dr * dr + dg * dg + db * db;
+			if (dist < best)
+			{
+				best = dist;
+				best_index = k;
+			}
+		}
+		indices[i] = best_index;
+		total += best * block.w[i];
+	}
+	return total;
+#endif
+}
+
+struct BC1Encoding
+{
+	uint16_t c0 = 0;
+	uint16_t c1 = 0;
+	uint32_t indices[16] = {};
+	float error = FLT_MAX;
+};
+
+// BC1 selects four color mode when c0 > c1, BC3 color blocks are always four color.
+static void evaluate_encoding(const ColorBlock &block, BC1Encoding &encoding, bool bc3)
+{
+	bool four_color = bc3 || encoding.c0 > encoding.c1;
+	int palette[4][3];
+	build_bc1_palette(palette, encoding.c0, encoding.c1, four_color);
+	encoding.error = fit_indices(block, palette, four_color ? 4 : 3, encoding.indices);
+}
+
+static void set_endpoints(BC1Encoding &encoding, uint16_t c0, uint16_t c1, bool four_color)
+{
+	if (four_color ? c0 < c1 : c0 > c1)
+		swap(c0, c1);
+	encoding.c0 = c0;
+	encoding.c1 = c1;
+}
+
+static void compute_principal_axis(const ColorBlock &block, const float *mean, float *axis)
+{
+	float cov[6] = {};
+	for (unsigned i = 0; i < 16; i++)
+	{
+		float r = block.r[i] - mean[0];
+		float g = block.g[i] - mean[1];
+		float b = block.b[i] - mean[2];
+		float w = block.w[i];
+		cov[0] += w * r * r;
+		cov[1] += w * r * g;
+		cov[2] += w * r * b;
+		cov[3] += w * g * g;
+		cov[4] += w * g * b;
+		cov[5] += w * b * b;
+	}
+
+	// Power iteration, starting from the luminance axis.
+	float v[3] = { 0.30f, 0.59f, 0.11f };
+	for (unsigned iter = 0; iter < 8; iter++)
+	{
+		float x = cov[0] * v[0] + cov[1] * v[1] + cov[2] * v[2];
+		float y = cov[1] * v[0] + cov[3] * v[1] + cov[4] * v[2];
+		float z = cov[2] * v[0] + cov[4] * v[1] + cov[5] * v[2];
+		float len = max(max(fabsf(x), fabsf(y)), fabsf(z));
+		if (len < 1e-6f)
+			break;
+		v[0] = x / len;
+		v[1] = y / len;
+		v[2] = z / len;
+	}
+
+	float len = sqrtf(v[0] * v[0] + v[1] * v[1] + v[2] * v[2]);
+	for (int c = 0; c < 3; c++)
+		axis[c] = v[c] / len;
+}
+
+static void compute_initial_endpoints(const ColorBlock &block, unsigned quality, float *e0, float *e1)
+{
+	if (quality <= 1)
+	{
+		// Bounding box diagonal, inset slightly to account for the interpolated palette entries.
+		float lo[3] = { 255.0f, 255.0f, 255.0f };
+		float hi[3] = { 0.0f, 0.0f, 0.0f };
+		for (unsigned i = 0; i < 16; i++)
+		{
+			if (block.w[i] == 0.0f)
+				continue;
+			lo[0] = min(lo[0], block.r[i]);
+			lo[1] = min(lo[1], block.g[i]);
+			lo[2] = min(lo[2], block.b[i]);
+			hi[0] = max(hi[0], block.r[i]);
+			hi[1] = max(hi[1], block.g[i]);
+			hi[2] = max(hi[2], block.b[i]);
+		}
+
+		for (int c = 0; c < 3; c++)
+		{
+			float inset = (hi[c] - lo[c]) / 16.0f;
+			e0[c] = hi[c] - inset;
+			e1[c] = lo[c] + inset;
+		}
+		return;
+	}
+
+	float mean[3] = {};
+	float total_weight = 0.0f;
+	for (unsigned i = 0; i < 16; i++)
+	{
+		mean[0] += block.w[i] * block.r[i];
+		mean[1] += block.w[i] * block.g[i];
+		mean[2] += block.w[i] * block.b[i];
+		total_weight += block.w[i];
+	}
+
+	for (auto &m : mean)
+		m /= total_weight;
+
+	float axis[3];
+	compute_principal_axis(block, mean, axis);
+
+	float t_min = FLT_MAX;
+	float t_max = -FLT_MAX;
+	for (unsigned i = 0; i < 16; i++)
+	{
+		if (block.w[i] == 0.0f)
+			continue;
+		float t = (block.r[i] - mean[0]) * axis[0] + (block.g[i] - mean[1]) * axis[1] + (block.b[i] - mean[2]) * axis[2];
+		t_min = min(t_min, t);
+		t_max = max(t_max, t);
+	}
+
+	for (int c = 0; c < 3; c++)
+	{
+		e0[c] = mean[c] + axis[c] * t_max;
+		e1[c] = mean[c] + axis[c] * t_min;
+	}
+}
+
+// Least squares fit of the endpoints given the current index assignment.
+static bool refine_endpoints(const ColorBlock &block, const uint32_t *indices, bool four_color, float *e0, float *e1)
+{
+	static const float four_color_weights[4] = { 1.0f, 0.0f, 2.0f / 3.0f, 1.0f / 3.0f };
+	static const float three_color_weights[4] = { 1.0f, 0.0f, 0.5f, 0.0f };
+	const float *weights = four_color ? four_color_weights : three_color_weights;
+
+	float aa = 0.0f, bb = 0.0f, ab = 0.0f;
+	float ax[3] = {};
+	float bx[3] = {};
+
+	for (unsigned i = 0; i < 16; i++)
+	{
+		float w = block.w[i];
+		if (w == 0.0f)
+			continue;
+
+		float a = weights[indices[i]];
+		float b = 1.0f - a;
+		aa += w * a * a;
+		bb += w * b * b;
+		ab += w * a * b;
+		ax[0] += w * a * block.r[i];
+		ax[1] += w * a * block.g[i];
+		ax[2] += w * a * block.b[i];
+		bx[0] += w * b * block.r[i];
+		bx[1] += w * b * block.g[i];
+		bx[2] += w * b * block.b[i];
+	}
+
+	float det = aa * bb - ab * ab;
+	if (fabsf(det) < 1e-6f)
+		return false;
+
+	float inv_det = 1.0f / det;
+	for (int c = 0; c < 3; c++)
+	{
+		e0[c] = (ax[c] * bb - bx[c] * ab) * inv_det;
+		e1[c] = (bx[c] * aa - ax[c] * ab) * inv_det;
+	}
+	return true;
+}
+
+// Greedily nudges each 565 component of both endpoints by one step while it lowers the error.
+static void perturb_endpoints(const ColorBlock &block, BC1Encoding &best, bool four_color, bool bc3)
+{
+	static const int shifts[3] = { 11, 5, 0 };
+	static const int masks[3] = { 31, 63, 31 };
+
+	for (unsigned pass = 0; pass < 4; pass++)
+	{
+		bool improved = false;
+		for (unsigned endpoint = 0; endpoint < 2; endpoint++)
+		{
+			for (unsigned c = 0; c < 3; c++)
+			{
+				for (int delta = -1; delta <= 1; delta += 2)
+				{
+					uint16_t endpoints[2] = { best.c0, best.c1 };
+					int v = ((endpoints[endpoint] >> shifts[c]) & masks[c]) + delta;
+					if (v < 0 || v > masks[c])
+						continue;
+
+					endpoints[endpoint] &= ~uint16_t(masks[c] << shifts[c]);
+					endpoints[endpoint] |= uint16_t(v << shifts[c]);
+
+					BC1Encoding candidate;
+					set_endpoints(candidate, endpoints[0], endpoints[1], four_color);
+					evaluate_encoding(block, candidate, bc3);
+					if (candidate.error < best.error)
+					{
+						best = candidate;
+						improved = true;
+					}
+				}
+			}
+		}
+
+		if (!improved)
+			break;
+	}
+}
+
+static BC1Encoding encode_color_mode(const ColorBlock &block, const float *initial_e0, const float *initial_e1,
+                                     unsigned quality, bool four_color, bool bc3)
+{
+	static const unsigned refine_iterations[6] = { 0, 0, 0, 1, 2, 4 };
+
+	BC1Encoding best;
+	set_endpoints(best, pack_565(initial_e0), pack_565(initial_e1), four_color);
+	evaluate_encoding(block, best, bc3);
+
+	float e0[3], e1[3];
+	for (unsigned iter = 0; iter < refine_iterations[min(quality, 5u)] && best.error > 0.0f; iter++)
+	{
+		// A 3 color block decodes as 4 color once the endpoints are ordered, so weights follow the decoder.
+		bool decode_four_color = bc3 || best.c0 > best.c1;
+		if (!refine_endpoints(block, best.indices, decode_four_color, e0, e1))
+			break;
+
+		BC1Encoding candidate;
+		set_endpoints(candidate, pack_565(e0), pack_565(e1), four_color);
+		if (candidate.c0 == best.c0 && candidate.c1 == best.c1)
+			break;
+
+		evaluate_encoding(block, candidate, bc3);
+		if (candidate.error >= best.error)
+			break;
+		best = candidate;
+	}
+
+	if (quality >= 5 && best.error > 0.0f)
+		perturb_endpoints(block, best, four_color, bc3);
+
+	return best;
+}
+
+static void write_color_block(uint8_t *output, const BC1Encoding &encoding, const ColorBlock &block)
+{
+	uint32_t bits = 0;
+	for (unsigned i = 0; i < 16; i++)
+	{
+		uint32_t index = block.w[i] == 0.0f ? 3 : encoding.indices[i];
+		bits |= index << (2 * i);
+	}
+
+	output[0] = uint8_t(encoding.c0 & 0xff);
+	output[1] = uint8_t(encoding.c0 >> 8);
+	output[2] = uint8_t(encoding.c1 & 0xff);
+	output[3] = uint8_t(encoding.c1 >> 8);
+	for (unsigned i = 0; i < 4; i++)
+		output[4 + i] = uint8_t((bits >> (8 * i)) & 0xff);
+}
+
+static void compress_color_block(uint8_t *output, const uint8_t *input_rgba, unsigned quality, bool punch_through_alpha, bool bc3)
+{
+	ColorBlock block;
+	bool has_transparent = false;
+	bool has_opaque = false;
+
+	for (unsigned i = 0; i < 16; i++)
+	{
+		block.r[i] = float(input_rgba[4 * i + 0]);
+		block.g[i] = float(input_rgba[4 * i + 1]);
+		block.b[i] = float(input_rgba[4 * i + 2]);
+		bool transparent = punch_through_alpha && input_rgba[4 * i + 3] < 128;
+		block.w[i] = transparent ? 0.0f : 1.0f;
+		has_transparent |= transparent;
+		has_opaque |= !transparent;
+	}
+
+	if (!has_opaque)
+	{
+		// c0 == c1 selects 3 color mode, and write_color_block uses index 3 everywhere.
+		BC1Encoding encoding;
+		write_color_block(output, encoding, block);
+		return;
+	}
+
+	float e0[3], e1[3];
+	compute_initial_endpoints(block, quality, e0, e1);
+
+	// Transparency is only expressible in 3 color mode.
+	BC1Encoding best;
+	if (!has_transparent)
+		best = encode_color_mode(block, e0, e1, quality, true, bc3);
+
+	if (has_transparent || (!bc3 && quality >= 4 && best.error > 0.0f))
+	{
+		auto three_color = encode_color_mode(block, e0, e1, quality, false, bc3);
+		if (three_color.error < best.error)
+			best = three_color;
+	}
+
+	write_color_block(output, best, block);
+}
+
+static void decompress_color_block(uint8_t *output_rgba, const uint8_t *block, bool bc3)
+{
+	uint16_t c0 = uint16_t(block[0] | (block[1] << 8));
+	uint16_t c1 = uint16_t(block[2] | (block[3] << 8));
+	uint32_t bits = uint32_t(block[4]) | (uint32_t(block[5]) << 8) | (uint32_t(block[6]) << 16) | (uint32_t(block[7]) << 24);
+
+	bool four_color = bc3 || c0 > c1;
+	int palette[4][3];
+	build_bc1_palette(palette, c0, c1, four_color);
+
+	for (unsigned i = 0; i < 16; i++)
+	{
+		unsigned index = (bits >> (2 * i)) & 3;
+		output_rgba[4 * i + 0] = uint8_t(palette[index][0]);
+		output_rgba[4 * i + 1] = uint8_t(palette[index][1]);
+		output_rgba[4 * i + 2] = uint8_t(palette[index][2]);
+		output_rgba[4 * i + 3] = (!four_color && index == 3) ? 0 : 255;
+	}
+}
+
+void compress_bc1_block(uint8_t *output, const uint8_t *input_rgba, unsigned quality, bool punch_through_alpha)
+{
+	compress_color_block(output, input_rgba, quality, punch_through_alpha, false);
+}
+
+void compress_bc3_block(uint8_t *output, const uint8_t *input_rgba, unsigned quality)
+{
+	// BC3 alpha is encoded exactly like a BC4 block.
+	uint8_t alpha[16];
+	for (unsigned i = 0; i < 16; i++)
+		alpha[i] = input_rgba[4 * i + 3];
+
+	compress_rgtc_red_block(output, alpha, quality);
+	compress_color_block(output + 8, input_rgba, quality, false, true);
+}
+
+void decompress_bc1_block(uint8_t *output_rgba, const uint8_t *block)
+{
+	decompress_color_block(output_rgba, block, false);
+}
+
+void decompress_bc3_block(uint8_t *output_rgba, const uint8_t *block)
+{
+	uint8_t alpha[16];
+	decompress_rgtc_red_block(alpha, block);
+	decompress_color_block(output_rgba, block + 8, true);
+	for (unsigned i = 0; i < 16; i++)
+		output_rgba[4 * i + 3] = alpha[i];
+}
+}
@@ -0,0 +1,38 @@
+/* Copyright (c) 2017-2018 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#pragma once
+
+#include <stdint.h>
+
+namespace Granite
+{
+// Input is 16 RGBA8 texels of a 4x4 block in row-major order.
+// quality is 1 (fastest) to 5 (best), as in CompressorArguments.
+// With punch_through_alpha, texels with alpha < 128 are encoded as transparent black.
+void compress_bc1_block(uint8_t *output, const uint8_t *input_rgba, unsigned quality, bool punch_through_alpha);
+void compress_bc3_block(uint8_t *output, const uint8_t *input_rgba, unsigned quality);
+
+void decompress_bc1_block(uint8_t *output_rgba, const uint8_t *block);
+void decompress_bc3_block(uint8_t *output_rgba, const uint8_t *block);
+}
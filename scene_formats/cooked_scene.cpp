@@ -0,0 +1,886 @@
+/* Copyright (c) 2017-2018 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include "cooked_scene.hpp"
+#include "path.hpp"
+#include "util.hpp"
+#include "texture_format.hpp"
+#include <string.h>
+#include <assert.h>
+#include <stdexcept>
+#include <type_traits>
+#include <algorithm>
+
+using namespace std;
+using namespace Util;
+
+namespace Granite
+{
+namespace SceneFormats
+{
+static const char cooked_magic[8] = { 'G', 'R', 'A', 'N', 'S', 'C', 'N', '\0' };
+static const uint32_t cooked_version = 1;
+static const size_t cooked_alignment = 16;
+
+// Byte offset from the start of the file and number of elements.
+struct CookedRange
+{
+	uint64_t offset;
+	uint64_t count;
+};
+
+struct CookedHeader
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t reserved;
+	uint64_t file_size;
+
+	CookedRange meshes;
+	CookedRange materials;
+	CookedRange nodes;
+	CookedRange skins;
+	CookedRange animations;
+	CookedRange cameras;
+	CookedRange lights;
+	CookedRange environments;
+	CookedRange scene_name;
+	CookedRange scene_node_indices;
+};
+
+struct CookedMesh
+{
+	CookedRange positions;
+	CookedRange attributes;
+	CookedRange indices;
+	uint32_t position_stride;
+	uint32_t attribute_stride;
+	MeshAttributeLayout attribute_layout[ecast(MeshAttribute::Count)];
+	VkIndexType index_type;
+	VkPrimitiveTopology topology;
+	uint32_t material_index;
+	uint32_t count;
+	uint32_t has_material;
+	uint32_t primitive_restart;
+	vec3 aabb_min;
+	vec3 aabb_max;
+};
+
+struct CookedTexture
+{
+	CookedRange path;
+	VkComponentMapping swizzle;
+};
+
+struct CookedMaterial
+{
+	CookedTexture base_color;
+	CookedTexture normal;
+	CookedTexture metallic_roughness;
+	CookedTexture occlusion;
+	CookedTexture emissive;
+	vec4 uniform_base_color;
+	vec3 uniform_emissive_color;
+	float uniform_metallic;
+	float uniform_roughness;
+	float normal_scale;
+	DrawPipeline pipeline;
+	Vulkan::StockSampler sampler;
+	uint32_t two_sided;
+	uint32_t bandlimited_pixel;
+};
+
+struct CookedNode
+{
+	CookedRange meshes;
+	CookedRange children;
+	NodeTransform transform;
+	uint64_t skin;
+	uint32_t has_skin;
+	uint32_t joint;
+};
+
+// Siblings are stored contiguously, so children are a range in the bone table.
+struct CookedBone
+{
+	CookedRange children;
+	uint32_t index;
+	uint32_t reserved;
+};
+
+struct CookedSkin
+{
+	CookedRange inverse_bind_pose;
+	CookedRange joint_transforms;
+	CookedRange skeletons;
+	uint64_t skin_compat;
+};
+
+struct CookedChannel
+{
+	CookedRange timestamps;
+	CookedRange linear;
+	CookedRange spherical;
+	CookedRange cubic;
+	uint32_t node_index;
+	AnimationChannel::Type type;
+	uint32_t joint_index;
+	uint32_t joint;
+};
+
+struct CookedAnimation
+{
+	CookedRange name;
+	CookedRange channels;
+	uint64_t skin_compat;
+	float length;
+	uint32_t skinning;
+};
+
+struct CookedCamera
+{
+	CookedRange name;
+	uint32_t node_index;
+	CameraInfo::Type type;
+	float aspect_ratio;
+	float znear;
+	float zfar;
+	float yfov;
+	float xmag;
+	float ymag;
+	uint32_t attached_to_node;
+	uint32_t reserved;
+};
+
+struct CookedLight
+{
+	CookedRange name;
+	uint32_t node_index;
+	LightInfo::Type type;
+	vec3 color;
+	float inner_cone;
+	float outer_cone;
+	float range;
+	uint32_t attached_to_node;
+};
+
+struct CookedEnvironment
+{
+	CookedTexture cube;
+	CookedTexture reflection;
+	CookedTexture irradiance;
+	vec3 fog_color;
+	float fog_falloff;
+	float intensity;
+	uint32_t reserved;
+};
+
+// Structs are written with memcpy, so start from zeroed memory to keep padding deterministic.
+template <typename T>
+static T zeroed()
+{
+	static_assert(is_trivially_copyable<T>::value, "Cooked structs must be trivially copyable.");
+	T t;
+	memset(static_cast<void *>(&t), 0, sizeof(T));
+	return t;
+}
+
+struct CookedWriter
+{
+	vector<uint8_t> blob = vector<uint8_t>(sizeof(CookedHeader));
+
+	CookedRange append(const void *data, size_t element_size, size_t count)
+	{
+		size_t offset = (blob.size() + cooked_alignment - 1) & ~(cooked_alignment - 1);
+		blob.resize(offset + element_size * count);
+		if (count)
+			memcpy(blob.data() + offset, data, element_size * count);
+		return { offset, count };
+	}
+
+	template <typename T>
+	CookedRange append(const vector<T> &data)
+	{
+		static_assert(is_trivially_copyable<T>::value, "Cooked data must be trivially copyable.");
+		return append(data.data(), sizeof(T), data.size());
+	}
+
+	CookedRange append(const string &str)
+	{
+		return append(str.data(), 1, str.size());
+	}
+
+	CookedTexture append(const MaterialInfo::Texture &texture)
+	{
+		auto cooked = zeroed<CookedTexture>();
+		cooked.path = append(texture.path);
+		cooked.swizzle = texture.swizzle;
+		return cooked;
+	}
+
+	CookedRange append_bones(const vector<Skin::Bone> &bones)
+	{
+		// Children are written before their parents, so a valid file only ever references backwards.
+		vector<CookedBone> cooked;
+		cooked.reserve(bones.size());
+		for (auto &bone : bones)
+		{
+			auto cooked_bone = zeroed<CookedBone>();
+			cooked_bone.children = append_bones(bone.children);
+			cooked_bone.index = bone.index;
+			cooked.push_back(cooked_bone);
+		}
+		return append(cooked);
+	}
+};
+
+bool export_cooked_scene(const string &path, const SceneInformation &scene,
+                         const vector<EnvironmentInfo> &environments)
+{
+	CookedWriter writer;
+	auto header = zeroed<CookedHeader>();
+	memcpy(header.magic, cooked_magic, sizeof(cooked_magic));
+	header.version = cooked_version;
+
+	vector<CookedMesh> meshes;
+	meshes.reserve(scene.meshes.size());
+	for (auto &mesh : scene.meshes)
+	{
+		auto cooked = zeroed<CookedMesh>();
+		cooked.positions = writer.append(mesh.positions);
+		cooked.attributes = writer.append(mesh.attributes);
+		cooked.indices = writer.append(mesh.indices);
+		cooked.position_stride = mesh.position_stride;
+		cooked.attribute_stride = mesh.attribute_stride;
+		memcpy(cooked.attribute_layout, mesh.attribute_layout, sizeof(mesh.attribute_layout));
+		cooked.index_type = mesh.index_type;
+		cooked.topology = mesh.topology;
+		cooked.material_index = mesh.material_index;
+		cooked.count = mesh.count;
+		cooked.has_material = mesh.has_material;
+		cooked.primitive_restart = mesh.primitive_restart;
+		cooked.aabb_min = mesh.static_aabb.get_minimum();
+		cooked.aabb_max = mesh.static_aabb.get_maximum();
+		meshes.push_back(cooked);
+	}
+	header.meshes = writer.append(meshes);
+
+	vector<CookedMaterial> materials;
+	materials.reserve(scene.materials.size());
+	for (auto &material : scene.materials)
+	{
+		auto cooked = zeroed<CookedMaterial>();
+		cooked.base_color = writer.append(material.base_color);
+		cooked.normal = writer.append(material.normal);
+		cooked.metallic_roughness = writer.append(material.metallic_roughness);
+		cooked.occlusion = writer.append(material.occlusion);
+		cooked.emissive = writer.append(material.emissive);
+		cooked.uniform_base_color = material.uniform_base_color;
+		cooked.uniform_emissive_color = material.uniform_emissive_color;
+		cooked.uniform_metallic = material.uniform_metallic;
+		cooked.uniform_roughness = material.uniform_roughness;
+		cooked.normal_scale = material.normal_scale;
+		cooked.pipeline = material.pipeline;
+		cooked.sampler = material.sampler;
+		cooked.two_sided = material.two_sided;
+		cooked.bandlimited_pixel = material.bandlimited_pixel;
+		materials.push_back(cooked);
+	}
+	header.materials = writer.append(materials);
+
+	vector<CookedNode> nodes;
+	nodes.reserve(scene.nodes.size());
+	for (auto &node : scene.nodes)
+	{
+		auto cooked = zeroed<CookedNode>();
+		cooked.meshes = writer.append(node.meshes);
+		cooked.children = writer.append(node.children);
+		cooked.transform = node.transform;
+		cooked.skin = node.skin;
+		cooked.has_skin = node.has_skin;
+		cooked.joint = node.joint;
+		nodes.push_back(cooked);
+	}
+	header.nodes = writer.append(nodes);
+
+	vector<CookedSkin> skins;
+	skins.reserve(scene.skins.size());
+	for (auto &skin : scene.skins)
+	{
+		auto cooked = zeroed<CookedSkin>();
+		cooked.inverse_bind_pose = writer.append(skin.inverse_bind_pose);
+		cooked.joint_transforms = writer.append(skin.joint_transforms);
+		cooked.skeletons = writer.append_bones(skin.skeletons);
+		cooked.skin_compat = skin.skin_compat;
+		skins.push_back(cooked);
+	}
+	header.skins = writer.append(skins);
+
+	vector<CookedAnimation> animations;
+	animations.reserve(scene.animations.size());
+	for (auto &animation : scene.animations)
+	{
+		vector<CookedChannel> channels;
+		channels.reserve(animation.channels.size());
+		for (auto &channel : animation.channels)
+		{
+			auto cooked = zeroed<CookedChannel>();
+			cooked.timestamps = writer.append(channel.timestamps);
+			cooked.linear = writer.append(channel.linear.values);
+			cooked.spherical = writer.append(channel.spherical.values);
+			cooked.cubic = writer.append(channel.cubic.values);
+			cooked.node_index = channel.node_index;
+			cooked.type = channel.type;
+			cooked.joint_index = channel.joint_index;
+			cooked.joint = channel.joint;
+			channels.push_back(cooked);
+		}
+
+		auto cooked = zeroed<CookedAnimation>();
+		cooked.name = writer.append(animation.name);
+		cooked.channels = writer.append(channels);
+		cooked.skin_compat = animation.skin_compat;
+		cooked.length = animation.length;
+		cooked.skinning = animation.skinning;
+		animations.push_back(cooked);
+	}
+	header.animations = writer.append(animations);
+
+	vector<CookedCamera> cameras;
+	cameras.reserve(scene.cameras.size());
+	for (auto &camera : scene.cameras)
+	{
+		auto cooked = zeroed<CookedCamera>();
+		cooked.name = writer.append(camera.name);
+		cooked.node_index = camera.node_index;
+		cooked.type = camera.type;
+		cooked.aspect_ratio = camera.aspect_ratio;
+		cooked.znear = camera.znear;
+		cooked.zfar = camera.zfar;
+		cooked.yfov = camera.yfov;
+		cooked.xmag = camera.xmag;
+		cooked.ymag = camera.ymag;
+		cooked.attached_to_node = camera.attached_to_node;
+		cameras.push_back(cooked);
+	}
+	header.cameras = writer.append(cameras);
+
+	vector<CookedLight> lights;
+	lights.reserve(scene.lights.size());
+	for (auto &light : scene.lights)
+	{
+		auto cooked = zeroed<CookedLight>();
+		cooked.name = writer.append(light.name);
+		cooked.node_index = light.node_index;
+		cooked.type = light.type;
+		cooked.color = light.color;
+		cooked.inner_cone = light.inner_cone;
+		cooked.outer_cone = light.outer_cone;
+		cooked.range = light.range;
+		cooked.attached_to_node = light.attached_to_node;
+		lights.push_back(cooked);
+	}
+	header.lights = writer.append(lights);
+
+	vector<CookedEnvironment> cooked_environments;
+	cooked_environments.reserve(environments.size());
+	for (auto &env : environments)
+	{
+		auto cooked = zeroed<CookedEnvironment>();
+		cooked.cube = writer.append(env.cube);
+		cooked.reflection = writer.append(env.reflection);
+		cooked.irradiance = writer.append(env.irradiance);
+		cooked.fog_color = env.fog.color;
+		cooked.fog_falloff = env.fog.falloff;
+		cooked.intensity = env.intensity;
+		cooked_environments.push_back(cooked);
+	}
+	header.environments = writer.append(cooked_environments);
+
+	if (scene.scene_nodes)
+	{
+		header.scene_name = writer.append(scene.scene_nodes->name);
+		header.scene_node_indices = writer.append(scene.scene_nodes->node_indices);
+	}
+
+	header.file_size = writer.blob.size();
+	memcpy(writer.blob.data(), &header, sizeof(header));
+
+	auto file = Global::filesystem()->open(path, FileMode::WriteOnly);
+	if (!file)
+	{
+		LOGE("Failed to open %s for writing.\n", path.c_str());
+		return false;
+	}
+
+	void *mapped = file->map_write(writer.blob.size());
+	if (!mapped)
+	{
+		LOGE("Failed to map %s for writing.\n", path.c_str());
+		return false;
+	}
+
+	memcpy(mapped, writer.blob.data(), writer.blob.size());
+	return true;
+}
+
+struct CookedReader
+{
+	const uint8_t *mapped;
+	size_t size;
+
+	template <typename T>
+	const T *get(const CookedRange &range) const
+	{
+		if (range.count == 0)
+			return reinterpret_cast<const T *>(mapped);
+
+		if ((range.offset & (cooked_alignment - 1)) != 0 || range.offset > size ||
+		    range.count > (size - range.offset) / sizeof(T))
+			throw logic_error("Cooked scene range is out of bounds.");
+
+		return reinterpret_cast<const T *>(mapped + range.offset);
+	}
+
+	template <typename T>
+	vector<T> get_vector(const CookedRange &range) const
+	{
+		auto *data = get<T>(range);
+		return vector<T>(data, data + range.count);
+	}
+
+	string get_string(const CookedRange &range) const
+	{
+		auto *data = get<char>(range);
+		return string(data, data + range.count);
+	}
+
+	MaterialInfo::Texture get_texture(const string &path, const CookedTexture &texture) const
+	{
+		auto texture_path = get_string(texture.path);
+		if (!texture_path.empty())
+			texture_path = Path::relpath(path, texture_path);
+		return { move(texture_path), texture.swizzle };
+	}
+
+	vector<Skin::Bone> get_bones(const CookedRange &range, size_t joint_count) const
+	{
+		auto *cooked = get<CookedBone>(range);
+		vector<Skin::Bone> bones(range.count);
+		for (size_t i = 0; i < range.count; i++)
+		{
+			// Children are always written before parents. Anything else could be a cycle.
+			if (cooked[i].children.count && cooked[i].children.offset >= range.offset)
+				throw logic_error("Cooked skeleton is not a tree.");
+			if (cooked[i].index >= joint_count)
+				throw logic_error("Cooked bone joint is out of range.");
+			bones[i].index = cooked[i].index;
+			bones[i].children = get_bones(cooked[i].children, joint_count);
+		}
+		return bones;
+	}
+};
+
+static void validate_indices(const vector<uint32_t> &indices, size_t count)
+{
+	for (auto index : indices)
+		if (index >= count)
+			throw logic_error("Cooked scene index is out of range.");
+}
+
+// Node children must form a forest. Loaders recurse through children,
+// so a cycle would never terminate, and a node with two parents would be instanced twice.
+static void validate_node_hierarchy(const vector<Node> &nodes)
+{
+	vector<uint8_t> has_parent(nodes.size());
+	for (auto &node : nodes)
+	{
+		for (auto child : node.children)
+		{
+			if (has_parent[child])
+				throw logic_error("Cooked node has more than one parent.");
+			has_parent[child] = 1;
+		}
+	}
+
+	// With at most one parent each, every node not reachable from a root is part of a cycle.
+	vector<uint32_t> stack;
+	size_t reached = 0;
+	for (size_t i = 0; i < nodes.size(); i++)
+		if (!has_parent[i])
+			stack.push_back(uint32_t(i));
+
+	while (!stack.empty())
+	{
+		uint32_t index = stack.back();
+		stack.pop_back();
+		reached++;
+		for (auto child : nodes[index].children)
+			stack.push_back(child);
+	}
+
+	if (reached != nodes.size())
+		throw logic_error("Cooked node hierarchy has a cycle.");
+}
+
+// Formats come from the file, and format_block_size() asserts on formats it does not know.
+// Block compressed formats and everything after them can never be vertex formats.
+static uint32_t get_vertex_format_size(VkFormat format)
+{
+	if (format <= VK_FORMAT_UNDEFINED || format >= VK_FORMAT_BC1_RGB_UNORM_BLOCK)
+		return 0;
+	return Vulkan::TextureFormatLayout::format_block_size(format);
+}
+
+template <typename T>
+static void validate_index_buffer(const T *indices, uint32_t count, uint64_t vertex_count, bool primitive_restart)
+{
+	for (uint32_t i = 0; i < count; i++)
+	{
+		if (primitive_restart && indices[i] == T(~T(0)))
+			continue;
+		if (indices[i] >= vertex_count)
+			throw logic_error("Cooked mesh index is out of range.");
+	}
+}
+
+// Everything the GPU will read is checked against the streams, so a corrupt file cannot cause out of bounds reads.
+static void validate_mesh(const CookedReader &reader, const CookedMesh &mesh, size_t material_count)
+{
+	if (mesh.has_material && mesh.material_index >= material_count)
+		throw logic_error("Cooked mesh material is out of range.");
+	if (mesh.topology < VK_PRIMITIVE_TOPOLOGY_POINT_LIST || mesh.topology > VK_PRIMITIVE_TOPOLOGY_PATCH_LIST)
+		throw logic_error("Cooked mesh topology is invalid.");
+
+	reader.get<uint8_t>(mesh.positions);
+	reader.get<uint8_t>(mesh.attributes);
+	auto *indices = reader.get<uint8_t>(mesh.indices);
+
+	if (mesh.attribute_layout[ecast(MeshAttribute::Position)].format == VK_FORMAT_UNDEFINED)
+		throw logic_error("Cooked mesh has no positions.");
+
+	bool has_attributes = false;
+	for (unsigned i = 0; i < ecast(MeshAttribute::Count); i++)
+	{
+		auto &layout = mesh.attribute_layout[i];
+		if (layout.format == VK_FORMAT_UNDEFINED)
+			continue;
+
+		uint32_t format_size = get_vertex_format_size(layout.format);
+		if (!format_size)
+			throw logic_error("Cooked mesh attribute format is invalid.");
+
+		// This also rejects zero strides.
+		bool position = i == ecast(MeshAttribute::Position);
+		uint32_t stride = position ? mesh.position_stride : mesh.attribute_stride;
+		if (uint64_t(layout.offset) + format_size > stride)
+			throw logic_error("Cooked mesh attribute does not fit in its vertex stride.");
+
+		if (!position)
+			has_attributes = true;
+	}
+
+	uint64_t vertex_count = mesh.positions.count / mesh.position_stride;
+	if (has_attributes && mesh.attributes.count / mesh.attribute_stride < vertex_count)
+		throw logic_error("Cooked mesh attribute stream is smaller than the position stream.");
+
+	if (mesh.indices.count)
+	{
+		uint32_t index_size;
+		if (mesh.index_type == VK_INDEX_TYPE_UINT16)
+			index_size = sizeof(uint16_t);
+		else if (mesh.index_type == VK_INDEX_TYPE_UINT32)
+			index_size = sizeof(uint32_t);
+		else
+			throw logic_error("Cooked mesh index type is invalid.");
+
+		if (mesh.count > mesh.indices.count / index_size)
+			throw logic_error("Cooked mesh index count is out of range.");
+
+		// Streams are aligned in the file, so indices can be read in place.
+		if (index_size == sizeof(uint16_t))
+		{
+			validate_index_buffer(reinterpret_cast<const uint16_t *>(indices), mesh.count, vertex_count,
+			                      mesh.primitive_restart != 0);
+		}
+		else
+		{
+			validate_index_buffer(reinterpret_cast<const uint32_t *>(indices), mesh.count, vertex_count,
+			                      mesh.primitive_restart != 0);
+		}
+	}
+	else if (mesh.count > vertex_count)
+		throw logic_error("Cooked mesh vertex count is out of range.");
+}
+
+static void validate_channel(const AnimationChannel &channel, const Animation &animation,
+                             const vector<Skin> &skins, size_t node_count)
+{
+	if (channel.timestamps.empty())
+		throw logic_error("Cooked animation channel has no timestamps.");
+
+	// Samplers read one key past the current one, and CubicSampler reads up to values[3 * index + 4].
+	size_t key_count = channel.timestamps.size();
+	switch (channel.type)
+	{
+	case AnimationChannel::Type::Translation:
+	case AnimationChannel::Type::Scale:
+		if (channel.linear.values.size() < key_count)
+			throw logic_error("Cooked animation channel has too few values.");
+		break;
+
+	case AnimationChannel::Type::Rotation:
+		if (channel.spherical.values.size() < key_count)
+			throw logic_error("Cooked animation channel has too few values.");
+		break;
+
+	case AnimationChannel::Type::CubicTranslation:
+	case AnimationChannel::Type::CubicScale:
+		if (channel.cubic.values.size() < 3 * std::max<size_t>(key_count, 2) - 1)
+			throw logic_error("Cooked animation channel has too few values.");
+		break;
+
+	default:
+		throw logic_error("Cooked animation channel type is invalid.");
+	}
+
+	if (channel.joint)
+	{
+		// Joint channels can be applied to any skinned node with a compatible skin.
+		for (auto &skin : skins)
+			if (skin.skin_compat == animation.skin_compat && channel.joint_index >= skin.joint_transforms.size())
+				throw logic_error("Cooked animation channel joint is out of range.");
+	}
+	else if (channel.node_index >= node_count)
+		throw logic_error("Cooked animation channel node is out of range.");
+}
+
+CookedScene::CookedScene(const string &path)
+{
+	file = Global::filesystem()->open(path, FileMode::ReadOnly);
+	if (!file)
+		throw runtime_error("Failed to open cooked scene.");
+
+	size = file->get_size();
+	mapped = static_cast<const uint8_t *>(file->map());
+	if (!mapped)
+		throw runtime_error("Failed to map cooked scene.");
+
+	if (size < sizeof(CookedHeader))
+		throw logic_error("Cooked scene is too small.");
+
+	CookedHeader header;
+	memcpy(&header, mapped, sizeof(header));
+	if (memcmp(header.magic, cooked_magic, sizeof(cooked_magic)) != 0)
+		throw logic_error("Invalid magic for cooked scene.");
+	if (header.version != cooked_version)
+		throw logic_error("Unsupported version of cooked scene.");
+	if (header.file_size != size)
+		throw logic_error("Cooked scene size mismatch.");
+
+	CookedReader reader = { mapped, size };
+
+	auto *cooked_meshes = reader.get<CookedMesh>(header.meshes);
+	mesh_offset = header.meshes.offset;
+	mesh_count = uint32_t(header.meshes.count);
+
+	auto *cooked_materials = reader.get<CookedMaterial>(header.materials);
+	materials.resize(header.materials.count);
+	for (size_t i = 0; i < materials.size(); i++)
+	{
+		auto &cooked = cooked_materials[i];
+		auto &material = materials[i];
+		material.base_color = reader.get_texture(path, cooked.base_color);
+		material.normal = reader.get_texture(path, cooked.normal);
+		material.metallic_roughness = reader.get_texture(path, cooked.metallic_roughness);
+		material.occlusion = reader.get_texture(path, cooked.occlusion);
+		material.emissive = reader.get_texture(path, cooked.emissive);
+		material.uniform_base_color = cooked.uniform_base_color;
+		material.uniform_emissive_color = cooked.uniform_emissive_color;
+		material.uniform_metallic = cooked.uniform_metallic;
+		material.uniform_roughness = cooked.uniform_roughness;
+		material.normal_scale = cooked.normal_scale;
+		material.pipeline = cooked.pipeline;
+		material.sampler = cooked.sampler;
+		material.two_sided = cooked.two_sided != 0;
+		material.bandlimited_pixel = cooked.bandlimited_pixel != 0;
+
+		if (unsigned(material.pipeline) > unsigned(DrawPipeline::AlphaBlend))
+			throw logic_error("Cooked material pipeline is invalid.");
+		if (unsigned(material.sampler) >= unsigned(Vulkan::StockSampler::Count))
+			throw logic_error("Cooked material sampler is invalid.");
+	}
+
+	// Validate meshes up front, so get_mesh() never has to throw.
+	for (uint32_t i = 0; i < mesh_count; i++)
+		validate_mesh(reader, cooked_meshes[i], materials.size());
+
+	// Skins come before nodes, so node skin indices can be validated.
+	auto *cooked_skins = reader.get<CookedSkin>(header.skins);
+	skins.resize(header.skins.count);
+	for (size_t i = 0; i < skins.size(); i++)
+	{
+		auto &cooked = cooked_skins[i];
+		auto &skin = skins[i];
+		skin.inverse_bind_pose = reader.get_vector<mat4>(cooked.inverse_bind_pose);
+		skin.joint_transforms = reader.get_vector<NodeTransform>(cooked.joint_transforms);
+		if (skin.inverse_bind_pose.size() != skin.joint_transforms.size())
+			throw logic_error("Cooked skin has mismatched joint counts.");
+		skin.skeletons = reader.get_bones(cooked.skeletons, skin.joint_transforms.size());
+		skin.skin_compat = cooked.skin_compat;
+	}
+
+	auto *cooked_nodes = reader.get<CookedNode>(header.nodes);
+	nodes.resize(header.nodes.count);
+	for (size_t i = 0; i < nodes.size(); i++)
+	{
+		auto &cooked = cooked_nodes[i];
+		auto &node = nodes[i];
+		node.meshes = reader.get_vector<uint32_t>(cooked.meshes);
+		node.children = reader.get_vector<uint32_t>(cooked.children);
+		node.transform = cooked.transform;
+		node.skin = cooked.skin;
+		node.has_skin = cooked.has_skin != 0;
+		node.joint = cooked.joint != 0;
+		validate_indices(node.meshes, mesh_count);
+		validate_indices(node.children, nodes.size());
+		if (node.has_skin && node.skin >= skins.size())
+			throw logic_error("Cooked node skin is out of range.");
+	}
+	validate_node_hierarchy(nodes);
+
+	auto *cooked_animations = reader.get<CookedAnimation>(header.animations);
+	animations.resize(header.animations.count);
+	for (size_t i = 0; i < animations.size(); i++)
+	{
+		auto &cooked = cooked_animations[i];
+		auto &animation = animations[i];
+		animation.name = reader.get_string(cooked.name);
+		animation.skin_compat = cooked.skin_compat;
+		animation.length = cooked.length;
+		animation.skinning = cooked.skinning != 0;
+
+		auto *cooked_channels = reader.get<CookedChannel>(cooked.channels);
+		animation.channels.resize(cooked.channels.count);
+		for (size_t j = 0; j < animation.channels.size(); j++)
+		{
+			auto &cooked_channel = cooked_channels[j];
+			auto &channel = animation.channels[j];
+			channel.timestamps = reader.get_vector<float>(cooked_channel.timestamps);
+			channel.linear.values = reader.get_vector<vec3>(cooked_channel.linear);
+			channel.spherical.values = reader.get_vector<quat>(cooked_channel.spherical);
+			channel.cubic.values = reader.get_vector<vec3>(cooked_channel.cubic);
+			channel.node_index = cooked_channel.node_index;
+			channel.type = cooked_channel.type;
+			channel.joint_index = cooked_channel.joint_index;
+			channel.joint = cooked_channel.joint != 0;
+			validate_channel(channel, animation, skins, nodes.size());
+		}
+	}
+
+	auto *cooked_cameras = reader.get<CookedCamera>(header.cameras);
+	cameras.resize(header.cameras.count);
+	for (size_t i = 0; i < cameras.size(); i++)
+	{
+		auto &cooked = cooked_cameras[i];
+		auto &camera = cameras[i];
+		camera.name = reader.get_string(cooked.name);
+		camera.node_index = cooked.node_index;
+		camera.type = cooked.type;
+		camera.aspect_ratio = cooked.aspect_ratio;
+		camera.znear = cooked.znear;
+		camera.zfar = cooked.zfar;
+		camera.yfov = cooked.yfov;
+		camera.xmag = cooked.xmag;
+		camera.ymag = cooked.ymag;
+		camera.attached_to_node = cooked.attached_to_node != 0;
+		if (camera.attached_to_node && camera.node_index >= nodes.size())
+			throw logic_error("Cooked camera node is out of range.");
+	}
+
+	auto *cooked_lights = reader.get<CookedLight>(header.lights);
+	lights.resize(header.lights.count);
+	for (size_t i = 0; i < lights.size(); i++)
+	{
+		auto &cooked = cooked_lights[i];
+		auto &light = lights[i];
+		light.name = reader.get_string(cooked.name);
+		light.node_index = cooked.node_index;
+		light.type = cooked.type;
+		light.color = cooked.color;
+		light.inner_cone = cooked.inner_cone;
+		light.outer_cone = cooked.outer_cone;
+		light.range = cooked.range;
+		light.attached_to_node = cooked.attached_to_node != 0;
+		if (light.attached_to_node && light.node_index >= nodes.size())
+			throw logic_error("Cooked light node is out of range.");
+	}
+
+	auto *cooked_environments = reader.get<CookedEnvironment>(header.environments);
+	environments.resize(header.environments.count);
+	for (size_t i = 0; i < environments.size(); i++)
+	{
+		auto &cooked = cooked_environments[i];
+		auto &env = environments[i];
+		env.cube = reader.get_texture(path, cooked.cube);
+		env.reflection = reader.get_texture(path, cooked.reflection);
+		env.irradiance = reader.get_texture(path, cooked.irradiance);
+		env.fog.color = cooked.fog_color;
+		env.fog.falloff = cooked.fog_falloff;
+		env.intensity = cooked.intensity;
+	}
+
+	scene_nodes.name = reader.get_string(header.scene_name);
+	scene_nodes.node_indices = reader.get_vector<uint32_t>(header.scene_node_indices);
+	validate_indices(scene_nodes.node_indices, nodes.size());
+}
+
+Mesh CookedScene::get_mesh(uint32_t index) const
+{
+	assert(index < mesh_count);
+	CookedReader reader = { mapped, size };
+	auto &cooked = reader.get<CookedMesh>({ mesh_offset, mesh_count })[index];
+
+	// The streams are already in the layout they are uploaded in, so this is just a copy.
+	Mesh mesh;
+	auto *positions = reader.get<uint8_t>(cooked.positions);
+	auto *attributes = reader.get<uint8_t>(cooked.attributes);
+	auto *indices = reader.get<uint8_t>(cooked.indices);
+	mesh.positions.assign(positions, positions + cooked.positions.count);
+	mesh.attributes.assign(attributes, attributes + cooked.attributes.count);
+	mesh.indices.assign(indices, indices + cooked.indices.count);
+
+	mesh.position_stride = cooked.position_stride;
+	mesh.attribute_stride = cooked.attribute_stride;
+	memcpy(mesh.attribute_layout, cooked.attribute_layout, sizeof(mesh.attribute_layout));
+	mesh.index_type = cooked.index_type;
+	mesh.topology = cooked.topology;
+	mesh.material_index = cooked.material_index;
+	mesh.has_material = cooked.has_material != 0;
+	mesh.primitive_restart = cooked.primitive_restart != 0;
+	mesh.static_aabb = AABB(cooked.aabb_min, cooked.aabb_max);
+	mesh.count = cooked.count;
+	return mesh;
+}
+}
+}
@@ -0,0 +1,118 @@
+/* Copyright (c) 2017-2018 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#pragma once
+
+#include "scene_formats.hpp"
+#include "filesystem.hpp"
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace Granite
+{
+namespace SceneFormats
+{
+// A cooked scene is a single memory mappable file holding one scene.
+// Vertex and index streams are stored in the layout they are uploaded to the GPU in,
+// and everything else is stored as flat tables of plain structs.
+// Variable length data is referenced by a byte offset from the start of the file and an element count.
+// Texture paths are relative to the cooked file, like URIs in glTF.
+bool export_cooked_scene(const std::string &path, const SceneInformation &scene,
+                         const std::vector<EnvironmentInfo> &environments);
+
+class CookedScene
+{
+public:
+	// Maps and validates the file. Tables other than vertex and index streams are copied out here,
+	// the streams stay in the mapping until get_mesh() is called.
+	explicit CookedScene(const std::string &path);
+
+	uint32_t get_mesh_count() const
+	{
+		return mesh_count;
+	}
+
+	// Copies the streams of a mesh out of the mapping. Safe to call from multiple threads.
+	// Everything was validated on construction, so this does not throw.
+	Mesh get_mesh(uint32_t index) const;
+
+	const std::vector<MaterialInfo> &get_materials() const
+	{
+		return materials;
+	}
+
+	const std::vector<Node> &get_nodes() const
+	{
+		return nodes;
+	}
+
+	const std::vector<Skin> &get_skins() const
+	{
+		return skins;
+	}
+
+	const std::vector<Animation> &get_animations() const
+	{
+		return animations;
+	}
+
+	const std::vector<CameraInfo> &get_cameras() const
+	{
+		return cameras;
+	}
+
+	const std::vector<LightInfo> &get_lights() const
+	{
+		return lights;
+	}
+
+	const std::vector<EnvironmentInfo> &get_environments() const
+	{
+		return environments;
+	}
+
+	const SceneNodes &get_scene_nodes() const
+	{
+		return scene_nodes;
+	}
+
+private:
+	std::unique_ptr<File> file;
+	const uint8_t *mapped = nullptr;
+	size_t size = 0;
+
+	uint64_t mesh_offset = 0;
+	uint32_t mesh_count = 0;
+
+	std::vector<MaterialInfo> materials;
+	std::vector<Node> nodes;
+	std::vector<Skin> skins;
+	std::vector<Animation> animations;
+	std::vector<CameraInfo> cameras;
+	std::vector<LightInfo> lights;
+	std::vector<EnvironmentInfo> environments;
+	SceneNodes scene_nodes;
+};
+}
+}
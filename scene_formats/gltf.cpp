@@ -24,10 +24,17 @@
 #include "vulkan.hpp"
 #include "filesystem.hpp"
 #include "mesh.hpp"
+#include "thread_group.hpp"
+#include "global_managers.hpp"
+#include "timer.hpp"
 #include <unordered_map>
 #include <algorithm>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
 #include "rapidjson_wrapper.hpp"
 #include "muglm/matrix_helper.hpp"
+#include "meshoptimizer.h"
 
 using namespace std;
 using namespace rapidjson;
@@ -37,6 +44,16 @@ using namespace Util;
 namespace GLTF
 {
 
+Parser::Buffer::Buffer(vector<uint8_t> owned_)
+	: owned(move(owned_)), ptr(owned.data()), length(owned.size())
+{
+}
+
+Parser::Buffer::Buffer(unique_ptr<File> file_, const uint8_t *data, size_t size)
+	: file(move(file_)), ptr(data), length(size)
+{
+}
+
 Parser::Buffer Parser::read_buffer(const string &path, uint64_t length)
 {
 	auto file = Global::filesystem()->open(path);
@@ -50,14 +67,62 @@ Parser::Buffer Parser::read_buffer(const string &path, uint64_t length)
 	if (!mapped)
 		throw runtime_error("Failed to map file.");
 
-	Buffer buf(length);
-	memcpy(buf.data(), mapped, length);
-	return buf;
+	// Keep the file mapped rather than copying it, accessors read straight from the mapping.
+	return Buffer(move(file), static_cast<const uint8_t *>(mapped), length);
+}
+
+void Parser::decode_meshopt_views(const vector<MeshoptView> &views)
+{
+	vector<vector<uint8_t>> decoded(views.size());
+	vector<exception_ptr> errors(views.size());
+
+	auto task = Global::thread_group()->create_task();
+	for (size_t i = 0; i < views.size(); i++)
+	{
+		task->enqueue_task([&, i]() {
+			try
+			{
+				auto &view = views[i];
+				const uint8_t *src = json_buffers[view.buffer_index].data() + view.offset;
+				decoded[i].resize(size_t(view.count) * view.stride);
+
+				int ret;
+				if (view.triangles)
+				{
+					if ((view.stride != 2 && view.stride != 4) || (view.count % 3) != 0)
+						throw logic_error("Invalid meshopt compressed index buffer.");
+					ret = meshopt_decodeIndexBuffer(decoded[i].data(), view.count, view.stride, src, view.length);
+				}
+				else
+				{
+					if (view.stride == 0 || (view.stride & 3) != 0 || view.stride > 256)
+						throw logic_error("Invalid meshopt compressed vertex buffer.");
+					ret = meshopt_decodeVertexBuffer(decoded[i].data(), view.count, view.stride, src, view.length);
+				}
+
+				if (ret != 0)
+					throw logic_error("Failed to decode meshopt compressed buffer view.");
+			}
+			catch (...)
+			{
+				errors[i] = current_exception();
+			}
+		});
+	}
+	task->flush();
+	task->wait();
+
+	for (auto &error : errors)
+		if (error)
+			rethrow_exception(error);
+
+	for (auto &buffer : decoded)
+		json_buffers.emplace_back(move(buffer));
 }
 
 Parser::Buffer Parser::read_base64(const char *data, uint64_t length)
 {
-	Buffer buf(length);
+	vector<uint8_t> buf(length);
 	auto *ptr = buf.data();
 
 	const auto base64_index = [](char c) -> uint32_t {
@@ -118,74 +183,86 @@ Parser::Buffer Parser::read_base64(const char *data, uint64_t length)
 		i += outbytes;
 	}
 
-	return buf;
+	return Buffer(move(buf));
 }
 
-Parser::Parser(const std::string &path)
+Parser::Parser(const std::string &path, const MeshCallback &on_mesh)
 {
-	string json;
+	Timer timer;
+	timer.start();
 
-	{
-		auto file = Global::filesystem()->open(path, FileMode::ReadOnly);
-		if (!file)
-			throw runtime_error("Failed to load GLTF file.");
+	// Parsed in situ, so this is the only copy of the JSON, and strings in the document point into it.
+	vector<char> json;
 
-		auto size = file->get_size();
-		void *mapped = file->map();
-		if (!mapped)
-			throw runtime_error("Failed to map GLTF file.");
-
-		bool is_glb = false;
+	auto file = Global::filesystem()->open(path, FileMode::ReadOnly);
+	if (!file)
+		throw runtime_error("Failed to load GLTF file.");
 
-		if (size >= 12 && memcmp("glTF", mapped, 4) == 0)
-			is_glb = true;
+	auto size = file->get_size();
+	void *mapped = file->map();
+	if (!mapped)
+		throw runtime_error("Failed to map GLTF file.");
 
-		if (is_glb)
-		{
-			// GLB is little endian. Just parse it lazily.
-			auto *words = static_cast<const uint32_t *>(mapped);
-			if (words[1] != 2)
-				throw runtime_error("GLB version is not 2.");
-			if (words[2] > size)
-				throw runtime_error("GLB length is larger than the file size.");
+	bool is_glb = false;
 
-			auto glb_size = words[2];
-			words += 3;
+	if (size >= 12 && memcmp("glTF", mapped, 4) == 0)
+		is_glb = true;
 
-			auto json_length = words[0];
-			if (memcmp(&words[1], "JSON", 4) != 0)
-				throw runtime_error("Could not find JSON chunk.");
+	if (is_glb)
+	{
+		// GLB is little endian. Just parse it lazily.
+		auto *words = static_cast<const uint32_t *>(mapped);
+		if (words[1] != 2)
+			throw runtime_error("GLB version is not 2.");
+		if (words[2] > size)
+			throw runtime_error("GLB length is larger than the file size.");
+
+		auto glb_size = words[2];
+		words += 3;
+
+		auto json_length = words[0];
+		if (memcmp(&words[1], "JSON", 4) != 0)
+			throw runtime_error("Could not find JSON chunk.");
+		words += 2;
+
+		if (json_length + 12 > glb_size)
+			throw logic_error("Header error, JSON chunk lengths out of range.");
+
+		json.reserve(json_length + 1);
+		json.insert(json.end(), reinterpret_cast<const char *>(words),
+		            reinterpret_cast<const char *>(words) + json_length);
+		words += (json_length + 3) >> 2;
+
+		// If there is another chunk, it's BIN chunk.
+		if (json_length + 12 + 8 < glb_size)
+		{
+			auto binary_length = words[0];
+			if (memcmp(&words[1], "BIN\0", 4) != 0)
+				throw runtime_error("Could not find BIN chunk.");
 			words += 2;
 
-			if (json_length + 12 > glb_size)
-				throw logic_error("Header error, JSON chunk lengths out of range.");
-
-			json = string(reinterpret_cast<const char *>(words),
-			              reinterpret_cast<const char *>(words) + json_length);
-			words += (json_length + 3) >> 2;
+			if (((binary_length + 3) & ~3) + ((json_length + 3) & ~3) + (2 * 2 + 3) * sizeof(uint32_t) != glb_size)
+				throw logic_error(
+						"Header error, binary chunk and JSON chunk lengths do not match up with GLB size.");
 
-			// If there is another chunk, it's BIN chunk.
-			if (json_length + 12 + 8 < glb_size)
-			{
-				auto binary_length = words[0];
-				if (memcmp(&words[1], "BIN\0", 4) != 0)
-					throw runtime_error("Could not find BIN chunk.");
-				words += 2;
-
-				if (((binary_length + 3) & ~3) + ((json_length + 3) & ~3) + (2 * 2 + 3) * sizeof(uint32_t) != glb_size)
-					throw logic_error(
-							"Header error, binary chunk and JSON chunk lengths do not match up with GLB size.");
-
-				// The first buffer in the JSON must be this embedded buffer.
-				Buffer buffer(reinterpret_cast<const uint8_t *>(words),
-				              reinterpret_cast<const uint8_t *>(words) + binary_length);
-				json_buffers.push_back(move(buffer));
-			}
+			// The first buffer in the JSON must be this embedded buffer.
+			// It keeps the GLB mapped, so the binary chunk is never copied.
+			json_buffers.emplace_back(move(file), reinterpret_cast<const uint8_t *>(words), binary_length);
 		}
-		else
-			json = string(static_cast<const char *>(mapped), static_cast<const char *>(mapped) + size);
 	}
-	parse(path, json);
+	else
+	{
+		json.reserve(size + 1);
+		json.insert(json.end(), static_cast<const char *>(mapped), static_cast<const char *>(mapped) + size);
+	}
+
+	file.reset();
+	json.push_back('\0');
+	timings.read = timer.end();
+
+	timer.start();
+	parse(path, json.data(), on_mesh);
+	timings.parse = timer.end() - timings.meshes;
 }
 
 #define GL_BYTE                           0x1400
@@ -534,6 +611,36 @@ static VkPrimitiveTopology gltf_topology(const char *top)
 		throw logic_error("Unrecognized primitive mode.");
 }
 
+Parser::AccessorView Parser::get_accessor_view(uint32_t index) const
+{
+	return make_accessor_view(json_accessors[index]);
+}
+
+Parser::AccessorView Parser::make_accessor_view(const Accessor &accessor) const
+{
+	auto &view = json_views[accessor.view];
+	auto &buffer = json_buffers[view.buffer_index];
+	return { buffer.data() + view.offset + accessor.offset, accessor.count, accessor.stride,
+	         accessor.type, accessor.components };
+}
+
+// Appends all elements of a float accessor, with a single memcpy if the accessor is tightly packed.
+template <typename T>
+static void append_float_elements(vector<T> &attributes, const Parser::AccessorView &view)
+{
+	size_t element_size = view.components * sizeof(float);
+	size_t base = attributes.size();
+	attributes.resize(base + view.count);
+
+	if (element_size == sizeof(T) && view.is_tightly_packed(sizeof(T)))
+		memcpy(static_cast<void *>(attributes.data() + base), view.data, view.count * sizeof(T));
+	else
+	{
+		for (uint32_t i = 0; i < view.count; i++)
+			memcpy(static_cast<void *>(&attributes[base + i]), view.get<float>(i), element_size);
+	}
+}
+
 void Parser::extract_attribute(std::vector<float> &attributes, const Accessor &accessor)
 {
 	if (accessor.type != ScalarType::Float32)
@@ -541,14 +648,7 @@ void Parser::extract_attribute(std::vector<float> &attributes, const Accessor &a
 	if (accessor.components != 1)
 		throw logic_error("Attribute is not single component.");
 
-	auto &view = json_views[accessor.view];
-	auto &buffer = json_buffers[view.buffer_index];
-	for (uint32_t i = 0; i < accessor.count; i++)
-	{
-		uint32_t offset = view.offset + accessor.offset + i * accessor.stride;
-		const auto *data = reinterpret_cast<const float *>(&buffer[offset]);
-		attributes.push_back(*data);
-	}
+	append_float_elements(attributes, make_accessor_view(accessor));
 }
 
 void Parser::extract_attribute(std::vector<vec3> &attributes, const Accessor &accessor)
@@ -558,14 +658,7 @@ void Parser::extract_attribute(std::vector<vec3> &attributes, const Accessor &ac
 	if (accessor.components != 3)
 		throw logic_error("Attribute is not single component.");
 
-	auto &view = json_views[accessor.view];
-	auto &buffer = json_buffers[view.buffer_index];
-	for (uint32_t i = 0; i < accessor.count; i++)
-	{
-		uint32_t offset = view.offset + accessor.offset + i * accessor.stride;
-		const auto *data = reinterpret_cast<const float *>(&buffer[offset]);
-		attributes.push_back(vec3(data[0], data[1], data[2]));
-	}
+	append_float_elements(attributes, make_accessor_view(accessor));
 }
 
 void Parser::extract_attribute(std::vector<quat> &attributes, const Accessor &accessor)
@@ -575,12 +668,11 @@ void Parser::extract_attribute(std::vector<quat> &attributes, const Accessor &ac
 	if (accessor.components != 4)
 		throw logic_error("Attribute is not single component.");
 
-	auto &view = json_views[accessor.view];
-	auto &buffer = json_buffers[view.buffer_index];
-	for (uint32_t i = 0; i < accessor.count; i++)
+	auto view = make_accessor_view(accessor);
+	attributes.reserve(attributes.size() + view.count);
+	for (uint32_t i = 0; i < view.count; i++)
 	{
-		uint32_t offset = view.offset + accessor.offset + i * accessor.stride;
-		const auto *data = reinterpret_cast<const float *>(&buffer[offset]);
+		const auto *data = view.get<float>(i);
 		attributes.push_back(normalize(quat(data[3], data[0], data[1], data[2])));
 	}
 }
@@ -592,18 +684,8 @@ void Parser::extract_attribute(std::vector<mat4> &attributes, const Accessor &ac
 	if (accessor.components != 16)
 		throw logic_error("Attribute is not single component.");
 
-	auto &view = json_views[accessor.view];
-	auto &buffer = json_buffers[view.buffer_index];
-	for (uint32_t i = 0; i < accessor.count; i++)
-	{
-		uint32_t offset = view.offset + accessor.offset + i * accessor.stride;
-		const auto *data = reinterpret_cast<const float *>(&buffer[offset]);
-		attributes.push_back(mat4(
-			vec4(data[0], data[1], data[2], data[3]),
-			vec4(data[4], data[5], data[6], data[7]),
-			vec4(data[8], data[9], data[10], data[11]),
-			vec4(data[12], data[13], data[14], data[15])));
-	}
+	// Column-major in both glTF and mat4.
+	append_float_elements(attributes, make_accessor_view(accessor));
 }
 
 static void build_bone_hierarchy(Skin::Bone &bone, const vector<vector<uint32_t>> &hierarchy, uint32_t index)
@@ -617,10 +699,10 @@ static void build_bone_hierarchy(Skin::Bone &bone, const vector<vector<uint32_t>
 	}
 }
 
-void Parser::parse(const string &original_path, const string &json)
+void Parser::parse(const string &original_path, char *json, const MeshCallback &on_mesh)
 {
 	Document doc;
-	doc.Parse(json);
+	doc.ParseInsitu(json);
 
 	if (doc.HasParseError())
 		throw logic_error("Parser error found.");
@@ -634,6 +716,10 @@ void Parser::parse(const string &original_path, const string &json)
 
 		if (!uri)
 		{
+			// Fallback for EXT_meshopt_compression, views into it are decoded from other buffers.
+			if (buf.HasMember("extensions") && buf["extensions"].HasMember("EXT_meshopt_compression"))
+				json_buffers.emplace_back();
+
 			//if (length != json_buffers.front().size())
 			//	throw logic_error("Baked GLB buffer size must match the provided size in the header.");
 			return;
@@ -651,13 +737,51 @@ void Parser::parse(const string &original_path, const string &json)
 		}
 	};
 
+	vector<MeshoptView> meshopt_views;
+	const auto add_meshopt_view = [&](const Value &meshopt, uint32_t length, uint32_t stride) {
+		MeshoptView view = {};
+		view.buffer_index = meshopt["buffer"].GetUint();
+		view.offset = meshopt.HasMember("byteOffset") ? meshopt["byteOffset"].GetUint() : 0u;
+		view.length = meshopt["byteLength"].GetUint();
+		view.stride = meshopt["byteStride"].GetUint();
+		view.count = meshopt["count"].GetUint();
+
+		auto *mode = meshopt["mode"].GetString();
+		if (strcmp(mode, "TRIANGLES") == 0)
+			view.triangles = true;
+		else if (strcmp(mode, "ATTRIBUTES") != 0)
+			throw logic_error("Unsupported meshopt compression mode.");
+
+		if (meshopt.HasMember("filter") && strcmp(meshopt["filter"].GetString(), "NONE") != 0)
+			throw logic_error("Unsupported meshopt compression filter.");
+
+		if (view.buffer_index >= json_buffers.size() ||
+		    uint64_t(view.offset) + view.length > json_buffers[view.buffer_index].size())
+			throw logic_error("Buffer view is out of range.");
+
+		if (uint64_t(view.count) * view.stride != length)
+			throw logic_error("Size mismatch of meshopt compressed buffer view.");
+
+		// Decoded buffers are appended after all buffers declared in the file.
+		uint32_t buffer_index = uint32_t(json_buffers.size() + meshopt_views.size());
+		meshopt_views.push_back(view);
+		json_views.push_back({buffer_index, 0, length, stride});
+	};
+
 	const auto add_view = [&](const Value &view) {
 		auto &buf = view["buffer"];
 		auto buffer_index = buf.GetUint();
 		auto offset = view.HasMember("byteOffset") ? view["byteOffset"].GetUint() : 0u;
 		auto length = view["byteLength"].GetUint();
 
-		if (offset + length > json_buffers[buffer_index].size())
+		if (view.HasMember("extensions") && view["extensions"].HasMember("EXT_meshopt_compression"))
+		{
+			auto stride = view.HasMember("byteStride") ? view["byteStride"].GetUint() : 0u;
+			add_meshopt_view(view["extensions"]["EXT_meshopt_compression"], length, stride);
+			return;
+		}
+
+		if (buffer_index >= json_buffers.size() || uint64_t(offset) + length > json_buffers[buffer_index].size())
 			throw logic_error("Buffer view is out of range.");
 
 		auto stride = view.HasMember("byteStride") ? view["byteStride"].GetUint() : 0u;
@@ -684,8 +808,17 @@ void Parser::parse(const string &original_path, const string &json)
 		acc.offset = offset;
 		acc.count = count;
 
-		if (json_views[view_index].stride)
-			acc.stride = json_views[view_index].stride;
+		if (view_index >= json_views.size())
+			throw logic_error("Buffer view index is out of range.");
+
+		auto element_size = acc.stride;
+		auto &buffer_view = json_views[view_index];
+		if (buffer_view.stride)
+			acc.stride = buffer_view.stride;
+
+		// Validate once here, so accessor views can be read without any range checking.
+		if (count && uint64_t(offset) + uint64_t(count - 1) * acc.stride + element_size > buffer_view.length)
+			throw logic_error("Accessor is out of range.");
 
 		auto *minimums = acc.min;
 		if (accessor.HasMember("min"))
@@ -1401,6 +1534,8 @@ void Parser::parse(const string &original_path, const string &json)
 		iterate_elements(doc["buffers"], add_buffer);
 	if (doc.HasMember("bufferViews"))
 		iterate_elements(doc["bufferViews"], add_view);
+	if (!meshopt_views.empty())
+		decode_meshopt_views(meshopt_views);
 	if (doc.HasMember("images"))
 		iterate_elements(doc["images"], add_image);
 	if (doc.HasMember("samplers"))
@@ -1421,7 +1556,11 @@ void Parser::parse(const string &original_path, const string &json)
 			iterate_elements(extra["environments"], add_environment);
 	}
 
-	build_meshes();
+	Timer mesh_timer;
+	mesh_timer.start();
+	build_meshes(on_mesh);
+	timings.meshes = mesh_timer.end();
+
 	if (doc.HasMember("nodes"))
 		iterate_elements(doc["nodes"], add_node);
 
@@ -1588,7 +1727,7 @@ static uint32_t padded_type_size(uint32_t type_size)
 		return type_size;
 }
 
-void Parser::build_primitive(const MeshData::AttributeData &prim)
+Mesh Parser::build_primitive(const MeshData::AttributeData &prim) const
 {
 	Mesh mesh;
 	mesh.topology = prim.topology;
@@ -1689,16 +1828,14 @@ void Parser::build_primitive(const MeshData::AttributeData &prim)
 		auto output_stride = (i == ecast(MeshAttribute::Position)) ? mesh.position_stride : mesh.attribute_stride;
 
 		auto &attr = json_accessors[prim.attributes[i].accessor_index];
-		auto &view = json_views[attr.view];
-		auto &buffer = json_buffers[view.buffer_index];
+		auto view = make_accessor_view(attr);
 		auto type_size = type_stride(attr.type) * attr.components;
 
 		if (i == ecast(MeshAttribute::BoneIndex))
 		{
 			for (uint32_t v = 0; v < vertex_count; v++)
 			{
-				uint32_t offset = view.offset + attr.offset + v * attr.stride;
-				const auto *data = &buffer[offset];
+				const auto *data = view.get<uint8_t>(v);
 
 				uint8_t indices[4] = {};
 				if (attr.type == ScalarType::Float32)
@@ -1732,8 +1869,7 @@ void Parser::build_primitive(const MeshData::AttributeData &prim)
 			// Need to rescale bone weights. Some meshes don't do this.
 			for (uint32_t v = 0; v < vertex_count; v++)
 			{
-				uint32_t offset = view.offset + attr.offset + v * attr.stride;
-				const auto *data = &buffer[offset];
+				const auto *data = view.get<uint8_t>(v);
 
 				uint16_t weights[4] = {};
 				if (attr.type == ScalarType::Float32)
@@ -1771,11 +1907,13 @@ void Parser::build_primitive(const MeshData::AttributeData &prim)
 		}
 		else
 		{
-			for (uint32_t v = 0; v < vertex_count; v++)
+			auto *dst = &output[mesh.attribute_layout[i].offset];
+			if (output_stride == type_size && view.is_tightly_packed(type_size))
+				memcpy(dst, view.data, size_t(vertex_count) * type_size);
+			else
 			{
-				uint32_t offset = view.offset + attr.offset + v * attr.stride;
-				const auto *data = &buffer[offset];
-				memcpy(&output[mesh.attribute_layout[i].offset + output_stride * v], data, type_size);
+				for (uint32_t v = 0; v < vertex_count; v++)
+					memcpy(dst + size_t(output_stride) * v, view.get<uint8_t>(v), type_size);
 			}
 		}
 	}
@@ -1783,56 +1921,55 @@ void Parser::build_primitive(const MeshData::AttributeData &prim)
 	if (prim.index_buffer.active)
 	{
 		auto &indices = json_accessors[prim.index_buffer.accessor_index];
-		auto &view = json_views[indices.view];
-		auto &buffer = json_buffers[view.buffer_index];
+		auto view = make_accessor_view(indices);
 
 		auto type_size = type_stride(indices.type);
 		bool u16_compat = (indices.max[0].u32 < 0xffff) && (indices.max[0].u32 > indices.min[0].u32);
 		auto index_count = indices.count;
-		auto offset = view.offset + indices.offset;
 
 		if (type_size == 1)
 		{
 			mesh.indices.resize(sizeof(uint16_t) * index_count);
 			mesh.index_type = VK_INDEX_TYPE_UINT16;
+			auto *outdata = reinterpret_cast<uint16_t *>(mesh.indices.data());
 			for (uint32_t i = 0; i < index_count; i++)
 			{
-				const uint8_t *indata = &buffer[indices.stride * i + offset];
-				uint16_t *outdata = reinterpret_cast<uint16_t *>(mesh.indices.data()) + i;
-				*outdata = uint16_t((*indata == 0xff) ? 0xffff : *indata);
+				uint8_t index = *view.get<uint8_t>(i);
+				outdata[i] = uint16_t(index == 0xff ? 0xffff : index);
 			}
 		}
 		else if (type_size == 2)
 		{
 			mesh.indices.resize(sizeof(uint16_t) * index_count);
 			mesh.index_type = VK_INDEX_TYPE_UINT16;
-			for (uint32_t i = 0; i < index_count; i++)
+			auto *outdata = reinterpret_cast<uint16_t *>(mesh.indices.data());
+			if (view.is_tightly_packed(sizeof(uint16_t)))
+				memcpy(outdata, view.data, sizeof(uint16_t) * index_count);
+			else
 			{
-				const uint16_t *indata = reinterpret_cast<const uint16_t *>(&buffer[indices.stride * i + offset]);
-				uint16_t *outdata = reinterpret_cast<uint16_t *>(mesh.indices.data()) + i;
-				*outdata = *indata;
+				for (uint32_t i = 0; i < index_count; i++)
+					outdata[i] = *view.get<uint16_t>(i);
 			}
 		}
 		else if (u16_compat)
 		{
 			mesh.indices.resize(sizeof(uint16_t) * index_count);
 			mesh.index_type = VK_INDEX_TYPE_UINT16;
+			auto *outdata = reinterpret_cast<uint16_t *>(mesh.indices.data());
 			for (uint32_t i = 0; i < index_count; i++)
-			{
-				const uint32_t *indata = reinterpret_cast<const uint32_t *>(&buffer[indices.stride * i + offset]);
-				uint16_t *outdata = reinterpret_cast<uint16_t *>(mesh.indices.data()) + i;
-				*outdata = uint16_t(*indata);
-			}
+				outdata[i] = uint16_t(*view.get<uint32_t>(i));
 		}
 		else
 		{
 			mesh.indices.resize(sizeof(uint32_t) * index_count);
 			mesh.index_type = VK_INDEX_TYPE_UINT32;
-			for (uint32_t i = 0; i < index_count; i++)
+			auto *outdata = reinterpret_cast<uint32_t *>(mesh.indices.data());
+			if (view.is_tightly_packed(sizeof(uint32_t)))
+				memcpy(outdata, view.data, sizeof(uint32_t) * index_count);
+			else
 			{
-				const uint32_t *indata = reinterpret_cast<const uint32_t *>(&buffer[indices.stride * i + offset]);
-				uint32_t *outdata = reinterpret_cast<uint32_t *>(mesh.indices.data()) + i;
-				*outdata = *indata;
+				for (uint32_t i = 0; i < index_count; i++)
+					outdata[i] = *view.get<uint32_t>(i);
 			}
 		}
 		mesh.count = index_count;
@@ -1843,25 +1980,91 @@ void Parser::build_primitive(const MeshData::AttributeData &prim)
 	if (rebuild_tangents)
 		mesh_recompute_tangents(mesh);
 
-	meshes.push_back(move(mesh));
+	return mesh;
 }
 
-void Parser::build_meshes()
+void Parser::build_meshes(const MeshCallback &on_mesh)
 {
 	mesh_index_to_primitives.resize(json_meshes.size());
-	uint32_t primitive_count = 0;
-	uint32_t mesh_count = 0;
+	vector<const MeshData::AttributeData *> primitives;
 
-	for (auto &mesh : json_meshes)
+	for (uint32_t mesh_index = 0; mesh_index < json_meshes.size(); mesh_index++)
 	{
-		for (auto &prim : mesh.primitives)
+		for (auto &prim : json_meshes[mesh_index].primitives)
 		{
-			mesh_index_to_primitives[mesh_count].push_back(primitive_count);
-			build_primitive(prim);
-			primitive_count++;
+			mesh_index_to_primitives[mesh_index].push_back(uint32_t(primitives.size()));
+			primitives.push_back(&prim);
 		}
-		mesh_count++;
 	}
+
+	meshes.resize(primitives.size());
+	if (primitives.empty())
+		return;
+
+	// Primitives are independent, so build them in parallel, normals and tangents included.
+	// Finished primitives are handed back to this thread, so the callback can consume them
+	// (e.g. start uploading them) while the remaining primitives are still being built.
+	vector<exception_ptr> errors(primitives.size());
+	vector<uint32_t> completed;
+	completed.reserve(primitives.size());
+	mutex lock;
+	condition_variable cond;
+
+	auto task = Global::thread_group()->create_task();
+	for (uint32_t i = 0; i < primitives.size(); i++)
+	{
+		task->enqueue_task([&, i]() {
+			try
+			{
+				meshes[i] = build_primitive(*primitives[i]);
+			}
+			catch (...)
+			{
+				errors[i] = current_exception();
+			}
+
+			lock_guard<mutex> holder{lock};
+			completed.push_back(i);
+			cond.notify_one();
+		});
+	}
+	task->flush();
+
+	// Workers reference this object, so drain everything before throwing.
+	exception_ptr error;
+	for (size_t consumed = 0; consumed < primitives.size(); consumed++)
+	{
+		uint32_t index;
+		{
+			unique_lock<mutex> holder{lock};
+			cond.wait(holder, [&]() {
+				return !completed.empty();
+			});
+			index = completed.back();
+			completed.pop_back();
+		}
+
+		if (error)
+			continue;
+
+		if (errors[index])
+			error = errors[index];
+		else if (on_mesh)
+		{
+			try
+			{
+				on_mesh(*this, index, meshes[index]);
+			}
+			catch (...)
+			{
+				error = current_exception();
+			}
+		}
+	}
+
+	task->wait();
+	if (error)
+		rethrow_exception(error);
 }
 
 }
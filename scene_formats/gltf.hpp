@@ -24,8 +24,11 @@
 
 #include <string>
 #include <vector>
+#include <memory>
+#include <functional>
 #include "math.hpp"
 #include "scene_formats.hpp"
+#include "filesystem.hpp"
 
 namespace GLTF
 {
@@ -55,7 +58,27 @@ enum class ScalarType
 class Parser
 {
 public:
-	explicit Parser(const std::string &path);
+	// Called on the thread constructing the parser as soon as a primitive has been built,
+	// while the remaining primitives are still being built on the thread group.
+	// The callback may move the mesh out of the parser.
+	using MeshCallback = std::function<void (const Parser &parser, uint32_t index, Mesh &mesh)>;
+
+	explicit Parser(const std::string &path, const MeshCallback &on_mesh = {});
+
+	struct LoadTimings
+	{
+		// Reading the file and copying out the JSON.
+		double read = 0.0;
+		// Parsing the JSON document, excluding primitives.
+		double parse = 0.0;
+		// Building primitives, including time spent in the mesh callback.
+		double meshes = 0.0;
+	};
+
+	const LoadTimings &get_load_timings() const
+	{
+		return timings;
+	}
 
 	const std::vector<SceneNodes> &get_scenes() const
 	{
@@ -107,8 +130,65 @@ public:
 		return json_environments;
 	}
 
+	// Non-owning view of an accessor. For GLB and external .bin buffers this points straight
+	// into the mapped file, which stays mapped for the lifetime of the parser.
+	struct AccessorView
+	{
+		const uint8_t *data;
+		uint32_t count;
+		uint32_t stride;
+		ScalarType type;
+		uint32_t components;
+
+		template <typename T>
+		const T *get(uint32_t index) const
+		{
+			return reinterpret_cast<const T *>(data + size_t(index) * stride);
+		}
+
+		bool is_tightly_packed(uint32_t element_size) const
+		{
+			return stride == element_size;
+		}
+	};
+
+	uint32_t get_accessor_count() const
+	{
+		return uint32_t(json_accessors.size());
+	}
+
+	AccessorView get_accessor_view(uint32_t index) const;
+
 private:
-	using Buffer = std::vector<uint8_t>;
+	// Either a range of a mapped file, or owned storage for data which had to be decoded, like base64 URIs.
+	class Buffer
+	{
+	public:
+		Buffer() = default;
+		explicit Buffer(std::vector<uint8_t> owned);
+		Buffer(std::unique_ptr<Granite::File> file, const uint8_t *data, size_t size);
+
+		const uint8_t *data() const
+		{
+			return ptr;
+		}
+
+		size_t size() const
+		{
+			return length;
+		}
+
+		const uint8_t &operator[](size_t index) const
+		{
+			return ptr[index];
+		}
+
+	private:
+		std::unique_ptr<Granite::File> file;
+		std::vector<uint8_t> owned;
+		const uint8_t *ptr = nullptr;
+		size_t length = 0;
+	};
 
 	struct BufferView
 	{
@@ -118,6 +198,17 @@ private:
 		uint32_t stride;
 	};
 
+	// Source of a view compressed with EXT_meshopt_compression.
+	struct MeshoptView
+	{
+		uint32_t buffer_index;
+		uint32_t offset;
+		uint32_t length;
+		uint32_t stride;
+		uint32_t count;
+		bool triangles;
+	};
+
 	struct Accessor
 	{
 		uint32_t view;
@@ -162,12 +253,14 @@ private:
 		VkComponentMapping swizzle;
 	};
 
-	void parse(const std::string &path, const std::string &json);
+	void parse(const std::string &path, char *json, const MeshCallback &on_mesh);
+	LoadTimings timings;
 	std::vector<Mesh> meshes;
 	std::vector<MaterialInfo> materials;
 	static VkFormat components_to_padded_format(ScalarType type, uint32_t components);
 	static Buffer read_buffer(const std::string &path, uint64_t length);
 	static Buffer read_base64(const char *data, uint64_t length);
+	void decode_meshopt_views(const std::vector<MeshoptView> &views);
 	static uint32_t type_stride(ScalarType type);
 	static void resolve_component_type(uint32_t component_type, const char *type, bool normalized,
 	                                   ScalarType &scalar_type, uint32_t &components, uint32_t &stride);
@@ -193,9 +286,10 @@ private:
 	std::vector<SceneNodes> json_scenes;
 	uint32_t default_scene_index = 0;
 
-	void build_meshes();
-	void build_primitive(const MeshData::AttributeData &prim);
+	void build_meshes(const MeshCallback &on_mesh);
+	Mesh build_primitive(const MeshData::AttributeData &prim) const;
 
+	AccessorView make_accessor_view(const Accessor &accessor) const;
 	void extract_attribute(std::vector<float> &attributes, const Accessor &accessor);
 	void extract_attribute(std::vector<vec3> &attributes, const Accessor &accessor);
 	void extract_attribute(std::vector<quat> &attributes, const Accessor &accessor);
@@ -31,6 +31,7 @@
 #include "texture_utils.hpp"
 #include "texture_format.hpp"
 #include "stb_image_write.h"
+#include "meshoptimizer.h"
 
 using namespace std;
 using namespace rapidjson;
@@ -48,10 +49,49 @@ struct Remap
 	vector<const T *> info;
 };
 
+enum class MeshoptMode
+{
+	None,
+	Attributes,
+	Triangles
+};
+
 struct BufferView
 {
 	size_t offset;
 	size_t length;
+
+	// With EXT_meshopt_compression, the view holds encoded data,
+	// and decodes to count * stride bytes at fallback_offset in the fallback buffer.
+	MeshoptMode meshopt_mode;
+	size_t fallback_offset;
+	uint32_t meshopt_stride;
+	uint32_t meshopt_count;
+};
+
+struct ProcessedStream
+{
+	vector<uint8_t> data;
+	VkFormat format = VK_FORMAT_UNDEFINED;
+	uint32_t count = 0;
+	uint32_t stride = 0;
+	MeshoptMode meshopt_mode = MeshoptMode::None;
+};
+
+// Final streams of a mesh, optimized, quantized and encoded as requested.
+// Meshes are processed in parallel, then emitted serially.
+struct ProcessedMesh
+{
+	ProcessedStream indices;
+	uint32_t min_index = 0;
+	uint32_t max_index = 0;
+	ProcessedStream attributes[ecast(MeshAttribute::Count)];
+
+	AABB static_aabb;
+	VkPrimitiveTopology topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+	bool primitive_restart = false;
+	bool has_material = false;
+	unsigned material_index = 0;
 };
 
 struct EmittedMesh
@@ -192,6 +232,8 @@ struct RemapState
 	void filter_input(StateType &output, const SceneType &input);
 
 	unsigned emit_buffer(ArrayView<const uint8_t> view);
+	unsigned emit_encoded_buffer(ArrayView<const uint8_t> view, MeshoptMode mode, uint32_t stride, uint32_t count);
+	unsigned emit_stream(const ProcessedStream &stream);
 
 	unsigned emit_accessor(unsigned view_index, VkFormat format, unsigned offset, unsigned count);
 
@@ -204,6 +246,7 @@ struct RemapState
 	                    TextureCompressionFamily compression, unsigned quality, TextureMode mode);
 
 	void emit_material(unsigned remapped_material);
+	void process_meshes(ThreadGroup &workers);
 	void emit_mesh(unsigned remapped_index);
 	void emit_environment(const string &cube, const string &reflection, const string &irradiance, float intensity,
 	                      vec3 fog_color, float fog_falloff,
@@ -217,6 +260,9 @@ struct RemapState
 	vector<uint8_t> glb_buffer_data;
 	HashMap<unsigned> buffer_hash;
 	vector<BufferView> buffer_views;
+	size_t fallback_buffer_size = 0;
+
+	vector<ProcessedMesh> processed_meshes;
 
 	HashMap<unsigned> accessor_hash;
 	vector<EmittedAccessor> accessor_cache;
@@ -343,6 +389,42 @@ unsigned RemapState::emit_buffer(ArrayView<const uint8_t> view)
 		return itr->second;
 }
 
+unsigned RemapState::emit_encoded_buffer(ArrayView<const uint8_t> view, MeshoptMode mode, uint32_t stride, uint32_t count)
+{
+	Hasher h;
+	h.u32(ecast(mode));
+	h.u32(stride);
+	h.u32(count);
+	h.data(view.data(), view.size());
+	auto itr = buffer_hash.find(h.get());
+
+	if (itr == end(buffer_hash))
+	{
+		unsigned index = buffer_views.size();
+		size_t offset = glb_buffer_data.size();
+		offset = (offset + 15) & ~15;
+		glb_buffer_data.resize(offset + view.size());
+		memcpy(glb_buffer_data.data() + offset, view.data(), view.size());
+
+		size_t fallback_offset = (fallback_buffer_size + 15) & ~15;
+		fallback_buffer_size = fallback_offset + size_t(stride) * count;
+
+		buffer_views.push_back({offset, view.size(), mode, fallback_offset, stride, count});
+		buffer_hash[h.get()] = index;
+		return index;
+	}
+	else
+		return itr->second;
+}
+
+unsigned RemapState::emit_stream(const ProcessedStream &stream)
+{
+	if (stream.meshopt_mode != MeshoptMode::None)
+		return emit_encoded_buffer(stream.data, stream.meshopt_mode, stream.stride, stream.count);
+	else
+		return emit_buffer(stream.data);
+}
+
 #define GL_BYTE                           0x1400
 #define GL_UNSIGNED_BYTE                  0x1401
 #define GL_SHORT                          0x1402
@@ -843,104 +925,126 @@ static void extract_attribute(uint8_t *output,
 		memcpy(output + output_stride * i, buffer + i * stride, format_stride);
 }
 
-void RemapState::emit_mesh(unsigned remapped_index)
+static void encode_vertex_stream(ProcessedStream &stream)
 {
-	Mesh new_mesh;
-	if (options->optimize_meshes)
-		new_mesh = mesh_optimize_index_buffer(*this->mesh.info[remapped_index], options->stripify_meshes);
-	auto &mesh = options->optimize_meshes ? new_mesh : *this->mesh.info[remapped_index];
+	// The vertex codec works on 4 byte granularity.
+	if (!stream.count || (stream.stride & 3) != 0 || stream.stride > 256)
+		return;
+
+	vector<uint8_t> encoded(meshopt_encodeVertexBufferBound(stream.count, stream.stride));
+	size_t size = meshopt_encodeVertexBuffer(encoded.data(), encoded.size(), stream.data.data(), stream.count, stream.stride);
+	if (size == 0 || size >= stream.data.size())
+		return;
+
+	encoded.resize(size);
+	stream.data = move(encoded);
+	stream.meshopt_mode = MeshoptMode::Attributes;
+}
 
-	mesh_cache.resize(std::max<size_t>(mesh_cache.size(), remapped_index + 1));
+static void encode_index_stream(ProcessedStream &stream, uint32_t vertex_count)
+{
+	// The index codec only understands triangle lists.
+	if (!stream.count || (stream.count % 3) != 0)
+		return;
 
-	auto &emit = mesh_cache[remapped_index];
-	emit.material = mesh.has_material ? int(mesh.material_index) : -1;
-	emit.topology = mesh.topology;
-	emit.primitive_restart = mesh.primitive_restart;
+	vector<uint32_t> indices(stream.count);
+	if (stream.stride == sizeof(uint16_t))
+	{
+		const auto *src = reinterpret_cast<const uint16_t *>(stream.data.data());
+		for (uint32_t i = 0; i < stream.count; i++)
+			indices[i] = src[i];
+	}
+	else
+		memcpy(indices.data(), stream.data.data(), stream.count * sizeof(uint32_t));
+
+	vector<uint8_t> encoded(meshopt_encodeIndexBufferBound(stream.count, vertex_count));
+	size_t size = meshopt_encodeIndexBuffer(encoded.data(), encoded.size(), indices.data(), indices.size());
+	if (size == 0 || size >= stream.data.size())
+		return;
+
+	encoded.resize(size);
+	stream.data = move(encoded);
+	stream.meshopt_mode = MeshoptMode::Triangles;
+}
+
+static ProcessedMesh process_mesh(const Mesh &input, const ExportOptions &options)
+{
+	Mesh optimized;
+	if (options.optimize_meshes)
+		optimized = mesh_optimize_index_buffer(input, options.stripify_meshes, options.optimize_overdraw);
+	auto &mesh = options.optimize_meshes ? optimized : input;
+
+	ProcessedMesh processed;
+	processed.static_aabb = mesh.static_aabb;
+	processed.topology = mesh.topology;
+	processed.primitive_restart = mesh.primitive_restart;
+	processed.has_material = mesh.has_material;
+	processed.material_index = mesh.material_index;
 
 	if (!mesh.indices.empty())
 	{
-		unsigned index = emit_buffer(mesh.indices);
-		emit.index_accessor = emit_accessor(index,
-		                                    mesh.index_type == VK_INDEX_TYPE_UINT16 ? VK_FORMAT_R16_UINT
-		                                                                            : VK_FORMAT_R32_UINT,
-		                                    0, mesh.count);
+		auto &indices = processed.indices;
+		bool is_16bit = mesh.index_type == VK_INDEX_TYPE_UINT16;
+		indices.format = is_16bit ? VK_FORMAT_R16_UINT : VK_FORMAT_R32_UINT;
+		indices.stride = is_16bit ? sizeof(uint16_t) : sizeof(uint32_t);
+		indices.count = mesh.count;
+		indices.data.resize(mesh.count * indices.stride);
+		memcpy(indices.data.data(), mesh.indices.data(), indices.data.size());
 
 		uint32_t min_index = ~0u;
 		uint32_t max_index = 0;
 
-		if (mesh.index_type == VK_INDEX_TYPE_UINT16)
+		if (is_16bit)
 		{
-			const auto *indices = reinterpret_cast<const uint16_t *>(mesh.indices.data());
+			const auto *index_data = reinterpret_cast<const uint16_t *>(mesh.indices.data());
 			for (uint32_t i = 0; i < mesh.count; i++)
 			{
-				min_index = muglm::min(min_index, uint32_t(indices[i]));
-				max_index = muglm::max(max_index, uint32_t(indices[i]));
+				min_index = muglm::min(min_index, uint32_t(index_data[i]));
+				max_index = muglm::max(max_index, uint32_t(index_data[i]));
 			}
 		}
 		else
 		{
-			const auto *indices = reinterpret_cast<const uint32_t *>(mesh.indices.data());
+			const auto *index_data = reinterpret_cast<const uint32_t *>(mesh.indices.data());
 			for (uint32_t i = 0; i < mesh.count; i++)
 			{
-				min_index = muglm::min(min_index, indices[i]);
-				max_index = muglm::max(max_index, indices[i]);
+				min_index = muglm::min(min_index, index_data[i]);
+				max_index = muglm::max(max_index, index_data[i]);
 			}
 		}
 
-		accessor_cache[emit.index_accessor].use_uint_min_max = true;
-		accessor_cache[emit.index_accessor].uint_min = min_index;
-		accessor_cache[emit.index_accessor].uint_max = max_index;
-	}
-	else
-		emit.index_accessor = -1;
-
-	if (mesh.has_material)
-	{
-		unsigned remapped_material = material.to_index[mesh.material_index];
-		if (!material_hash.count(remapped_material))
-		{
-			emit_material(remapped_material);
-			material_hash.insert(remapped_material);
-		}
+		processed.min_index = min_index;
+		processed.max_index = max_index;
 	}
 
 	const auto &layout = mesh.attribute_layout;
 
-	emit.attribute_mask = 0;
 	if (!mesh.positions.empty())
 	{
-		uint32_t buffer_index = 0;
+		auto &stream = processed.attributes[ecast(MeshAttribute::Position)];
 		uint32_t count = uint32_t(mesh.positions.size() / mesh.position_stride);
-		int &acc = emit.attribute_accessor[ecast(MeshAttribute::Position)];
 		VkFormat format = layout[ecast(MeshAttribute::Position)].format;
 
 		bool format_is_fp32 = format == VK_FORMAT_R32G32B32_SFLOAT ||
 		                      format == VK_FORMAT_R32G32B32A32_SFLOAT;
 
-		if (options->quantize_attributes && format_is_fp32 &&
+		stream.count = count;
+
+		if (options.quantize_attributes && format_is_fp32 &&
 		    all(greaterThan(mesh.static_aabb.get_minimum(), vec3(-0x8000))) &&
 		    all(lessThan(mesh.static_aabb.get_maximum(), vec3(0x8000))))
 		{
-			vector<uint8_t> output(sizeof(u16vec4) * count);
-
-			quantize_attribute_fp32_fp16(output.data(), mesh.positions.data(), mesh.position_stride, count);
-
-			buffer_index = emit_buffer(output);
-			acc = emit_accessor(buffer_index,
-			                    VK_FORMAT_R16G16B16A16_SFLOAT,
-			                    0, count);
+			stream.data.resize(sizeof(u16vec4) * count);
+			quantize_attribute_fp32_fp16(stream.data.data(), mesh.positions.data(), mesh.position_stride, count);
+			stream.format = VK_FORMAT_R16G16B16A16_SFLOAT;
+			stream.stride = sizeof(u16vec4);
 		}
 		else
 		{
-			buffer_index = emit_buffer(mesh.positions);
-			acc = emit_accessor(buffer_index,
-			                    layout[ecast(MeshAttribute::Position)].format,
-			                    0, count);
+			stream.data = mesh.positions;
+			stream.format = format;
+			stream.stride = mesh.position_stride;
 		}
-
-		accessor_cache[acc].aabb = mesh.static_aabb;
-		accessor_cache[acc].use_aabb = true;
-		emit.attribute_mask |= 1u << ecast(MeshAttribute::Position);
 	}
 
 	if (!mesh.attributes.empty())
@@ -953,8 +1057,6 @@ void RemapState::emit_mesh(unsigned remapped_index)
 			if (layout[i].format == VK_FORMAT_UNDEFINED || i == ecast(MeshAttribute::Position))
 				continue;
 
-			emit.attribute_mask |= 1u << i;
-
 			auto format_size = Vulkan::TextureFormatLayout::format_block_size(layout[i].format);
 			vector<uint8_t> unpacked_buffer(attr_count * format_size);
 
@@ -963,7 +1065,7 @@ void RemapState::emit_mesh(unsigned remapped_index)
 
 			VkFormat remapped_format = layout[i].format;
 
-			if (options->quantize_attributes &&
+			if (options.quantize_attributes &&
 			    (attr == MeshAttribute::Normal || attr == MeshAttribute::Tangent) &&
 			    (layout[i].format == VK_FORMAT_R32G32B32A32_SFLOAT || layout[i].format == VK_FORMAT_R32G32B32_SFLOAT))
 			{
@@ -974,7 +1076,7 @@ void RemapState::emit_mesh(unsigned remapped_index)
 				remapped_format = VK_FORMAT_A2B10G10R10_SNORM_PACK32;
 				format_size = sizeof(uint32_t);
 			}
-			else if (options->quantize_attributes &&
+			else if (options.quantize_attributes &&
 			         attr == MeshAttribute::UV &&
 			         layout[i].format == VK_FORMAT_R32G32_SFLOAT)
 			{
@@ -1008,10 +1110,90 @@ void RemapState::emit_mesh(unsigned remapped_index)
 				}
 			}
 
-			auto buffer_index = emit_buffer(unpacked_buffer);
-			emit.attribute_accessor[i] = emit_accessor(buffer_index, remapped_format, 0, attr_count);
+			auto &stream = processed.attributes[i];
+			stream.data = move(unpacked_buffer);
+			stream.format = remapped_format;
+			stream.count = attr_count;
+			stream.stride = format_size;
 		}
 	}
+
+	if (options.encode_meshes)
+	{
+		for (auto &stream : processed.attributes)
+			if (stream.format != VK_FORMAT_UNDEFINED)
+				encode_vertex_stream(stream);
+
+		if (processed.topology == VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST)
+			encode_index_stream(processed.indices, processed.max_index + 1);
+	}
+
+	return processed;
+}
+
+void RemapState::process_meshes(ThreadGroup &workers)
+{
+	processed_meshes.resize(mesh.info.size());
+	auto group = workers.create_task();
+	for (size_t i = 0; i < mesh.info.size(); i++)
+	{
+		group->enqueue_task([this, i]() {
+			processed_meshes[i] = process_mesh(*mesh.info[i], *options);
+		});
+	}
+	group->flush();
+	group->wait();
+}
+
+void RemapState::emit_mesh(unsigned remapped_index)
+{
+	auto &mesh = processed_meshes[remapped_index];
+
+	mesh_cache.resize(std::max<size_t>(mesh_cache.size(), remapped_index + 1));
+
+	auto &emit = mesh_cache[remapped_index];
+	emit.material = mesh.has_material ? int(mesh.material_index) : -1;
+	emit.topology = mesh.topology;
+	emit.primitive_restart = mesh.primitive_restart;
+
+	if (mesh.indices.count)
+	{
+		unsigned index = emit_stream(mesh.indices);
+		emit.index_accessor = emit_accessor(index, mesh.indices.format, 0, mesh.indices.count);
+		accessor_cache[emit.index_accessor].use_uint_min_max = true;
+		accessor_cache[emit.index_accessor].uint_min = mesh.min_index;
+		accessor_cache[emit.index_accessor].uint_max = mesh.max_index;
+	}
+	else
+		emit.index_accessor = -1;
+
+	if (mesh.has_material)
+	{
+		unsigned remapped_material = material.to_index[mesh.material_index];
+		if (!material_hash.count(remapped_material))
+		{
+			emit_material(remapped_material);
+			material_hash.insert(remapped_material);
+		}
+	}
+
+	emit.attribute_mask = 0;
+	for (unsigned i = 0; i < ecast(MeshAttribute::Count); i++)
+	{
+		auto &stream = mesh.attributes[i];
+		if (stream.format == VK_FORMAT_UNDEFINED)
+			continue;
+
+		auto buffer_index = emit_stream(stream);
+		int &acc = emit.attribute_accessor[i];
+		acc = emit_accessor(buffer_index, stream.format, 0, stream.count);
+		if (i == ecast(MeshAttribute::Position))
+		{
+			accessor_cache[acc].aabb = mesh.static_aabb;
+			accessor_cache[acc].use_aabb = true;
+		}
+		emit.attribute_mask |= 1u << i;
+	}
 }
 
 unsigned RemapState::emit_meshes(ArrayView<const unsigned> meshes)
@@ -1575,21 +1757,11 @@ bool export_scene_to_glb(const SceneInformation &scene, const string &path, cons
 	asset.AddMember("version", "2.0", allocator);
 	doc.AddMember("asset", asset, allocator);
 
-	if (!scene.lights.empty())
-	{
-		Value req(kArrayType);
-		req.PushBack("KHR_lights", allocator);
-		doc.AddMember("extensionsRequired", req, allocator);
-
-		Value used(kArrayType);
-		used.PushBack("KHR_lights", allocator);
-		doc.AddMember("extensionsUsed", used, allocator);
-	}
-
 	RemapState state;
 	state.options = &options;
 	state.filter_input(state.material, scene.materials);
 	state.filter_input(state.mesh, scene.meshes);
+	state.process_meshes(workers);
 
 	if (!options.environment.cube.empty())
 	{
@@ -1670,10 +1842,30 @@ bool export_scene_to_glb(const SceneInformation &scene, const string &path, cons
 	}
 	doc.AddMember("nodes", nodes, allocator);
 
+	// Extensions are known once all meshes are emitted.
+	vector<const char *> extensions;
+	if (!scene.lights.empty())
+		extensions.push_back("KHR_lights");
+	if (state.fallback_buffer_size)
+		extensions.push_back("EXT_meshopt_compression");
+
+	if (!extensions.empty())
+	{
+		Value req(kArrayType);
+		Value used(kArrayType);
+		for (auto *ext : extensions)
+		{
+			req.PushBack(StringRef(ext), allocator);
+			used.PushBack(StringRef(ext), allocator);
+		}
+		doc.AddMember("extensionsRequired", req, allocator);
+		doc.AddMember("extensionsUsed", used, allocator);
+	}
+
+	Value buffers(kArrayType);
 	if (options.gltf)
 	{
 		// The baked GLB buffer.
-		Value buffers(kArrayType);
 		Value buffer(kObjectType);
 		buffer.AddMember("byteLength", state.glb_buffer_data.size(), allocator);
 
@@ -1696,18 +1888,29 @@ bool export_scene_to_glb(const SceneInformation &scene, const string &path, cons
 
 		memcpy(mapped, state.glb_buffer_data.data(), state.glb_buffer_data.size());
 		buffers.PushBack(buffer, allocator);
-		doc.AddMember("buffers", buffers, allocator);
 	}
 	else
 	{
 		// The baked GLB buffer.
-		Value buffers(kArrayType);
 		Value buffer(kObjectType);
 		buffer.AddMember("byteLength", state.glb_buffer_data.size(), allocator);
 		buffers.PushBack(buffer, allocator);
-		doc.AddMember("buffers", buffers, allocator);
 	}
 
+	// Encoded views decode into this buffer, which has no backing data.
+	if (state.fallback_buffer_size)
+	{
+		Value buffer(kObjectType);
+		buffer.AddMember("byteLength", state.fallback_buffer_size, allocator);
+		Value ext(kObjectType);
+		Value meshopt(kObjectType);
+		meshopt.AddMember("fallback", true, allocator);
+		ext.AddMember("EXT_meshopt_compression", meshopt, allocator);
+		buffer.AddMember("extensions", ext, allocator);
+		buffers.PushBack(buffer, allocator);
+	}
+	doc.AddMember("buffers", buffers, allocator);
+
 	// Buffer Views
 	if (!state.buffer_views.empty())
 	{
@@ -1715,9 +1918,30 @@ bool export_scene_to_glb(const SceneInformation &scene, const string &path, cons
 		for (auto &view : state.buffer_views)
 		{
 			Value v(kObjectType);
-			v.AddMember("buffer", 0, allocator);
-			v.AddMember("byteLength", view.length, allocator);
-			v.AddMember("byteOffset", view.offset, allocator);
+			if (view.meshopt_mode != MeshoptMode::None)
+			{
+				v.AddMember("buffer", 1, allocator);
+				v.AddMember("byteLength", size_t(view.meshopt_stride) * view.meshopt_count, allocator);
+				v.AddMember("byteOffset", view.fallback_offset, allocator);
+
+				Value meshopt(kObjectType);
+				meshopt.AddMember("buffer", 0, allocator);
+				meshopt.AddMember("byteOffset", view.offset, allocator);
+				meshopt.AddMember("byteLength", view.length, allocator);
+				meshopt.AddMember("byteStride", view.meshopt_stride, allocator);
+				meshopt.AddMember("count", view.meshopt_count, allocator);
+				meshopt.AddMember("mode", view.meshopt_mode == MeshoptMode::Triangles ? "TRIANGLES" : "ATTRIBUTES", allocator);
+
+				Value ext(kObjectType);
+				ext.AddMember("EXT_meshopt_compression", meshopt, allocator);
+				v.AddMember("extensions", ext, allocator);
+			}
+			else
+			{
+				v.AddMember("buffer", 0, allocator);
+				v.AddMember("byteLength", view.length, allocator);
+				v.AddMember("byteOffset", view.offset, allocator);
+			}
 			views.PushBack(v, allocator);
 		}
 		doc.AddMember("bufferViews", views, allocator);
@@ -75,6 +75,9 @@ struct ExportOptions
 	bool quantize_attributes = false;
 	bool optimize_meshes = false;
 	bool stripify_meshes = false;
+	bool optimize_overdraw = false;
+	// Compress vertex and index streams with EXT_meshopt_compression.
+	bool encode_meshes = false;
 	bool gltf = false;
 };
 
@@ -24,94 +24,19 @@
 #include "filesystem.hpp"
 #include "memory_mapped_texture.hpp"
 #include "texture_files.hpp"
+#include "thread_group.hpp"
+#include "global_managers.hpp"
+#include <algorithm>
+#include <exception>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
 
 using namespace std;
 using namespace Util;
 
 namespace OBJ
 {
-void Parser::flush_mesh()
-{
-	if (current_positions.empty())
-		return;
-
-	Mesh mesh = {};
-
-	if (current_material >= 0)
-	{
-		mesh.has_material = true;
-		mesh.material_index = unsigned(current_material);
-	}
-
-	mesh.positions.resize(current_positions.size() * sizeof(vec3));
-	memcpy(mesh.positions.data(), current_positions.data(), mesh.positions.size());
-	mesh.position_stride = sizeof(vec3);
-	mesh.attribute_layout[ecast(MeshAttribute::Position)].format = VK_FORMAT_R32G32B32_SFLOAT;
-	mesh.count = unsigned(current_positions.size());
-	mesh.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
-
-	vec3 lo = vec3(numeric_limits<float>::max());
-	vec3 hi = vec3(-numeric_limits<float>::max());
-	for (auto &p : current_positions)
-	{
-		lo = min(lo, p);
-		hi = max(hi, p);
-	}
-	mesh.static_aabb = AABB(lo, hi);
-
-	if (!current_normals.empty() && !current_uvs.empty())
-	{
-		if (current_normals.size() != current_positions.size())
-			throw runtime_error("Normal size != position size.");
-		if (current_uvs.size() != current_positions.size())
-			throw runtime_error("UV size != position size.");
-
-		mesh.attribute_layout[ecast(MeshAttribute::Normal)].format = VK_FORMAT_R32G32B32_SFLOAT;
-		mesh.attribute_layout[ecast(MeshAttribute::UV)].format = VK_FORMAT_R32G32_SFLOAT;
-		mesh.attribute_layout[ecast(MeshAttribute::UV)].offset = sizeof(vec3);
-		static const size_t stride = sizeof(vec3) + sizeof(vec2);
-		mesh.attribute_stride = stride;
-		mesh.attributes.resize(stride * current_positions.size());
-
-		for (size_t i = 0; i < current_positions.size(); i++)
-		{
-			memcpy(mesh.attributes.data() + stride * i, &current_normals[i], sizeof(vec3));
-			memcpy(mesh.attributes.data() + stride * i + sizeof(vec3), &current_uvs[i], sizeof(vec2));
-		}
-	}
-	else if (!current_normals.empty())
-	{
-		if (current_normals.size() != current_positions.size())
-			throw runtime_error("Normal size != position size.");
-		mesh.attribute_layout[ecast(MeshAttribute::Normal)].format = VK_FORMAT_R32G32B32_SFLOAT;
-		static const size_t stride = sizeof(vec3);
-		mesh.attribute_stride = stride;
-		mesh.attributes.resize(stride * current_positions.size());
-		for (size_t i = 0; i < current_positions.size(); i++)
-			memcpy(mesh.attributes.data() + stride * i, &current_normals[i], sizeof(vec3));
-	}
-	else if (!current_uvs.empty())
-	{
-		if (current_uvs.size() != current_positions.size())
-			throw runtime_error("UV size != position size.");
-		mesh.attribute_layout[ecast(MeshAttribute::UV)].format = VK_FORMAT_R32G32_SFLOAT;
-		static const size_t stride = sizeof(vec2);
-		mesh.attribute_stride = stride;
-		mesh.attributes.resize(stride * current_positions.size());
-		for (size_t i = 0; i < current_positions.size(); i++)
-			memcpy(mesh.attributes.data() + stride * i, &current_uvs[i], sizeof(vec2));
-	}
-
-	current_positions.clear();
-	current_normals.clear();
-	current_uvs.clear();
-
-	mesh_deduplicate_vertices(mesh);
-
-	root_node.meshes.push_back(meshes.size());
-	meshes.push_back(move(mesh));
-}
-
 void Parser::emit_gltf_base_color(const std::string &base_color_path, const std::string &alpha_mask_path)
 {
 	MemoryMappedTexture alpha_mask;
@@ -314,60 +239,6 @@ void Parser::emit_gltf_pbr_metallic_roughness(const std::string &metallic_path,
 	}
 }
 
-void Parser::emit_vertex(const OBJVertex * const *face)
-{
-	// Positions
-	for (unsigned i = 0; i < 3; i++)
-	{
-		auto &p = face[i]->operator[](0);
-
-		if (!p.empty())
-		{
-			int index = stoi(p);
-			if (index < 0)
-				index = int(positions.size()) + index;
-			else
-				index--;
-
-			if (index < 0 || index >= int(positions.size()))
-				throw logic_error("Index out of bounds.");
-			current_positions.push_back(positions[index]);
-		}
-
-		if (face[i]->size() == 1)
-			continue;
-
-		auto &u = face[i]->operator[](1);
-		auto &n = face[i]->operator[](2);
-
-		if (!u.empty())
-		{
-			int index = stoi(u);
-			if (index < 0)
-				index = int(uvs.size()) + index;
-			else
-				index--;
-
-			if (index < 0 || index >= int(uvs.size()))
-				throw logic_error("Index out of bounds.");
-			current_uvs.push_back(uvs[index]);
-		}
-
-		if (!n.empty())
-		{
-			int index = stoi(n);
-			if (index < 0)
-				index = int(normals.size()) + index;
-			else
-				index--;
-
-			if (index < 0 || index >= int(normals.size()))
-				throw logic_error("Index out of bounds.");
-			current_normals.push_back(normals[index]);
-		}
-	}
-}
-
 void Parser::load_material_library(const std::string &path)
 {
 	string mtl;
@@ -382,10 +253,10 @@ void Parser::load_material_library(const std::string &path)
 
 	for (auto &line : lines)
 	{
-		line = strip_whitespace(line);
 		auto comment_index = line.find_first_of('#');
 		if (comment_index != string::npos)
-			line = line.substr(comment_index, string::npos);
+			line = line.substr(0, comment_index);
+		line = strip_whitespace(line);
 
 		auto elements = split_no_empty(line, " ");
 		if (elements.empty())
@@ -453,74 +324,663 @@ void Parser::load_material_library(const std::string &path)
 		emit_gltf_base_color(base_color, alpha_mask);
 }
 
-Parser::Parser(const std::string &path)
+// Component of a face vertex which was not specified, e.g. the UV in "1//1".
+static const uint32_t NoIndex = ~0u;
+
+struct OBJIndex
 {
-	string obj;
-	if (!Global::filesystem()->read_file_to_string(path, obj))
-		throw runtime_error("Failed to load OBJ.");
+	uint32_t position;
+	uint32_t uv;
+	uint32_t normal;
+};
 
-	vector<string> lines = split_no_empty(obj, "\n");
-	for (auto &line : lines)
+struct OBJEvent
+{
+	enum class Type
 	{
-		line = strip_whitespace(line);
-		auto comment_index = line.find_first_of('#');
-		if (comment_index != string::npos)
-			line = line.substr(comment_index, string::npos);
+		MaterialLibrary,
+		UseMaterial
+	};
+	Type type;
+	// Number of triangles in the chunk which precede the event.
+	size_t triangle;
+	// Points into the mapped file.
+	const char *name;
+	size_t name_length;
+};
+
+// A range of whole lines, parsed independently of all other chunks.
+// Global vertex counts before the chunk are only needed to resolve relative indices,
+// and they are known up front from a cheap counting pass.
+struct OBJChunk
+{
+	const char *begin = nullptr;
+	const char *end = nullptr;
+
+	uint32_t num_positions = 0;
+	uint32_t num_normals = 0;
+	uint32_t num_uvs = 0;
+	uint32_t base_position = 0;
+	uint32_t base_normal = 0;
+	uint32_t base_uv = 0;
+
+	// Three indices per triangle.
+	vector<OBJIndex> triangles;
+	vector<OBJEvent> events;
+};
+
+struct OBJMeshRange
+{
+	int material = -1;
+	struct Span
+	{
+		const OBJChunk *chunk;
+		size_t begin, end;
+	};
+	vector<Span> spans;
+	size_t num_triangles = 0;
+};
+
+static inline bool is_space(char c)
+{
+	return c == ' ' || c == '\t' || c == '\r' || c == '\f' || c == '\v';
+}
 
-		auto elements = split_no_empty(line, " ");
-		if (elements.empty())
+static inline bool is_digit(char c)
+{
+	return c >= '0' && c <= '9';
+}
+
+static inline const char *skip_space(const char *p, const char *end)
+{
+	while (p < end && is_space(*p))
+		p++;
+	return p;
+}
+
+static inline const char *skip_token(const char *p, const char *end)
+{
+	while (p < end && !is_space(*p))
+		p++;
+	return p;
+}
+
+// Returns the end of the line, excluding any comment. next is set to the start of the following line.
+static inline const char *find_line_end(const char *p, const char *end, const char *&next)
+{
+	auto *newline = static_cast<const char *>(memchr(p, '\n', size_t(end - p)));
+	next = newline ? newline + 1 : end;
+	auto *line_end = newline ? newline : end;
+	auto *comment = static_cast<const char *>(memchr(p, '#', size_t(line_end - p)));
+	return comment ? comment : line_end;
+}
+
+static inline bool token_equals(const char *p, const char *end, const char *ident, size_t len)
+{
+	return size_t(end - p) >= len && memcmp(p, ident, len) == 0 && (p + len == end || is_space(p[len]));
+}
+
+// Parses a decimal floating point number without allocating or requiring a NUL-terminated string.
+// Up to 19 significant digits are accumulated exactly, and exact powers of ten are used where possible,
+// which covers everything OBJ exporters write. Anything unusual (nan, inf, hex floats) goes through strtof.
+static const char *parse_float(const char *p, const char *end, float &value)
+{
+	static const double exact_powers[] = {
+		1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+		1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+	};
+
+	const char *start = p;
+	bool negative = false;
+	if (p < end && (*p == '-' || *p == '+'))
+	{
+		negative = *p == '-';
+		p++;
+	}
+
+	uint64_t mantissa = 0;
+	int exponent = 0;
+	unsigned digits = 0;
+	bool has_digits = false;
+
+	while (p < end && is_digit(*p))
+	{
+		if (digits < 19)
+		{
+			mantissa = mantissa * 10 + unsigned(*p - '0');
+			if (mantissa)
+				digits++;
+		}
+		else
+			exponent++;
+		has_digits = true;
+		p++;
+	}
+
+	if (p < end && *p == '.')
+	{
+		p++;
+		while (p < end && is_digit(*p))
+		{
+			if (digits < 19)
+			{
+				mantissa = mantissa * 10 + unsigned(*p - '0');
+				if (mantissa)
+					digits++;
+				exponent--;
+			}
+			has_digits = true;
+			p++;
+		}
+	}
+
+	if (has_digits && p < end && (*p == 'e' || *p == 'E'))
+	{
+		const char *exp_start = p;
+		p++;
+		bool negative_exp = false;
+		if (p < end && (*p == '-' || *p == '+'))
+		{
+			negative_exp = *p == '-';
+			p++;
+		}
+
+		if (p < end && is_digit(*p))
+		{
+			int exp = 0;
+			while (p < end && is_digit(*p))
+			{
+				if (exp < 10000)
+					exp = exp * 10 + (*p - '0');
+				p++;
+			}
+			exponent += negative_exp ? -exp : exp;
+		}
+		else
+			p = exp_start;
+	}
+
+	if (!has_digits || (p < end && !is_space(*p) && *p != '/'))
+	{
+		char buffer[64];
+		auto *token_end = skip_token(start, end);
+		size_t len = std::min(size_t(token_end - start), sizeof(buffer) - 1);
+		memcpy(buffer, start, len);
+		buffer[len] = '\0';
+
+		char *parsed_end = nullptr;
+		value = strtof(buffer, &parsed_end);
+		if (parsed_end == buffer)
+			throw logic_error("Invalid number in OBJ.");
+		return start + (parsed_end - buffer);
+	}
+
+	double v = double(mantissa);
+	if (mantissa == 0)
+		v = 0.0;
+	else if (exponent >= 0 && exponent <= 22)
+		v *= exact_powers[exponent];
+	else if (exponent < 0 && exponent >= -22)
+		v /= exact_powers[-exponent];
+	else
+		v *= pow(10.0, double(exponent));
+
+	value = float(negative ? -v : v);
+	return p;
+}
+
+static inline const char *parse_index(const char *p, const char *end, int64_t &value)
+{
+	bool negative = false;
+	if (p < end && (*p == '-' || *p == '+'))
+	{
+		negative = *p == '-';
+		p++;
+	}
+
+	if (p >= end || !is_digit(*p))
+		throw logic_error("Invalid index in OBJ.");
+
+	int64_t v = 0;
+	while (p < end && is_digit(*p))
+	{
+		if (v < 0x100000000ll)
+			v = v * 10 + (*p - '0');
+		p++;
+	}
+
+	value = negative ? -v : v;
+	return p;
+}
+
+// Indices are 1-based, and negative indices count back from the last element defined so far.
+static inline uint32_t resolve_index(int64_t index, uint32_t base, uint32_t local_count)
+{
+	int64_t count = int64_t(base) + local_count;
+	int64_t resolved = index < 0 ? count + index : index - 1;
+	if (index == 0 || resolved < 0 || resolved >= count)
+		throw logic_error("Index out of bounds.");
+	return uint32_t(resolved);
+}
+
+static void count_chunk_vertices(OBJChunk &chunk)
+{
+	const char *next;
+	for (const char *p = chunk.begin; p < chunk.end; p = next)
+	{
+		auto *line_end = find_line_end(p, chunk.end, next);
+		p = skip_space(p, line_end);
+		if (line_end - p < 2 || p[0] != 'v')
 			continue;
 
-		auto &ident = elements.front();
-		if (ident == "mtllib")
-			load_material_library(Path::relpath(path, elements.at(1)));
-		else if (ident == "v")
-			positions.push_back(vec3(stof(elements.at(1)), stof(elements.at(2)), stof(elements.at(3))));
-		else if (ident == "vn")
-			normals.push_back(vec3(stof(elements.at(1)), stof(elements.at(2)), stof(elements.at(3))));
-		else if (ident == "vt")
-			uvs.push_back(vec2(stof(elements.at(1)), 1.0f - stof(elements.at(2))));
-		else if (ident == "usemtl")
-		{
-			auto itr = material_library.find(elements.at(1));
-			if (itr == end(material_library))
+		if (is_space(p[1]))
+			chunk.num_positions++;
+		else if (line_end - p >= 3 && is_space(p[2]))
+		{
+			if (p[1] == 'n')
+				chunk.num_normals++;
+			else if (p[1] == 't')
+				chunk.num_uvs++;
+		}
+	}
+}
+
+static const char *parse_face_vertex(const char *p, const char *end, const OBJChunk &chunk,
+                                     uint32_t local_positions, uint32_t local_uvs, uint32_t local_normals,
+                                     OBJIndex &index)
+{
+	int64_t value;
+	p = parse_index(p, end, value);
+	index.position = resolve_index(value, chunk.base_position, local_positions);
+	index.uv = NoIndex;
+	index.normal = NoIndex;
+
+	if (p < end && *p == '/')
+	{
+		p++;
+		if (p < end && *p != '/' && !is_space(*p))
+		{
+			p = parse_index(p, end, value);
+			index.uv = resolve_index(value, chunk.base_uv, local_uvs);
+		}
+
+		if (p < end && *p == '/')
+		{
+			p++;
+			if (p < end && !is_space(*p))
+			{
+				p = parse_index(p, end, value);
+				index.normal = resolve_index(value, chunk.base_normal, local_normals);
+			}
+		}
+	}
+
+	if (p < end && !is_space(*p))
+		throw logic_error("Invalid face in OBJ.");
+	return p;
+}
+
+static void parse_chunk(OBJChunk &chunk, vec3 *positions, vec3 *normals, vec2 *uvs)
+{
+	uint32_t local_positions = 0;
+	uint32_t local_normals = 0;
+	uint32_t local_uvs = 0;
+
+	const char *next;
+	for (const char *p = chunk.begin; p < chunk.end; p = next)
+	{
+		auto *line_end = find_line_end(p, chunk.end, next);
+		p = skip_space(p, line_end);
+		if (p == line_end)
+			continue;
+
+		auto *ident_end = skip_token(p, line_end);
+		size_t ident_len = size_t(ident_end - p);
+		auto *args = skip_space(ident_end, line_end);
+
+		if (ident_len == 1 && p[0] == 'v')
+		{
+			float v[3];
+			for (auto &c : v)
 			{
-				LOGE("Material %s does not exist!\n",
-				     elements.at(1).c_str());
-				throw runtime_error("Material does not exist.");
+				if (args == line_end)
+					throw logic_error("Too few components in vertex.");
+				args = skip_space(parse_float(args, line_end, c), line_end);
 			}
-			int index = int(itr->second);
-			if (index != current_material)
-				flush_mesh();
-			current_material = index;
+			positions[chunk.base_position + local_positions++] = vec3(v[0], v[1], v[2]);
 		}
-		else if (ident == "f")
+		else if (ident_len == 2 && p[0] == 'v' && p[1] == 'n')
 		{
-			if (elements.size() == 5)
+			float v[3];
+			for (auto &c : v)
 			{
-				auto v0 = split(elements.at(1), "/");
-				auto v1 = split(elements.at(2), "/");
-				auto v2 = split(elements.at(3), "/");
-				auto v3 = split(elements.at(4), "/");
-
-				const OBJVertex *f0[3] = { &v0, &v1, &v2 };
-				const OBJVertex *f1[3] = { &v0, &v2, &v3 };
-				emit_vertex(f0);
-				emit_vertex(f1);
+				if (args == line_end)
+					throw logic_error("Too few components in normal.");
+				args = skip_space(parse_float(args, line_end, c), line_end);
 			}
-			else if (elements.size() == 4)
+			normals[chunk.base_normal + local_normals++] = vec3(v[0], v[1], v[2]);
+		}
+		else if (ident_len == 2 && p[0] == 'v' && p[1] == 't')
+		{
+			float v[2];
+			for (auto &c : v)
 			{
-				auto v0 = split(elements.at(1), "/");
-				auto v1 = split(elements.at(2), "/");
-				auto v2 = split(elements.at(3), "/");
-				const OBJVertex *f0[3] = { &v0, &v1, &v2 };
-				emit_vertex(f0);
+				if (args == line_end)
+					throw logic_error("Too few components in UV.");
+				args = skip_space(parse_float(args, line_end, c), line_end);
 			}
+			uvs[chunk.base_uv + local_uvs++] = vec2(v[0], 1.0f - v[1]);
+		}
+		else if (ident_len == 1 && p[0] == 'f')
+		{
+			// Triangulate polygons as a fan.
+			OBJIndex first, prev, index;
+			unsigned count = 0;
+			while (args < line_end)
+			{
+				args = parse_face_vertex(args, line_end, chunk, local_positions, local_uvs, local_normals, index);
+				args = skip_space(args, line_end);
+
+				if (count == 0)
+					first = index;
+				else if (count >= 2)
+				{
+					chunk.triangles.push_back(first);
+					chunk.triangles.push_back(prev);
+					chunk.triangles.push_back(index);
+				}
+				prev = index;
+				count++;
+			}
+		}
+		else if (token_equals(p, line_end, "usemtl", 6) || token_equals(p, line_end, "mtllib", 6))
+		{
+			if (args == line_end)
+				throw logic_error("Missing name in OBJ.");
+
+			OBJEvent event;
+			event.type = p[0] == 'u' ? OBJEvent::Type::UseMaterial : OBJEvent::Type::MaterialLibrary;
+			event.triangle = chunk.triangles.size() / 3;
+			event.name = args;
+			event.name_length = size_t(skip_token(args, line_end) - args);
+			chunk.events.push_back(event);
 		}
 	}
+}
 
-	flush_mesh();
-	nodes.push_back(move(root_node));
+// Deduplicates face vertices by their (position, uv, normal) index triple as they are emitted,
+// so attributes only need to be gathered once per unique vertex.
+struct OBJVertexCache
+{
+	explicit OBJVertexCache(size_t max_vertices)
+	{
+		size_t size = 16;
+		while (size < max_vertices * 2)
+			size <<= 1;
+		table.resize(size, NoIndex);
+		mask = size - 1;
+		vertices.reserve(max_vertices);
+	}
+
+	uint32_t emit_vertex(const OBJIndex &index)
+	{
+		uint32_t h = index.position * 0x9e3779b1u;
+		h ^= index.uv * 0x85ebca77u;
+		h ^= index.normal * 0xc2b2ae3du;
+		h ^= h >> 15;
+
+		for (size_t slot = h & mask; ; slot = (slot + 1) & mask)
+		{
+			uint32_t entry = table[slot];
+			if (entry == NoIndex)
+			{
+				entry = uint32_t(vertices.size());
+				table[slot] = entry;
+				vertices.push_back(index);
+				return entry;
+			}
+
+			auto &v = vertices[entry];
+			if (v.position == index.position && v.uv == index.uv && v.normal == index.normal)
+				return entry;
+		}
+	}
+
+	vector<OBJIndex> vertices;
+	vector<uint32_t> table;
+	size_t mask;
+};
+
+static Mesh build_mesh(const OBJMeshRange &range,
+                       const vector<vec3> &positions,
+                       const vector<vec3> &normals,
+                       const vector<vec2> &uvs)
+{
+	Mesh mesh = {};
+
+	if (range.material >= 0)
+	{
+		mesh.has_material = true;
+		mesh.material_index = unsigned(range.material);
+	}
+
+	size_t num_indices = range.num_triangles * 3;
+	OBJVertexCache cache(num_indices);
+	mesh.indices.resize(num_indices * sizeof(uint32_t));
+	auto *indices = reinterpret_cast<uint32_t *>(mesh.indices.data());
+
+	for (auto &span : range.spans)
+		for (size_t i = 3 * span.begin; i < 3 * span.end; i++)
+			*indices++ = cache.emit_vertex(span.chunk->triangles[i]);
+
+	auto &vertices = cache.vertices;
+	bool has_uv = vertices.front().uv != NoIndex;
+	bool has_normal = vertices.front().normal != NoIndex;
+	for (auto &v : vertices)
+	{
+		if ((v.normal != NoIndex) != has_normal)
+			throw runtime_error("Normal size != position size.");
+		if ((v.uv != NoIndex) != has_uv)
+			throw runtime_error("UV size != position size.");
+	}
+
+	mesh.index_type = VK_INDEX_TYPE_UINT32;
+	mesh.count = unsigned(num_indices);
+	mesh.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+
+	mesh.positions.resize(vertices.size() * sizeof(vec3));
+	mesh.position_stride = sizeof(vec3);
+	mesh.attribute_layout[ecast(MeshAttribute::Position)].format = VK_FORMAT_R32G32B32_SFLOAT;
+
+	vec3 lo = vec3(numeric_limits<float>::max());
+	vec3 hi = vec3(-numeric_limits<float>::max());
+	auto *out_positions = reinterpret_cast<vec3 *>(mesh.positions.data());
+	for (size_t i = 0; i < vertices.size(); i++)
+	{
+		auto &p = positions[vertices[i].position];
+		out_positions[i] = p;
+		lo = min(lo, p);
+		hi = max(hi, p);
+	}
+	mesh.static_aabb = AABB(lo, hi);
+
+	size_t stride = 0;
+	if (has_normal)
+	{
+		mesh.attribute_layout[ecast(MeshAttribute::Normal)].format = VK_FORMAT_R32G32B32_SFLOAT;
+		stride += sizeof(vec3);
+	}
+
+	if (has_uv)
+	{
+		mesh.attribute_layout[ecast(MeshAttribute::UV)].format = VK_FORMAT_R32G32_SFLOAT;
+		mesh.attribute_layout[ecast(MeshAttribute::UV)].offset = uint32_t(stride);
+		stride += sizeof(vec2);
+	}
+
+	if (stride)
+	{
+		mesh.attribute_stride = uint32_t(stride);
+		mesh.attributes.resize(stride * vertices.size());
+		uint8_t *attr = mesh.attributes.data();
+		for (auto &v : vertices)
+		{
+			if (has_normal)
+				memcpy(attr, &normals[v.normal], sizeof(vec3));
+			if (has_uv)
+				memcpy(attr + (has_normal ? sizeof(vec3) : 0), &uvs[v.uv], sizeof(vec2));
+			attr += stride;
+		}
+	}
+
+	return mesh;
 }
+
+// Runs func for every element on the thread group and rethrows the first error in order.
+template <typename Func>
+static void run_parallel(size_t count, const Func &func)
+{
+	vector<exception_ptr> errors(count);
+	auto task = Global::thread_group()->create_task();
+	for (size_t i = 0; i < count; i++)
+	{
+		task->enqueue_task([&, i]() {
+			try
+			{
+				func(i);
+			}
+			catch (...)
+			{
+				errors[i] = current_exception();
+			}
+		});
+	}
+	task->flush();
+	task->wait();
+
+	for (auto &error : errors)
+		if (error)
+			rethrow_exception(error);
 }
 
+Parser::Parser(const std::string &path)
+{
+	auto file = Global::filesystem()->open(path, FileMode::ReadOnly);
+	if (!file)
+		throw runtime_error("Failed to load OBJ.");
+
+	size_t size = file->get_size();
+	const char *data = nullptr;
+	if (size)
+	{
+		data = static_cast<const char *>(file->map());
+		if (!data)
+			throw runtime_error("Failed to map OBJ.");
+	}
+
+	// Split the file into chunks of whole lines. Chunks are parsed in parallel,
+	// but merged in file order, so the result does not depend on the number of threads.
+	static const size_t MinChunkSize = 1024 * 1024;
+	size_t num_threads = std::max(Global::thread_group()->get_num_threads(), 1u);
+	size_t num_chunks = std::max<size_t>(std::min(num_threads * 4, size / MinChunkSize), 1);
+
+	vector<OBJChunk> chunks(num_chunks);
+	const char *chunk_begin = data;
+	for (size_t i = 0; i < num_chunks; i++)
+	{
+		const char *chunk_end = data + size;
+		if (i + 1 < num_chunks)
+		{
+			const char *target = std::max(data + (size * (i + 1)) / num_chunks, chunk_begin);
+			auto *newline = static_cast<const char *>(memchr(target, '\n', size_t(data + size - target)));
+			chunk_end = newline ? newline + 1 : data + size;
+		}
+
+		chunks[i].begin = chunk_begin;
+		chunks[i].end = chunk_end;
+		chunk_begin = chunk_end;
+	}
+
+	run_parallel(num_chunks, [&](size_t i) {
+		count_chunk_vertices(chunks[i]);
+	});
+
+	uint32_t num_positions = 0;
+	uint32_t num_normals = 0;
+	uint32_t num_uvs = 0;
+	for (auto &chunk : chunks)
+	{
+		chunk.base_position = num_positions;
+		chunk.base_normal = num_normals;
+		chunk.base_uv = num_uvs;
+		num_positions += chunk.num_positions;
+		num_normals += chunk.num_normals;
+		num_uvs += chunk.num_uvs;
+	}
+
+	positions.resize(num_positions);
+	normals.resize(num_normals);
+	uvs.resize(num_uvs);
+
+	run_parallel(num_chunks, [&](size_t i) {
+		parse_chunk(chunks[i], positions.data(), normals.data(), uvs.data());
+	});
+
+	// Material libraries and material switches are applied in file order.
+	vector<OBJMeshRange> ranges;
+	OBJMeshRange current;
+
+	const auto add_span = [&](const OBJChunk &chunk, size_t begin, size_t end) {
+		if (begin == end)
+			return;
+		current.spans.push_back({ &chunk, begin, end });
+		current.num_triangles += end - begin;
+	};
+
+	for (auto &chunk : chunks)
+	{
+		size_t cursor = 0;
+		for (auto &event : chunk.events)
+		{
+			add_span(chunk, cursor, event.triangle);
+			cursor = event.triangle;
+
+			string name(event.name, event.name_length);
+			if (event.type == OBJEvent::Type::MaterialLibrary)
+				load_material_library(Path::relpath(path, name));
+			else
+			{
+				auto itr = material_library.find(name);
+				if (itr == end(material_library))
+				{
+					LOGE("Material %s does not exist!\n", name.c_str());
+					throw runtime_error("Material does not exist.");
+				}
+
+				int index = int(itr->second);
+				if (index != current.material)
+				{
+					if (current.num_triangles)
+						ranges.push_back(move(current));
+					current = {};
+				}
+				current.material = index;
+			}
+		}
+		add_span(chunk, cursor, chunk.triangles.size() / 3);
+	}
+
+	if (current.num_triangles)
+		ranges.push_back(move(current));
+
+	meshes.resize(ranges.size());
+	run_parallel(ranges.size(), [&](size_t i) {
+		meshes[i] = build_mesh(ranges[i], positions, normals, uvs);
+	});
+
+	Node root_node;
+	for (size_t i = 0; i < meshes.size(); i++)
+		root_node.meshes.push_back(uint32_t(i));
+	nodes.push_back(move(root_node));
+}
+}
\ No newline at end of file
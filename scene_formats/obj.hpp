@@ -61,18 +61,9 @@ private:
 	std::vector<vec3> positions;
 	std::vector<vec3> normals;
 	std::vector<vec2> uvs;
-	std::vector<vec3> current_positions;
-	std::vector<vec3> current_normals;
-	std::vector<vec2> current_uvs;
-	int current_material = -1;
 
 	void load_material_library(const std::string &path);
-	void flush_mesh();
-
-	using OBJVertex = std::vector<std::string>;
-	void emit_vertex(const OBJVertex * const *face);
 	void emit_gltf_pbr_metallic_roughness(const std::string &metallic, const std::string &roughness);
 	void emit_gltf_base_color(const std::string &metallic, const std::string &roughness);
-	Node root_node;
 };
 }
\ No newline at end of file
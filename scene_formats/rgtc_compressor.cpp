@@ -23,149 +23,109 @@
 #include "rgtc_compressor.hpp"
 #include <algorithm>
 #include <iterator>
-#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 using namespace std;
 
 namespace Granite
 {
-static const int range_threshold = 16;
 static const int div_7 = (0x100000) / 7;
 static const int div_5 = (0x100000) / 5;
 
-class DividerLut
+// Builds the 8 values a decoder derives from the two endpoints.
+static void build_rgtc_palette(uint8_t *palette, int red0, int red1)
 {
-public:
-	DividerLut() noexcept
-	{
-		lut_5[0] = 0;
-		lut_7[0] = 0;
-
-		for (int range = 1; range < 256; range++)
-		{
-			lut_7[range] = (0x700000 + (range >> 1)) / range;
-			assert(((lut_7[range] * range + 0x80000) >> 20) == 7);
-		}
+	palette[0] = uint8_t(red0);
+	palette[1] = uint8_t(red1);
 
-		for (int range = 1; range < 256; range++)
-		{
-			lut_5[range] = (0x500000 + (range >> 1)) / range;
-			assert(((lut_5[range] * range + 0x80000) >> 20) == 5);
-		}
+	if (red0 > red1)
+	{
+		for (int i = 1; i < 7; i++)
+			palette[i + 1] = uint8_t((((7 - i) * red0 + i * red1) * div_7 + 0x80000) >> 20);
 	}
-
-	int lut7(int index) const
+	else
 	{
-		return lut_7[index];
+		for (int i = 1; i < 5; i++)
+			palette[i + 1] = uint8_t((((5 - i) * red0 + i * red1) * div_5 + 0x80000) >> 20);
+		palette[6] = 0;
+		palette[7] = 255;
 	}
+}
 
-	int lut5(int index) const
+// Squared error of the block when every value snaps to its nearest palette entry.
+static int rgtc_palette_error(const uint8_t *input_r, const uint8_t *palette)
+{
+#ifdef __SSE2__
+	// All 16 values fit in one register, and |a - b| of unsigned bytes is two saturating subtracts.
+	__m128i values = _mm_loadu_si128(reinterpret_cast<const __m128i *>(input_r));
+	__m128i best = _mm_set1_epi8(-1);
+	for (int i = 0; i < 8; i++)
 	{
-		return lut_5[index];
+		__m128i p = _mm_set1_epi8(char(palette[i]));
+		__m128i diff = _mm_or_si128(_mm_subs_epu8(values, p), _mm_subs_epu8(p, values));
+		best = _mm_min_epu8(best, diff);
 	}
 
-private:
-	int lut_5[256];
-	int lut_7[256];
-};
-static DividerLut divider_lut;
+	__m128i zero = _mm_setzero_si128();
+	__m128i lo = _mm_unpacklo_epi8(best, zero);
+	__m128i hi = _mm_unpackhi_epi8(best, zero);
+	__m128i sum = _mm_add_epi32(_mm_madd_epi16(lo, lo), _mm_madd_epi16(hi, hi));
+	sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(1, 0, 3, 2)));
+	sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(2, 3, 0, 1)));
+	return _mm_cvtsi128_si32(sum);
+#else
+	int error = 0;
+	for (int i = 0; i < 16; i++)
+	{
+		int best = 255;
+		for (int j = 0; j < 8; j++)
+			best = min(best, abs(int(input_r[i]) - int(palette[j])));
+		error += best * best;
+	}
+	return error;
+#endif
+}
 
-void decompress_rgtc_red_block(uint8_t *output_r, const uint8_t *block)
+static uint64_t encode_rgtc_indices(const uint8_t *input_r, const uint8_t *palette)
 {
-	uint8_t red0 = block[0];
-	uint8_t red1 = block[1];
-	uint64_t bits = 0;
-
-	for (int i = 0; i < 6; i++)
-		bits |= uint64_t(block[2 + i]) << (8 * i);
-
-	if (red0 > red1)
+	uint64_t block = 0;
+	for (int i = 0; i < 16; i++)
 	{
-		for (int i = 0; i < 16; i++)
+		int best_code = 0;
+		int best_diff = 256;
+		for (int code = 0; code < 8; code++)
 		{
-			int code = int((bits >> (3 * i)) & 7);
-			switch (code)
+			int diff = abs(int(input_r[i]) - int(palette[code]));
+			if (diff < best_diff)
 			{
-			default:
-			case 0:
-				output_r[i] = red0;
-				break;
-
-			case 1:
-				output_r[i] = red1;
-				break;
-
-			case 2:
-				output_r[i] = uint8_t(((red0 * 6 + red1 * 1) * div_7 + 0x80000) >> 20);
-				break;
-
-			case 3:
-				output_r[i] = uint8_t(((red0 * 5 + red1 * 2) * div_7 + 0x80000) >> 20);
-				break;
-
-			case 4:
-				output_r[i] = uint8_t(((red0 * 4 + red1 * 3) * div_7 + 0x80000) >> 20);
-				break;
-
-			case 5:
-				output_r[i] = uint8_t(((red0 * 3 + red1 * 4) * div_7 + 0x80000) >> 20);
-				break;
-
-			case 6:
-				output_r[i] = uint8_t(((red0 * 2 + red1 * 5) * div_7 + 0x80000) >> 20);
-				break;
-
-			case 7:
-				output_r[i] = uint8_t(((red0 * 1 + red1 * 6) * div_7 + 0x80000) >> 20);
-				break;
+				best_diff = diff;
+				best_code = code;
 			}
 		}
+		block |= uint64_t(best_code) << (3 * i);
 	}
-	else
-	{
-		for (int i = 0; i < 16; i++)
-		{
-			int code = int((bits >> (3 * i)) & 7);
-			switch (code)
-			{
-			default:
-			case 0:
-				output_r[i] = red0;
-				break;
-
-			case 1:
-				output_r[i] = red1;
-				break;
-
-			case 2:
-				output_r[i] = uint8_t(((red0 * 4 + red1 * 1) * div_5 + 0x80000) >> 20);
-				break;
-
-			case 3:
-				output_r[i] = uint8_t(((red0 * 3 + red1 * 2) * div_5 + 0x80000) >> 20);
-				break;
-
-			case 4:
-				output_r[i] = uint8_t(((red0 * 2 + red1 * 3) * div_5 + 0x80000) >> 20);
-				break;
+	return block;
+}
 
-			case 5:
-				output_r[i] = uint8_t(((red0 * 1 + red1 * 4) * div_5 + 0x80000) >> 20);
-				break;
+void decompress_rgtc_red_block(uint8_t *output_r, const uint8_t *block)
+{
+	uint8_t palette[8];
+	build_rgtc_palette(palette, block[0], block[1]);
 
-			case 6:
-				output_r[i] = 0;
-				break;
+	uint64_t bits = 0;
+	for (int i = 0; i < 6; i++)
+		bits |= uint64_t(block[2 + i]) << (8 * i);
 
-			case 7:
-				output_r[i] = 255;
-				break;
-			}
-		}
-	}
+	for (int i = 0; i < 16; i++)
+		output_r[i] = palette[(bits >> (3 * i)) & 7];
 }
 
-void compress_rgtc_red_block(uint8_t *output_r, const uint8_t *input_r)
+void compress_rgtc_red_block(uint8_t *output_r, const uint8_t *input_r, unsigned quality)
 {
 	int block_lo = 255;
 	int block_hi = 0;
@@ -176,174 +136,65 @@ void compress_rgtc_red_block(uint8_t *output_r, const uint8_t *input_r)
 		block_hi = max<int>(block_hi, input_r[i]);
 	}
 
-	uint64_t block = 0;
-	uint8_t encode_0 = 0;
-	uint8_t encode_1 = 0;
-
-	int range = block_hi - block_lo;
-
-	if (range == 0)
-	{
-		encode_0 = uint8_t(block_hi);
-		encode_1 = uint8_t(block_lo);
-	}
-	else if (range < range_threshold)
-	{
-		// Simple case, range is small enough that we can directly quantize and be done with it.
-		int divider = divider_lut.lut7(range);
-
-		encode_0 = uint8_t(block_hi);
-		encode_1 = uint8_t(block_lo);
+	int encode_0 = block_hi;
+	int encode_1 = block_lo;
+	uint8_t palette[8];
+	build_rgtc_palette(palette, encode_0, encode_1);
+	int best_error = rgtc_palette_error(input_r, palette);
 
-		for (int i = 0; i < 16; i++)
+	const auto try_endpoints = [&](int red0, int red1) {
+		build_rgtc_palette(palette, red0, red1);
+		int error = rgtc_palette_error(input_r, palette);
+		if (error < best_error)
 		{
-			int code = ((input_r[i] - block_lo) * divider + 0x80000) >> 20;
-			assert(code <= 7);
-
-			if (code == 7)
-				code = 0;
-			else if (code == 0)
-				code = 1;
-			else
-				code = 8 - code;
-
-			block |= uint64_t(code) << (3 * i);
+			best_error = error;
+			encode_0 = red0;
+			encode_1 = red1;
 		}
-	}
-	else
-	{
-		int divider = divider_lut.lut7(range);
-		encode_0 = uint8_t(block_hi);
-		encode_1 = uint8_t(block_lo);
+	};
 
-		int best_error = 0;
-		int lo_index = 0;
-		int hi_index = 15;
-		bool use_5_weight = false;
-
-		for (int i = 0; i < 16; i++)
-		{
-			int code = ((input_r[i] - block_lo) * divider + 0x80000) >> 20;
-			assert(code <= 7);
-			int interpolated_value = block_lo + ((range * code * div_7 + 0x80000) >> 20);
-
-			if (code == 7)
-				code = 0;
-			else if (code == 0)
-				code = 1;
-			else
-				code = 8 - code;
-
-			int diff = interpolated_value - input_r[i];
-			best_error += diff * diff;
-
-			block |= uint64_t(code) << (3 * i);
-		}
-
-		int sorted_block[16];
-		for (int i = 0; i < 16; i++)
-			sorted_block[i] = input_r[i];
+	// Search the 6 value mode, where values outside the endpoints can snap to 0 or 255 instead.
+	if (quality >= 2 && best_error != 0)
+	{
+		uint8_t sorted_block[16];
+		memcpy(sorted_block, input_r, sizeof(sorted_block));
 		sort(begin(sorted_block), end(sorted_block));
+		int count = int(unique(begin(sorted_block), end(sorted_block)) - begin(sorted_block));
 
-		for (int lo = 0; lo < 15; lo++)
-		{
-			for (int hi = lo; hi < 15; hi++)
-			{
-				int partition_lo = sorted_block[lo];
-				int partition_hi = sorted_block[hi];
-				assert(partition_hi >= partition_lo);
-				int range = partition_hi - partition_lo;
-				int divider = divider_lut.lut5(range);
-
-				int error = 0;
-
-				// Consider that we can quantize to 0.0 as well.
-				for (int i = 0; i < lo; i++)
-				{
-					int diff = min(sorted_block[i] - 0, partition_lo - sorted_block[i]);
-					error += diff * diff;
-				}
-
-				for (int i = lo; i <= hi; i++)
-				{
-					int code = ((sorted_block[i] - partition_lo) * divider + 0x80000) >> 20;
-					assert(code <= 7);
-					int interpolated_value = partition_lo + ((range * code * div_5 + 0x80000) >> 20);
-					int diff = interpolated_value - sorted_block[i];
-					error += diff * diff;
-				}
-
-				// Consider that we can quantize to 1.0 as well.
-				for (int i = hi + 1; i <= 15; i++)
-				{
-					int diff = min(255 - sorted_block[i], sorted_block[i] - partition_hi);
-					error += diff * diff;
-				}
-
-				if (error < best_error)
-				{
-					lo_index = lo;
-					hi_index = hi;
-					best_error = error;
-					use_5_weight = true;
-				}
-			}
-		}
+		for (int lo = 0; lo < count && best_error != 0; lo++)
+			for (int hi = lo; hi < count; hi++)
+				try_endpoints(sorted_block[lo], sorted_block[hi]);
+	}
 
-		// Did we find a better partition?
-		if (use_5_weight)
+	// Jitter the 8 value endpoints around the block extremes.
+	if (quality >= 4 && best_error != 0 && block_hi > block_lo)
+	{
+		int radius = quality >= 5 ? 4 : 2;
+		for (int d0 = -radius; d0 <= radius; d0++)
 		{
-			int partition_lo = sorted_block[lo_index];
-			int partition_hi = sorted_block[hi_index];
-			encode_0 = uint8_t(partition_lo);
-			encode_1 = uint8_t(partition_hi);
-
-			block = 0;
-			assert(partition_hi >= partition_lo);
-			int range = partition_hi - partition_lo;
-			int divider = divider_lut.lut5(range);
-
-			for (int i = 0; i < 16; i++)
+			for (int d1 = -radius; d1 <= radius; d1++)
 			{
-				int code;
-				if (input_r[i] < partition_lo)
-				{
-					if ((input_r[i] - 0) < (partition_lo - input_r[i]))
-						code = 6;
-					else
-						code = 0;
-				}
-				else if (input_r[i] > partition_hi)
-				{
-					if ((255 - input_r[i]) < (input_r[i] - partition_hi))
-						code = 7;
-					else
-						code = 1;
-				}
-				else
-				{
-					code = ((input_r[i] - partition_lo) * divider + 0x80000) >> 20;
-					assert(code <= 5);
-					if (code == 5)
-						code = 1;
-					else if (code != 0)
-						code++;
-				}
-
-				block |= uint64_t(code) << (3 * i);
+				int red0 = block_hi + d0;
+				int red1 = block_lo + d1;
+				if (red0 > 255 || red1 < 0 || red0 <= red1)
+					continue;
+				try_endpoints(red0, red1);
 			}
 		}
 	}
 
-	output_r[0] = encode_0;
-	output_r[1] = encode_1;
+	build_rgtc_palette(palette, encode_0, encode_1);
+	uint64_t block = encode_rgtc_indices(input_r, palette);
+
+	output_r[0] = uint8_t(encode_0);
+	output_r[1] = uint8_t(encode_1);
 	for (int i = 0; i < 6; i++)
 		output_r[2 + i] = uint8_t((block >> (8 * i)) & 0xff);
 }
 
-void compress_rgtc_red_green_block(uint8_t *output_rg, const uint8_t *input_r, const uint8_t *input_g)
+void compress_rgtc_red_green_block(uint8_t *output_rg, const uint8_t *input_r, const uint8_t *input_g, unsigned quality)
 {
-	compress_rgtc_red_block(output_rg, input_r);
-	compress_rgtc_red_block(output_rg + 8, input_g);
+	compress_rgtc_red_block(output_rg, input_r, quality);
+	compress_rgtc_red_block(output_rg + 8, input_g, quality);
 }
 }
\ No newline at end of file
@@ -26,7 +26,8 @@
 
 namespace Granite
 {
-void compress_rgtc_red_block(uint8_t *output_r, const uint8_t *input_r);
-void compress_rgtc_red_green_block(uint8_t *output_rg, const uint8_t *input_r, const uint8_t *input_g);
+// quality is 1 (fastest) to 5 (best), as in CompressorArguments.
+void compress_rgtc_red_block(uint8_t *output_r, const uint8_t *input_r, unsigned quality = 3);
+void compress_rgtc_red_green_block(uint8_t *output_rg, const uint8_t *input_r, const uint8_t *input_g, unsigned quality = 3);
 void decompress_rgtc_red_block(uint8_t *output_r, const uint8_t *block);
 }
\ No newline at end of file
@@ -22,12 +22,12 @@
 
 #include "scene_formats.hpp"
 #include <string.h>
-#include <unordered_map>
 #include <unordered_set>
 #include <vector>
 #include <mikktspace/mikktspace.h>
 #include "meshoptimizer.h"
 #include "mikktspace.h"
+#include "texture_format.hpp"
 
 using namespace Util;
 using namespace std;
@@ -49,34 +49,61 @@ struct IndexRemapping
 	std::vector<unsigned> unique_attrib_to_source_index;
 };
 
+static Hash hash_vertex(const Mesh &mesh, unsigned index)
+{
+	Hasher h;
+	h.data(mesh.positions.data() + index * mesh.position_stride, mesh.position_stride);
+	if (!mesh.attributes.empty())
+		h.data(mesh.attributes.data() + index * mesh.attribute_stride, mesh.attribute_stride);
+	return h.get();
+}
+
+static bool vertex_equal(const Mesh &mesh, unsigned a, unsigned b)
+{
+	if (memcmp(mesh.positions.data() + a * mesh.position_stride,
+	           mesh.positions.data() + b * mesh.position_stride,
+	           mesh.position_stride) != 0)
+		return false;
+
+	return mesh.attributes.empty() ||
+	       memcmp(mesh.attributes.data() + a * mesh.attribute_stride,
+	              mesh.attributes.data() + b * mesh.attribute_stride,
+	              mesh.attribute_stride) == 0;
+}
+
 // Find duplicate indices.
+// Open addressing with linear probing, slots hold the unique vertex index.
+// Vertices are compared bytewise, so hash collisions cannot merge distinct vertices.
 static IndexRemapping build_index_remap_list(const Mesh &mesh)
 {
 	unsigned attribute_count = unsigned(mesh.positions.size() / mesh.position_stride);
-	unordered_map<Hash, unsigned> attribute_remapper;
 	IndexRemapping remapped;
 	remapped.index_remap.reserve(attribute_count);
 
-	unsigned unique_count = 0;
+	size_t table_size = 16;
+	while (table_size < size_t(attribute_count) * 2)
+		table_size <<= 1;
+	size_t mask = table_size - 1;
+	vector<unsigned> table(table_size, ~0u);
+
 	for (unsigned i = 0; i < attribute_count; i++)
 	{
-		Hasher h;
-		h.data(mesh.positions.data() + i * mesh.position_stride, mesh.position_stride);
-		if (!mesh.attributes.empty())
-			h.data(mesh.attributes.data() + i * mesh.attribute_stride, mesh.attribute_stride);
-
-		auto hash = h.get();
-		auto itr = attribute_remapper.find(hash);
-		if (itr != end(attribute_remapper))
+		for (size_t slot = hash_vertex(mesh, i) & mask; ; slot = (slot + 1) & mask)
 		{
-			remapped.index_remap.push_back(itr->second);
-		}
-		else
-		{
-			attribute_remapper[hash] = unique_count;
-			remapped.index_remap.push_back(unique_count);
-			remapped.unique_attrib_to_source_index.push_back(i);
-			unique_count++;
+			unsigned unique_index = table[slot];
+			if (unique_index == ~0u)
+			{
+				unique_index = unsigned(remapped.unique_attrib_to_source_index.size());
+				table[slot] = unique_index;
+				remapped.index_remap.push_back(unique_index);
+				remapped.unique_attrib_to_source_index.push_back(i);
+				break;
+			}
+			else if (vertex_equal(mesh, remapped.unique_attrib_to_source_index[unique_index], i))
+			{
+				remapped.index_remap.push_back(unique_index);
+				break;
+			}
 		}
 	}
 
@@ -240,7 +267,7 @@ void mesh_deduplicate_vertices(Mesh &mesh)
 	mesh.count = unsigned(index_buffer.size());
 }
 
-Mesh mesh_optimize_index_buffer(const Mesh &mesh, bool stripify)
+Mesh mesh_optimize_index_buffer(const Mesh &mesh, bool stripify, bool optimize_overdraw)
 {
 	if (mesh.topology != VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST)
 		return mesh;
@@ -262,6 +289,16 @@ Mesh mesh_optimize_index_buffer(const Mesh &mesh, bool stripify)
 	meshopt_optimizeVertexCache(index_buffer.data(), index_buffer.data(), index_buffer.size(),
 	                            vertex_count);
 
+	// Reorder clusters of triangles to reduce overdraw, trading at most 5% vertex cache efficiency.
+	auto position_format = mesh.attribute_layout[ecast(MeshAttribute::Position)].format;
+	if (optimize_overdraw &&
+	    (position_format == VK_FORMAT_R32G32B32_SFLOAT || position_format == VK_FORMAT_R32G32B32A32_SFLOAT))
+	{
+		meshopt_optimizeOverdraw(index_buffer.data(), index_buffer.data(), index_buffer.size(),
+		                         reinterpret_cast<const float *>(optimized.positions.data()), vertex_count,
+		                         optimized.position_stride, 1.05f);
+	}
+
 	// Remap vertex fetch to get contiguous indices as much as possible.
 	vector<uint32_t> remap_table(optimized.positions.size() / optimized.position_stride);
 	meshopt_optimizeVertexFetchRemap(remap_table.data(), index_buffer.data(), index_buffer.size(), vertex_count);
@@ -482,6 +519,156 @@ bool mesh_flip_tangents_w(Mesh &mesh)
 	return true;
 }
 
+static vec2 encode_octahedral(vec3 n)
+{
+	n /= muglm::abs(n.x) + muglm::abs(n.y) + muglm::abs(n.z);
+	vec2 p = vec2(n.x, n.y);
+	if (n.z < 0.0f)
+	{
+		p = vec2((1.0f - muglm::abs(n.y)) * (n.x >= 0.0f ? 1.0f : -1.0f),
+		         (1.0f - muglm::abs(n.x)) * (n.y >= 0.0f ? 1.0f : -1.0f));
+	}
+	return p;
+}
+
+static int16_t quantize_snorm16(float v)
+{
+	return int16_t(muglm::round(muglm::clamp(v, -1.0f, 1.0f) * 32767.0f));
+}
+
+bool mesh_compact_vertices(Mesh &mesh, vec3 &position_scale, vec3 &position_offset)
+{
+	auto &layout = mesh.attribute_layout;
+	auto position_format = layout[ecast(MeshAttribute::Position)].format;
+	if (position_format != VK_FORMAT_R32G32B32_SFLOAT && position_format != VK_FORMAT_R32G32B32A32_SFLOAT)
+		return false;
+
+	auto normal_format = layout[ecast(MeshAttribute::Normal)].format;
+	if (normal_format != VK_FORMAT_UNDEFINED && normal_format != VK_FORMAT_R32G32B32_SFLOAT)
+		return false;
+
+	auto tangent_format = layout[ecast(MeshAttribute::Tangent)].format;
+	if (tangent_format != VK_FORMAT_UNDEFINED && tangent_format != VK_FORMAT_R32G32B32A32_SFLOAT)
+		return false;
+
+	size_t count = mesh.positions.size() / mesh.position_stride;
+	if (!count)
+		return false;
+
+	// Decode with the actual bounds of the vertices rather than trusting static_aabb.
+	vec3 lo = vec3(numeric_limits<float>::max());
+	vec3 hi = vec3(-numeric_limits<float>::max());
+	for (size_t i = 0; i < count; i++)
+	{
+		auto &p = *reinterpret_cast<const vec3 *>(mesh.positions.data() + i * mesh.position_stride);
+		lo = min(lo, p);
+		hi = max(hi, p);
+	}
+
+	position_offset = lo;
+	position_scale = hi - lo;
+	vec3 inv_scale = vec3(1.0f) / max(position_scale, vec3(numeric_limits<float>::min()));
+
+	vector<uint8_t> positions(count * sizeof(u16vec4));
+	for (size_t i = 0; i < count; i++)
+	{
+		auto &p = *reinterpret_cast<const vec3 *>(mesh.positions.data() + i * mesh.position_stride);
+		vec3 unorm = clamp((p - lo) * inv_scale, vec3(0.0f), vec3(1.0f));
+		u16vec4 q(u16vec3(round(unorm * 65535.0f)), 0xffffu);
+		memcpy(positions.data() + i * sizeof(u16vec4), q.data, sizeof(u16vec4));
+	}
+
+	// Everything but normals, tangents and UVs is copied as-is.
+	// UVs become half floats as long as that keeps reasonable precision.
+	// Half floats have 10 mantissa bits, so steps are 1/1024 in [1, 2), which is about a texel of a 1K texture.
+	// Beyond that, tiling UVs would visibly swim, so they stay 32-bit float.
+	MeshAttributeLayout new_layout[ecast(MeshAttribute::Count)] = {};
+	new_layout[ecast(MeshAttribute::Position)].format = VK_FORMAT_R16G16B16A16_UNORM;
+
+	auto uv_format = layout[ecast(MeshAttribute::UV)].format;
+	bool uv_to_half = false;
+	if (uv_format == VK_FORMAT_R32G32_SFLOAT)
+	{
+		uv_to_half = true;
+		for (size_t i = 0; i < count && uv_to_half; i++)
+		{
+			auto &uv = *reinterpret_cast<const vec2 *>(mesh.attributes.data() + i * mesh.attribute_stride +
+			                                          layout[ecast(MeshAttribute::UV)].offset);
+			uv_to_half = all(lessThanEqual(abs(uv), vec2(2.0f)));
+		}
+	}
+
+	uint32_t attribute_stride = 0;
+	for (unsigned i = 0; i < ecast(MeshAttribute::Count); i++)
+	{
+		auto attr = static_cast<MeshAttribute>(i);
+		if (attr == MeshAttribute::Position || layout[i].format == VK_FORMAT_UNDEFINED)
+			continue;
+
+		VkFormat format = layout[i].format;
+		if (attr == MeshAttribute::Normal || attr == MeshAttribute::Tangent)
+			format = VK_FORMAT_R16G16_SNORM;
+		else if (attr == MeshAttribute::UV && uv_to_half)
+			format = VK_FORMAT_R16G16_SFLOAT;
+
+		new_layout[i].format = format;
+		new_layout[i].offset = attribute_stride;
+		attribute_stride += (Vulkan::TextureFormatLayout::format_block_size(format) + 3) & ~3u;
+	}
+
+	vector<uint8_t> attributes(count * attribute_stride);
+	for (size_t v = 0; v < count; v++)
+	{
+		const uint8_t *src = mesh.attributes.data() + v * mesh.attribute_stride;
+		uint8_t *dst = attributes.data() + v * attribute_stride;
+
+		for (unsigned i = 0; i < ecast(MeshAttribute::Count); i++)
+		{
+			auto attr = static_cast<MeshAttribute>(i);
+			if (attr == MeshAttribute::Position || layout[i].format == VK_FORMAT_UNDEFINED)
+				continue;
+
+			if (attr == MeshAttribute::Normal)
+			{
+				vec3 n;
+				memcpy(n.data, src + layout[i].offset, sizeof(vec3));
+				vec2 oct = encode_octahedral(n);
+				int16_t q[2] = { quantize_snorm16(oct.x), quantize_snorm16(oct.y) };
+				memcpy(dst + new_layout[i].offset, q, sizeof(q));
+			}
+			else if (attr == MeshAttribute::Tangent)
+			{
+				// The sign of w is folded into y, which is remapped to [0, 1] so it cannot be zero.
+				vec4 t;
+				memcpy(t.data, src + layout[i].offset, sizeof(vec4));
+				vec2 oct = encode_octahedral(t.xyz());
+				float y = muglm::max(oct.y * 0.5f + 0.5f, 1.0f / 32767.0f);
+				int16_t q[2] = { quantize_snorm16(oct.x), quantize_snorm16(t.w < 0.0f ? -y : y) };
+				memcpy(dst + new_layout[i].offset, q, sizeof(q));
+			}
+			else if (attr == MeshAttribute::UV && uv_to_half)
+			{
+				vec2 uv;
+				memcpy(uv.data, src + layout[i].offset, sizeof(vec2));
+				u16vec2 h = floatToHalf(uv);
+				memcpy(dst + new_layout[i].offset, h.data, sizeof(u16vec2));
+			}
+			else
+			{
+				memcpy(dst + new_layout[i].offset, src + layout[i].offset,
+				       Vulkan::TextureFormatLayout::format_block_size(layout[i].format));
+			}
+		}
+	}
+
+	mesh.positions = move(positions);
+	mesh.position_stride = sizeof(u16vec4);
+	mesh.attributes = move(attributes);
+	mesh.attribute_stride = attribute_stride;
+	memcpy(mesh.attribute_layout, new_layout, sizeof(new_layout));
+	return true;
+}
+
 bool mesh_recompute_normals(Mesh &mesh)
 {
 	if (mesh.attribute_layout[ecast(MeshAttribute::Position)].format != VK_FORMAT_R32G32B32_SFLOAT &&
@@ -572,7 +759,7 @@ bool mesh_recompute_normals(Mesh &mesh)
 	return true;
 }
 
-static void touch_node_children(unordered_set<uint32_t> &touched, const vector<Node> &nodes, uint32_t index)
+static void touch_node_children(unordered_set<uint32_t> &touched, const ArrayView<const Node> &nodes, uint32_t index)
 {
 	touched.insert(index);
 	for (auto &child : nodes[index].children)
@@ -582,7 +769,7 @@ static void touch_node_children(unordered_set<uint32_t> &touched, const vector<N
 	}
 }
 
-unordered_set<uint32_t> build_used_nodes_in_scene(const SceneNodes &scene, const vector<Node> &nodes)
+unordered_set<uint32_t> build_used_nodes_in_scene(const SceneNodes &scene, const ArrayView<const Node> &nodes)
 {
 	unordered_set<uint32_t> touched;
 	for (auto &node : scene.node_indices)
@@ -272,8 +272,15 @@ bool mesh_renormalize_normals(Mesh &mesh);
 bool mesh_renormalize_tangents(Mesh &mesh);
 bool mesh_flip_tangents_w(Mesh &mesh);
 
+// Rewrites vertex streams into the compact layout decoded by static_mesh.vert with HAVE_COMPACT_VERTEX:
+// RGBA16_UNORM positions which decode to position * position_scale + position_offset,
+// octahedral RG16_SNORM normals and tangents (tangent w is folded into the sign of y),
+// and half float UVs if every UV is within [-2, 2].
+// Returns false and leaves the mesh untouched if it does not have 32-bit float positions, normals and tangents.
+bool mesh_compact_vertices(Mesh &mesh, vec3 &position_scale, vec3 &position_offset);
+
 void mesh_deduplicate_vertices(Mesh &mesh);
-Mesh mesh_optimize_index_buffer(const Mesh &mesh, bool stripify);
-std::unordered_set<uint32_t> build_used_nodes_in_scene(const SceneNodes &scene, const std::vector<Node> &nodes);
+Mesh mesh_optimize_index_buffer(const Mesh &mesh, bool stripify, bool optimize_overdraw);
+std::unordered_set<uint32_t> build_used_nodes_in_scene(const SceneNodes &scene, const Util::ArrayView<const Node> &nodes);
 }
 }
@@ -35,7 +35,7 @@
 #endif
 
 #include "rgtc_compressor.hpp"
-#define RGTC_DEBUG
+#include "bc_compressor.hpp"
 
 using namespace std;
 
@@ -55,10 +55,18 @@ VkFormat string_to_format(const string &s)
 		return VK_FORMAT_BC1_RGB_UNORM_BLOCK;
 	else if (s == "bc1_srgb")
 		return VK_FORMAT_BC1_RGB_SRGB_BLOCK;
+	else if (s == "bc1_rgba_unorm")
+		return VK_FORMAT_BC1_RGBA_UNORM_BLOCK;
+	else if (s == "bc1_rgba_srgb")
+		return VK_FORMAT_BC1_RGBA_SRGB_BLOCK;
 	else if (s == "bc3_unorm")
 		return VK_FORMAT_BC3_UNORM_BLOCK;
 	else if (s == "bc3_srgb")
 		return VK_FORMAT_BC3_SRGB_BLOCK;
+	else if (s == "bc4_unorm")
+		return VK_FORMAT_BC4_UNORM_BLOCK;
+	else if (s == "bc5_unorm")
+		return VK_FORMAT_BC5_UNORM_BLOCK;
 	else if (s == "rgba8_unorm")
 		return VK_FORMAT_R8G8B8A8_UNORM;
 	else if (s == "rgba8_srgb")
@@ -159,7 +167,7 @@ struct CompressorState : enable_shared_from_this<CompressorState>
 	void enqueue_compression(ThreadGroup &group, const CompressorArguments &args);
 	void enqueue_compression_block_ispc(TaskGroup &group, const CompressorArguments &args, unsigned layer, unsigned level);
 	void enqueue_compression_block_astc(TaskGroup &group, const CompressorArguments &args, unsigned layer, unsigned level, TextureMode mode);
-	void enqueue_compression_block_rgtc(TaskGroup &group, const CompressorArguments &args, unsigned layer, unsigned level);
+	void enqueue_compression_block_bc(TaskGroup &group, const CompressorArguments &args, unsigned layer, unsigned level);
 
 	double total_error[4] = {};
 	mutex lock;
@@ -335,6 +343,8 @@ void CompressorState::setup(const CompressorArguments &args)
 		}
 		break;
 
+#endif
+
 	case VK_FORMAT_BC1_RGB_SRGB_BLOCK:
 	case VK_FORMAT_BC1_RGB_UNORM_BLOCK:
 	case VK_FORMAT_BC1_RGBA_SRGB_BLOCK:
@@ -349,7 +359,6 @@ void CompressorState::setup(const CompressorArguments &args)
 			return;
 		}
 		break;
-#endif
 
 	case VK_FORMAT_ASTC_4x4_UNORM_BLOCK:
 	case VK_FORMAT_ASTC_4x4_SRGB_BLOCK:
@@ -405,102 +414,159 @@ void CompressorState::setup(const CompressorArguments &args)
 	}
 }
 
-void CompressorState::enqueue_compression_block_rgtc(TaskGroup &group, const CompressorArguments &args, unsigned layer, unsigned level)
+#ifdef BC_DEBUG
+// Accumulates squared error per channel for the texels of a block which are inside the image.
+static void accumulate_block_error(VkFormat format, const uint8_t *block, const uint8_t *rgba,
+                                   int valid_x, int valid_y, double *error)
+{
+	uint8_t decoded[16 * 4];
+	unsigned num_channels = 0;
+	bool alpha = false;
+
+	switch (format)
+	{
+	case VK_FORMAT_BC1_RGBA_SRGB_BLOCK:
+	case VK_FORMAT_BC1_RGBA_UNORM_BLOCK:
+		alpha = true;
+		// Fallthrough
+	case VK_FORMAT_BC1_RGB_SRGB_BLOCK:
+	case VK_FORMAT_BC1_RGB_UNORM_BLOCK:
+		decompress_bc1_block(decoded, block);
+		num_channels = 3;
+		break;
+
+	case VK_FORMAT_BC3_SRGB_BLOCK:
+	case VK_FORMAT_BC3_UNORM_BLOCK:
+		decompress_bc3_block(decoded, block);
+		num_channels = 3;
+		alpha = true;
+		break;
+
+	case VK_FORMAT_BC4_UNORM_BLOCK:
+	case VK_FORMAT_BC5_UNORM_BLOCK:
+	{
+		uint8_t red[16], green[16];
+		decompress_rgtc_red_block(red, block);
+		if (format == VK_FORMAT_BC5_UNORM_BLOCK)
+			decompress_rgtc_red_block(green, block + 8);
+		for (unsigned i = 0; i < 16; i++)
+		{
+			decoded[4 * i + 0] = red[i];
+			decoded[4 * i + 1] = format == VK_FORMAT_BC5_UNORM_BLOCK ? green[i] : 0;
+		}
+		num_channels = format == VK_FORMAT_BC5_UNORM_BLOCK ? 2 : 1;
+		break;
+	}
+
+	default:
+		return;
+	}
+
+	for (int y = 0; y < valid_y; y++)
+	{
+		for (int x = 0; x < valid_x; x++)
+		{
+			unsigned i = 4 * (y * 4 + x);
+			for (unsigned c = 0; c < num_channels; c++)
+			{
+				double diff = double(decoded[i + c]) - double(rgba[i + c]);
+				error[c] += diff * diff;
+			}
+
+			if (alpha)
+			{
+				double diff = double(decoded[i + 3]) - double(rgba[i + 3]);
+				error[3] += diff * diff;
+			}
+		}
+	}
+}
+#endif
+
+void CompressorState::enqueue_compression_block_bc(TaskGroup &group, const CompressorArguments &args, unsigned layer, unsigned level)
 {
 	auto &layout = input->get_layout();
 	int width = layout.get_width(level);
 	int height = layout.get_height(level);
 	int blocks_x = (width + block_size_x - 1) / block_size_x;
+	unsigned block_size = Vulkan::TextureFormatLayout::format_block_size(args.format);
 
+	// One task per row of blocks. Single blocks are too cheap to be worth a task each.
 	for (int y = 0; y < height; y += block_size_y)
 	{
-		for (int x = 0; x < width; x += block_size_x)
-		{
-			group->enqueue_task([=, format = args.format]() {
-				uint8_t padded_red[4 * 4];
-				uint8_t padded_green[4 * 4];
-				auto *src = static_cast<const uint8_t *>(layout.data(layer, level));
-
-				const auto get_block_data = [&](int block_size) -> uint8_t * {
-					auto *dst = static_cast<uint8_t *>(output->get_layout().data(layer, level));
-					dst += (x / block_size_x) * block_size;
-					dst += (y / block_size_y) * blocks_x * block_size;
-					return dst;
-				};
-
-				const auto get_encode_data = [&](int block_size) -> uint8_t * {
-					return get_block_data(block_size);
-				};
-
-				const auto get_component = [&](int sx, int sy, int c) -> uint8_t {
-					sx = std::min(sx, width - 1);
-					sy = std::min(sy, height - 1);
-					return src[4 * (sy * width + sx) + c];
-				};
+		group->enqueue_task([=, format = args.format, quality = args.quality]() {
+			uint8_t padded_rgba[4 * 4 * 4];
+			uint8_t padded_red[4 * 4];
+			uint8_t padded_green[4 * 4];
+			auto *src = static_cast<const uint8_t *>(layout.data(layer, level));
+			auto *dst = static_cast<uint8_t *>(output->get_layout().data(layer, level));
+			dst += (y / block_size_y) * blocks_x * block_size;
+
+#ifdef BC_DEBUG
+			double error[4] = {};
+#endif
 
+			for (int x = 0; x < width; x += block_size_x, dst += block_size)
+			{
 				for (int sy = 0; sy < 4; sy++)
 				{
 					for (int sx = 0; sx < 4; sx++)
 					{
-						padded_red[sy * 4 + sx] = get_component(x + sx, y + sy, 0);
-						padded_green[sy * 4 + sx] = get_component(x + sx, y + sy, 1);
+						int cx = std::min(x + sx, width - 1);
+						int cy = std::min(y + sy, height - 1);
+						memcpy(&padded_rgba[4 * (sy * 4 + sx)], &src[4 * (cy * width + cx)], 4);
+						padded_red[sy * 4 + sx] = padded_rgba[4 * (sy * 4 + sx) + 0];
+						padded_green[sy * 4 + sx] = padded_rgba[4 * (sy * 4 + sx) + 1];
 					}
 				}
 
 				switch (format)
 				{
-				case VK_FORMAT_BC4_UNORM_BLOCK:
-				{
-					compress_rgtc_red_block(get_encode_data(8), padded_red);
+				case VK_FORMAT_BC1_RGB_SRGB_BLOCK:
+				case VK_FORMAT_BC1_RGB_UNORM_BLOCK:
+					compress_bc1_block(dst, padded_rgba, quality, false);
+					break;
 
-#ifdef RGTC_DEBUG
-					if (level == 0 && layer == 0)
-					{
-						uint8_t decoded_red[16];
-						decompress_rgtc_red_block(decoded_red, get_encode_data(8));
-						double error = 0.0;
-						for (int i = 0; i < 16; i++)
-							error += double((decoded_red[i] - padded_red[i]) * (decoded_red[i] - padded_red[i])) / (width * height);
-
-						lock_guard<mutex> l{lock};
-						total_error[0] += error;
-					}
-#endif
+				case VK_FORMAT_BC1_RGBA_SRGB_BLOCK:
+				case VK_FORMAT_BC1_RGBA_UNORM_BLOCK:
+					compress_bc1_block(dst, padded_rgba, quality, true);
 					break;
-				}
 
-				case VK_FORMAT_BC5_UNORM_BLOCK:
-				{
-					compress_rgtc_red_green_block(get_encode_data(16), padded_red, padded_green);
+				case VK_FORMAT_BC3_SRGB_BLOCK:
+				case VK_FORMAT_BC3_UNORM_BLOCK:
+					compress_bc3_block(dst, padded_rgba, quality);
+					break;
 
-#ifdef RGTC_DEBUG
-					if (level == 0 && layer == 0)
-					{
-						uint8_t decoded_red[16];
-						uint8_t decoded_green[16];
-						decompress_rgtc_red_block(decoded_red, get_encode_data(16));
-						decompress_rgtc_red_block(decoded_green, get_encode_data(16) + 8);
-
-						double error_red = 0.0;
-						double error_green = 0.0;
-						for (int i = 0; i < 16; i++)
-							error_red += double((decoded_red[i] - padded_red[i]) * (decoded_red[i] - padded_red[i])) / (width * height);
-						for (int i = 0; i < 16; i++)
-							error_green += double((decoded_green[i] - padded_green[i]) * (decoded_green[i] - padded_green[i])) / (width * height);
-
-						lock_guard<mutex> l{lock};
-						total_error[0] += error_red;
-						total_error[1] += error_green;
-					}
-#endif
+				case VK_FORMAT_BC4_UNORM_BLOCK:
+					compress_rgtc_red_block(dst, padded_red, quality);
+					break;
+
+				case VK_FORMAT_BC5_UNORM_BLOCK:
+					compress_rgtc_red_green_block(dst, padded_red, padded_green, quality);
 					break;
-				}
 
 				default:
 					break;
 				}
-			});
-		}
+
+#ifdef BC_DEBUG
+				if (level == 0 && layer == 0)
+				{
+					accumulate_block_error(format, dst, padded_rgba,
+					                       std::min(width - x, 4), std::min(height - y, 4), error);
+				}
+#endif
+			}
+
+#ifdef BC_DEBUG
+			if (level == 0 && layer == 0)
+			{
+				lock_guard<mutex> l{lock};
+				for (unsigned c = 0; c < 4; c++)
+					total_error[c] += error[c] / (width * height);
+			}
+#endif
+		});
 	}
 }
 
@@ -811,19 +877,26 @@ void CompressorState::enqueue_compression(ThreadGroup &group, const CompressorAr
 			{
 			case VK_FORMAT_BC4_UNORM_BLOCK:
 			case VK_FORMAT_BC5_UNORM_BLOCK:
-				enqueue_compression_block_rgtc(compression_task, args, layer, level);
+				enqueue_compression_block_bc(compression_task, args, layer, level);
 				break;
 
-#ifdef HAVE_ISPC
-			case VK_FORMAT_BC6H_UFLOAT_BLOCK:
-			case VK_FORMAT_BC7_SRGB_BLOCK:
-			case VK_FORMAT_BC7_UNORM_BLOCK:
 			case VK_FORMAT_BC1_RGB_SRGB_BLOCK:
 			case VK_FORMAT_BC1_RGB_UNORM_BLOCK:
 			case VK_FORMAT_BC1_RGBA_SRGB_BLOCK:
 			case VK_FORMAT_BC1_RGBA_UNORM_BLOCK:
 			case VK_FORMAT_BC3_SRGB_BLOCK:
 			case VK_FORMAT_BC3_UNORM_BLOCK:
+#ifdef HAVE_ISPC
+				enqueue_compression_block_ispc(compression_task, args, layer, level);
+#else
+				enqueue_compression_block_bc(compression_task, args, layer, level);
+#endif
+				break;
+
+#ifdef HAVE_ISPC
+			case VK_FORMAT_BC6H_UFLOAT_BLOCK:
+			case VK_FORMAT_BC7_SRGB_BLOCK:
+			case VK_FORMAT_BC7_UNORM_BLOCK:
 				enqueue_compression_block_ispc(compression_task, args, layer, level);
 				break;
 #endif
@@ -860,6 +933,10 @@ void CompressorState::enqueue_compression(ThreadGroup &group, const CompressorAr
 			LOGI("Red PSNR: %.f dB\n", 10.0 * log10(255.0 * 255.0 / state->total_error[0]));
 		if (state->total_error[1] != 0.0)
 			LOGI("Green PSNR: %.f dB\n", 10.0 * log10(255.0 * 255.0 / state->total_error[1]));
+		if (state->total_error[2] != 0.0)
+			LOGI("Blue PSNR: %.f dB\n", 10.0 * log10(255.0 * 255.0 / state->total_error[2]));
+		if (state->total_error[3] != 0.0)
+			LOGI("Alpha PSNR: %.f dB\n", 10.0 * log10(255.0 * 255.0 / state->total_error[3]));
 
 		LOGI("Unmapping %u bytes for texture writing.\n", unsigned(state->output->get_required_size()));
 		LOGI("Unmapping %u bytes for texture reading.\n", unsigned(state->input->get_required_size()));
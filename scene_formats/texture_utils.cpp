@@ -21,82 +21,379 @@
  */
 
 #include "texture_utils.hpp"
+#include "thread_group.hpp"
+#include <mutex>
+#include <vector>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 namespace Granite
 {
 namespace SceneFormats
 {
-struct MipmapGeneratorUnorm
+static const unsigned mip_tile_size = 128;
+static const float kaiser_radius = 3.0f;
+static const float kaiser_alpha = 4.0f;
+
+// sRGB decode is a plain table lookup. Encode finds the nearest 8-bit code by binary search over
+// the linear values halfway between codes, which is exact and avoids a pow() per channel.
+class SrgbLut
 {
-	inline vec4 sample(const Vulkan::TextureFormatLayout &layout, const uvec2 &coord,
-	                   uint32_t layer, uint32_t mip) const
+public:
+	SrgbLut() noexcept
 	{
-		u8vec4 &v = *layout.data_generic<u8vec4>(coord.x, coord.y, layer, mip);
-		return vec4(v) * (1.0f / 255.0f);
+		for (unsigned i = 0; i < 256; i++)
+		{
+			unorm_to_float[i] = float(i) / 255.0f;
+			srgb_to_linear[i] = gamma_to_linear(float(i) / 255.0f);
+		}
+
+		linear_thresholds[0] = 0.0f;
+		for (unsigned i = 1; i < 256; i++)
+			linear_thresholds[i] = gamma_to_linear((float(i) - 0.5f) / 255.0f);
 	}
 
-	inline void write(const Vulkan::TextureFormatLayout &layout, const uvec2 &coord,
-	                  uint32_t layer, uint32_t mip, const vec4 &v) const
+	float unorm_to_float[256];
+	float srgb_to_linear[256];
+
+	uint8_t linear_to_srgb(float v) const
 	{
-		auto q = clamp(round(v * 255.0f), vec4(0.0f), vec4(255.0f));
-		*layout.data_generic<u8vec4>(coord.x, coord.y, layer, mip) = u8vec4(q);
+		unsigned index = 0;
+		for (unsigned step = 128; step; step >>= 1)
+			if (v >= linear_thresholds[index + step])
+				index += step;
+		return uint8_t(index);
 	}
-};
 
-struct MipmapGeneratorSrgb
-{
-	static inline float srgb_gamma_to_linear(float v)
+private:
+	float linear_thresholds[256];
+
+	static float gamma_to_linear(float v)
 	{
 		if (v <= 0.04045f)
 			return v * (1.0f / 12.92f);
 		else
 			return muglm::pow((v + 0.055f) / (1.0f + 0.055f), 2.4f);
 	}
+};
+static SrgbLut srgb_lut;
+
+struct FilterTap
+{
+	uint32_t index;
+	float weight;
+};
+
+// Separable resampling kernel for one axis. Every destination texel has taps_per_texel taps,
+// with source indices clamped to the edge.
+struct FilterTaps
+{
+	std::vector<FilterTap> taps;
+	unsigned taps_per_texel = 0;
+
+	const FilterTap *get(unsigned dst_index) const
+	{
+		return &taps[dst_index * taps_per_texel];
+	}
+};
+
+static float bessel_i0(float x)
+{
+	float sum = 1.0f;
+	float term = 1.0f;
+	float half_x = 0.5f * x;
+	for (unsigned k = 1; k < 32; k++)
+	{
+		term *= (half_x / float(k)) * (half_x / float(k));
+		sum += term;
+		if (term < 1e-8f * sum)
+			break;
+	}
+	return sum;
+}
+
+static float kaiser_filter(float t)
+{
+	float x = t / kaiser_radius;
+	if (x <= -1.0f || x >= 1.0f)
+		return 0.0f;
+
+	float sinc = 1.0f;
+	if (t != 0.0f)
+		sinc = muglm::sin(pi<float>() * t) / (pi<float>() * t);
+
+	return sinc * bessel_i0(kaiser_alpha * muglm::sqrt(1.0f - x * x)) / bessel_i0(kaiser_alpha);
+}
+
+static FilterTaps compute_filter_taps(uint32_t src_size, uint32_t dst_size, MipmapFilter filter)
+{
+	FilterTaps result;
+	float scale = float(src_size) / float(dst_size);
+	float radius = (filter == MipmapFilter::Box ? 0.5f : kaiser_radius) * scale;
+	result.taps_per_texel = unsigned(muglm::ceil(2.0f * radius)) + 1;
+	result.taps.resize(dst_size * result.taps_per_texel);
+
+	for (uint32_t d = 0; d < dst_size; d++)
+	{
+		float center = (float(d) + 0.5f) * scale;
+		int first = int(muglm::floor(center - radius));
+		auto *taps = &result.taps[d * result.taps_per_texel];
+		float total = 0.0f;
+
+		for (unsigned k = 0; k < result.taps_per_texel; k++)
+		{
+			int s = first + int(k);
+			float w;
+			if (filter == MipmapFilter::Box)
+			{
+				// Box weight is the overlap of the source texel with the destination footprint.
+				float lo = muglm::max(float(s), center - radius);
+				float hi = muglm::min(float(s + 1), center + radius);
+				w = muglm::max(hi - lo, 0.0f);
+			}
+			else
+				w = kaiser_filter((float(s) + 0.5f - center) / scale);
+
+			taps[k].index = uint32_t(muglm::clamp(s, 0, int(src_size) - 1));
+			taps[k].weight = w;
+			total += w;
+		}
+
+		for (unsigned k = 0; k < result.taps_per_texel; k++)
+			taps[k].weight /= total;
+	}
+
+	return result;
+}
+
+static inline void accumulate_texel(float *dst, const float *src, float weight)
+{
+#ifdef __SSE2__
+	_mm_storeu_ps(dst, _mm_add_ps(_mm_loadu_ps(dst), _mm_mul_ps(_mm_loadu_ps(src), _mm_set1_ps(weight))));
+#else
+	for (unsigned c = 0; c < 4; c++)
+		dst[c] += src[c] * weight;
+#endif
+}
+
+static void accumulate_row(float *dst, const float *src, float weight, size_t count)
+{
+	size_t i = 0;
+	for (; i + 4 <= count; i += 4)
+		accumulate_texel(dst + i, src + i, weight);
+	for (; i < count; i++)
+		dst[i] += src[i] * weight;
+}
+
+struct MipLevelContext
+{
+	const Vulkan::TextureFormatLayout *layout;
+	uint32_t level;
+	bool srgb;
+	FilterTaps horizontal;
+	FilterTaps vertical;
+};
+
+static void decode_row(float *dst, const uint8_t *src, uint32_t count, bool srgb)
+{
+	const float *rgb_lut = srgb ? srgb_lut.srgb_to_linear : srgb_lut.unorm_to_float;
+	for (uint32_t i = 0; i < count; i++, dst += 4, src += 4)
+	{
+		dst[0] = rgb_lut[src[0]];
+		dst[1] = rgb_lut[src[1]];
+		dst[2] = rgb_lut[src[2]];
+		dst[3] = srgb_lut.unorm_to_float[src[3]];
+	}
+}
+
+static inline uint8_t encode_unorm(float v)
+{
+	return uint8_t(muglm::clamp(v * 255.0f + 0.5f, 0.0f, 255.0f));
+}
 
-	static inline float srgb_linear_to_gamma(float v)
+static void encode_row(uint8_t *dst, const float *src, uint32_t count, bool srgb)
+{
+	for (uint32_t i = 0; i < count; i++, dst += 4, src += 4)
 	{
-		if (v <= 0.0031308f)
-			return 12.92f * v;
+		if (srgb)
+		{
+			dst[0] = srgb_lut.linear_to_srgb(src[0]);
+			dst[1] = srgb_lut.linear_to_srgb(src[1]);
+			dst[2] = srgb_lut.linear_to_srgb(src[2]);
+		}
 		else
-			return (1.0f + 0.055f) * muglm::pow(v, 1.0f / 2.4f) - 0.055f;
+		{
+			dst[0] = encode_unorm(src[0]);
+			dst[1] = encode_unorm(src[1]);
+			dst[2] = encode_unorm(src[2]);
+		}
+		dst[3] = encode_unorm(src[3]);
+	}
+}
+
+// Filters one destination tile of a level from the previous level, which is already complete.
+static void generate_mip_tile(const MipLevelContext &ctx, uint32_t layer, uint32_t x0, uint32_t x1, uint32_t y0, uint32_t y1,
+                              uint64_t *alpha_histogram)
+{
+	auto &layout = *ctx.layout;
+	uint32_t tile_width = x1 - x0;
+
+	uint32_t sx_lo = ~0u, sx_hi = 0;
+	for (uint32_t x = x0; x < x1; x++)
+	{
+		auto *taps = ctx.horizontal.get(x);
+		for (unsigned k = 0; k < ctx.horizontal.taps_per_texel; k++)
+		{
+			sx_lo = muglm::min(sx_lo, taps[k].index);
+			sx_hi = muglm::max(sx_hi, taps[k].index);
+		}
 	}
 
-	static inline vec4 srgb_gamma_to_linear(const vec4 &v)
+	uint32_t sy_lo = ~0u, sy_hi = 0;
+	for (uint32_t y = y0; y < y1; y++)
 	{
-		return vec4(srgb_gamma_to_linear(v.x),
-		            srgb_gamma_to_linear(v.y),
-		            srgb_gamma_to_linear(v.z),
-		            v.w);
+		auto *taps = ctx.vertical.get(y);
+		for (unsigned k = 0; k < ctx.vertical.taps_per_texel; k++)
+		{
+			sy_lo = muglm::min(sy_lo, taps[k].index);
+			sy_hi = muglm::max(sy_hi, taps[k].index);
+		}
 	}
 
-	static inline vec4 srgb_linear_to_gamma(const vec4 &v)
+	std::vector<float> decoded((sx_hi - sx_lo + 1) * 4);
+	std::vector<float> horizontal((sy_hi - sy_lo + 1) * tile_width * 4);
+	std::vector<float> row(tile_width * 4);
+	std::vector<uint8_t> encoded(tile_width * 4);
+
+	for (uint32_t sy = sy_lo; sy <= sy_hi; sy++)
 	{
-		return vec4(srgb_linear_to_gamma(v.x),
-		            srgb_linear_to_gamma(v.y),
-		            srgb_linear_to_gamma(v.z),
-		            v.w);
+		decode_row(decoded.data(), layout.data_generic<u8vec4>(sx_lo, sy, layer, ctx.level - 1)->data,
+		           sx_hi - sx_lo + 1, ctx.srgb);
+
+		float *dst = &horizontal[(sy - sy_lo) * tile_width * 4];
+		memset(dst, 0, tile_width * 4 * sizeof(float));
+		for (uint32_t x = x0; x < x1; x++, dst += 4)
+		{
+			auto *taps = ctx.horizontal.get(x);
+			for (unsigned k = 0; k < ctx.horizontal.taps_per_texel; k++)
+				if (taps[k].weight != 0.0f)
+					accumulate_texel(dst, &decoded[(taps[k].index - sx_lo) * 4], taps[k].weight);
+		}
 	}
 
-	inline vec4 sample(const Vulkan::TextureFormatLayout &layout, const uvec2 &coord,
-	                   uint32_t layer, uint32_t mip) const
+	for (uint32_t y = y0; y < y1; y++)
 	{
-		u8vec4 &v = *layout.data_generic<u8vec4>(coord.x, coord.y, layer, mip);
-		return srgb_gamma_to_linear(vec4(v) * (1.0f / 255.0f));
+		memset(row.data(), 0, row.size() * sizeof(float));
+		auto *taps = ctx.vertical.get(y);
+		for (unsigned k = 0; k < ctx.vertical.taps_per_texel; k++)
+		{
+			if (taps[k].weight != 0.0f)
+			{
+				accumulate_row(row.data(), &horizontal[(taps[k].index - sy_lo) * tile_width * 4],
+				               taps[k].weight, row.size());
+			}
+		}
+
+		encode_row(encoded.data(), row.data(), tile_width, ctx.srgb);
+		memcpy(layout.data_generic<u8vec4>(x0, y, layer, ctx.level), encoded.data(), encoded.size());
+
+		if (alpha_histogram)
+			for (uint32_t x = 0; x < tile_width; x++)
+				alpha_histogram[encoded[4 * x + 3]]++;
 	}
+}
 
-	inline void write(const Vulkan::TextureFormatLayout &layout, const uvec2 &coord,
-	                  uint32_t layer, uint32_t mip, const vec4 &v) const
+template <typename Func>
+static void run_tasks(ThreadGroup *group, unsigned count, const Func &func)
+{
+	if (!group)
 	{
-		auto q = clamp(round(srgb_linear_to_gamma(v) * 255.0f), vec4(0.0f), vec4(255.0f));
-		*layout.data_generic<u8vec4>(coord.x, coord.y, layer, mip) = u8vec4(q);
+		for (unsigned i = 0; i < count; i++)
+			func(i);
+		return;
 	}
-};
 
-template <typename Ops>
-inline void generate_mipmaps(const Vulkan::TextureFormatLayout &dst_layout,
-                             const Vulkan::TextureFormatLayout &layout, const Ops &op)
+	auto task = group->create_task();
+	for (unsigned i = 0; i < count; i++)
+		task->enqueue_task([&func, i]() { func(i); });
+	task->flush();
+	task->wait();
+}
+
+static inline uint8_t scale_alpha(uint8_t alpha, float scale)
+{
+	return encode_unorm(float(alpha) * (1.0f / 255.0f) * scale);
+}
+
+// Coverage after scaling and requantizing, so it matches what ends up in the level.
+static double compute_alpha_coverage(const uint64_t *histogram, float scale, float cutoff)
+{
+	uint64_t covered = 0;
+	uint64_t total = 0;
+	for (unsigned i = 0; i < 256; i++)
+	{
+		if (float(scale_alpha(uint8_t(i), scale)) >= cutoff * 255.0f)
+			covered += histogram[i];
+		total += histogram[i];
+	}
+	return total ? double(covered) / double(total) : 0.0;
+}
+
+// Finds the alpha scale which brings coverage of a level closest to the reference by bisection.
+static float find_alpha_coverage_scale(const uint64_t *histogram, float cutoff, double reference)
+{
+	float lo = 0.0f;
+	float hi = 4.0f;
+	for (unsigned iter = 0; iter < 16; iter++)
+	{
+		float mid = 0.5f * (lo + hi);
+		if (compute_alpha_coverage(histogram, mid, cutoff) < reference)
+			lo = mid;
+		else
+			hi = mid;
+	}
+
+	double lo_error = muglm::abs(compute_alpha_coverage(histogram, lo, cutoff) - reference);
+	double hi_error = muglm::abs(compute_alpha_coverage(histogram, hi, cutoff) - reference);
+	return lo_error < hi_error ? lo : hi;
+}
+
+static void generate_mipmaps(const Vulkan::TextureFormatLayout &dst_layout, const Vulkan::TextureFormatLayout &layout,
+                             bool srgb, const MipmapGenerationOptions &options)
 {
-	memcpy(dst_layout.data(0, 0), layout.data(0, 0), dst_layout.get_layer_size(0) * layout.get_layers());
+	uint32_t layers = dst_layout.get_layers();
+
+	// Level 0 is a straight copy, split into chunks so huge images are copied in parallel too.
+	{
+		size_t total_size = dst_layout.get_layer_size(0) * layers;
+		const size_t chunk_size = 4 * 1024 * 1024;
+		auto *dst = static_cast<uint8_t *>(dst_layout.data(0, 0));
+		auto *src = static_cast<const uint8_t *>(layout.data(0, 0));
+		run_tasks(options.group, unsigned((total_size + chunk_size - 1) / chunk_size), [&](unsigned chunk) {
+			size_t offset = chunk * chunk_size;
+			memcpy(dst + offset, src + offset, muglm::min(chunk_size, total_size - offset));
+		});
+	}
+
+	bool preserve_coverage = options.alpha_coverage_cutoff > 0.0f;
+	std::vector<double> reference_coverage(layers);
+	std::vector<uint64_t> histograms(preserve_coverage ? layers * 256 : 0);
+	std::mutex histogram_lock;
+
+	if (preserve_coverage)
+	{
+		auto &mip = dst_layout.get_mip_info(0);
+		for (uint32_t layer = 0; layer < layers; layer++)
+		{
+			uint64_t *histogram = &histograms[layer * 256];
+			auto *src = static_cast<const uint8_t *>(dst_layout.data(layer, 0));
+			for (size_t i = 0; i < size_t(mip.block_row_length) * mip.block_image_height; i++)
+				histogram[src[4 * i + 3]]++;
+			reference_coverage[layer] = compute_alpha_coverage(histogram, 1.0f, options.alpha_coverage_cutoff);
+		}
+	}
 
 	for (uint32_t level = 1; level < dst_layout.get_levels(); level++)
 	{
@@ -106,44 +403,69 @@ inline void generate_mipmaps(const Vulkan::TextureFormatLayout &dst_layout,
 		uint32_t dst_width = dst_mip.block_row_length;
 		uint32_t dst_height = dst_mip.block_image_height;
 
-		uint32_t src_width = src_mip.block_row_length;
-		uint32_t src_height = src_mip.block_image_height;
-		uvec2 max_coord(src_width - 1u, src_height - 1u);
+		MipLevelContext ctx;
+		ctx.layout = &dst_layout;
+		ctx.level = level;
+		ctx.srgb = srgb;
+		ctx.horizontal = compute_filter_taps(src_mip.block_row_length, dst_width, options.filter);
+		ctx.vertical = compute_filter_taps(src_mip.block_image_height, dst_height, options.filter);
+
+		uint32_t tiles_x = (dst_width + mip_tile_size - 1) / mip_tile_size;
+		uint32_t tiles_y = (dst_height + mip_tile_size - 1) / mip_tile_size;
+
+		std::fill(histograms.begin(), histograms.end(), 0);
 
-		float src_width_f = float(src_mip.block_row_length);
-		float src_height_f = float(src_mip.block_image_height);
+		run_tasks(options.group, tiles_x * tiles_y * layers, [&](unsigned index) {
+			uint32_t layer = index / (tiles_x * tiles_y);
+			uint32_t tile_x = index % tiles_x;
+			uint32_t tile_y = (index / tiles_x) % tiles_y;
+			uint32_t x0 = tile_x * mip_tile_size;
+			uint32_t y0 = tile_y * mip_tile_size;
+
+			uint64_t local_histogram[256];
+			if (preserve_coverage)
+				memset(local_histogram, 0, sizeof(local_histogram));
+
+			generate_mip_tile(ctx, layer, x0, muglm::min(x0 + mip_tile_size, dst_width),
+			                  y0, muglm::min(y0 + mip_tile_size, dst_height),
+			                  preserve_coverage ? local_histogram : nullptr);
+
+			if (preserve_coverage)
+			{
+				std::lock_guard<std::mutex> holder{histogram_lock};
+				for (unsigned i = 0; i < 256; i++)
+					histograms[layer * 256 + i] += local_histogram[i];
+			}
+		});
 
-		float rescale_width = src_width_f / float(dst_width);
-		float rescale_height = src_height_f / float(dst_height);
+		if (!preserve_coverage)
+			continue;
 
-		for (uint32_t layer = 0; layer < dst_layout.get_layers(); layer++)
+		std::vector<float> alpha_scale(layers, 1.0f);
+		for (uint32_t layer = 0; layer < layers; layer++)
 		{
-			for (uint32_t y = 0; y < dst_height; y++)
+			if (reference_coverage[layer] > 0.0 && reference_coverage[layer] < 1.0)
 			{
-				float coord_y = (float(y) + 0.5f) * rescale_height - 0.5f;
-				for (uint32_t x = 0; x < dst_width; x++)
-				{
-					float coord_x = (float(x) + 0.5f) * rescale_width - 0.5f;
-					vec2 base_coord = vec2(coord_x, coord_y);
-					vec2 floor_coord = floor(base_coord);
-					vec2 uv = base_coord - floor_coord;
-					uvec2 c0(floor_coord);
-					uvec2 c1 = min(c0 + uvec2(1, 0), max_coord);
-					uvec2 c2 = min(c0 + uvec2(0, 1), max_coord);
-					uvec2 c3 = min(c0 + uvec2(1, 1), max_coord);
-
-					auto v0 = op.sample(dst_layout, c0, layer, level - 1);
-					auto v1 = op.sample(dst_layout, c1, layer, level - 1);
-					auto v2 = op.sample(dst_layout, c2, layer, level - 1);
-					auto v3 = op.sample(dst_layout, c3, layer, level - 1);
-
-					auto x0 = mix(v0, v1, uv.x);
-					auto x1 = mix(v2, v3, uv.x);
-					auto filtered = mix(x0, x1, uv.y);
-					op.write(dst_layout, uvec2(x, y), layer, level, filtered);
-				}
+				alpha_scale[layer] = find_alpha_coverage_scale(&histograms[layer * 256], options.alpha_coverage_cutoff,
+				                                               reference_coverage[layer]);
 			}
 		}
+
+		run_tasks(options.group, tiles_y * layers, [&](unsigned index) {
+			uint32_t layer = index / tiles_y;
+			float scale = alpha_scale[layer];
+			if (scale == 1.0f)
+				return;
+
+			uint32_t y0 = (index % tiles_y) * mip_tile_size;
+			uint32_t y1 = muglm::min(y0 + mip_tile_size, dst_height);
+			for (uint32_t y = y0; y < y1; y++)
+			{
+				auto *texel = dst_layout.data_generic<u8vec4>(0, y, layer, level);
+				for (uint32_t x = 0; x < dst_width; x++)
+					texel[x].w = scale_alpha(texel[x].w, scale);
+			}
+		});
 	}
 }
 
@@ -170,7 +492,8 @@ static void copy_dimensions(MemoryMappedTexture &mapped, const Vulkan::TextureFo
 	}
 }
 
-static void generate(const MemoryMappedTexture &mapped, const Vulkan::TextureFormatLayout &layout)
+static void generate(const MemoryMappedTexture &mapped, const Vulkan::TextureFormatLayout &layout,
+                     const MipmapGenerationOptions &options)
 {
 	auto &dst_layout = mapped.get_layout();
 
@@ -178,12 +501,12 @@ static void generate(const MemoryMappedTexture &mapped, const Vulkan::TextureFor
 	{
 	case VK_FORMAT_R8G8B8A8_SRGB:
 	case VK_FORMAT_B8G8R8A8_SRGB:
-		generate_mipmaps(dst_layout, layout, MipmapGeneratorSrgb());
+		generate_mipmaps(dst_layout, layout, true, options);
 		break;
 
 	case VK_FORMAT_R8G8B8A8_UNORM:
 	case VK_FORMAT_B8G8R8A8_UNORM:
-		generate_mipmaps(dst_layout, layout, MipmapGeneratorUnorm());
+		generate_mipmaps(dst_layout, layout, false, options);
 		break;
 
 	default:
@@ -191,24 +514,26 @@ static void generate(const MemoryMappedTexture &mapped, const Vulkan::TextureFor
 	}
 }
 
-MemoryMappedTexture generate_mipmaps_to_file(const std::string &path, const Vulkan::TextureFormatLayout &layout, MemoryMappedTextureFlags flags)
+MemoryMappedTexture generate_mipmaps_to_file(const std::string &path, const Vulkan::TextureFormatLayout &layout,
+                                             MemoryMappedTextureFlags flags, const MipmapGenerationOptions &options)
 {
 	MemoryMappedTexture mapped;
 	copy_dimensions(mapped, layout, flags);
 	if (!mapped.map_write(path))
 		return {};
-	generate(mapped, layout);
+	generate(mapped, layout, options);
 	return mapped;
 }
 
-MemoryMappedTexture generate_mipmaps(const Vulkan::TextureFormatLayout &layout, MemoryMappedTextureFlags flags)
+MemoryMappedTexture generate_mipmaps(const Vulkan::TextureFormatLayout &layout, MemoryMappedTextureFlags flags,
+                                     const MipmapGenerationOptions &options)
 {
 	MemoryMappedTexture mapped;
 	copy_dimensions(mapped, layout, flags);
 	if (!mapped.map_write_scratch())
 		return {};
-	generate(mapped, layout);
+	generate(mapped, layout, options);
 	return mapped;
 }
 }
-}
\ No newline at end of file
+}
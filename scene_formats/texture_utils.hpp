@@ -30,6 +30,8 @@
 
 namespace Granite
 {
+class ThreadGroup;
+
 namespace SceneFormats
 {
 template <typename T, typename Op>
@@ -61,7 +63,30 @@ inline void transform_texture_layout(const Vulkan::TextureFormatLayout &layout,
 	}
 }
 
-MemoryMappedTexture generate_mipmaps(const Vulkan::TextureFormatLayout &layout, MemoryMappedTextureFlags flags);
-MemoryMappedTexture generate_mipmaps_to_file(const std::string &path, const Vulkan::TextureFormatLayout &layout, MemoryMappedTextureFlags flags);
+enum class MipmapFilter
+{
+	Box,
+	Kaiser
+};
+
+struct MipmapGenerationOptions
+{
+	MipmapFilter filter = MipmapFilter::Box;
+
+	// If non-zero, alpha in every level is rescaled so the fraction of texels with alpha >= cutoff
+	// matches the first level, which keeps alpha-tested foliage from thinning out in the distance.
+	float alpha_coverage_cutoff = 0.0f;
+
+	// Tiles are distributed over this group if set, otherwise all work happens on the calling thread.
+	// Must not be called from a task running on the same group.
+	ThreadGroup *group = nullptr;
+};
+
+// Mips are built tile by tile from the previous level in the output, so working memory stays bounded
+// by the tile size. With generate_mipmaps_to_file, tiles are written straight into the mapped file.
+MemoryMappedTexture generate_mipmaps(const Vulkan::TextureFormatLayout &layout, MemoryMappedTextureFlags flags,
+                                     const MipmapGenerationOptions &options = {});
+MemoryMappedTexture generate_mipmaps_to_file(const std::string &path, const Vulkan::TextureFormatLayout &layout,
+                                             MemoryMappedTextureFlags flags, const MipmapGenerationOptions &options = {});
 }
 }
\ No newline at end of file
@@ -0,0 +1,297 @@
+/* Copyright (c) 2017-2018 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "bc_compressor.hpp"
+#include "rgtc_compressor.hpp"
+#include "util.hpp"
+#include <vector>
+#include <math.h>
+#include <stdlib.h>
+
+using namespace Granite;
+using namespace std;
+
+static const unsigned image_size = 64;
+
+struct TestImage
+{
+	const char *name;
+	vector<uint8_t> rgba;
+};
+
+static uint32_t next_random(uint32_t &state)
+{
+	state = state * 1664525u + 1013904223u;
+	return state >> 24;
+}
+
+static vector<TestImage> create_test_images()
+{
+	vector<TestImage> images;
+	uint32_t seed = 1;
+
+	TestImage gradient = { "gradient", vector<uint8_t>(image_size * image_size * 4) };
+	TestImage noisy = { "noisy gradient", vector<uint8_t>(image_size * image_size * 4) };
+	for (unsigned y = 0; y < image_size; y++)
+	{
+		for (unsigned x = 0; x < image_size; x++)
+		{
+			uint8_t *g = &gradient.rgba[4 * (y * image_size + x)];
+			g[0] = uint8_t(x * 255 / (image_size - 1));
+			g[1] = uint8_t(y * 255 / (image_size - 1));
+			g[2] = uint8_t(255 - (x + y) * 255 / (2 * (image_size - 1)));
+			g[3] = uint8_t((x ^ y) * 4);
+
+			uint8_t *n = &noisy.rgba[4 * (y * image_size + x)];
+			for (unsigned c = 0; c < 4; c++)
+				n[c] = uint8_t(std::min(255u, g[c] / 2u + next_random(seed) / 8u + 32u));
+		}
+	}
+
+	images.push_back(move(gradient));
+	images.push_back(move(noisy));
+	return images;
+}
+
+// Fetches the 4x4 block at bx, by and returns it in row-major order.
+static void fetch_block(uint8_t *block, const vector<uint8_t> &rgba, unsigned bx, unsigned by)
+{
+	for (unsigned y = 0; y < 4; y++)
+		for (unsigned x = 0; x < 4; x++)
+			for (unsigned c = 0; c < 4; c++)
+				block[4 * (y * 4 + x) + c] = rgba[4 * ((by * 4 + y) * image_size + bx * 4 + x) + c];
+}
+
+static double psnr(double squared_error, unsigned count)
+{
+	if (squared_error == 0.0)
+		return 100.0;
+	return 10.0 * log10(255.0 * 255.0 * count / squared_error);
+}
+
+enum class Codec
+{
+	BC1,
+	BC3,
+	BC4,
+	BC5
+};
+
+static const char *codec_name(Codec codec)
+{
+	switch (codec)
+	{
+	case Codec::BC1:
+		return "BC1";
+	case Codec::BC3:
+		return "BC3";
+	case Codec::BC4:
+		return "BC4";
+	case Codec::BC5:
+		return "BC5";
+	}
+	return "?";
+}
+
+// Encodes and decodes every block, and returns the PSNR of the worst channel the codec stores.
+static double measure_psnr(Codec codec, const vector<uint8_t> &rgba, unsigned quality)
+{
+	double error[4] = {};
+	unsigned num_channels = 0;
+
+	for (unsigned by = 0; by < image_size / 4; by++)
+	{
+		for (unsigned bx = 0; bx < image_size / 4; bx++)
+		{
+			uint8_t block[16 * 4];
+			uint8_t decoded[16 * 4];
+			uint8_t encoded[16];
+			fetch_block(block, rgba, bx, by);
+
+			uint8_t red[16], green[16];
+			for (unsigned i = 0; i < 16; i++)
+			{
+				red[i] = block[4 * i + 0];
+				green[i] = block[4 * i + 1];
+			}
+
+			switch (codec)
+			{
+			case Codec::BC1:
+				compress_bc1_block(encoded, block, quality, false);
+				decompress_bc1_block(decoded, encoded);
+				num_channels = 3;
+				break;
+
+			case Codec::BC3:
+				compress_bc3_block(encoded, block, quality);
+				decompress_bc3_block(decoded, encoded);
+				num_channels = 4;
+				break;
+
+			case Codec::BC4:
+			case Codec::BC5:
+			{
+				uint8_t decoded_red[16], decoded_green[16];
+				if (codec == Codec::BC4)
+				{
+					compress_rgtc_red_block(encoded, red, quality);
+					num_channels = 1;
+				}
+				else
+				{
+					compress_rgtc_red_green_block(encoded, red, green, quality);
+					decompress_rgtc_red_block(decoded_green, encoded + 8);
+					num_channels = 2;
+				}
+				decompress_rgtc_red_block(decoded_red, encoded);
+
+				for (unsigned i = 0; i < 16; i++)
+				{
+					decoded[4 * i + 0] = decoded_red[i];
+					decoded[4 * i + 1] = codec == Codec::BC5 ? decoded_green[i] : 0;
+				}
+				break;
+			}
+			}
+
+			for (unsigned i = 0; i < 16; i++)
+			{
+				for (unsigned c = 0; c < num_channels; c++)
+				{
+					double diff = double(decoded[4 * i + c]) - double(block[4 * i + c]);
+					error[c] += diff * diff;
+				}
+			}
+		}
+	}
+
+	double worst = 100.0;
+	for (unsigned c = 0; c < num_channels; c++)
+		worst = std::min(worst, psnr(error[c], image_size * image_size));
+	return worst;
+}
+
+static bool test_exact_blocks()
+{
+	// Two colors which are exactly representable in RGB565 must survive the round trip untouched.
+	// Quality 1 insets its bounding box endpoints without refining them, so it is not exact.
+	uint8_t block[16 * 4];
+	for (unsigned i = 0; i < 16; i++)
+	{
+		bool first = (i & 1) != 0;
+		block[4 * i + 0] = first ? 0xff : 0x00;
+		block[4 * i + 1] = first ? 0x82 : 0x41;
+		block[4 * i + 2] = first ? 0x08 : 0xff;
+		block[4 * i + 3] = 0xff;
+	}
+
+	for (unsigned quality = 2; quality <= 5; quality++)
+	{
+		uint8_t encoded[16];
+		uint8_t decoded[16 * 4];
+		compress_bc1_block(encoded, block, quality, false);
+		decompress_bc1_block(decoded, encoded);
+		for (unsigned i = 0; i < 16; i++)
+		{
+			for (unsigned c = 0; c < 3; c++)
+			{
+				if (decoded[4 * i + c] != block[4 * i + c])
+				{
+					LOGE("BC1 quality %u did not reproduce an exact two color block.\n", quality);
+					return false;
+				}
+			}
+		}
+	}
+
+	// Fully transparent texels must come back transparent with punch-through alpha.
+	for (unsigned i = 0; i < 16; i++)
+		block[4 * i + 3] = (i & 2) ? 0x00 : 0xff;
+
+	uint8_t encoded[8];
+	uint8_t decoded[16 * 4];
+	compress_bc1_block(encoded, block, 3, true);
+	decompress_bc1_block(decoded, encoded);
+	for (unsigned i = 0; i < 16; i++)
+	{
+		bool transparent = decoded[4 * i + 3] == 0;
+		if (transparent != (block[4 * i + 3] == 0))
+		{
+			LOGE("BC1 punch-through alpha did not round trip.\n");
+			return false;
+		}
+	}
+
+	return true;
+}
+
+int main()
+{
+	if (!test_exact_blocks())
+		return EXIT_FAILURE;
+
+	// Lower bounds with some headroom. A broken fit or a broken SIMD path lands far below these.
+	struct Expectation
+	{
+		Codec codec;
+		double min_psnr;
+	};
+	static const Expectation expectations[] = {
+		{ Codec::BC1, 28.0 },
+		{ Codec::BC3, 28.0 },
+		{ Codec::BC4, 42.0 },
+		{ Codec::BC5, 42.0 },
+	};
+
+	auto images = create_test_images();
+	bool success = true;
+
+	for (auto &image : images)
+	{
+		for (auto &expect : expectations)
+		{
+			double previous = 0.0;
+			for (unsigned quality = 1; quality <= 5; quality++)
+			{
+				double value = measure_psnr(expect.codec, image.rgba, quality);
+				LOGI("%s, %s, quality %u: %.2f dB.\n", image.name, codec_name(expect.codec), quality, value);
+
+				if (value < expect.min_psnr)
+				{
+					LOGE("PSNR below %.1f dB.\n", expect.min_psnr);
+					success = false;
+				}
+
+				// Higher quality levels search more, so they should never do noticeably worse.
+				if (value + 0.5 < previous)
+				{
+					LOGE("Quality %u is worse than quality %u.\n", quality, quality - 1);
+					success = false;
+				}
+				previous = value;
+			}
+		}
+	}
+
+	return success ? EXIT_SUCCESS : EXIT_FAILURE;
+}
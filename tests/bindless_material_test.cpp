@@ -0,0 +1,183 @@
+/* Copyright (c) 2017-2018 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "bindless_material_table.hpp"
+#include "device.hpp"
+#include "vulkan.hpp"
+#include "global_managers.hpp"
+#include "util.hpp"
+#include <vector>
+#include <stddef.h>
+#include <stdlib.h>
+
+using namespace Granite;
+using namespace Vulkan;
+using namespace Util;
+using namespace std;
+
+// static_mesh.frag reads the table as a std430 array of MaterialData.
+static bool check_layout()
+{
+	if (offsetof(BindlessMaterialData, base_color) != 0 ||
+	    offsetof(BindlessMaterialData, emissive) != 16 ||
+	    offsetof(BindlessMaterialData, roughness) != 32 ||
+	    offsetof(BindlessMaterialData, metallic) != 36 ||
+	    offsetof(BindlessMaterialData, normal_scale) != 40 ||
+	    offsetof(BindlessMaterialData, textures) != 44 ||
+	    sizeof(BindlessMaterialData) != 64)
+	{
+		LOGE("BindlessMaterialData does not match the std430 layout of MaterialData.\n");
+		return false;
+	}
+	return true;
+}
+
+static void init_material(Material &material, unsigned seed)
+{
+	for (auto &tex : material.textures)
+		tex = nullptr;
+	material.base_color = vec4(float(seed & 0xff), float((seed >> 8) & 0xff), float(seed >> 16), 1.0f);
+	material.roughness = 0.5f;
+	material.bake();
+}
+
+static bool check_index_assignment(BindlessMaterialTable &table)
+{
+	table.begin();
+
+	Material a;
+	init_material(a, 1);
+	Material b;
+	init_material(b, 2);
+	uint32_t index_a = table.get_material_index(a);
+	uint32_t index_b = table.get_material_index(b);
+	if (index_a == ~0u || index_b == ~0u || index_a == index_b)
+	{
+		LOGE("Distinct materials must get distinct indices (%u, %u).\n", index_a, index_b);
+		return false;
+	}
+
+	// Materials are identified by their hash, so an identical copy shares the index.
+	Material a_copy;
+	init_material(a_copy, 1);
+	if (table.get_material_index(a_copy) != index_a || table.get_material_index(a) != index_a)
+	{
+		LOGE("Identical materials must share an index.\n");
+		return false;
+	}
+
+	if (table.get_num_materials() != 2)
+	{
+		LOGE("Expected 2 materials, got %u.\n", table.get_num_materials());
+		return false;
+	}
+
+	// Only a is used from now on, so b gives up its index, which the next new material reuses.
+	for (unsigned i = 0; i < 2 * BindlessMaterialTable::RecycleFrames; i++)
+	{
+		table.begin();
+		table.get_material_index(a);
+	}
+
+	if (table.get_num_materials() != 1 || table.get_material_index(a) != index_a)
+	{
+		LOGE("Recycling dropped a material which is still in use.\n");
+		return false;
+	}
+
+	Material c;
+	init_material(c, 3);
+	if (table.get_material_index(c) != index_b)
+	{
+		LOGE("Recycled index was not reused.\n");
+		return false;
+	}
+
+	return true;
+}
+
+static bool check_large_indices(BindlessMaterialTable &table)
+{
+	// Indices go beyond what a mediump uint is guaranteed to hold, which is why vMaterialIndex is highp.
+	const unsigned count = 70000;
+	table.begin();
+	vector<bool> seen(count, false);
+	for (unsigned i = 0; i < count; i++)
+	{
+		Material material;
+		init_material(material, 1000 + i);
+		uint32_t index = table.get_material_index(material);
+		if (index >= count || seen[index])
+		{
+			LOGE("Material %u got invalid or duplicate index %u.\n", i, index);
+			return false;
+		}
+		seen[index] = true;
+	}
+
+	return true;
+}
+
+static int run_test(Context &context)
+{
+	Device device;
+	device.set_context(context);
+
+	BindlessMaterialTable table;
+	table.init(&device);
+	if (!table.is_supported())
+	{
+		LOGI("Device does not support descriptor indexing, skipping material table checks.\n");
+		return EXIT_SUCCESS;
+	}
+
+	if (!check_index_assignment(table))
+		return EXIT_FAILURE;
+
+	table.reset();
+	table.init(&device);
+	if (!check_large_indices(table))
+		return EXIT_FAILURE;
+
+	table.reset();
+	return EXIT_SUCCESS;
+}
+
+int main()
+{
+	if (!check_layout())
+		return EXIT_FAILURE;
+
+	Global::init();
+
+	if (!Context::init_loader(nullptr))
+		return EXIT_FAILURE;
+
+	int ret;
+	{
+		Context context(nullptr, 0, nullptr, 0);
+		ret = run_test(context);
+	}
+
+	Global::deinit();
+	return ret;
+}
@@ -0,0 +1,242 @@
+/* Copyright (c) 2017-2018 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "scene_formats.hpp"
+#include "util.hpp"
+#include <vector>
+#include <math.h>
+#include <string.h>
+#include <stdlib.h>
+
+using namespace Granite;
+using namespace Granite::SceneFormats;
+using namespace Util;
+using namespace std;
+
+// Mirrors decode_octahedral() in static_mesh.vert.
+static vec3 decode_octahedral(vec2 e)
+{
+	vec3 n = vec3(e.x, e.y, 1.0f - muglm::abs(e.x) - muglm::abs(e.y));
+	float t = std::max(-n.z, 0.0f);
+	n.x += n.x >= 0.0f ? -t : t;
+	n.y += n.y >= 0.0f ? -t : t;
+	return normalize(n);
+}
+
+static float decode_snorm16(int16_t v)
+{
+	return std::max(float(v) / 32767.0f, -1.0f);
+}
+
+static float decode_half(uint16_t h)
+{
+	int exponent = (h >> 10) & 0x1f;
+	int mantissa = h & 0x3ff;
+	float v;
+	if (exponent == 0)
+		v = ldexpf(float(mantissa), -24);
+	else
+		v = ldexpf(float(mantissa | 0x400), exponent - 25);
+	return (h & 0x8000) ? -v : v;
+}
+
+struct Vertex
+{
+	vec3 position;
+	vec3 normal;
+	vec4 tangent;
+	vec2 uv;
+};
+
+static vector<Vertex> build_vertices(float uv_scale)
+{
+	vector<Vertex> vertices;
+
+	// Directions spread over the sphere, plus the axes and the octahedron edges, where the folding is most fragile.
+	vector<vec3> directions = {
+		vec3(1.0f, 0.0f, 0.0f), vec3(-1.0f, 0.0f, 0.0f),
+		vec3(0.0f, 1.0f, 0.0f), vec3(0.0f, -1.0f, 0.0f),
+		vec3(0.0f, 0.0f, 1.0f), vec3(0.0f, 0.0f, -1.0f),
+		normalize(vec3(1.0f, 1.0f, 0.0f)), normalize(vec3(-1.0f, 1.0f, 0.0f)),
+		normalize(vec3(1.0f, -1.0f, 0.0f)), normalize(vec3(-1.0f, -1.0f, 0.0f)),
+		normalize(vec3(1.0f, 0.0f, -1.0f)), normalize(vec3(0.0f, -1.0f, -1.0f)),
+	};
+
+	const unsigned count = 4096;
+	for (unsigned i = 0; i < count; i++)
+	{
+		float z = 1.0f - 2.0f * (float(i) + 0.5f) / float(count);
+		float r = sqrtf(std::max(1.0f - z * z, 0.0f));
+		float phi = float(i) * 2.39996323f;
+		directions.push_back(vec3(r * cosf(phi), r * sinf(phi), z));
+	}
+
+	for (size_t i = 0; i < directions.size(); i++)
+	{
+		Vertex v;
+		auto &d = directions[i];
+		v.position = vec3(d.x * 10.0f + 3.0f, d.y * 0.5f, d.z * 100.0f - 50.0f);
+		v.normal = d;
+		v.tangent = vec4(d.z, d.x, d.y, (i & 1) ? -1.0f : 1.0f);
+		v.uv = vec2(0.5f * d.x + 0.5f, 0.5f * d.y + 0.5f) * uv_scale;
+		vertices.push_back(v);
+	}
+
+	return vertices;
+}
+
+static Mesh build_mesh(const vector<Vertex> &vertices)
+{
+	Mesh mesh;
+	mesh.position_stride = sizeof(vec3);
+	mesh.attribute_stride = sizeof(vec3) + sizeof(vec4) + sizeof(vec2);
+	mesh.attribute_layout[ecast(MeshAttribute::Position)].format = VK_FORMAT_R32G32B32_SFLOAT;
+	mesh.attribute_layout[ecast(MeshAttribute::Normal)] = { VK_FORMAT_R32G32B32_SFLOAT, 0 };
+	mesh.attribute_layout[ecast(MeshAttribute::Tangent)] = { VK_FORMAT_R32G32B32A32_SFLOAT, sizeof(vec3) };
+	mesh.attribute_layout[ecast(MeshAttribute::UV)] = { VK_FORMAT_R32G32_SFLOAT, sizeof(vec3) + sizeof(vec4) };
+	mesh.topology = VK_PRIMITIVE_TOPOLOGY_POINT_LIST;
+	mesh.index_type = VK_INDEX_TYPE_UINT32;
+	mesh.count = unsigned(vertices.size());
+
+	mesh.positions.resize(vertices.size() * mesh.position_stride);
+	mesh.attributes.resize(vertices.size() * mesh.attribute_stride);
+	for (size_t i = 0; i < vertices.size(); i++)
+	{
+		auto &v = vertices[i];
+		uint8_t *attr = mesh.attributes.data() + i * mesh.attribute_stride;
+		memcpy(mesh.positions.data() + i * mesh.position_stride, v.position.data, sizeof(vec3));
+		memcpy(attr, v.normal.data, sizeof(vec3));
+		memcpy(attr + sizeof(vec3), v.tangent.data, sizeof(vec4));
+		memcpy(attr + sizeof(vec3) + sizeof(vec4), v.uv.data, sizeof(vec2));
+	}
+
+	return mesh;
+}
+
+static bool check_mesh(float uv_scale, VkFormat expected_uv_format)
+{
+	auto vertices = build_vertices(uv_scale);
+	auto mesh = build_mesh(vertices);
+
+	vec3 position_scale, position_offset;
+	if (!mesh_compact_vertices(mesh, position_scale, position_offset))
+	{
+		LOGE("Mesh was not compacted.\n");
+		return false;
+	}
+
+	auto &layout = mesh.attribute_layout;
+	if (layout[ecast(MeshAttribute::Position)].format != VK_FORMAT_R16G16B16A16_UNORM ||
+	    layout[ecast(MeshAttribute::Normal)].format != VK_FORMAT_R16G16_SNORM ||
+	    layout[ecast(MeshAttribute::Tangent)].format != VK_FORMAT_R16G16_SNORM ||
+	    layout[ecast(MeshAttribute::UV)].format != expected_uv_format)
+	{
+		LOGE("Unexpected compact layout for UV scale %.1f.\n", uv_scale);
+		return false;
+	}
+
+	float max_position_error = 0.0f;
+	float min_normal_dot = 1.0f;
+	float min_tangent_dot = 1.0f;
+	float max_uv_error = 0.0f;
+
+	for (size_t i = 0; i < vertices.size(); i++)
+	{
+		auto &v = vertices[i];
+
+		uint16_t p[4];
+		memcpy(p, mesh.positions.data() + i * mesh.position_stride, sizeof(p));
+		vec3 position = vec3(p[0], p[1], p[2]) / 65535.0f * position_scale + position_offset;
+		max_position_error = std::max(max_position_error, muglm::length(position - v.position));
+
+		const uint8_t *attr = mesh.attributes.data() + i * mesh.attribute_stride;
+
+		int16_t n[2];
+		memcpy(n, attr + layout[ecast(MeshAttribute::Normal)].offset, sizeof(n));
+		vec3 normal = decode_octahedral(vec2(decode_snorm16(n[0]), decode_snorm16(n[1])));
+		min_normal_dot = std::min(min_normal_dot, dot(normal, v.normal));
+
+		// Tangent w is folded into the sign of y, which is remapped to [0, 1].
+		int16_t t[2];
+		memcpy(t, attr + layout[ecast(MeshAttribute::Tangent)].offset, sizeof(t));
+		float ty = decode_snorm16(t[1]);
+		vec3 tangent = decode_octahedral(vec2(decode_snorm16(t[0]), muglm::abs(ty) * 2.0f - 1.0f));
+		min_tangent_dot = std::min(min_tangent_dot, dot(tangent, v.tangent.xyz()));
+		if ((ty < 0.0f) != (v.tangent.w < 0.0f))
+		{
+			LOGE("Tangent sign was lost for vertex %u.\n", unsigned(i));
+			return false;
+		}
+
+		vec2 uv;
+		if (expected_uv_format == VK_FORMAT_R16G16_SFLOAT)
+		{
+			uint16_t h[2];
+			memcpy(h, attr + layout[ecast(MeshAttribute::UV)].offset, sizeof(h));
+			uv = vec2(decode_half(h[0]), decode_half(h[1]));
+		}
+		else
+			memcpy(uv.data, attr + layout[ecast(MeshAttribute::UV)].offset, sizeof(vec2));
+
+		max_uv_error = std::max(max_uv_error, std::max(muglm::abs(uv.x - v.uv.x), muglm::abs(uv.y - v.uv.y)));
+	}
+
+	LOGI("UV scale %.1f: position error %g, normal dot %.7f, tangent dot %.7f, UV error %g.\n",
+	     uv_scale, max_position_error, min_normal_dot, min_tangent_dot, max_uv_error);
+
+	// Rounding is at most half a quantization step per axis, so a full step leaves room for float error.
+	float position_tolerance = muglm::length(position_scale) / 65535.0f;
+	if (max_position_error > position_tolerance)
+	{
+		LOGE("Position error %g exceeds %g.\n", max_position_error, position_tolerance);
+		return false;
+	}
+
+	// Quantizing octahedral coordinates to 16 bits is accurate to well below 0.01 degrees.
+	if (min_normal_dot < 0.99999f || min_tangent_dot < 0.99999f)
+	{
+		LOGE("Octahedral round trip is not accurate enough.\n");
+		return false;
+	}
+
+	// Half floats in [1, 2] round to 1/2048. Float UVs must be untouched.
+	float uv_tolerance = expected_uv_format == VK_FORMAT_R16G16_SFLOAT ? 1.0f / 2048.0f : 0.0f;
+	if (max_uv_error > uv_tolerance)
+	{
+		LOGE("UV error %g exceeds %g.\n", max_uv_error, uv_tolerance);
+		return false;
+	}
+
+	return true;
+}
+
+int main()
+{
+	// UVs in [0, 2] become half floats, anything beyond keeps full precision.
+	if (!check_mesh(1.0f, VK_FORMAT_R16G16_SFLOAT))
+		return EXIT_FAILURE;
+	if (!check_mesh(2.0f, VK_FORMAT_R16G16_SFLOAT))
+		return EXIT_FAILURE;
+	if (!check_mesh(8.0f, VK_FORMAT_R32G32_SFLOAT))
+		return EXIT_FAILURE;
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,329 @@
+/* Copyright (c) 2017-2018 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include "cooked_scene.hpp"
+#include "global_managers.hpp"
+#include "filesystem.hpp"
+#include "path.hpp"
+#include "util.hpp"
+#include <functional>
+#include <string.h>
+#include <stdlib.h>
+#include <stdexcept>
+
+using namespace Granite;
+using namespace Granite::SceneFormats;
+using namespace Util;
+using namespace std;
+
+static const char cooked_path[] = "memory://test.cooked";
+
+struct TestScene
+{
+	vector<Mesh> meshes;
+	vector<MaterialInfo> materials;
+	vector<Node> nodes;
+	vector<Skin> skins;
+	vector<Animation> animations;
+	SceneNodes scene_nodes;
+};
+
+// A textured quad, a skinned node with two joints, and an animation which targets both a node and a joint.
+static TestScene build_scene()
+{
+	TestScene scene;
+
+	Mesh mesh;
+	const vec3 positions[] = { vec3(0.0f, 0.0f, 0.0f), vec3(1.0f, 0.0f, 0.0f), vec3(0.0f, 1.0f, 0.0f), vec3(1.0f, 1.0f, 0.0f) };
+	const vec2 uvs[] = { vec2(0.0f, 0.0f), vec2(1.0f, 0.0f), vec2(0.0f, 1.0f), vec2(1.0f, 1.0f) };
+	const uint16_t indices[] = { 0, 1, 2, 2, 1, 3 };
+	mesh.positions.resize(sizeof(positions));
+	memcpy(mesh.positions.data(), positions, sizeof(positions));
+	mesh.attributes.resize(sizeof(uvs));
+	memcpy(mesh.attributes.data(), uvs, sizeof(uvs));
+	mesh.indices.resize(sizeof(indices));
+	memcpy(mesh.indices.data(), indices, sizeof(indices));
+	mesh.position_stride = sizeof(vec3);
+	mesh.attribute_stride = sizeof(vec2);
+	mesh.attribute_layout[ecast(MeshAttribute::Position)].format = VK_FORMAT_R32G32B32_SFLOAT;
+	mesh.attribute_layout[ecast(MeshAttribute::UV)].format = VK_FORMAT_R32G32_SFLOAT;
+	mesh.index_type = VK_INDEX_TYPE_UINT16;
+	mesh.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+	mesh.count = 6;
+	mesh.has_material = true;
+	mesh.material_index = 0;
+	mesh.static_aabb = AABB(vec3(0.0f), vec3(1.0f, 1.0f, 0.0f));
+	scene.meshes.push_back(move(mesh));
+
+	MaterialInfo material;
+	material.base_color.path = "base_color.png";
+	material.uniform_base_color = vec4(0.5f, 0.25f, 1.0f, 1.0f);
+	material.uniform_roughness = 0.75f;
+	material.two_sided = true;
+	scene.materials.push_back(move(material));
+
+	Node root;
+	root.meshes.push_back(0);
+	root.children.push_back(1);
+	root.transform.translation = vec3(1.0f, 2.0f, 3.0f);
+	scene.nodes.push_back(move(root));
+
+	Node skinned;
+	skinned.has_skin = true;
+	skinned.skin = 0;
+	scene.nodes.push_back(move(skinned));
+
+	Skin skin;
+	skin.inverse_bind_pose.resize(2, mat4(1.0f));
+	skin.joint_transforms.resize(2);
+	skin.joint_transforms[1].translation = vec3(0.0f, 1.0f, 0.0f);
+	Skin::Bone bone = { 0, {} };
+	bone.children.push_back({ 1, {} });
+	skin.skeletons.push_back(move(bone));
+	skin.skin_compat = 0x1234;
+	scene.skins.push_back(move(skin));
+
+	Animation animation;
+	animation.name = "anim";
+	animation.skin_compat = 0x1234;
+	animation.skinning = true;
+
+	AnimationChannel joint_channel;
+	joint_channel.type = AnimationChannel::Type::Rotation;
+	joint_channel.timestamps = { 0.0f, 1.0f };
+	joint_channel.spherical.values = { quat(1.0f, 0.0f, 0.0f, 0.0f), quat(0.0f, 1.0f, 0.0f, 0.0f) };
+	joint_channel.joint = true;
+	joint_channel.joint_index = 1;
+	animation.channels.push_back(move(joint_channel));
+
+	AnimationChannel node_channel;
+	node_channel.type = AnimationChannel::Type::Translation;
+	node_channel.timestamps = { 0.0f, 2.0f };
+	node_channel.linear.values = { vec3(0.0f), vec3(1.0f) };
+	node_channel.node_index = 0;
+	animation.channels.push_back(move(node_channel));
+
+	animation.update_length();
+	scene.animations.push_back(move(animation));
+
+	scene.scene_nodes.name = "scene";
+	scene.scene_nodes.node_indices.push_back(0);
+	return scene;
+}
+
+static bool export_scene(const TestScene &scene)
+{
+	SceneInformation info;
+	info.meshes = scene.meshes;
+	info.materials = scene.materials;
+	info.nodes = scene.nodes;
+	info.skins = scene.skins;
+	info.animations = scene.animations;
+	info.scene_nodes = &scene.scene_nodes;
+	return export_cooked_scene(cooked_path, info, {});
+}
+
+#define CHECK(x) do { \
+	if (!(x)) { \
+		LOGE("Check failed at line %d: %s\n", __LINE__, #x); \
+		exit(EXIT_FAILURE); \
+	} \
+} while (0)
+
+static void test_round_trip()
+{
+	auto scene = build_scene();
+	CHECK(export_scene(scene));
+	CookedScene cooked(cooked_path);
+
+	CHECK(cooked.get_mesh_count() == 1);
+	auto mesh = cooked.get_mesh(0);
+	auto &ref = scene.meshes[0];
+	CHECK(mesh.positions == ref.positions);
+	CHECK(mesh.attributes == ref.attributes);
+	CHECK(mesh.indices == ref.indices);
+	CHECK(mesh.position_stride == ref.position_stride);
+	CHECK(mesh.attribute_stride == ref.attribute_stride);
+	CHECK(memcmp(mesh.attribute_layout, ref.attribute_layout, sizeof(ref.attribute_layout)) == 0);
+	CHECK(mesh.index_type == ref.index_type);
+	CHECK(mesh.topology == ref.topology);
+	CHECK(mesh.count == ref.count);
+	CHECK(mesh.has_material && mesh.material_index == 0);
+	CHECK(all(equal(mesh.static_aabb.get_maximum(), ref.static_aabb.get_maximum())));
+
+	auto &materials = cooked.get_materials();
+	CHECK(materials.size() == 1);
+	CHECK(materials[0].base_color.path == Path::relpath(cooked_path, "base_color.png"));
+	CHECK(all(equal(materials[0].uniform_base_color, scene.materials[0].uniform_base_color)));
+	CHECK(materials[0].uniform_roughness == 0.75f);
+	CHECK(materials[0].two_sided);
+
+	auto &nodes = cooked.get_nodes();
+	CHECK(nodes.size() == 2);
+	CHECK(nodes[0].meshes == scene.nodes[0].meshes);
+	CHECK(nodes[0].children == scene.nodes[0].children);
+	CHECK(all(equal(nodes[0].transform.translation, vec3(1.0f, 2.0f, 3.0f))));
+	CHECK(nodes[1].has_skin && nodes[1].skin == 0);
+
+	auto &skins = cooked.get_skins();
+	CHECK(skins.size() == 1);
+	CHECK(skins[0].joint_transforms.size() == 2);
+	CHECK(skins[0].inverse_bind_pose.size() == 2);
+	CHECK(skins[0].skin_compat == 0x1234);
+	CHECK(skins[0].skeletons.size() == 1);
+	CHECK(skins[0].skeletons[0].index == 0);
+	CHECK(skins[0].skeletons[0].children.size() == 1);
+	CHECK(skins[0].skeletons[0].children[0].index == 1);
+
+	auto &animations = cooked.get_animations();
+	CHECK(animations.size() == 1);
+	CHECK(animations[0].name == "anim");
+	CHECK(animations[0].skinning);
+	CHECK(animations[0].length == 2.0f);
+	CHECK(animations[0].channels.size() == 2);
+	CHECK(animations[0].channels[0].joint && animations[0].channels[0].joint_index == 1);
+	CHECK(animations[0].channels[0].spherical.values.size() == 2);
+	CHECK(!animations[0].channels[1].joint && animations[0].channels[1].node_index == 0);
+	CHECK(animations[0].channels[1].linear.values.size() == 2);
+
+	CHECK(cooked.get_scene_nodes().name == "scene");
+	CHECK(cooked.get_scene_nodes().node_indices == scene.scene_nodes.node_indices);
+}
+
+// The exporter writes whatever it is given, so a broken scene produces the same file a corrupt or stale one would.
+static void expect_rejected(const char *tag, const function<void (TestScene &)> &corrupt)
+{
+	auto scene = build_scene();
+	corrupt(scene);
+	CHECK(export_scene(scene));
+
+	try
+	{
+		CookedScene cooked(cooked_path);
+	}
+	catch (const logic_error &e)
+	{
+		LOGI("%s: rejected with \"%s\".\n", tag, e.what());
+		return;
+	}
+
+	LOGE("%s: corrupt scene was accepted.\n", tag);
+	exit(EXIT_FAILURE);
+}
+
+static void test_rejection()
+{
+	expect_rejected("node skin", [](TestScene &scene) {
+		scene.nodes[1].skin = 1;
+	});
+
+	expect_rejected("node child", [](TestScene &scene) {
+		scene.nodes[0].children[0] = 2;
+	});
+
+	expect_rejected("node cycle", [](TestScene &scene) {
+		scene.nodes[1].children.push_back(0);
+	});
+
+	expect_rejected("node with two parents", [](TestScene &scene) {
+		scene.nodes[0].children.push_back(1);
+	});
+
+	expect_rejected("channel joint", [](TestScene &scene) {
+		scene.animations[0].channels[0].joint_index = 2;
+	});
+
+	expect_rejected("channel values", [](TestScene &scene) {
+		scene.animations[0].channels[1].linear.values.pop_back();
+	});
+
+	expect_rejected("bone index", [](TestScene &scene) {
+		scene.skins[0].skeletons[0].children[0].index = 2;
+	});
+
+	expect_rejected("inverse bind pose", [](TestScene &scene) {
+		scene.skins[0].inverse_bind_pose.pop_back();
+	});
+
+	expect_rejected("zero position stride", [](TestScene &scene) {
+		scene.meshes[0].position_stride = 0;
+	});
+
+	expect_rejected("zero attribute stride", [](TestScene &scene) {
+		scene.meshes[0].attribute_stride = 0;
+	});
+
+	expect_rejected("attribute offset", [](TestScene &scene) {
+		scene.meshes[0].attribute_layout[ecast(MeshAttribute::UV)].offset = 4;
+	});
+
+	expect_rejected("attribute format", [](TestScene &scene) {
+		scene.meshes[0].attribute_layout[ecast(MeshAttribute::UV)].format = VK_FORMAT_BC1_RGB_UNORM_BLOCK;
+	});
+
+	expect_rejected("short attribute stream", [](TestScene &scene) {
+		scene.meshes[0].attributes.resize(3 * sizeof(vec2));
+	});
+
+	expect_rejected("index count", [](TestScene &scene) {
+		scene.meshes[0].count = 7;
+	});
+
+	expect_rejected("index type", [](TestScene &scene) {
+		scene.meshes[0].index_type = VK_INDEX_TYPE_MAX_ENUM;
+	});
+
+	expect_rejected("index value", [](TestScene &scene) {
+		reinterpret_cast<uint16_t *>(scene.meshes[0].indices.data())[5] = 4;
+	});
+
+	expect_rejected("primitive restart", [](TestScene &scene) {
+		reinterpret_cast<uint16_t *>(scene.meshes[0].indices.data())[5] = 0xffff;
+	});
+
+	expect_rejected("vertex count", [](TestScene &scene) {
+		scene.meshes[0].indices.clear();
+		scene.meshes[0].count = 5;
+	});
+
+	expect_rejected("material index", [](TestScene &scene) {
+		scene.meshes[0].material_index = 1;
+	});
+
+	// Primitive restart indices are fine when restart is enabled.
+	auto scene = build_scene();
+	scene.meshes[0].primitive_restart = true;
+	scene.meshes[0].topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_STRIP;
+	reinterpret_cast<uint16_t *>(scene.meshes[0].indices.data())[2] = 0xffff;
+	CHECK(export_scene(scene));
+	CookedScene cooked(cooked_path);
+}
+
+int main()
+{
+	Global::init(Global::MANAGER_FEATURE_FILESYSTEM_BIT);
+	test_round_trip();
+	test_rejection();
+	LOGI("Cooked scene tests passed.\n");
+	Global::deinit();
+}
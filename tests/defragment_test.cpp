@@ -0,0 +1,158 @@
+/* Copyright (c) 2017-2018 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "device.hpp"
+#include "vulkan.hpp"
+#include "global_managers.hpp"
+#include "util.hpp"
+#include <vector>
+#include <stdlib.h>
+
+using namespace Vulkan;
+using namespace Granite;
+using namespace std;
+
+// Large enough to land in the 128 KiB sub-block class, which nothing else in a headless device allocates from.
+static const VkDeviceSize buffer_size = 128 * 1024;
+
+static BufferHandle create_relocatable_buffer(Device &device, uint32_t pattern)
+{
+	BufferCreateInfo info = {};
+	info.domain = BufferDomain::Device;
+	info.size = buffer_size;
+	info.usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT;
+	info.misc = BUFFER_MISC_RELOCATABLE_BIT;
+
+	vector<uint32_t> data(buffer_size / sizeof(uint32_t));
+	for (auto &d : data)
+		d = pattern;
+	return device.create_buffer(info, data.data());
+}
+
+static bool buffer_has_pattern(Device &device, const Buffer &buffer, uint32_t pattern)
+{
+	BufferCreateInfo info = {};
+	info.domain = BufferDomain::CachedHost;
+	info.size = buffer_size;
+	info.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+	auto readback = device.create_buffer(info, nullptr);
+
+	auto cmd = device.request_command_buffer();
+	cmd->copy_buffer(*readback, buffer);
+	cmd->barrier(VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT,
+	             VK_PIPELINE_STAGE_HOST_BIT, VK_ACCESS_HOST_READ_BIT);
+	Fence fence;
+	device.submit(cmd, &fence);
+	fence->wait();
+
+	auto *data = static_cast<const uint32_t *>(device.map_host_buffer(*readback, MEMORY_ACCESS_READ_BIT));
+	bool ret = true;
+	for (VkDeviceSize i = 0; i < buffer_size / sizeof(uint32_t); i++)
+		if (data[i] != pattern)
+			ret = false;
+	device.unmap_host_buffer(*readback, MEMORY_ACCESS_READ_BIT);
+	return ret;
+}
+
+static DefragmentationStats run_frames(Device &device, unsigned count)
+{
+	for (unsigned i = 0; i < count; i++)
+		device.next_frame_context();
+	device.wait_idle();
+	return device.get_defragmentation_stats();
+}
+
+static int run_test(Context &context)
+{
+	Device device;
+	device.set_context(context);
+	device.set_defragmentation_budget(64 * 1024 * 1024);
+
+	// A full mini-heap, and one which is a quarter full.
+	vector<BufferHandle> dense;
+	vector<BufferHandle> sparse;
+	for (unsigned i = 0; i < Block::NumSubBlocks; i++)
+		dense.push_back(create_relocatable_buffer(device, i));
+	for (unsigned i = 0; i < Block::NumSubBlocks / 4; i++)
+		sparse.push_back(create_relocatable_buffer(device, 0x10000 + i));
+
+	// The sparse buffers are candidates, but there is nowhere better to put them.
+	// They must not be picked, let alone recreated and thrown away every frame.
+	auto stats = run_frames(device, 8);
+	if (stats.relocated_buffers != 0 || stats.failed_relocations != 0)
+	{
+		LOGE("Picked candidates which cannot improve packing (%llu relocated, %llu failed).\n",
+		     static_cast<unsigned long long>(stats.relocated_buffers),
+		     static_cast<unsigned long long>(stats.failed_relocations));
+		return EXIT_FAILURE;
+	}
+
+	// Make room in the full mini-heap. It is now fuller than the sparse one, so the sparse buffers should move there.
+	dense.resize(Block::NumSubBlocks - sparse.size());
+	stats = run_frames(device, 8);
+	if (stats.relocated_buffers != sparse.size() || stats.failed_relocations != 0)
+	{
+		LOGE("Expected %u relocations, got %llu (%llu failed).\n", unsigned(sparse.size()),
+		     static_cast<unsigned long long>(stats.relocated_buffers),
+		     static_cast<unsigned long long>(stats.failed_relocations));
+		return EXIT_FAILURE;
+	}
+
+	for (unsigned i = 0; i < sparse.size(); i++)
+	{
+		if (!buffer_has_pattern(device, *sparse[i], 0x10000 + i))
+		{
+			LOGE("Relocated buffer %u lost its contents.\n", i);
+			return EXIT_FAILURE;
+		}
+	}
+
+	// Everything is packed now, so the allocator state is stable.
+	auto settled = run_frames(device, 8);
+	if (settled.relocated_buffers != stats.relocated_buffers || settled.failed_relocations != 0)
+	{
+		LOGE("Defragmentation did not settle.\n");
+		return EXIT_FAILURE;
+	}
+
+	LOGI("Relocated %llu buffers, %llu bytes.\n",
+	     static_cast<unsigned long long>(settled.relocated_buffers),
+	     static_cast<unsigned long long>(settled.relocated_bytes));
+	return EXIT_SUCCESS;
+}
+
+int main()
+{
+	Global::init();
+
+	if (!Context::init_loader(nullptr))
+		return EXIT_FAILURE;
+
+	int ret;
+	{
+		Context context(nullptr, 0, nullptr, 0);
+		ret = run_test(context);
+	}
+
+	Global::deinit();
+	return ret;
+}
@@ -0,0 +1,89 @@
+/* Copyright (c) 2017-2018 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "frame_allocator.hpp"
+#include "util.hpp"
+#include <thread>
+#include <stdlib.h>
+
+using namespace Util;
+
+static void run_frame(unsigned frame)
+{
+	// Sizes vary per frame, but are bounded, like visibility lists.
+	FrameVector<uint32_t> a(thread_frame_allocator<uint32_t>());
+	FrameVector<uint64_t> b(thread_frame_allocator<uint64_t>());
+	for (unsigned i = 0; i < 10000 + (frame % 7) * 1000; i++)
+		a.push_back(i);
+	for (unsigned i = 0; i < 5000; i++)
+		b.push_back(i);
+
+	for (unsigned i = 0; i < a.size(); i++)
+	{
+		if (a[i] != i)
+		{
+			LOGE("Data corruption.\n");
+			exit(1);
+		}
+	}
+}
+
+int main()
+{
+	// Persistent lists are heap backed, and stop allocating once they reach capacity.
+	FrameVector<uint32_t> persistent;
+
+	for (unsigned frame = 0; frame < 100; frame++)
+	{
+		FrameArena::begin_frame();
+
+		persistent.clear();
+		for (unsigned i = 0; i < 1000; i++)
+			persistent.push_back(i);
+
+		run_frame(frame);
+		std::thread worker([frame]() {
+			run_frame(frame);
+		});
+		worker.join();
+
+		auto stats = FrameArena::get_last_frame_stats();
+		LOGI("Frame %u: %llu arena blocks, %llu heap allocations.\n", frame,
+		     static_cast<unsigned long long>(stats.block_allocations),
+		     static_cast<unsigned long long>(stats.heap_allocations));
+	}
+
+	// A fresh worker thread needs new blocks every frame, but the main thread's arena must be warm by now.
+	FrameArena::begin_frame();
+	auto before = FrameArena::get_total_stats();
+	run_frame(3);
+	persistent.clear();
+	for (unsigned i = 0; i < 1000; i++)
+		persistent.push_back(i);
+	auto after = FrameArena::get_total_stats();
+
+	if (after.block_allocations != before.block_allocations || after.heap_allocations != before.heap_allocations)
+	{
+		LOGE("Steady state frame allocated memory.\n");
+		return EXIT_FAILURE;
+	}
+}
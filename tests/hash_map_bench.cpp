@@ -0,0 +1,182 @@
+/* Copyright (c) 2017-2018 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "intrusive_hash_map.hpp"
+#include "flat_hash_map.hpp"
+#include "timer.hpp"
+#include "util.hpp"
+#include <vector>
+#include <stdlib.h>
+#include <random>
+
+using namespace Util;
+
+struct Value : IntrusiveHashMapEnabled<Value>
+{
+	Value(unsigned v)
+		: v(v)
+	{
+	}
+	unsigned v;
+};
+
+// Mimics the kind of hashes we get from keys which only differ in a few bits.
+static Hash get_clustered_key(unsigned v)
+{
+	return (Hash(v & 7) << 24) | (v >> 3);
+}
+
+static Hash get_random_key(unsigned)
+{
+	static std::mt19937_64 rnd(1234);
+	return rnd();
+}
+
+template <typename Holder>
+static void run_bench(const char *tag, const std::vector<Hash> &keys)
+{
+	std::vector<Value> values;
+	values.reserve(keys.size());
+	for (unsigned i = 0; i < keys.size(); i++)
+	{
+		values.emplace_back(i);
+		values.back().set_hash(keys[i]);
+	}
+
+	Holder holder;
+	Timer timer;
+
+	timer.start();
+	for (auto &v : values)
+		holder.insert_replace(&v);
+	double insert_time = timer.end();
+
+	timer.start();
+	unsigned found = 0;
+	for (unsigned iter = 0; iter < 10; iter++)
+		for (auto &key : keys)
+			if (holder.find(key))
+				found++;
+	double find_time = timer.end();
+
+	timer.start();
+	unsigned missing = 0;
+	for (auto &key : keys)
+		if (!holder.find(key ^ 0x8000000000000000ull))
+			missing++;
+	double miss_time = timer.end();
+
+	timer.start();
+	for (unsigned i = 0; i < keys.size(); i += 2)
+		holder.erase(keys[i]);
+	double erase_time = timer.end();
+
+	for (unsigned i = 1; i < keys.size(); i += 2)
+	{
+		auto *v = holder.find(keys[i]);
+		if (!v || v->v != i)
+		{
+			LOGE("%s: Lookup failed after erase.\n", tag);
+			exit(1);
+		}
+	}
+
+	if (found != 10 * keys.size() || missing != keys.size())
+	{
+		LOGE("%s: Unexpected lookup results.\n", tag);
+		exit(1);
+	}
+
+	LOGI("%s: insert %.3f ms, find %.3f ms, miss %.3f ms, erase %.3f ms.\n", tag,
+	     insert_time * 1e3, find_time * 1e3, miss_time * 1e3, erase_time * 1e3);
+}
+
+static void run_bench_for_keys(const char *tag, unsigned count, Hash (*func)(unsigned))
+{
+	std::vector<Hash> keys;
+	keys.reserve(count);
+	for (unsigned i = 0; i < count; i++)
+		keys.push_back(func(i));
+
+	LOGI("=== %s (%u keys) ===\n", tag, count);
+	run_bench<IntrusiveHashMapHolder<Value>>("IntrusiveHashMapHolder", keys);
+	run_bench<FlatHashMapHolder<Value>>("FlatHashMapHolder", keys);
+}
+
+static unsigned destructor_count = 0;
+
+struct NonPOD : IntrusiveHashMapEnabled<NonPOD>
+{
+	NonPOD(int a) { v = a; }
+	~NonPOD()
+	{
+		destructor_count++;
+	}
+	int get() { return v; }
+	int v;
+};
+
+static void test_owning_map()
+{
+	ThreadSafeFlatHashMap<NonPOD> hash_map;
+
+	for (unsigned i = 0; i < 100000; i++)
+	{
+		hash_map.emplace_yield(get_clustered_key(i), i + 2000000);
+		hash_map.emplace_replace(get_clustered_key(i), i + 3000000);
+	}
+
+	if (destructor_count != 100000)
+	{
+		LOGE("Unexpected destructor count.\n");
+		exit(1);
+	}
+
+	for (unsigned i = 0; i < 100000; i += 2)
+		hash_map.erase(hash_map.find(get_clustered_key(i)));
+
+	for (unsigned i = 1; i < 100000; i += 2)
+	{
+		auto *v = hash_map.find(get_clustered_key(i));
+		if (!v || v->get() != int(i + 3000000))
+		{
+			LOGE("Lookup failed in owning map.\n");
+			exit(1);
+		}
+	}
+
+	hash_map.clear();
+	if (destructor_count != 200000)
+	{
+		LOGE("Unexpected destructor count.\n");
+		exit(1);
+	}
+}
+
+int main()
+{
+	test_owning_map();
+	run_bench_for_keys("Random", 1000, get_random_key);
+	run_bench_for_keys("Random", 100000, get_random_key);
+	run_bench_for_keys("Clustered", 1000, get_clustered_key);
+	run_bench_for_keys("Clustered", 100000, get_clustered_key);
+}
@@ -0,0 +1,156 @@
+/* Copyright (c) 2017-2018 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "hash.hpp"
+#include "timer.hpp"
+#include "util.hpp"
+#include <vector>
+#include <stdlib.h>
+
+using namespace Util;
+
+// The per-element path Hasher::data() used for every range before the bulk path existed.
+static Hash hash_per_element(const uint32_t *data, size_t size)
+{
+	Hash h = 0xcbf29ce484222325ull;
+	size /= sizeof(*data);
+	for (size_t i = 0; i < size; i++)
+		h = (h * 0x100000001b3ull) ^ data[i];
+	return h;
+}
+
+static void bench_range(const std::vector<uint32_t> &data, size_t size)
+{
+	unsigned iterations = unsigned(std::max<size_t>(64 * 1024 * 1024 / size, 1));
+	Hash sink = 0;
+	Timer timer;
+
+	timer.start();
+	for (unsigned i = 0; i < iterations; i++)
+		sink ^= hash_per_element(data.data(), size);
+	double per_element_time = timer.end();
+
+	timer.start();
+	for (unsigned i = 0; i < iterations; i++)
+		sink ^= hash_bulk(data.data(), size, i);
+	double bulk_time = timer.end();
+
+	double total_gb = double(size) * iterations / (1024.0 * 1024.0 * 1024.0);
+	LOGI("%8u bytes: per-element %6.2f GB/s, bulk %6.2f GB/s (sink %llx).\n",
+	     unsigned(size), total_gb / per_element_time, total_gb / bulk_time, static_cast<unsigned long long>(sink));
+}
+
+// Emulates the sequence of calls CommandBuffer::flush_descriptor_set does for a set with
+// a couple of UBOs and a handful of combined image samplers.
+static Hash hash_descriptor_set(const uint64_t *cookies, unsigned iteration)
+{
+	Hasher h;
+	h.u32(0);
+	for (unsigned binding = 0; binding < 2; binding++)
+	{
+		h.u64(cookies[binding] + iteration);
+		h.u32(256);
+	}
+
+	for (unsigned binding = 2; binding < 8; binding++)
+	{
+		h.u64(cookies[binding] + iteration);
+		h.u64(cookies[binding + 8]);
+		h.u32(5);
+	}
+	return h.get();
+}
+
+// Emulates CommandBuffer::flush_graphics_pipeline, which hashes vertex layout with u32()
+// and the static state words with data().
+static Hash hash_graphics_pipeline(const uint32_t *static_state, unsigned iteration)
+{
+	Hasher h;
+	h.u32(0xf);
+	for (unsigned attr = 0; attr < 4; attr++)
+	{
+		h.u32(attr);
+		h.u32(0);
+		h.u32(100 + attr);
+		h.u32(attr * 12);
+	}
+	h.u32(0);
+	h.u32(48);
+	h.u64(0x1234567890abcdefull + iteration);
+	h.u32(0);
+	h.u64(0xfedcba0987654321ull);
+	h.data(static_state, 4 * sizeof(uint32_t));
+	h.u32(0);
+	return h.get();
+}
+
+static void bench_command_buffer_paths()
+{
+	uint64_t cookies[16];
+	for (unsigned i = 0; i < 16; i++)
+		cookies[i] = 0x100000000ull * i + 3;
+	uint32_t static_state[4] = { 1, 2, 3, 4 };
+
+	const unsigned iterations = 10000000;
+	Hash sink = 0;
+	Timer timer;
+
+	timer.start();
+	for (unsigned i = 0; i < iterations; i++)
+		sink ^= hash_descriptor_set(cookies, i);
+	double descriptor_time = timer.end();
+
+	timer.start();
+	for (unsigned i = 0; i < iterations; i++)
+		sink ^= hash_graphics_pipeline(static_state, i);
+	double pipeline_time = timer.end();
+
+	LOGI("flush_descriptor_set hashing: %.2f ns / call.\n", 1e9 * descriptor_time / iterations);
+	LOGI("flush_graphics_pipeline hashing: %.2f ns / call (sink %llx).\n", 1e9 * pipeline_time / iterations,
+	     static_cast<unsigned long long>(sink));
+}
+
+int main()
+{
+	std::vector<uint32_t> data(16 * 1024 * 1024 / sizeof(uint32_t));
+	for (size_t i = 0; i < data.size(); i++)
+		data[i] = uint32_t(i * 0x9e3779b1u);
+
+	for (size_t size = 16; size <= data.size() * sizeof(uint32_t); size *= 4)
+		bench_range(data, size);
+
+	// Sanity check that the bulk path is sensitive to every byte in range.
+	Hash reference = hash_bulk(data.data(), 1000, 0);
+	for (unsigned i = 0; i < 1000; i++)
+	{
+		auto *bytes = reinterpret_cast<uint8_t *>(data.data());
+		bytes[i] ^= 1;
+		if (hash_bulk(data.data(), 1000, 0) == reference)
+		{
+			LOGE("Bulk hash did not change when flipping byte %u.\n", i);
+			return EXIT_FAILURE;
+		}
+		bytes[i] ^= 1;
+	}
+
+	bench_command_buffer_paths();
+}
@@ -0,0 +1,156 @@
+/* Copyright (c) 2017-2018 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include "object_pool.hpp"
+#include "timer.hpp"
+#include "util.hpp"
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <stdlib.h>
+
+using namespace Util;
+
+static std::atomic<unsigned> destructor_count;
+
+struct Object
+{
+	explicit Object(unsigned v)
+		: v(v)
+	{
+	}
+
+	~Object()
+	{
+		destructor_count++;
+	}
+
+	unsigned v;
+	uint8_t padding[60];
+};
+
+static void check(bool cond, const char *msg)
+{
+	if (!cond)
+	{
+		LOGE("%s\n", msg);
+		exit(EXIT_FAILURE);
+	}
+}
+
+static void test_slab_release()
+{
+	ObjectPool<Object> pool;
+	pool.set_release_delay_nsecs(0);
+
+	std::vector<Object *> objects;
+	for (unsigned i = 0; i < 10000; i++)
+		objects.push_back(pool.allocate(i));
+
+	auto stats = pool.get_stats();
+	LOGI("Peak: %u live, %u slabs, %u bytes.\n",
+	     unsigned(stats.live_objects), unsigned(stats.slab_count), unsigned(stats.bytes_retained));
+	check(stats.live_objects == 10000, "Wrong live count.");
+	check(stats.slab_count > 1, "Expected several slabs.");
+
+	for (unsigned i = 0; i < 10000; i++)
+		check(objects[i]->v == i, "Object was clobbered.");
+
+	// Keep every 1000th object alive, which pins a handful of slabs.
+	for (unsigned i = 0; i < 10000; i++)
+	{
+		if (i % 1000)
+			pool.free(objects[i]);
+	}
+
+	check(destructor_count == 9990, "Wrong destructor count.");
+	stats = pool.get_stats();
+	LOGI("After free: %u live, %u slabs, %u bytes.\n",
+	     unsigned(stats.live_objects), unsigned(stats.slab_count), unsigned(stats.bytes_retained));
+	check(stats.live_objects == 10, "Wrong live count.");
+	check(stats.slab_count <= 10, "Empty slabs were not released.");
+
+	for (unsigned i = 0; i < 10000; i += 1000)
+		pool.free(objects[i]);
+	check(pool.get_stats().slab_count == 0, "Pool still holds memory.");
+}
+
+static void test_release_delay()
+{
+	ObjectPool<Object> pool;
+	pool.free(pool.allocate(0u));
+
+	// With the default delay, the slab is kept around for reuse.
+	auto stats = pool.get_stats();
+	check(stats.slab_count == 1 && stats.empty_slab_count == 1, "Empty slab should have been retained.");
+	pool.free(pool.allocate(1u));
+	check(pool.get_stats().slab_count == 1, "Empty slab was not reused.");
+
+	pool.trim(true);
+	check(pool.get_stats().slab_count == 0, "Forced trim did not release slab.");
+}
+
+static void test_thread_safe()
+{
+	ThreadSafeObjectPool<Object> pool;
+	std::vector<std::thread> threads;
+	Timer timer;
+	timer.start();
+
+	for (unsigned t = 0; t < 4; t++)
+	{
+		threads.emplace_back([&pool, t]() {
+			std::vector<Object *> objects;
+			for (unsigned iter = 0; iter < 100; iter++)
+			{
+				for (unsigned i = 0; i < 1000; i++)
+					objects.push_back(pool.allocate(t * 1000 + i));
+				for (unsigned i = 0; i < 1000; i++)
+					check(objects[i]->v == t * 1000 + i, "Object was clobbered.");
+				for (auto *obj : objects)
+					pool.free(obj);
+				objects.clear();
+			}
+		});
+	}
+
+	for (auto &thread : threads)
+		thread.join();
+
+	double elapsed = timer.end();
+	auto stats = pool.get_stats();
+	LOGI("Threaded: %.3f ms, %u live, %u cached, %u slabs.\n", elapsed * 1e3,
+	     unsigned(stats.live_objects), unsigned(stats.cached_objects), unsigned(stats.slab_count));
+	check(stats.live_objects == 0, "Objects leaked.");
+
+	pool.trim(true);
+	check(pool.get_stats().slab_count == 0, "Pool still holds memory after trim.");
+}
+
+int main()
+{
+	test_slab_release();
+	test_release_delay();
+	test_thread_safe();
+	LOGI("All tests passed.\n");
+}
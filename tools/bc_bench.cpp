@@ -0,0 +1,357 @@
+/* Copyright (c) 2017-2018 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include "bc_compressor.hpp"
+#include "rgtc_compressor.hpp"
+#include "texture_files.hpp"
+#include "thread_group.hpp"
+#include "cli_parser.hpp"
+#include "timer.hpp"
+#include "util.hpp"
+#include <algorithm>
+#include <vector>
+#include <math.h>
+#include <string.h>
+
+using namespace std;
+using namespace Granite;
+using namespace Util;
+
+enum class BenchFormat
+{
+	BC1,
+	BC1_Alpha,
+	BC3,
+	BC4,
+	BC5
+};
+
+static const char *format_to_string(BenchFormat format)
+{
+	switch (format)
+	{
+	case BenchFormat::BC1:
+		return "bc1";
+	case BenchFormat::BC1_Alpha:
+		return "bc1_rgba";
+	case BenchFormat::BC3:
+		return "bc3";
+	case BenchFormat::BC4:
+		return "bc4";
+	case BenchFormat::BC5:
+		return "bc5";
+	}
+	return "";
+}
+
+static unsigned format_to_block_size(BenchFormat format)
+{
+	return format == BenchFormat::BC1 || format == BenchFormat::BC1_Alpha || format == BenchFormat::BC4 ? 8 : 16;
+}
+
+struct Image
+{
+	unsigned width = 0;
+	unsigned height = 0;
+	vector<uint8_t> rgba;
+};
+
+static Image create_synthetic_image(unsigned width, unsigned height)
+{
+	Image image;
+	image.width = width;
+	image.height = height;
+	image.rgba.resize(width * height * 4);
+
+	uint32_t seed = 1;
+	const auto noise = [&]() -> int {
+		seed = seed * 1664525u + 1013904223u;
+		return int((seed >> 24) & 15) - 8;
+	};
+
+	const auto saturate = [](float v) -> uint8_t {
+		return uint8_t(max(min(v, 255.0f), 0.0f));
+	};
+
+	// Smooth gradients, high frequency detail and noise, so every encoder mode is exercised.
+	for (unsigned y = 0; y < height; y++)
+	{
+		for (unsigned x = 0; x < width; x++)
+		{
+			float fx = float(x) / width;
+			float fy = float(y) / height;
+			auto *pix = &image.rgba[4 * (y * width + x)];
+			pix[0] = saturate(255.0f * fx + float(noise()));
+			pix[1] = saturate(127.5f + 127.5f * sinf(40.0f * fx * fy) + float(noise()));
+			pix[2] = saturate(255.0f * (1.0f - fy) * float((x / 16 + y / 16) & 1) + float(noise()));
+			pix[3] = saturate(255.0f * fy + 64.0f * sinf(float(x) * 0.1f));
+		}
+	}
+
+	return image;
+}
+
+static void compress_block(BenchFormat format, uint8_t *dst, const uint8_t *rgba, unsigned quality)
+{
+	uint8_t red[16], green[16];
+	switch (format)
+	{
+	case BenchFormat::BC1:
+		compress_bc1_block(dst, rgba, quality, false);
+		break;
+
+	case BenchFormat::BC1_Alpha:
+		compress_bc1_block(dst, rgba, quality, true);
+		break;
+
+	case BenchFormat::BC3:
+		compress_bc3_block(dst, rgba, quality);
+		break;
+
+	case BenchFormat::BC4:
+	case BenchFormat::BC5:
+		for (unsigned i = 0; i < 16; i++)
+		{
+			red[i] = rgba[4 * i + 0];
+			green[i] = rgba[4 * i + 1];
+		}
+
+		if (format == BenchFormat::BC4)
+			compress_rgtc_red_block(dst, red, quality);
+		else
+			compress_rgtc_red_green_block(dst, red, green, quality);
+		break;
+	}
+}
+
+static void decompress_block(BenchFormat format, uint8_t *rgba, const uint8_t *block)
+{
+	uint8_t red[16], green[16];
+	switch (format)
+	{
+	case BenchFormat::BC1:
+	case BenchFormat::BC1_Alpha:
+		decompress_bc1_block(rgba, block);
+		break;
+
+	case BenchFormat::BC3:
+		decompress_bc3_block(rgba, block);
+		break;
+
+	case BenchFormat::BC4:
+	case BenchFormat::BC5:
+		decompress_rgtc_red_block(red, block);
+		if (format == BenchFormat::BC5)
+			decompress_rgtc_red_block(green, block + 8);
+		for (unsigned i = 0; i < 16; i++)
+		{
+			rgba[4 * i + 0] = red[i];
+			rgba[4 * i + 1] = format == BenchFormat::BC5 ? green[i] : 0;
+			rgba[4 * i + 2] = 0;
+			rgba[4 * i + 3] = 255;
+		}
+		break;
+	}
+}
+
+static void fetch_block(const Image &image, unsigned x, unsigned y, uint8_t *rgba)
+{
+	for (unsigned sy = 0; sy < 4; sy++)
+	{
+		for (unsigned sx = 0; sx < 4; sx++)
+		{
+			unsigned cx = min(x + sx, image.width - 1);
+			unsigned cy = min(y + sy, image.height - 1);
+			memcpy(&rgba[4 * (sy * 4 + sx)], &image.rgba[4 * (cy * image.width + cx)], 4);
+		}
+	}
+}
+
+static void compress_block_row(const Image &image, BenchFormat format, unsigned quality, unsigned y, uint8_t *dst)
+{
+	uint8_t rgba[16 * 4];
+	unsigned block_size = format_to_block_size(format);
+	for (unsigned x = 0; x < image.width; x += 4, dst += block_size)
+	{
+		fetch_block(image, x, y, rgba);
+		compress_block(format, dst, rgba, quality);
+	}
+}
+
+// Returns PSNR over the channels the format stores.
+// Punch-through alpha is binary, so BC1 with alpha only measures RGB of texels which stay opaque.
+static double compute_psnr(const Image &image, BenchFormat format, const vector<uint8_t> &encoded)
+{
+	unsigned num_channels = 0;
+	switch (format)
+	{
+	case BenchFormat::BC1:
+	case BenchFormat::BC1_Alpha:
+		num_channels = 3;
+		break;
+	case BenchFormat::BC3:
+		num_channels = 4;
+		break;
+	case BenchFormat::BC4:
+		num_channels = 1;
+		break;
+	case BenchFormat::BC5:
+		num_channels = 2;
+		break;
+	}
+
+	unsigned block_size = format_to_block_size(format);
+	unsigned blocks_x = (image.width + 3) / 4;
+	uint8_t decoded[16 * 4];
+	uint8_t reference[16 * 4];
+	double error = 0.0;
+	double texels = 0.0;
+
+	for (unsigned y = 0; y < image.height; y += 4)
+	{
+		for (unsigned x = 0; x < image.width; x += 4)
+		{
+			decompress_block(format, decoded, &encoded[((y / 4) * blocks_x + x / 4) * block_size]);
+			fetch_block(image, x, y, reference);
+
+			for (unsigned sy = 0; sy < min(4u, image.height - y); sy++)
+			{
+				for (unsigned sx = 0; sx < min(4u, image.width - x); sx++)
+				{
+					if (format == BenchFormat::BC1_Alpha && reference[4 * (sy * 4 + sx) + 3] < 128)
+						continue;
+
+					texels += 1.0;
+					for (unsigned c = 0; c < num_channels; c++)
+					{
+						double diff = double(decoded[4 * (sy * 4 + sx) + c]) - double(reference[4 * (sy * 4 + sx) + c]);
+						error += diff * diff;
+					}
+				}
+			}
+		}
+	}
+
+	if (texels == 0.0)
+		return INFINITY;
+
+	error /= texels * num_channels;
+	if (error == 0.0)
+		return INFINITY;
+	return 10.0 * log10(255.0 * 255.0 / error);
+}
+
+static void run_bench(ThreadGroup &group, const Image &image, BenchFormat format, unsigned quality, unsigned iterations)
+{
+	unsigned block_size = format_to_block_size(format);
+	unsigned blocks_x = (image.width + 3) / 4;
+	unsigned blocks_y = (image.height + 3) / 4;
+	vector<uint8_t> encoded(blocks_x * blocks_y * block_size);
+	Timer timer;
+
+	timer.start();
+	for (unsigned i = 0; i < iterations; i++)
+		for (unsigned y = 0; y < image.height; y += 4)
+			compress_block_row(image, format, quality, y, &encoded[(y / 4) * blocks_x * block_size]);
+	double single_time = timer.end();
+
+	timer.start();
+	for (unsigned i = 0; i < iterations; i++)
+	{
+		auto task = group.create_task();
+		for (unsigned y = 0; y < image.height; y += 4)
+		{
+			task->enqueue_task([&, y]() {
+				compress_block_row(image, format, quality, y, &encoded[(y / 4) * blocks_x * block_size]);
+			});
+		}
+		task->flush();
+		task->wait();
+	}
+	double threaded_time = timer.end();
+
+	double mpix = double(image.width) * image.height * iterations * 1e-6;
+	LOGI("%-9s q%u: %8.2f MPix/s, %8.2f MPix/s threaded, PSNR %6.2f dB.\n",
+	     format_to_string(format), quality, mpix / single_time, mpix / threaded_time,
+	     compute_psnr(image, format, encoded));
+}
+
+static void print_help()
+{
+	LOGI("Usage: bc-bench [--quality [1-5]] [--iterations <count>] [--threads <count>] [input.png]\n");
+}
+
+int main(int argc, char *argv[])
+{
+	string input_path;
+	unsigned quality = 0;
+	unsigned iterations = 4;
+	unsigned threads = std::thread::hardware_concurrency();
+
+	CLICallbacks cbs;
+	cbs.add("--help", [&](CLIParser &parser) { print_help(); parser.end(); });
+	cbs.add("--quality", [&](CLIParser &parser) { quality = parser.next_uint(); });
+	cbs.add("--iterations", [&](CLIParser &parser) { iterations = parser.next_uint(); });
+	cbs.add("--threads", [&](CLIParser &parser) { threads = parser.next_uint(); });
+	cbs.default_handler = [&](const char *arg) { input_path = arg; };
+	cbs.error_handler = []() { print_help(); };
+	CLIParser parser(move(cbs), argc - 1, argv + 1);
+
+	if (!parser.parse())
+		return 1;
+	else if (parser.is_ended_state())
+		return 0;
+
+	Image image;
+	if (!input_path.empty())
+	{
+		auto tex = load_texture_from_file(input_path, ColorSpace::Linear);
+		auto &layout = tex.get_layout();
+		if (layout.get_format() != VK_FORMAT_R8G8B8A8_UNORM)
+		{
+			LOGE("Input %s must be an RGBA8 image.\n", input_path.c_str());
+			return 1;
+		}
+
+		image.width = layout.get_width();
+		image.height = layout.get_height();
+		image.rgba.resize(image.width * image.height * 4);
+		memcpy(image.rgba.data(), layout.data(), image.rgba.size());
+	}
+	else
+		image = create_synthetic_image(1024, 1024);
+
+	ThreadGroup group;
+	group.start(max(threads, 1u));
+
+	static const BenchFormat formats[] = {
+		BenchFormat::BC1, BenchFormat::BC1_Alpha, BenchFormat::BC3, BenchFormat::BC4, BenchFormat::BC5,
+	};
+
+	for (auto format : formats)
+	{
+		for (unsigned q = 1; q <= 5; q++)
+			if (quality == 0 || quality == q)
+				run_bench(group, image, format, q, max(iterations, 1u));
+	}
+}
@@ -0,0 +1,168 @@
+/* Copyright (c) 2017-2018 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include "device.hpp"
+#include "vulkan.hpp"
+#include "global_managers.hpp"
+#include "filesystem.hpp"
+#include "timer.hpp"
+#include "util.hpp"
+#include <string>
+#include <limits>
+#include <algorithm>
+#include <string.h>
+#include <stdlib.h>
+
+using namespace Vulkan;
+using namespace Granite;
+using namespace std;
+
+// Every run gets empty in-memory cache:// and assets:// protocols, so no run can see a VkPipelineCache
+// or shader cache flushed by an earlier run, and Device::set_context() finds no pipelines.json to replay implicitly.
+// Whatever is written on teardown is thrown away with the scratch filesystems.
+static void isolate_caches()
+{
+	Global::filesystem()->register_protocol("cache", unique_ptr<FilesystemBackend>(new ScratchFilesystem));
+	Global::filesystem()->register_protocol("assets", unique_ptr<FilesystemBackend>(new ScratchFilesystem));
+}
+
+// Replays a recorded pipeline database on a fresh device and measures wall time until every pipeline is created.
+static double run_replay(Context &context, const string &json, PipelineReplayMode mode, PipelineReplayProgress &progress)
+{
+	isolate_caches();
+
+	Device device;
+	device.set_pipeline_replay_mode(mode);
+	device.set_context(context);
+
+	auto start = Util::get_current_time_nsecs();
+	if (!device.replay_pipeline_state(json.data(), json.size()))
+		return -1.0;
+	progress = device.get_pipeline_replay_progress();
+	device.wait_pipeline_replay();
+	auto end = Util::get_current_time_nsecs();
+	return (end - start) * 1e-6;
+}
+
+struct ReplayTimes
+{
+	double total = 0.0;
+	double min = numeric_limits<double>::max();
+	unsigned count = 0;
+
+	void add(double t)
+	{
+		total += t;
+		min = std::min(min, t);
+		count++;
+	}
+};
+
+static void set_environment(const char *name, const char *value)
+{
+#ifdef _WIN32
+	_putenv_s(name, value);
+#else
+	setenv(name, value, 1);
+#endif
+}
+
+static void print_usage(const char *name)
+{
+	LOGE("Usage: %s <pipelines.json> [--iterations <count>]\n", name);
+}
+
+int main(int argc, char *argv[])
+{
+	if (argc != 2 && argc != 4)
+	{
+		print_usage(argv[0]);
+		return 1;
+	}
+
+	unsigned iterations = 2;
+	if (argc == 4)
+	{
+		if (strcmp(argv[2], "--iterations") != 0)
+		{
+			print_usage(argv[0]);
+			return 1;
+		}
+		iterations = std::max(1u, unsigned(strtoul(argv[3], nullptr, 0)));
+	}
+
+	// Driver-side disk caches would otherwise make every run after the first one a cache hit.
+	set_environment("MESA_SHADER_CACHE_DISABLE", "true");
+	set_environment("__GL_SHADER_DISK_CACHE", "0");
+
+	Global::init();
+
+	string json;
+	if (!Global::filesystem()->read_file_to_string(argv[1], json))
+	{
+		LOGE("Failed to read pipeline database: %s\n", argv[1]);
+		return 1;
+	}
+
+	if (!Context::init_loader(nullptr))
+		return 1;
+	Context context(nullptr, 0, nullptr, 0);
+
+	// Alternate which mode goes first, so neither mode is always the one to pay for a cold process.
+	PipelineReplayProgress progress;
+	ReplayTimes times[2][2];
+	static const PipelineReplayMode modes[2] = { PipelineReplayMode::Serial, PipelineReplayMode::Parallel };
+	for (unsigned i = 0; i < iterations; i++)
+	{
+		unsigned order = i & 1;
+		for (unsigned j = 0; j < 2; j++)
+		{
+			unsigned mode = j ^ order;
+			double t = run_replay(context, json, modes[mode], progress);
+			if (t < 0.0)
+				return 1;
+			times[mode][order].add(t);
+			LOGI("Iteration %u: %s replay %.3f ms.\n", i, mode ? "parallel" : "serial", t);
+		}
+	}
+
+	LOGI("Database: %u shader modules, %u programs, %u pipelines.\n",
+	     progress.shader_modules, progress.programs, progress.pipelines);
+
+	static const char *order_names[2] = { "serial first", "parallel first" };
+	for (unsigned order = 0; order < 2; order++)
+	{
+		auto &serial = times[0][order];
+		auto &parallel = times[1][order];
+		if (!serial.count || !parallel.count)
+			continue;
+
+		double serial_mean = serial.total / serial.count;
+		double parallel_mean = parallel.total / parallel.count;
+		LOGI("%s (%u runs): serial mean %.3f ms (min %.3f ms), parallel (%u workers) mean %.3f ms (min %.3f ms), %.2fx.\n",
+		     order_names[order], serial.count, serial_mean, serial.min,
+		     Global::thread_group()->get_num_threads(), parallel_mean, parallel.min, serial_mean / parallel_mean);
+	}
+
+	Global::deinit();
+}
@@ -0,0 +1,130 @@
+/* Copyright (c) 2017-2018 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include "gltf.hpp"
+#include "cooked_scene.hpp"
+#include "util.hpp"
+#include "cli_parser.hpp"
+#include "path.hpp"
+
+using namespace std;
+using namespace Util;
+using namespace Granite;
+
+static void print_help()
+{
+	LOGI("Usage: --output <out.gscene> input.glb\n");
+	LOGI("Texture paths are stored relative to the cooked scene, so it must be placed alongside the input.\n");
+}
+
+static bool make_texture_relative(SceneFormats::MaterialInfo::Texture &texture, const string &base)
+{
+	if (texture.path.empty())
+		return true;
+
+	if (texture.path.find("memory://") == 0)
+	{
+		LOGE("Embedded images cannot be cooked, repack the scene with external textures first.\n");
+		return false;
+	}
+
+	// The glTF parser resolves URIs against the input path, undo that.
+	if (texture.path.compare(0, base.size(), base) == 0)
+		texture.path = texture.path.substr(base.size());
+	return true;
+}
+
+int main(int argc, char *argv[])
+{
+	struct Arguments
+	{
+		string input;
+		string output;
+	} args;
+
+	CLICallbacks cbs;
+	cbs.add("--output", [&](CLIParser &parser) { args.output = parser.next_string(); });
+	cbs.add("--help", [](CLIParser &parser) { print_help(); parser.end(); });
+	cbs.default_handler = [&](const char *arg) { args.input = arg; };
+	CLIParser cli_parser(move(cbs), argc - 1, argv + 1);
+	if (!cli_parser.parse())
+		return 1;
+	else if (cli_parser.is_ended_state())
+		return 0;
+
+	if (args.input.empty() || args.output.empty())
+	{
+		print_help();
+		return 1;
+	}
+
+	if (Path::basedir(args.input) != Path::basedir(args.output))
+	{
+		LOGE("The cooked scene must be written to the same directory as the input.\n");
+		return 1;
+	}
+
+	GLTF::Parser parser(args.input);
+
+	auto base = Path::basedir(args.input);
+	if (base.empty() || base.back() != '/')
+		base += '/';
+
+	vector<SceneFormats::MaterialInfo> materials = parser.get_materials();
+	for (auto &material : materials)
+	{
+		if (!make_texture_relative(material.base_color, base) ||
+		    !make_texture_relative(material.normal, base) ||
+		    !make_texture_relative(material.metallic_roughness, base) ||
+		    !make_texture_relative(material.occlusion, base) ||
+		    !make_texture_relative(material.emissive, base))
+			return 1;
+	}
+
+	vector<SceneFormats::EnvironmentInfo> environments = parser.get_environments();
+	for (auto &env : environments)
+	{
+		if (!make_texture_relative(env.cube, base) ||
+		    !make_texture_relative(env.reflection, base) ||
+		    !make_texture_relative(env.irradiance, base))
+			return 1;
+	}
+
+	SceneFormats::SceneInformation info;
+	info.animations = parser.get_animations();
+	info.cameras = parser.get_cameras();
+	info.lights = parser.get_lights();
+	info.materials = materials;
+	info.meshes = parser.get_meshes();
+	info.nodes = parser.get_nodes();
+	info.skins = parser.get_skins();
+	info.scene_nodes = &parser.get_scenes()[parser.get_default_scene()];
+
+	if (!SceneFormats::export_cooked_scene(args.output, info, environments))
+	{
+		LOGE("Failed to export cooked scene.\n");
+		return 1;
+	}
+
+	return 0;
+}
@@ -59,6 +59,8 @@ static void print_help()
 	LOGI("[--animate-cameras]\n");
 	LOGI("[--optimize-meshes]\n");
 	LOGI("[--stripify-meshes]\n");
+	LOGI("[--optimize-overdraw]\n");
+	LOGI("[--encode-meshes]\n");
 	LOGI("[--quantize-attributes]\n");
 	LOGI("[--flip-tangent-w]\n");
 	LOGI("[--renormalize-normals]\n");
@@ -121,6 +123,15 @@ int main(int argc, char *argv[])
 		options.stripify_meshes = true;
 	});
 
+	cbs.add("--optimize-overdraw", [&](CLIParser &) {
+		options.optimize_meshes = true;
+		options.optimize_overdraw = true;
+	});
+
+	cbs.add("--encode-meshes", [&](CLIParser &) {
+		options.encode_meshes = true;
+	});
+
 	cbs.add("--threads", [&](CLIParser &parser) { options.threads = parser.next_uint(); });
 	cbs.add("--help", [](CLIParser &parser) { print_help(); parser.end(); });
 	cbs.default_handler = [&](const char *arg) { args.input = arg; };
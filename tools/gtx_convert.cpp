@@ -34,13 +34,14 @@ using namespace Util;
 
 static void print_help()
 {
-	LOGI("Usage: [--mipgen] [--quality [1-5]] [--format <format>] --output <out.gtx> <in.gtx>\n");
+	LOGI("Usage: [--mipgen] [--mip-filter <box/kaiser>] [--alpha-coverage <cutoff>] [--quality [1-5]] [--format <format>] --output <out.gtx> <in.gtx>\n");
 }
 
 int main(int argc, char *argv[])
 {
 	string input_path;
 	bool generate_mipmap = false;
+	MipmapGenerationOptions mip_options;
 	CompressorArguments args;
 
 	args.mode = TextureMode::RGB;
@@ -52,6 +53,16 @@ int main(int argc, char *argv[])
 	cbs.add("--output", [&](CLIParser &parser) { args.output = parser.next_string(); });
 	cbs.add("--alpha", [&](CLIParser &) { args.mode = TextureMode::RGBA; });
 	cbs.add("--mipgen", [&](CLIParser &) { generate_mipmap = true; });
+	cbs.add("--mip-filter", [&](CLIParser &parser) {
+		auto filter = parser.next_string();
+		if (strcmp(filter, "kaiser") == 0)
+			mip_options.filter = MipmapFilter::Kaiser;
+		else if (strcmp(filter, "box") == 0)
+			mip_options.filter = MipmapFilter::Box;
+		else
+			throw invalid_argument("Unknown mip filter");
+	});
+	cbs.add("--alpha-coverage", [&](CLIParser &parser) { mip_options.alpha_coverage_cutoff = float(parser.next_double()); });
 	cbs.default_handler = [&](const char *arg) { input_path = arg; };
 	cbs.error_handler = []() { print_help(); };
 	CLIParser parser(move(cbs), argc - 1, argv + 1);
@@ -96,12 +107,16 @@ int main(int argc, char *argv[])
 		return 1;
 	}
 
+	ThreadGroup group;
+	group.start(std::thread::hardware_concurrency());
+
 	if (generate_mipmap)
 	{
+		mip_options.group = &group;
 		if (args.format == VK_FORMAT_R8G8B8A8_UNORM || args.format == VK_FORMAT_R8G8B8A8_SRGB)
-			*input = generate_mipmaps_to_file(args.output, input->get_layout(), input->get_flags());
+			*input = generate_mipmaps_to_file(args.output, input->get_layout(), input->get_flags(), mip_options);
 		else
-			*input = generate_mipmaps(input->get_layout(), input->get_flags());
+			*input = generate_mipmaps(input->get_layout(), input->get_flags(), mip_options);
 
 		if (input->get_layout().get_required_size() == 0)
 		{
@@ -113,9 +128,6 @@ int main(int argc, char *argv[])
 	if (input->get_layout().get_format() == VK_FORMAT_R16G16B16A16_SFLOAT)
 		args.mode = TextureMode::HDR;
 
-	ThreadGroup group;
-	group.start(std::thread::hardware_concurrency());
-
 	auto dummy = group.create_task();
 	compress_texture(group, args, input, dummy, nullptr);
 	dummy->flush();
@@ -24,6 +24,8 @@
 #include "util.hpp"
 #include "cli_parser.hpp"
 #include "obj.hpp"
+#include "filesystem.hpp"
+#include "timer.hpp"
 
 using namespace std;
 using namespace Util;
@@ -31,7 +33,7 @@ using namespace Granite;
 
 static void print_help()
 {
-	LOGI("Usage: --output <out.glb> --scale <scale> input.obj\n");
+	LOGI("Usage: --output <out.glb> --scale <scale> [--benchmark <iterations>] input.obj\n");
 }
 
 int main(int argc, char *argv[])
@@ -41,11 +43,13 @@ int main(int argc, char *argv[])
 		string input;
 		string output;
 		float scale = 1.0f;
+		unsigned benchmark_iterations = 0;
 	} args;
 
 	CLICallbacks cbs;
 	cbs.add("--output", [&](CLIParser &parser) { args.output = parser.next_string(); });
 	cbs.add("--scale", [&](CLIParser &parser) { args.scale = parser.next_double(); });
+	cbs.add("--benchmark", [&](CLIParser &parser) { args.benchmark_iterations = parser.next_uint(); });
 	cbs.add("--help", [](CLIParser &parser) { print_help(); parser.end(); });
 	cbs.default_handler = [&](const char *arg) { args.input = arg; };
 	CLIParser cli_parser(move(cbs), argc - 1, argv + 1);
@@ -54,12 +58,42 @@ int main(int argc, char *argv[])
 	else if (cli_parser.is_ended_state())
 		return 0;
 
-	if (args.input.empty() || args.output.empty())
+	if (args.input.empty() || (args.output.empty() && !args.benchmark_iterations))
 	{
 		print_help();
 		return 1;
 	}
 
+	if (args.benchmark_iterations)
+	{
+		FileStat s;
+		if (!Global::filesystem()->stat(args.input, s))
+		{
+			LOGE("Failed to stat %s.\n", args.input.c_str());
+			return 1;
+		}
+
+		Timer timer;
+		double best_time = 0.0;
+		double total_time = 0.0;
+		for (unsigned i = 0; i < args.benchmark_iterations; i++)
+		{
+			timer.start();
+			OBJ::Parser bench_parser(args.input);
+			double t = timer.end();
+			total_time += t;
+			if (i == 0 || t < best_time)
+				best_time = t;
+		}
+
+		double mb = double(s.size) / (1024.0 * 1024.0);
+		LOGI("Parsed %.2f MB in %.3f ms (best), %.3f ms (average), %.2f MB/s (best).\n",
+		     mb, best_time * 1e3, 1e3 * total_time / args.benchmark_iterations, mb / best_time);
+
+		if (args.output.empty())
+			return 0;
+	}
+
 	OBJ::Parser parser(args.input);
 
 	SceneFormats::SceneInformation info;
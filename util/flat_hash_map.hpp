@@ -0,0 +1,365 @@
+/* Copyright (c) 2017-2018 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include "intrusive_hash_map.hpp"
+#include "util.hpp"
+#include <vector>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define GRANITE_FLAT_HASH_MAP_SSE2 1
+#endif
+
+namespace Util
+{
+// Drop-in replacement for IntrusiveHashMapHolder.
+// Open addressing in the style of SwissTable. Every slot has one control byte which holds
+// either a 7-bit tag of the hash or an empty/deleted marker. Control bytes are scanned 16 at a time,
+// and the full hash is stored inline next to the pointer, so lookups never have to dereference
+// a stored value unless it is the one we are looking for.
+// Load factor is kept between 7/16 and 7/8, so memory overhead is bounded
+// to 17 bytes per slot regardless of how the hashes cluster.
+// Like IntrusiveHashMapHolder, this container is non-owning and T must inherit from IntrusiveHashMapEnabled<T>.
+template <typename T>
+class FlatHashMapHolder
+{
+public:
+	enum { GroupSize = 16, InitialSize = 16 };
+
+	FlatHashMapHolder() = default;
+	FlatHashMapHolder(const FlatHashMapHolder &) = delete;
+	void operator=(const FlatHashMapHolder &) = delete;
+
+	T *find(Hash hash) const
+	{
+		size_t index;
+		if (find_index(hash, index))
+			return slots[index].value;
+		else
+			return nullptr;
+	}
+
+	template <typename P>
+	bool find_and_consume_pod(Hash hash, P &p) const
+	{
+		T *t = find(hash);
+		if (t)
+		{
+			p = t->get();
+			return true;
+		}
+		else
+			return false;
+	}
+
+	// Same semantics as IntrusiveHashMapHolder::insert_yield.
+	T *insert_yield(T *&value)
+	{
+		auto hash = get_hash(value);
+		size_t index;
+		if (find_index(hash, index))
+		{
+			T *ret = value;
+			value = slots[index].value;
+			return ret;
+		}
+
+		insert_new(hash, value);
+		list.insert_front(value);
+		return nullptr;
+	}
+
+	// Same semantics as IntrusiveHashMapHolder::insert_replace.
+	T *insert_replace(T *value)
+	{
+		auto hash = get_hash(value);
+		size_t index;
+		if (find_index(hash, index))
+		{
+			std::swap(slots[index].value, value);
+			list.erase(value);
+			list.insert_front(slots[index].value);
+			return value;
+		}
+
+		insert_new(hash, value);
+		list.insert_front(value);
+		return nullptr;
+	}
+
+	T *erase(Hash hash)
+	{
+		size_t index;
+		if (!find_index(hash, index))
+			return nullptr;
+
+		auto *value = slots[index].value;
+		list.erase(value);
+		erase_index(index);
+		return value;
+	}
+
+	void erase(T *value)
+	{
+		erase(get_hash(value));
+	}
+
+	// Keeps the table allocated, so maps which are cleared every frame do not reallocate.
+	void clear()
+	{
+		list.clear();
+		if (!control.empty())
+			memset(control.data(), ControlEmpty, control.size());
+		count = 0;
+		tombstones = 0;
+	}
+
+	size_t size() const
+	{
+		return count;
+	}
+
+	size_t get_capacity() const
+	{
+		return control.size();
+	}
+
+	typename IntrusiveList<T>::Iterator begin()
+	{
+		return list.begin();
+	}
+
+	typename IntrusiveList<T>::Iterator end()
+	{
+		return list.end();
+	}
+
+	IntrusiveList<T> &inner_list()
+	{
+		return list;
+	}
+
+private:
+	enum : uint8_t
+	{
+		ControlEmpty = 0x80,
+		ControlDeleted = 0xfe
+	};
+
+	struct Slot
+	{
+		Hash hash;
+		T *value;
+	};
+
+	std::vector<uint8_t> control;
+	std::vector<Slot> slots;
+	IntrusiveList<T> list;
+	size_t count = 0;
+	size_t tombstones = 0;
+
+	static inline Hash get_hash(const T *value)
+	{
+		return static_cast<const IntrusiveHashMapEnabled<T> *>(value)->get_hash();
+	}
+
+	// Hashes from Util::Hasher which only differ in the last few values hashed
+	// mostly differ in the low bits, so mix everything before splitting into group index and tag.
+	static inline Hash mix_hash(Hash hash)
+	{
+		return (hash ^ (hash >> 32)) * 0x9e3779b97f4a7c15ull;
+	}
+
+	static inline uint8_t get_tag(Hash mixed)
+	{
+		return uint8_t(mixed >> 57);
+	}
+
+	static inline size_t get_group_start(Hash mixed)
+	{
+		return size_t(mixed >> 25);
+	}
+
+	inline size_t get_group_mask() const
+	{
+		return control.size() / GroupSize - 1;
+	}
+
+	// Returns a bitmask of which bytes in the group are equal to tag.
+	static inline uint32_t match_group(const uint8_t *group, uint8_t tag)
+	{
+#ifdef GRANITE_FLAT_HASH_MAP_SSE2
+		__m128i ctrl = _mm_loadu_si128(reinterpret_cast<const __m128i *>(group));
+		return uint32_t(_mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, _mm_set1_epi8(char(tag)))));
+#else
+		uint32_t mask = 0;
+		for (unsigned i = 0; i < GroupSize; i++)
+			if (group[i] == tag)
+				mask |= 1u << i;
+		return mask;
+#endif
+	}
+
+	// Returns a bitmask of which bytes are either empty or deleted, i.e. have the top bit set.
+	static inline uint32_t match_empty_or_deleted(const uint8_t *group)
+	{
+#ifdef GRANITE_FLAT_HASH_MAP_SSE2
+		__m128i ctrl = _mm_loadu_si128(reinterpret_cast<const __m128i *>(group));
+		return uint32_t(_mm_movemask_epi8(ctrl));
+#else
+		uint32_t mask = 0;
+		for (unsigned i = 0; i < GroupSize; i++)
+			if (group[i] & 0x80)
+				mask |= 1u << i;
+		return mask;
+#endif
+	}
+
+	bool find_index(Hash hash, size_t &index) const
+	{
+		if (control.empty())
+			return false;
+
+		Hash mixed = mix_hash(hash);
+		uint8_t tag = get_tag(mixed);
+		size_t group_mask = get_group_mask();
+		size_t group = get_group_start(mixed) & group_mask;
+
+		// Triangular probing over groups visits every group exactly once when the group count is a power of two.
+		for (size_t step = 1; step <= group_mask + 1; step++)
+		{
+			const uint8_t *ctrl = control.data() + group * GroupSize;
+			uint32_t mask = match_group(ctrl, tag);
+			while (mask)
+			{
+				size_t i = group * GroupSize + trailing_zeroes(mask);
+				if (slots[i].hash == hash)
+				{
+					index = i;
+					return true;
+				}
+				mask &= mask - 1;
+			}
+
+			// If there is an empty slot in this group, no insertion could have probed past it.
+			if (match_group(ctrl, ControlEmpty))
+				return false;
+
+			group = (group + step) & group_mask;
+		}
+
+		return false;
+	}
+
+	size_t find_insertion_index(Hash hash) const
+	{
+		size_t group_mask = get_group_mask();
+		size_t group = get_group_start(mix_hash(hash)) & group_mask;
+
+		for (size_t step = 1;; step++)
+		{
+			uint32_t mask = match_empty_or_deleted(control.data() + group * GroupSize);
+			if (mask)
+				return group * GroupSize + trailing_zeroes(mask);
+			group = (group + step) & group_mask;
+		}
+	}
+
+	void insert_new(Hash hash, T *value)
+	{
+		// Keep at least 1/8 of the slots empty so that probe sequences terminate quickly.
+		size_t capacity = control.size();
+		if ((count + tombstones + 1) * 8 > capacity * 7)
+		{
+			// If most of the load comes from tombstones, just rehash in place.
+			if (capacity && (count + 1) * 16 <= capacity * 7)
+				rehash(capacity);
+			else
+				rehash(capacity ? capacity * 2 : size_t(InitialSize));
+		}
+
+		size_t index = find_insertion_index(hash);
+		if (control[index] == ControlDeleted)
+			tombstones--;
+		control[index] = get_tag(mix_hash(hash));
+		slots[index] = { hash, value };
+		count++;
+	}
+
+	void erase_index(size_t index)
+	{
+		// If the group still has an empty slot, no probe sequence can have continued past this group,
+		// so we can mark the slot as empty rather than leaving a tombstone.
+		const uint8_t *group = control.data() + (index & ~size_t(GroupSize - 1));
+		if (match_group(group, ControlEmpty))
+			control[index] = ControlEmpty;
+		else
+		{
+			control[index] = ControlDeleted;
+			tombstones++;
+		}
+
+		slots[index] = { 0, nullptr };
+		count--;
+	}
+
+	void rehash(size_t new_capacity)
+	{
+		assert((new_capacity & (new_capacity - 1)) == 0);
+		assert(new_capacity >= GroupSize);
+
+		std::vector<uint8_t> old_control;
+		std::vector<Slot> old_slots;
+		std::swap(old_control, control);
+		std::swap(old_slots, slots);
+
+		control.resize(new_capacity);
+		memset(control.data(), ControlEmpty, new_capacity);
+		slots.resize(new_capacity);
+		tombstones = 0;
+
+		for (size_t i = 0; i < old_control.size(); i++)
+		{
+			if ((old_control[i] & 0x80) == 0)
+			{
+				size_t index = find_insertion_index(old_slots[i].hash);
+				control[index] = old_control[i];
+				slots[index] = old_slots[i];
+			}
+		}
+	}
+};
+
+template <typename T>
+using FlatHashMap = IntrusiveHashMap<T, FlatHashMapHolder<T>>;
+
+template <typename T>
+using ThreadSafeFlatHashMap = ThreadSafeIntrusiveHashMap<T, FlatHashMapHolder<T>>;
+
+template <typename T>
+using FlatHashMapWrapper = FlatHashMap<IntrusivePODWrapper<T>>;
+}
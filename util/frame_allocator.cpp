@@ -0,0 +1,148 @@
+/* Copyright (c) 2017-2018 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "frame_allocator.hpp"
+#include <atomic>
+
+namespace Util
+{
+static std::atomic<uint64_t> frame_epoch;
+static std::atomic<uint64_t> block_allocation_count;
+static std::atomic<uint64_t> heap_allocation_count;
+static std::atomic<uint64_t> last_frame_block_allocation_count;
+static std::atomic<uint64_t> last_frame_heap_allocation_count;
+static std::atomic<uint64_t> frame_start_block_allocation_count;
+static std::atomic<uint64_t> frame_start_heap_allocation_count;
+
+FrameArena::~FrameArena()
+{
+	for (auto &gen : generations)
+		for (auto &block : gen.blocks)
+			free(block.data);
+}
+
+FrameArena &FrameArena::get_thread_arena()
+{
+	static thread_local FrameArena arena;
+	return arena;
+}
+
+void FrameArena::begin_frame()
+{
+	uint64_t blocks = block_allocation_count.load(std::memory_order_relaxed);
+	uint64_t heap = heap_allocation_count.load(std::memory_order_relaxed);
+	last_frame_block_allocation_count.store(blocks - frame_start_block_allocation_count.load(std::memory_order_relaxed),
+	                                        std::memory_order_relaxed);
+	last_frame_heap_allocation_count.store(heap - frame_start_heap_allocation_count.load(std::memory_order_relaxed),
+	                                       std::memory_order_relaxed);
+	frame_start_block_allocation_count.store(blocks, std::memory_order_relaxed);
+	frame_start_heap_allocation_count.store(heap, std::memory_order_relaxed);
+
+	frame_epoch.fetch_add(1, std::memory_order_release);
+}
+
+FrameArenaStats FrameArena::get_total_stats()
+{
+	FrameArenaStats stats;
+	stats.block_allocations = block_allocation_count.load(std::memory_order_relaxed);
+	stats.heap_allocations = heap_allocation_count.load(std::memory_order_relaxed);
+	return stats;
+}
+
+FrameArenaStats FrameArena::get_last_frame_stats()
+{
+	FrameArenaStats stats;
+	stats.block_allocations = last_frame_block_allocation_count.load(std::memory_order_relaxed);
+	stats.heap_allocations = last_frame_heap_allocation_count.load(std::memory_order_relaxed);
+	return stats;
+}
+
+void FrameArena::count_heap_allocation()
+{
+	heap_allocation_count.fetch_add(1, std::memory_order_relaxed);
+}
+
+FrameArena::Block FrameArena::allocate_block(size_t size)
+{
+	Block block;
+	block.data = static_cast<uint8_t *>(malloc(size));
+	if (!block.data)
+		throw std::bad_alloc();
+	block.size = size;
+	block_allocation_count.fetch_add(1, std::memory_order_relaxed);
+	return block;
+}
+
+void FrameArena::recycle(Generation &gen)
+{
+	// Merge into one block which is large enough to hold everything we needed last time around.
+	if (gen.blocks.size() > 1)
+	{
+		for (auto &block : gen.blocks)
+			free(block.data);
+		gen.blocks.clear();
+		gen.blocks.push_back(allocate_block(gen.total_size));
+	}
+
+	gen.offset = 0;
+}
+
+void *FrameArena::allocate(size_t size, size_t alignment)
+{
+	uint64_t epoch = frame_epoch.load(std::memory_order_acquire);
+	if (epoch != current_epoch)
+	{
+		current_epoch = epoch;
+		recycle(generations[epoch % NumGenerations]);
+	}
+
+	auto &gen = generations[current_epoch % NumGenerations];
+
+	if (!gen.blocks.empty())
+	{
+		auto &block = gen.blocks.back();
+		uintptr_t base = reinterpret_cast<uintptr_t>(block.data);
+		uintptr_t ptr = (base + gen.offset + alignment - 1) & ~uintptr_t(alignment - 1);
+		if (ptr + size <= base + block.size)
+		{
+			gen.offset = ptr + size - base;
+			return reinterpret_cast<void *>(ptr);
+		}
+	}
+
+	// Grow geometrically, so a generation converges on a single block quickly.
+	size_t block_size = BlockSize;
+	if (block_size < gen.total_size)
+		block_size = gen.total_size;
+	if (block_size < size + alignment)
+		block_size = size + alignment;
+
+	gen.blocks.push_back(allocate_block(block_size));
+	gen.total_size += block_size;
+
+	auto &block = gen.blocks.back();
+	uintptr_t base = reinterpret_cast<uintptr_t>(block.data);
+	uintptr_t ptr = (base + alignment - 1) & ~uintptr_t(alignment - 1);
+	gen.offset = ptr + size - base;
+	return reinterpret_cast<void *>(ptr);
+}
+}
@@ -0,0 +1,166 @@
+/* Copyright (c) 2017-2018 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <new>
+#include <vector>
+
+namespace Util
+{
+struct FrameArenaStats
+{
+	// Number of times any thread's arena had to call malloc for a new block.
+	uint64_t block_allocations = 0;
+	// Number of allocations through FrameAllocator which were not backed by an arena.
+	uint64_t heap_allocations = 0;
+};
+
+// Per-thread bump allocator for scratch data which only lives within a frame.
+// Memory is never freed individually. Each arena has two generations which alternate every frame,
+// so data allocated in frame N stays valid until frame N + 2 begins.
+// Generations are recycled lazily by the owning thread on the first allocation in a new frame,
+// and if a generation needed several blocks, they are merged into one, so steady state needs no mallocs.
+class FrameArena
+{
+public:
+	enum { BlockSize = 64 * 1024, NumGenerations = 2 };
+
+	FrameArena() = default;
+	~FrameArena();
+	FrameArena(const FrameArena &) = delete;
+	void operator=(const FrameArena &) = delete;
+
+	void *allocate(size_t size, size_t alignment);
+
+	// Arena of the calling thread.
+	static FrameArena &get_thread_arena();
+
+	// Called once per frame, from Device::next_frame_context().
+	static void begin_frame();
+
+	static FrameArenaStats get_total_stats();
+	static FrameArenaStats get_last_frame_stats();
+
+	static void count_heap_allocation();
+
+private:
+	struct Block
+	{
+		uint8_t *data = nullptr;
+		size_t size = 0;
+	};
+
+	struct Generation
+	{
+		std::vector<Block> blocks;
+		size_t offset = 0;
+		size_t total_size = 0;
+	};
+
+	Generation generations[NumGenerations];
+	uint64_t current_epoch = ~0ull;
+
+	void recycle(Generation &gen);
+	Block allocate_block(size_t size);
+};
+
+// STL-compatible allocator. When constructed with an arena, memory comes from that arena and deallocate() is a no-op.
+// When default constructed, it falls back to the heap, so containers which persist across frames
+// can share a type with per-frame scratch containers.
+template <typename T>
+class FrameAllocator
+{
+public:
+	using value_type = T;
+
+	FrameAllocator() noexcept = default;
+
+	explicit FrameAllocator(FrameArena *arena) noexcept
+		: arena(arena)
+	{
+	}
+
+	template <typename U>
+	FrameAllocator(const FrameAllocator<U> &other) noexcept
+		: arena(other.get_arena())
+	{
+	}
+
+	T *allocate(size_t n)
+	{
+		if (arena)
+			return static_cast<T *>(arena->allocate(n * sizeof(T), alignof(T)));
+
+		FrameArena::count_heap_allocation();
+		void *ptr = malloc(n * sizeof(T));
+		if (!ptr)
+			throw std::bad_alloc();
+		return static_cast<T *>(ptr);
+	}
+
+	void deallocate(T *ptr, size_t) noexcept
+	{
+		if (!arena)
+			free(ptr);
+	}
+
+	FrameArena *get_arena() const noexcept
+	{
+		return arena;
+	}
+
+	template <typename U>
+	struct rebind
+	{
+		using other = FrameAllocator<U>;
+	};
+
+private:
+	FrameArena *arena = nullptr;
+};
+
+template <typename T, typename U>
+inline bool operator==(const FrameAllocator<T> &a, const FrameAllocator<U> &b) noexcept
+{
+	return a.get_arena() == b.get_arena();
+}
+
+template <typename T, typename U>
+inline bool operator!=(const FrameAllocator<T> &a, const FrameAllocator<U> &b) noexcept
+{
+	return a.get_arena() != b.get_arena();
+}
+
+template <typename T>
+using FrameVector = std::vector<T, FrameAllocator<T>>;
+
+// Allocator which uses the calling thread's frame arena.
+template <typename T>
+inline FrameAllocator<T> thread_frame_allocator()
+{
+	return FrameAllocator<T>(&FrameArena::get_thread_arena());
+}
+}
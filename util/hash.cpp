@@ -0,0 +1,165 @@
+/* Copyright (c) 2017-2018 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "hash.hpp"
+#include <string.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define GRANITE_HASH_SSE2 1
+#endif
+
+namespace Util
+{
+// The kernel is modelled after XXH3. Each 64-byte stripe is split into 8 lanes,
+// and each lane accumulates (lo32(v ^ key) * hi32(v ^ key)) as well as its neighbour's raw value.
+// The 32x32 -> 64 multiply maps directly to pmuludq, so two lanes are processed per SSE2 instruction.
+enum
+{
+	StripeSize = 64,
+	NumLanes = 8,
+	StripesPerScramble = 16
+};
+
+static const uint64_t Prime64_1 = 0x9e3779b185ebca87ull;
+static const uint64_t Prime64_2 = 0xc2b2ae3d27d4eb4full;
+static const uint64_t Prime64_3 = 0x165667b19e3779f9ull;
+static const uint64_t Prime32_1 = 0x9e3779b1ull;
+
+alignas(16) static const uint64_t lane_keys[NumLanes] = {
+	0xbe4ba423396cfeb8ull, 0x1cad21f72c81017cull, 0xdb979083e96dd4deull, 0x1f67b3b7a4a44072ull,
+	0x78e5c0cc4ee679cbull, 0x2172ffcc7dd05a82ull, 0x8e2443f7744608b8ull, 0x4c263a81e69035e0ull,
+};
+
+static inline uint64_t load64(const uint8_t *ptr)
+{
+	uint64_t v;
+	memcpy(&v, ptr, sizeof(v));
+	return v;
+}
+
+static inline void accumulate_stripe_scalar(uint64_t *acc, const uint8_t *ptr)
+{
+	for (unsigned i = 0; i < NumLanes; i++)
+	{
+		uint64_t v = load64(ptr + i * sizeof(uint64_t));
+		uint64_t k = v ^ lane_keys[i];
+		acc[i ^ 1] += v;
+		acc[i] += (k & 0xffffffffu) * (k >> 32);
+	}
+}
+
+#ifdef GRANITE_HASH_SSE2
+static inline void accumulate_stripes_sse2(uint64_t *acc_, const uint8_t *ptr, size_t count)
+{
+	__m128i acc[NumLanes / 2];
+	__m128i keys[NumLanes / 2];
+	for (unsigned i = 0; i < NumLanes / 2; i++)
+	{
+		acc[i] = _mm_loadu_si128(reinterpret_cast<const __m128i *>(acc_) + i);
+		keys[i] = _mm_load_si128(reinterpret_cast<const __m128i *>(lane_keys) + i);
+	}
+
+	for (size_t stripe = 0; stripe < count; stripe++, ptr += StripeSize)
+	{
+		for (unsigned i = 0; i < NumLanes / 2; i++)
+		{
+			__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(ptr) + i);
+			__m128i k = _mm_xor_si128(v, keys[i]);
+			__m128i k_hi = _mm_shuffle_epi32(k, _MM_SHUFFLE(0, 3, 0, 1));
+			__m128i product = _mm_mul_epu32(k, k_hi);
+			__m128i v_swapped = _mm_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 3, 2));
+			acc[i] = _mm_add_epi64(acc[i], _mm_add_epi64(product, v_swapped));
+		}
+	}
+
+	for (unsigned i = 0; i < NumLanes / 2; i++)
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(acc_) + i, acc[i]);
+}
+#endif
+
+static inline void accumulate_stripes(uint64_t *acc, const uint8_t *ptr, size_t count)
+{
+#ifdef GRANITE_HASH_SSE2
+	accumulate_stripes_sse2(acc, ptr, count);
+#else
+	for (size_t i = 0; i < count; i++)
+		accumulate_stripe_scalar(acc, ptr + i * StripeSize);
+#endif
+}
+
+// Without scrambling, the low 32 bits of each lane would only ever see their own products.
+static inline void scramble(uint64_t *acc)
+{
+	for (unsigned i = 0; i < NumLanes; i++)
+	{
+		uint64_t a = acc[i];
+		a ^= a >> 47;
+		a ^= lane_keys[i];
+		acc[i] = a * Prime32_1;
+	}
+}
+
+static inline uint64_t avalanche(uint64_t h)
+{
+	h ^= h >> 33;
+	h *= Prime64_2;
+	h ^= h >> 29;
+	h *= Prime64_3;
+	h ^= h >> 32;
+	return h;
+}
+
+Hash hash_bulk(const void *data_, size_t size, Hash seed)
+{
+	auto *data = static_cast<const uint8_t *>(data_);
+
+	uint64_t acc[NumLanes];
+	for (unsigned i = 0; i < NumLanes; i++)
+		acc[i] = seed + lane_keys[i];
+
+	size_t stripes = size / StripeSize;
+	while (stripes)
+	{
+		size_t to_process = stripes < StripesPerScramble ? stripes : size_t(StripesPerScramble);
+		accumulate_stripes(acc, data, to_process);
+		data += to_process * StripeSize;
+		stripes -= to_process;
+		if (to_process == StripesPerScramble)
+			scramble(acc);
+	}
+
+	// Zero-pad the last partial stripe. The length is mixed in below, so padding is unambiguous.
+	size_t tail = size & (StripeSize - 1);
+	if (tail)
+	{
+		uint8_t last[StripeSize] = {};
+		memcpy(last, data, tail);
+		accumulate_stripe_scalar(acc, last);
+	}
+
+	uint64_t h = seed ^ (uint64_t(size) * Prime64_1);
+	for (unsigned i = 0; i < NumLanes; i++)
+		h = (h ^ avalanche(acc[i])) * Prime64_1 + Prime64_3;
+	return avalanche(h);
+}
+}
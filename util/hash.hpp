@@ -23,14 +23,23 @@
 #pragma once
 #include <stdint.h>
 #include <string>
+#include <stddef.h>
 
 namespace Util
 {
 using Hash = uint64_t;
 
+// Hashes a large block of memory, processing 64 bytes per iteration with 8 independent lanes.
+// Results are identical with and without SIMD.
+Hash hash_bulk(const void *data, size_t size, Hash seed);
+
 class Hasher
 {
 public:
+	// Ranges at least this large take the bulk path.
+	// Smaller ranges, like pipeline state, go through the per-element path which has less setup cost.
+	enum { BulkThreshold = 128 };
+
 	Hasher(Hash h)
 		: h(h)
 	{
@@ -42,6 +51,12 @@ public:
 	inline void data(const T *data, size_t size)
 	{
 		size /= sizeof(*data);
+		if (size * sizeof(*data) >= BulkThreshold)
+		{
+			u64(hash_bulk(data, size * sizeof(*data), h));
+			return;
+		}
+
 		for (size_t i = 0; i < size; i++)
 			h = (h * 0x100000001b3ull) ^ data[i];
 	}
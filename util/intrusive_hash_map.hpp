@@ -308,7 +308,7 @@ private:
 	unsigned load_count = 0;
 };
 
-template <typename T>
+template <typename T, typename Holder = IntrusiveHashMapHolder<T>>
 class IntrusiveHashMap
 {
 public:
@@ -426,14 +426,14 @@ public:
 	}
 
 private:
-	IntrusiveHashMapHolder<T> hashmap;
+	Holder hashmap;
 	ObjectPool<T> pool;
 };
 
 template <typename T>
 using IntrusiveHashMapWrapper = IntrusiveHashMap<IntrusivePODWrapper<T>>;
 
-template <typename T>
+template <typename T, typename Holder = IntrusiveHashMapHolder<T>>
 class ThreadSafeIntrusiveHashMap
 {
 public:
@@ -542,13 +542,13 @@ public:
 		return hashmap.end();
 	}
 
-	IntrusiveHashMap<T> &get_thread_unsafe()
+	IntrusiveHashMap<T, Holder> &get_thread_unsafe()
 	{
 		return hashmap;
 	}
 
 private:
-	IntrusiveHashMap<T> hashmap;
+	IntrusiveHashMap<T, Holder> hashmap;
 	mutable RWSpinLock lock;
 };
 }
\ No newline at end of file
@@ -22,41 +22,98 @@
 
 #pragma once
 
-#include <memory>
+#include "intrusive_list.hpp"
+#include "timer.hpp"
+#include <atomic>
 #include <mutex>
-#include <vector>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <stddef.h>
+#include <stdint.h>
 #include <stdlib.h>
+#ifdef _WIN32
+#include <malloc.h>
+#endif
 
 //#define OBJECT_POOL_DEBUG
 
 namespace Util
 {
-template<typename T>
+struct ObjectPoolStats
+{
+	// Objects which have been allocated and not yet freed.
+	size_t live_objects = 0;
+	// Free objects held in per-thread magazines (ThreadSafeObjectPool only).
+	size_t cached_objects = 0;
+	size_t slab_count = 0;
+	size_t empty_slab_count = 0;
+	size_t bytes_retained = 0;
+};
+
+namespace Internal
+{
+inline void *object_pool_aligned_alloc(size_t size, size_t alignment)
+{
+#ifdef _WIN32
+	return _aligned_malloc(size, alignment);
+#else
+	void *ptr = nullptr;
+	if (posix_memalign(&ptr, alignment, size) != 0)
+		return nullptr;
+	return ptr;
+#endif
+}
+
+inline void object_pool_aligned_free(void *ptr)
+{
+#ifdef _WIN32
+	_aligned_free(ptr);
+#else
+	::free(ptr);
+#endif
+}
+
+// Threads are assigned magazines round-robin in the order they first touch any pool.
+inline unsigned get_object_pool_thread_index()
+{
+	static std::atomic<unsigned> counter;
+	static thread_local unsigned index = counter.fetch_add(1, std::memory_order_relaxed);
+	return index;
+}
+}
+
+// Slab allocator. Every slab is a power-of-two sized block aligned to its own size,
+// so the owning slab of an object is found by masking its address.
+// Free objects are linked through their own storage, so there is no per-object bookkeeping.
+// Slabs which become completely empty are kept around for a while to absorb churn,
+// and are released once they have been idle for longer than the release delay.
+template <typename T>
 class ObjectPool
 {
 public:
-	template<typename... P>
-	T *allocate(P &&... p)
-	{
-#ifndef OBJECT_POOL_DEBUG
-		if (vacants.empty())
-		{
-			unsigned num_objects = 64u << memory.size();
-			T *ptr = static_cast<T *>(malloc(num_objects * sizeof(T)));
-			if (!ptr)
-				return nullptr;
+	enum { MinSlabSize = 16 * 1024, MinObjectsPerSlab = 32 };
+	static constexpr int64_t DefaultReleaseDelayNsecs = 1000000000;
 
-			for (unsigned i = 0; i < num_objects; i++)
-				vacants.push_back(&ptr[i]);
+	ObjectPool() = default;
+	ObjectPool(const ObjectPool &) = delete;
+	void operator=(const ObjectPool &) = delete;
 
-			memory.emplace_back(ptr);
-		}
+	~ObjectPool()
+	{
+		clear();
+	}
 
-		T *ptr = vacants.back();
-		vacants.pop_back();
-		new(ptr) T(std::forward<P>(p)...);
-		return ptr;
+	template <typename... P>
+	T *allocate(P &&... p)
+	{
+#ifndef OBJECT_POOL_DEBUG
+		void *slot = allocate_slot();
+		if (!slot)
+			return nullptr;
+		return construct(slot, std::forward<P>(p)...);
 #else
+		live_objects++;
 		return new T(std::forward<P>(p)...);
 #endif
 	}
@@ -64,66 +121,387 @@ public:
 	void free(T *ptr)
 	{
 #ifndef OBJECT_POOL_DEBUG
-		ptr->~T();
-		vacants.push_back(ptr);
+		destroy(ptr);
+		free_slot(ptr);
 #else
+		live_objects--;
 		delete ptr;
 #endif
 	}
 
+	// Releases all memory. Any objects still alive are not destructed.
 	void clear()
 	{
 #ifndef OBJECT_POOL_DEBUG
-		vacants.clear();
-		memory.clear();
+		release_list(partial_slabs);
+		release_list(full_slabs);
+		release_list(empty_slabs);
+		empty_slab_count = 0;
 #endif
+		live_objects = 0;
 	}
 
-protected:
+	// Releases empty slabs which have been idle for longer than the release delay, or all of them if force is set.
+	void trim(bool force = false)
+	{
 #ifndef OBJECT_POOL_DEBUG
-	std::vector<T *> vacants;
+		if (empty_slab_count)
+			release_idle_slabs(force ? INT64_MAX : Util::get_current_time_nsecs());
+#else
+		(void)force;
+#endif
+	}
+
+	void set_release_delay_nsecs(int64_t delay)
+	{
+		release_delay_nsecs = delay;
+	}
 
-	struct MallocDeleter
+	ObjectPoolStats get_stats() const
+	{
+		ObjectPoolStats stats;
+		stats.live_objects = live_objects;
+		stats.slab_count = slab_count;
+		stats.empty_slab_count = empty_slab_count;
+		stats.bytes_retained = slab_count * get_slab_size();
+		return stats;
+	}
+
+protected:
+	union Slot
 	{
-		void operator()(T *ptr)
+		Slot *next;
+		typename std::aligned_storage<sizeof(T), alignof(T)>::type storage;
+	};
+
+	enum class SlabList
+	{
+		Partial,
+		Full,
+		Empty
+	};
+
+	struct Slab : IntrusiveListEnabled<Slab>
+	{
+		Slot *free_list = nullptr;
+		// Slots at index initialized and up have never been handed out, so they are not linked into free_list yet.
+		unsigned initialized = 0;
+		unsigned live = 0;
+		int64_t empty_timestamp = 0;
+		SlabList list = SlabList::Partial;
+	};
+
+	static constexpr size_t get_slot_offset()
+	{
+		return (sizeof(Slab) + alignof(Slot) - 1) & ~(alignof(Slot) - 1);
+	}
+
+	static constexpr size_t get_slab_size()
+	{
+		size_t size = MinSlabSize;
+		while (size < get_slot_offset() + MinObjectsPerSlab * sizeof(Slot))
+			size *= 2;
+		return size;
+	}
+
+	static constexpr unsigned get_objects_per_slab()
+	{
+		return unsigned((get_slab_size() - get_slot_offset()) / sizeof(Slot));
+	}
+
+	// Construction and destruction go through the base class, so types which only befriend ObjectPool<T> work with
+	// ThreadSafeObjectPool<T> as well.
+	template <typename... P>
+	static T *construct(void *slot, P &&... p)
+	{
+		return new(slot) T(std::forward<P>(p)...);
+	}
+
+	static void destroy(T *ptr)
+	{
+		ptr->~T();
+	}
+
+	void *allocate_slot()
+	{
+		Slab *slab;
+		if (!partial_slabs.empty())
+			slab = partial_slabs.begin().get();
+		else if (!empty_slabs.empty())
 		{
-			::free(ptr);
+			slab = empty_slabs.begin().get();
+			move_slab(slab, SlabList::Partial);
+			empty_slab_count--;
+		}
+		else
+		{
+			slab = allocate_slab();
+			if (!slab)
+				return nullptr;
 		}
-	};
 
-	std::vector<std::unique_ptr<T, MallocDeleter>> memory;
-#endif
+		Slot *slot;
+		if (slab->free_list)
+		{
+			slot = slab->free_list;
+			slab->free_list = slot->next;
+		}
+		else
+			slot = get_slots(slab) + slab->initialized++;
+
+		slab->live++;
+		live_objects++;
+		if (!slab->free_list && slab->initialized == get_objects_per_slab())
+			move_slab(slab, SlabList::Full);
+
+		return slot;
+	}
+
+	void free_slot(void *ptr)
+	{
+		auto *slab = get_slab(ptr);
+		auto *slot = static_cast<Slot *>(ptr);
+		slot->next = slab->free_list;
+		slab->free_list = slot;
+		live_objects--;
+
+		if (slab->list == SlabList::Full)
+			move_slab(slab, SlabList::Partial);
+
+		if (--slab->live == 0)
+		{
+			auto now = Util::get_current_time_nsecs();
+			move_slab(slab, SlabList::Empty);
+			slab->empty_timestamp = now;
+			empty_slab_count++;
+			release_idle_slabs(now);
+		}
+	}
+
+	size_t live_objects = 0;
+
+private:
+	IntrusiveList<Slab> partial_slabs;
+	IntrusiveList<Slab> full_slabs;
+	IntrusiveList<Slab> empty_slabs;
+	size_t slab_count = 0;
+	size_t empty_slab_count = 0;
+	int64_t release_delay_nsecs = DefaultReleaseDelayNsecs;
+
+	static Slab *get_slab(void *ptr)
+	{
+		return reinterpret_cast<Slab *>(reinterpret_cast<uintptr_t>(ptr) & ~uintptr_t(get_slab_size() - 1));
+	}
+
+	static Slot *get_slots(Slab *slab)
+	{
+		return reinterpret_cast<Slot *>(reinterpret_cast<uint8_t *>(slab) + get_slot_offset());
+	}
+
+	IntrusiveList<Slab> &get_list(SlabList list)
+	{
+		switch (list)
+		{
+		case SlabList::Full:
+			return full_slabs;
+		case SlabList::Empty:
+			return empty_slabs;
+		default:
+			return partial_slabs;
+		}
+	}
+
+	void move_slab(Slab *slab, SlabList list)
+	{
+		get_list(list).move_to_front(get_list(slab->list), slab);
+		slab->list = list;
+	}
+
+	Slab *allocate_slab()
+	{
+		void *memory = Internal::object_pool_aligned_alloc(get_slab_size(), get_slab_size());
+		if (!memory)
+			return nullptr;
+
+		auto *slab = new(memory) Slab;
+		partial_slabs.insert_front(slab);
+		slab_count++;
+		return slab;
+	}
+
+	void release_slab(Slab *slab)
+	{
+		slab->~Slab();
+		Internal::object_pool_aligned_free(slab);
+		slab_count--;
+	}
+
+	void release_list(IntrusiveList<Slab> &list)
+	{
+		auto itr = list.begin();
+		while (itr != list.end())
+		{
+			auto *slab = itr.get();
+			itr = list.erase(itr);
+			release_slab(slab);
+		}
+	}
+
+	void release_idle_slabs(int64_t now)
+	{
+		auto itr = empty_slabs.begin();
+		while (itr != empty_slabs.end())
+		{
+			auto *slab = itr.get();
+			if (now - slab->empty_timestamp >= release_delay_nsecs)
+			{
+				itr = empty_slabs.erase(itr);
+				release_slab(slab);
+				empty_slab_count--;
+			}
+			else
+				++itr;
+		}
+	}
 };
 
-template<typename T>
+template <typename T>
+constexpr int64_t ObjectPool<T>::DefaultReleaseDelayNsecs;
+
+// Each thread allocates from and frees to a small magazine of free slots,
+// so the shared pool lock is only taken when a magazine runs dry or overflows, and then for a batch of slots.
+// Objects are constructed and destructed outside any lock.
+template <typename T>
 class ThreadSafeObjectPool : private ObjectPool<T>
 {
 public:
-	template<typename... P>
+	enum { NumMagazines = 8, MagazineSize = 32 };
+
+	template <typename... P>
 	T *allocate(P &&... p)
 	{
+#ifndef OBJECT_POOL_DEBUG
+		auto &mag = get_magazine();
+		void *slot;
+		{
+			std::lock_guard<std::mutex> holder{mag.lock};
+			if (!mag.count)
+				refill(mag);
+			if (!mag.count)
+				return nullptr;
+			slot = mag.slots[--mag.count];
+		}
+		return ObjectPool<T>::construct(slot, std::forward<P>(p)...);
+#else
 		std::lock_guard<std::mutex> holder{lock};
 		return ObjectPool<T>::allocate(std::forward<P>(p)...);
+#endif
 	}
 
 	void free(T *ptr)
 	{
 #ifndef OBJECT_POOL_DEBUG
-		ptr->~T();
-		std::lock_guard<std::mutex> holder{lock};
-		this->vacants.push_back(ptr);
+		ObjectPool<T>::destroy(ptr);
+		auto &mag = get_magazine();
+		std::lock_guard<std::mutex> holder{mag.lock};
+		if (mag.count == MagazineSize)
+			flush(mag, MagazineSize / 2);
+		mag.slots[mag.count++] = ptr;
 #else
-		delete ptr;
+		std::lock_guard<std::mutex> holder{lock};
+		ObjectPool<T>::free(ptr);
 #endif
 	}
 
 	void clear()
 	{
+		for (auto &mag : magazines)
+			mag.lock.lock();
+
+		{
+			std::lock_guard<std::mutex> holder{lock};
+			for (auto &mag : magazines)
+				mag.count = 0;
+			ObjectPool<T>::clear();
+		}
+
+		for (auto &mag : magazines)
+			mag.lock.unlock();
+	}
+
+	// Returns all cached slots to the pool before trimming, so slabs which are only held by magazines can be released.
+	void trim(bool force = false)
+	{
+		for (auto &mag : magazines)
+		{
+			std::lock_guard<std::mutex> holder{mag.lock};
+			flush(mag, mag.count);
+		}
+
+		std::lock_guard<std::mutex> holder{lock};
+		ObjectPool<T>::trim(force);
+	}
+
+	void set_release_delay_nsecs(int64_t delay)
+	{
+		std::lock_guard<std::mutex> holder{lock};
+		ObjectPool<T>::set_release_delay_nsecs(delay);
+	}
+
+	ObjectPoolStats get_stats()
+	{
+		size_t cached = 0;
+		for (auto &mag : magazines)
+		{
+			std::lock_guard<std::mutex> holder{mag.lock};
+			cached += mag.count;
+		}
+
 		std::lock_guard<std::mutex> holder{lock};
-		ObjectPool<T>::clear();
+		auto stats = ObjectPool<T>::get_stats();
+		stats.cached_objects = cached;
+		stats.live_objects = stats.live_objects > cached ? stats.live_objects - cached : 0;
+		return stats;
 	}
 
 private:
+	struct Magazine
+	{
+		std::mutex lock;
+		void *slots[MagazineSize];
+		unsigned count = 0;
+	};
+
+	Magazine magazines[NumMagazines];
 	std::mutex lock;
+
+	Magazine &get_magazine()
+	{
+		return magazines[Internal::get_object_pool_thread_index() % NumMagazines];
+	}
+
+	// Called with mag.lock held.
+	void refill(Magazine &mag)
+	{
+		std::lock_guard<std::mutex> holder{lock};
+		while (mag.count < MagazineSize / 2)
+		{
+			void *slot = this->allocate_slot();
+			if (!slot)
+				break;
+			mag.slots[mag.count++] = slot;
+		}
+	}
+
+	// Called with mag.lock held.
+	void flush(Magazine &mag, unsigned count)
+	{
+		if (!count)
+			return;
+
+		std::lock_guard<std::mutex> holder{lock};
+		for (unsigned i = 0; i < count; i++)
+			this->free_slot(mag.slots[--mag.count]);
+	}
 };
 }
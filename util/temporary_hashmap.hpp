@@ -86,7 +86,7 @@ public:
 
 	void begin_frame()
 	{
-		index = (index + 1) & (RingSize - 1);
+		index = (index + 1) % rings.size();
 		for (auto &node : rings[index])
 		{
 			hashmap.erase(node.get_hash());
@@ -113,6 +113,37 @@ public:
 			return nullptr;
 	}
 
+	// Number of frames an entry survives without being requested, RingSize by default.
+	// Everything currently held is treated as if it was requested this frame.
+	void set_ring_size(unsigned size)
+	{
+		if (!size || size == rings.size())
+			return;
+
+		IntrusiveList<T> merged;
+		for (auto &ring : rings)
+		{
+			auto itr = ring.begin();
+			while (itr)
+			{
+				auto node = itr;
+				itr = ring.erase(itr);
+				node->set_index(0);
+				merged.insert_front(node);
+			}
+		}
+
+		rings.clear();
+		rings.resize(size);
+		rings[0] = merged;
+		index = 0;
+	}
+
+	unsigned get_ring_size() const
+	{
+		return unsigned(rings.size());
+	}
+
 	template <typename... P>
 	void make_vacant(P &&... p)
 	{
@@ -145,7 +176,7 @@ public:
 	}
 
 private:
-	IntrusiveList<T> rings[RingSize];
+	std::vector<IntrusiveList<T>> rings = std::vector<IntrusiveList<T>>(RingSize);
 	ObjectPool<T> object_pool;
 	unsigned index = 0;
 	IntrusiveHashMap<IntrusivePODWrapper<typename IntrusiveList<T>::Iterator>> hashmap;
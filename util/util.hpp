@@ -86,6 +86,7 @@ namespace Util
 #define leading_zeroes(x) ((x) == 0 ? 32 : __builtin_clz(x))
 #define trailing_zeroes(x) ((x) == 0 ? 32 : __builtin_ctz(x))
 #define trailing_ones(x) __builtin_ctz(~(x))
+#define popcount32(x) uint32_t(__builtin_popcount(x))
 #elif defined(_MSC_VER)
 namespace Internal
 {
@@ -111,6 +112,7 @@ static inline uint32_t ctz(uint32_t x)
 #define leading_zeroes(x) ::Util::Internal::clz(x)
 #define trailing_zeroes(x) ::Util::Internal::ctz(x)
 #define trailing_ones(x) ::Util::Internal::ctz(~(x))
+#define popcount32(x) uint32_t(__popcnt(x))
 #else
 #error "Implement me."
 #endif
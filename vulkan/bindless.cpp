@@ -0,0 +1,182 @@
+/* Copyright (c) 2017-2018 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include "bindless.hpp"
+#include "device.hpp"
+
+using namespace std;
+
+namespace Vulkan
+{
+BindlessTextureTable::BindlessTextureTable(Device *device, unsigned max_textures)
+	: device(device)
+	, max_textures(max_textures)
+{
+	VkDescriptorSetLayoutBinding binding = {};
+	binding.binding = 0;
+	binding.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	binding.descriptorCount = max_textures;
+	binding.stageFlags = VK_SHADER_STAGE_ALL;
+
+	// Slots which were never registered are never accessed, and slots are written while
+	// command buffers using other slots are pending.
+	VkDescriptorBindingFlagsEXT binding_flags =
+			VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT_EXT |
+			VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT_EXT |
+			VK_DESCRIPTOR_BINDING_UPDATE_UNUSED_WHILE_PENDING_BIT_EXT;
+
+	VkDescriptorSetLayoutBindingFlagsCreateInfoEXT flags_info =
+			{ VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO_EXT };
+	flags_info.bindingCount = 1;
+	flags_info.pBindingFlags = &binding_flags;
+
+	VkDescriptorSetLayoutCreateInfo info = { VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO };
+	info.pNext = &flags_info;
+	info.flags = VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT_EXT;
+	info.bindingCount = 1;
+	info.pBindings = &binding;
+
+#ifdef GRANITE_VULKAN_FOSSILIZE
+	Util::Hasher h;
+	h.string("bindless");
+	h.u32(max_textures);
+	unsigned desc_index = device->register_descriptor_set_layout(h.get(), info);
+#endif
+	LOGI("Creating bindless descriptor set layout with %u textures.\n", max_textures);
+	if (vkCreateDescriptorSetLayout(device->get_device(), &info, nullptr, &set_layout) != VK_SUCCESS)
+	{
+		LOGE("Failed to create bindless descriptor set layout.\n");
+		return;
+	}
+#ifdef GRANITE_VULKAN_FOSSILIZE
+	device->set_descriptor_set_layout_handle(desc_index, set_layout);
+#endif
+
+	VkDescriptorPoolSize size = { VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, max_textures };
+	VkDescriptorPoolCreateInfo pool_info = { VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO };
+	pool_info.flags = VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT_EXT;
+	pool_info.maxSets = 1;
+	pool_info.poolSizeCount = 1;
+	pool_info.pPoolSizes = &size;
+	if (vkCreateDescriptorPool(device->get_device(), &pool_info, nullptr, &pool) != VK_SUCCESS)
+	{
+		LOGE("Failed to create bindless descriptor pool.\n");
+		return;
+	}
+
+	VkDescriptorSetAllocateInfo alloc = { VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO };
+	alloc.descriptorPool = pool;
+	alloc.descriptorSetCount = 1;
+	alloc.pSetLayouts = &set_layout;
+	if (vkAllocateDescriptorSets(device->get_device(), &alloc, &set) != VK_SUCCESS)
+		LOGE("Failed to allocate bindless descriptor set.\n");
+}
+
+BindlessTextureTable::~BindlessTextureTable()
+{
+	if (pool != VK_NULL_HANDLE)
+		vkDestroyDescriptorPool(device->get_device(), pool, nullptr);
+	if (set_layout != VK_NULL_HANDLE)
+		vkDestroyDescriptorSetLayout(device->get_device(), set_layout, nullptr);
+}
+
+unsigned BindlessTextureTable::register_texture(const ImageView &view, StockSampler sampler)
+{
+	VK_ASSERT(view.get_image().get_create_info().usage & VK_IMAGE_USAGE_SAMPLED_BIT);
+	VkImageView vk_view = view.get_float_view();
+
+#ifdef GRANITE_VULKAN_MT
+	lock_guard<mutex> holder{lock};
+#endif
+
+	auto &slots = views[vk_view];
+	for (auto &slot : slots)
+		if (slot.sampler == sampler)
+			return slot.index;
+
+	unsigned index;
+	if (!free_slots.empty())
+	{
+		index = free_slots.back();
+		free_slots.pop_back();
+	}
+	else if (next_slot < max_textures)
+		index = next_slot++;
+	else
+	{
+		LOGE("Bindless texture table is full.\n");
+		if (slots.empty())
+			views.erase(vk_view);
+		return ~0u;
+	}
+
+	VkDescriptorImageInfo image_info = {};
+	image_info.sampler = device->get_stock_sampler(sampler).get_sampler();
+	image_info.imageView = vk_view;
+	image_info.imageLayout = view.get_image().get_layout(VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+
+	VkWriteDescriptorSet write = { VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET };
+	write.dstSet = set;
+	write.dstBinding = 0;
+	write.dstArrayElement = index;
+	write.descriptorCount = 1;
+	write.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	write.pImageInfo = &image_info;
+	vkUpdateDescriptorSets(device->get_device(), 1, &write, 0, nullptr);
+
+	slots.push_back({ index, sampler });
+	return index;
+}
+
+void BindlessTextureTable::release_view(VkImageView view)
+{
+#ifdef GRANITE_VULKAN_MT
+	lock_guard<mutex> holder{lock};
+#endif
+
+	auto itr = views.find(view);
+	if (itr == end(views))
+		return;
+
+	// The descriptors are left as-is. Partially bound slots are fine as long as nothing indexes them.
+	for (auto &slot : itr->second)
+		free_slots.push_back(slot.index);
+	views.erase(itr);
+}
+
+bool BindlessTextureTable::is_registered(VkImageView view)
+{
+#ifdef GRANITE_VULKAN_MT
+	lock_guard<mutex> holder{lock};
+#endif
+	return views.find(view) != end(views);
+}
+
+unsigned BindlessTextureTable::get_num_registered()
+{
+#ifdef GRANITE_VULKAN_MT
+	lock_guard<mutex> holder{lock};
+#endif
+	return next_slot - unsigned(free_slots.size());
+}
+}
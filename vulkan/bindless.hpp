@@ -0,0 +1,100 @@
+/* Copyright (c) 2017-2018 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#pragma once
+
+#include "vulkan.hpp"
+#include "sampler.hpp"
+#include <unordered_map>
+#include <vector>
+
+#ifdef GRANITE_VULKAN_MT
+#include <mutex>
+#endif
+
+namespace Vulkan
+{
+class Device;
+class ImageView;
+
+// One device-wide descriptor set holding a large array of combined image samplers (VK_EXT_descriptor_indexing).
+// Shaders declare a runtime sized sampler2D array at binding 0 of a set, and that set is bound to this table
+// instead of going through a DescriptorSetAllocator.
+// A texture is written into its slot once, when it is first registered, and the slot is recycled
+// when the image view is destroyed, so the set never has to be rebuilt while textures change between draws.
+class BindlessTextureTable
+{
+public:
+	BindlessTextureTable(Device *device, unsigned max_textures);
+	~BindlessTextureTable();
+	void operator=(const BindlessTextureTable &) = delete;
+	BindlessTextureTable(const BindlessTextureTable &) = delete;
+
+	VkDescriptorSetLayout get_layout() const
+	{
+		return set_layout;
+	}
+
+	VkDescriptorSet get_set() const
+	{
+		return set;
+	}
+
+	unsigned get_max_textures() const
+	{
+		return max_textures;
+	}
+
+	// Returns the array index for the view and sampler, writing the descriptor the first time it is seen.
+	// Returns ~0u if the table is full.
+	unsigned register_texture(const ImageView &view, StockSampler sampler);
+
+	// Called by the device when an image view is destroyed, after the GPU is done with it.
+	void release_view(VkImageView view);
+
+	// Views which are referenced by the table cannot be relocated by defragmentation.
+	bool is_registered(VkImageView view);
+
+	unsigned get_num_registered();
+
+private:
+	Device *device;
+	VkDescriptorSetLayout set_layout = VK_NULL_HANDLE;
+	VkDescriptorPool pool = VK_NULL_HANDLE;
+	VkDescriptorSet set = VK_NULL_HANDLE;
+	unsigned max_textures;
+	unsigned next_slot = 0;
+	std::vector<unsigned> free_slots;
+
+	struct Slot
+	{
+		unsigned index;
+		StockSampler sampler;
+	};
+	std::unordered_map<VkImageView, std::vector<Slot>> views;
+
+#ifdef GRANITE_VULKAN_MT
+	std::mutex lock;
+#endif
+};
+}
@@ -36,6 +36,9 @@ Buffer::Buffer(Device *device, VkBuffer buffer, const DeviceAllocation &alloc, c
 
 Buffer::~Buffer()
 {
+	if (info.misc & BUFFER_MISC_RELOCATABLE_BIT)
+		device->unregister_relocatable(this);
+
 	if (internal_sync)
 	{
 		device->destroy_buffer_nolock(buffer);
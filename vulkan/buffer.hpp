@@ -78,7 +78,10 @@ enum class BufferDomain
 
 enum BufferMiscFlagBits
 {
-	BUFFER_MISC_ZERO_INITIALIZE_BIT = 1 << 0
+	BUFFER_MISC_ZERO_INITIALIZE_BIT = 1 << 0,
+	// The device may move the buffer to a new allocation when defragmenting.
+	// The VkBuffer handle must not be kept across frames, and no buffer views can be created.
+	BUFFER_MISC_RELOCATABLE_BIT = 1 << 1
 };
 
 using BufferMiscFlags = uint32_t;
@@ -132,6 +135,7 @@ public:
 
 private:
 	friend class Util::ObjectPool<Buffer>;
+	friend class Device;
 	Buffer(Device *device, VkBuffer buffer, const DeviceAllocation &alloc, const BufferCreateInfo &info);
 
 	Device *device;
@@ -35,10 +35,11 @@ CommandBuffer::CommandBuffer(Device *device, VkCommandBuffer cmd, VkPipelineCach
     , cmd(cmd)
     , cache(cache)
     , type(type)
+    , pipeline_compile_mode(device->get_pipeline_compile_mode())
 {
 	begin_compute();
 	set_opaque_state();
-	memset(&static_state, 0, sizeof(static_state));
+	memset(&pipeline_state.static_state, 0, sizeof(pipeline_state.static_state));
 	memset(&bindings, 0, sizeof(bindings));
 }
 
@@ -75,6 +76,11 @@ void CommandBuffer::copy_buffer(const Buffer &dst, const Buffer &src)
 	copy_buffer(dst, 0, src, 0, dst.get_create_info().size);
 }
 
+void CommandBuffer::copy_buffer(const Buffer &dst, const Buffer &src, const VkBufferCopy *copies, size_t count)
+{
+	vkCmdCopyBuffer(cmd, src.get_buffer(), dst.get_buffer(), uint32_t(count), copies);
+}
+
 void CommandBuffer::copy_image(const Vulkan::Image &dst, const Vulkan::Image &src, const VkOffset3D &dst_offset,
                                const VkOffset3D &src_offset, const VkExtent3D &extent,
                                const VkImageSubresourceLayers &dst_subresource,
@@ -438,7 +444,7 @@ void CommandBuffer::begin_context()
 	current_pipeline = VK_NULL_HANDLE;
 	current_pipeline_layout = VK_NULL_HANDLE;
 	current_layout = nullptr;
-	current_program = nullptr;
+	pipeline_state.program = nullptr;
 	memset(bindings.cookies, 0, sizeof(bindings.cookies));
 	memset(bindings.secondary_cookies, 0, sizeof(bindings.secondary_cookies));
 	memset(&index, 0, sizeof(index));
@@ -477,11 +483,11 @@ CommandBufferHandle CommandBuffer::request_secondary_command_buffer(Device &devi
 	cmd->begin_graphics();
 
 	cmd->framebuffer = fb;
-	cmd->compatible_render_pass = &fb->get_compatible_render_pass();
+	cmd->pipeline_state.compatible_render_pass = &fb->get_compatible_render_pass();
 	cmd->actual_render_pass = &device.request_render_pass(info, false);
 
 	cmd->init_viewport_scissor(info, fb);
-	cmd->current_subpass = subpass;
+	cmd->pipeline_state.subpass_index = subpass;
 	cmd->current_contents = VK_SUBPASS_CONTENTS_INLINE;
 
 	return cmd;
@@ -496,10 +502,10 @@ CommandBufferHandle CommandBuffer::request_secondary_command_buffer(unsigned thr
 	cmd->begin_graphics();
 
 	cmd->framebuffer = framebuffer;
-	cmd->compatible_render_pass = compatible_render_pass;
+	cmd->pipeline_state.compatible_render_pass = pipeline_state.compatible_render_pass;
 	cmd->actual_render_pass = actual_render_pass;
 
-	cmd->current_subpass = subpass;
+	cmd->pipeline_state.subpass_index = subpass;
 	cmd->viewport = viewport;
 	cmd->scissor = scissor;
 	cmd->current_contents = VK_SUBPASS_CONTENTS_INLINE;
@@ -511,7 +517,7 @@ void CommandBuffer::submit_secondary(CommandBufferHandle secondary)
 {
 	VK_ASSERT(!is_secondary);
 	VK_ASSERT(secondary->is_secondary);
-	VK_ASSERT(current_subpass == secondary->current_subpass);
+	VK_ASSERT(pipeline_state.subpass_index == secondary->pipeline_state.subpass_index);
 	VK_ASSERT(current_contents == VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
 
 	device->submit_secondary(*this, *secondary);
@@ -520,10 +526,10 @@ void CommandBuffer::submit_secondary(CommandBufferHandle secondary)
 void CommandBuffer::next_subpass(VkSubpassContents contents)
 {
 	VK_ASSERT(framebuffer);
-	VK_ASSERT(compatible_render_pass);
+	VK_ASSERT(pipeline_state.compatible_render_pass);
 	VK_ASSERT(actual_render_pass);
-	current_subpass++;
-	VK_ASSERT(current_subpass < actual_render_pass->get_num_subpasses());
+	pipeline_state.subpass_index++;
+	VK_ASSERT(pipeline_state.subpass_index < actual_render_pass->get_num_subpasses());
 	vkCmdNextSubpass(cmd, contents);
 	current_contents = contents;
 	begin_graphics();
@@ -532,11 +538,11 @@ void CommandBuffer::next_subpass(VkSubpassContents contents)
 void CommandBuffer::begin_render_pass(const RenderPassInfo &info, VkSubpassContents contents)
 {
 	VK_ASSERT(!framebuffer);
-	VK_ASSERT(!compatible_render_pass);
+	VK_ASSERT(!pipeline_state.compatible_render_pass);
 	VK_ASSERT(!actual_render_pass);
 
 	framebuffer = &device->request_framebuffer(info);
-	compatible_render_pass = &framebuffer->get_compatible_render_pass();
+	pipeline_state.compatible_render_pass = &framebuffer->get_compatible_render_pass();
 	actual_render_pass = &device->request_render_pass(info, false);
 
 	init_viewport_scissor(info, framebuffer);
@@ -580,21 +586,21 @@ void CommandBuffer::end_render_pass()
 {
 	VK_ASSERT(framebuffer);
 	VK_ASSERT(actual_render_pass);
-	VK_ASSERT(compatible_render_pass);
+	VK_ASSERT(pipeline_state.compatible_render_pass);
 
 	vkCmdEndRenderPass(cmd);
 
 	framebuffer = nullptr;
 	actual_render_pass = nullptr;
-	compatible_render_pass = nullptr;
+	pipeline_state.compatible_render_pass = nullptr;
 	begin_compute();
 }
 
 VkPipeline CommandBuffer::build_compute_pipeline(Hash hash)
 {
-	auto &shader = *current_program->get_shader(ShaderStage::Compute);
+	auto &shader = *pipeline_state.program->get_shader(ShaderStage::Compute);
 	VkComputePipelineCreateInfo info = { VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO };
-	info.layout = current_program->get_pipeline_layout()->get_layout();
+	info.layout = pipeline_state.program->get_pipeline_layout()->get_layout();
 	info.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
 	info.stage.module = shader.get_module();
 	info.stage.pName = "main";
@@ -609,13 +615,13 @@ VkPipeline CommandBuffer::build_compute_pipeline(Hash hash)
 	VkSpecializationInfo spec_info = {};
 	VkSpecializationMapEntry spec_entries[VULKAN_NUM_SPEC_CONSTANTS];
 	auto mask = current_layout->get_resource_layout().combined_spec_constant_mask &
-	            static_state.state.spec_constant_mask;
+	            pipeline_state.static_state.state.spec_constant_mask;
 
 	if (mask)
 	{
 		info.stage.pSpecializationInfo = &spec_info;
-		spec_info.pData = potential_static_state.spec_constants;
-		spec_info.dataSize = sizeof(potential_static_state.spec_constants);
+		spec_info.pData = pipeline_state.potential_static_state.spec_constants;
+		spec_info.dataSize = sizeof(pipeline_state.potential_static_state.spec_constants);
 		spec_info.pMapEntries = spec_entries;
 
 		for_each_bit(mask, [&](uint32_t bit) {
@@ -635,11 +641,14 @@ VkPipeline CommandBuffer::build_compute_pipeline(Hash hash)
 	if (vkCreateComputePipelines(device->get_device(), cache, 1, &info, nullptr, &compute_pipeline) != VK_SUCCESS)
 		LOGE("Failed to create compute pipeline!\n");
 
-	return current_program->add_pipeline(hash, compute_pipeline);
+	return pipeline_state.program->add_pipeline(hash, compute_pipeline);
 }
 
-VkPipeline CommandBuffer::build_graphics_pipeline(Hash hash)
+VkPipeline CommandBuffer::build_graphics_pipeline(Device *device, VkPipelineCache cache,
+                                                  const DeferredPipelineCompile &compile, Hash hash)
 {
+	auto &layout = compile.program->get_pipeline_layout()->get_resource_layout();
+
 	// Viewport state
 	VkPipelineViewportStateCreateInfo vp = { VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO };
 	vp.viewportCount = 1;
@@ -653,9 +662,9 @@ VkPipeline CommandBuffer::build_graphics_pipeline(Hash hash)
 	};
 	dyn.pDynamicStates = states;
 
-	if (static_state.state.depth_bias_enable)
+	if (compile.static_state.state.depth_bias_enable)
 		states[dyn.dynamicStateCount++] = VK_DYNAMIC_STATE_DEPTH_BIAS;
-	if (static_state.state.stencil_test)
+	if (compile.static_state.state.stencil_test)
 	{
 		states[dyn.dynamicStateCount++] = VK_DYNAMIC_STATE_STENCIL_COMPARE_MASK;
 		states[dyn.dynamicStateCount++] = VK_DYNAMIC_STATE_STENCIL_REFERENCE;
@@ -665,64 +674,64 @@ VkPipeline CommandBuffer::build_graphics_pipeline(Hash hash)
 	// Blend state
 	VkPipelineColorBlendAttachmentState blend_attachments[VULKAN_NUM_ATTACHMENTS];
 	VkPipelineColorBlendStateCreateInfo blend = { VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO };
-	blend.attachmentCount = compatible_render_pass->get_num_color_attachments(current_subpass);
+	blend.attachmentCount = compile.compatible_render_pass->get_num_color_attachments(compile.subpass_index);
 	blend.pAttachments = blend_attachments;
 	for (unsigned i = 0; i < blend.attachmentCount; i++)
 	{
 		auto &att = blend_attachments[i];
 		att = {};
 
-		if (compatible_render_pass->get_color_attachment(current_subpass, i).attachment != VK_ATTACHMENT_UNUSED &&
-			(current_layout->get_resource_layout().render_target_mask & (1u << i)))
+		if (compile.compatible_render_pass->get_color_attachment(compile.subpass_index, i).attachment != VK_ATTACHMENT_UNUSED &&
+			(layout.render_target_mask & (1u << i)))
 		{
-			att.colorWriteMask = (static_state.state.write_mask >> (4 * i)) & 0xf;
-			att.blendEnable = static_state.state.blend_enable;
+			att.colorWriteMask = (compile.static_state.state.write_mask >> (4 * i)) & 0xf;
+			att.blendEnable = compile.static_state.state.blend_enable;
 			if (att.blendEnable)
 			{
-				att.alphaBlendOp = static_cast<VkBlendOp>(static_state.state.alpha_blend_op);
-				att.colorBlendOp = static_cast<VkBlendOp>(static_state.state.color_blend_op);
-				att.dstAlphaBlendFactor = static_cast<VkBlendFactor>(static_state.state.dst_alpha_blend);
-				att.srcAlphaBlendFactor = static_cast<VkBlendFactor>(static_state.state.src_alpha_blend);
-				att.dstColorBlendFactor = static_cast<VkBlendFactor>(static_state.state.dst_color_blend);
-				att.srcColorBlendFactor = static_cast<VkBlendFactor>(static_state.state.src_color_blend);
+				att.alphaBlendOp = static_cast<VkBlendOp>(compile.static_state.state.alpha_blend_op);
+				att.colorBlendOp = static_cast<VkBlendOp>(compile.static_state.state.color_blend_op);
+				att.dstAlphaBlendFactor = static_cast<VkBlendFactor>(compile.static_state.state.dst_alpha_blend);
+				att.srcAlphaBlendFactor = static_cast<VkBlendFactor>(compile.static_state.state.src_alpha_blend);
+				att.dstColorBlendFactor = static_cast<VkBlendFactor>(compile.static_state.state.dst_color_blend);
+				att.srcColorBlendFactor = static_cast<VkBlendFactor>(compile.static_state.state.src_color_blend);
 			}
 		}
 	}
-	memcpy(blend.blendConstants, potential_static_state.blend_constants, sizeof(blend.blendConstants));
+	memcpy(blend.blendConstants, compile.potential_static_state.blend_constants, sizeof(blend.blendConstants));
 
 	// Depth state
 	VkPipelineDepthStencilStateCreateInfo ds = { VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO };
-	ds.stencilTestEnable = compatible_render_pass->has_stencil(current_subpass) && static_state.state.stencil_test;
-	ds.depthTestEnable = compatible_render_pass->has_depth(current_subpass) && static_state.state.depth_test;
-	ds.depthWriteEnable = compatible_render_pass->has_depth(current_subpass) && static_state.state.depth_write;
+	ds.stencilTestEnable = compile.compatible_render_pass->has_stencil(compile.subpass_index) && compile.static_state.state.stencil_test;
+	ds.depthTestEnable = compile.compatible_render_pass->has_depth(compile.subpass_index) && compile.static_state.state.depth_test;
+	ds.depthWriteEnable = compile.compatible_render_pass->has_depth(compile.subpass_index) && compile.static_state.state.depth_write;
 
 	if (ds.depthTestEnable)
-		ds.depthCompareOp = static_cast<VkCompareOp>(static_state.state.depth_compare);
+		ds.depthCompareOp = static_cast<VkCompareOp>(compile.static_state.state.depth_compare);
 
 	if (ds.stencilTestEnable)
 	{
-		ds.front.compareOp = static_cast<VkCompareOp>(static_state.state.stencil_front_compare_op);
-		ds.front.passOp = static_cast<VkStencilOp>(static_state.state.stencil_front_pass);
-		ds.front.failOp = static_cast<VkStencilOp>(static_state.state.stencil_front_fail);
-		ds.front.depthFailOp = static_cast<VkStencilOp>(static_state.state.stencil_front_depth_fail);
-		ds.back.compareOp = static_cast<VkCompareOp>(static_state.state.stencil_back_compare_op);
-		ds.back.passOp = static_cast<VkStencilOp>(static_state.state.stencil_back_pass);
-		ds.back.failOp = static_cast<VkStencilOp>(static_state.state.stencil_back_fail);
-		ds.back.depthFailOp = static_cast<VkStencilOp>(static_state.state.stencil_back_depth_fail);
+		ds.front.compareOp = static_cast<VkCompareOp>(compile.static_state.state.stencil_front_compare_op);
+		ds.front.passOp = static_cast<VkStencilOp>(compile.static_state.state.stencil_front_pass);
+		ds.front.failOp = static_cast<VkStencilOp>(compile.static_state.state.stencil_front_fail);
+		ds.front.depthFailOp = static_cast<VkStencilOp>(compile.static_state.state.stencil_front_depth_fail);
+		ds.back.compareOp = static_cast<VkCompareOp>(compile.static_state.state.stencil_back_compare_op);
+		ds.back.passOp = static_cast<VkStencilOp>(compile.static_state.state.stencil_back_pass);
+		ds.back.failOp = static_cast<VkStencilOp>(compile.static_state.state.stencil_back_fail);
+		ds.back.depthFailOp = static_cast<VkStencilOp>(compile.static_state.state.stencil_back_depth_fail);
 	}
 
 	// Vertex input
 	VkPipelineVertexInputStateCreateInfo vi = { VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO };
 	VkVertexInputAttributeDescription vi_attribs[VULKAN_NUM_VERTEX_ATTRIBS];
 	vi.pVertexAttributeDescriptions = vi_attribs;
-	uint32_t attr_mask = current_layout->get_resource_layout().attribute_mask;
+	uint32_t attr_mask = layout.attribute_mask;
 	uint32_t binding_mask = 0;
 	for_each_bit(attr_mask, [&](uint32_t bit) {
 		auto &attr = vi_attribs[vi.vertexAttributeDescriptionCount++];
 		attr.location = bit;
-		attr.binding = attribs[bit].binding;
-		attr.format = attribs[bit].format;
-		attr.offset = attribs[bit].offset;
+		attr.binding = compile.attribs[bit].binding;
+		attr.format = compile.attribs[bit].format;
+		attr.offset = compile.attribs[bit].offset;
 		binding_mask |= 1u << attr.binding;
 	});
 
@@ -731,34 +740,34 @@ VkPipeline CommandBuffer::build_graphics_pipeline(Hash hash)
 	for_each_bit(binding_mask, [&](uint32_t bit) {
 		auto &bind = vi_bindings[vi.vertexBindingDescriptionCount++];
 		bind.binding = bit;
-		bind.inputRate = vbo.input_rates[bit];
-		bind.stride = vbo.strides[bit];
+		bind.inputRate = compile.input_rates[bit];
+		bind.stride = compile.strides[bit];
 	});
 
 	// Input assembly
 	VkPipelineInputAssemblyStateCreateInfo ia = { VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO };
-	ia.primitiveRestartEnable = static_state.state.primitive_restart;
-	ia.topology = static_cast<VkPrimitiveTopology>(static_state.state.topology);
+	ia.primitiveRestartEnable = compile.static_state.state.primitive_restart;
+	ia.topology = static_cast<VkPrimitiveTopology>(compile.static_state.state.topology);
 
 	// Multisample
 	VkPipelineMultisampleStateCreateInfo ms = { VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO };
-	ms.rasterizationSamples = static_cast<VkSampleCountFlagBits>(compatible_render_pass->get_sample_count(current_subpass));
+	ms.rasterizationSamples = static_cast<VkSampleCountFlagBits>(compile.compatible_render_pass->get_sample_count(compile.subpass_index));
 
-	if (compatible_render_pass->get_sample_count(current_subpass) > 1)
+	if (compile.compatible_render_pass->get_sample_count(compile.subpass_index) > 1)
 	{
-		ms.alphaToCoverageEnable = static_state.state.alpha_to_coverage;
-		ms.alphaToOneEnable = static_state.state.alpha_to_one;
-		ms.sampleShadingEnable = static_state.state.sample_shading;
+		ms.alphaToCoverageEnable = compile.static_state.state.alpha_to_coverage;
+		ms.alphaToOneEnable = compile.static_state.state.alpha_to_one;
+		ms.sampleShadingEnable = compile.static_state.state.sample_shading;
 		ms.minSampleShading = 1.0f;
 	}
 
 	// Raster
 	VkPipelineRasterizationStateCreateInfo raster = { VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO };
-	raster.cullMode = static_cast<VkCullModeFlags>(static_state.state.cull_mode);
-	raster.frontFace = static_cast<VkFrontFace>(static_state.state.front_face);
+	raster.cullMode = static_cast<VkCullModeFlags>(compile.static_state.state.cull_mode);
+	raster.frontFace = static_cast<VkFrontFace>(compile.static_state.state.front_face);
 	raster.lineWidth = 1.0f;
-	raster.polygonMode = static_state.state.wireframe ? VK_POLYGON_MODE_LINE : VK_POLYGON_MODE_FILL;
-	raster.depthBiasEnable = static_state.state.depth_bias_enable != 0;
+	raster.polygonMode = compile.static_state.state.wireframe ? VK_POLYGON_MODE_LINE : VK_POLYGON_MODE_FILL;
+	raster.depthBiasEnable = compile.static_state.state.depth_bias_enable != 0;
 
 	// Stages
 	VkPipelineShaderStageCreateInfo stages[static_cast<unsigned>(ShaderStage::Count)];
@@ -770,27 +779,27 @@ VkPipeline CommandBuffer::build_graphics_pipeline(Hash hash)
 	for (unsigned i = 0; i < static_cast<unsigned>(ShaderStage::Count); i++)
 	{
 		auto stage = static_cast<ShaderStage>(i);
-		if (current_program->get_shader(stage))
+		if (compile.program->get_shader(stage))
 		{
 			auto &s = stages[num_stages++];
 			s = { VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO };
-			s.module = current_program->get_shader(stage)->get_module();
+			s.module = compile.program->get_shader(stage)->get_module();
 #ifdef GRANITE_SPIRV_DUMP
 			LOGI("Compiling SPIR-V file: (%s) %s\n",
 			     Shader::stage_to_name(stage),
-			     (to_string(current_program->get_shader(stage)->get_hash()) + ".spv").c_str());
+			     (to_string(compile.program->get_shader(stage)->get_hash()) + ".spv").c_str());
 #endif
 			s.pName = "main";
 			s.stage = static_cast<VkShaderStageFlagBits>(1u << i);
 
-			auto mask = current_layout->get_resource_layout().spec_constant_mask[i] &
-			            static_state.state.spec_constant_mask;
+			auto mask = layout.spec_constant_mask[i] &
+			            compile.static_state.state.spec_constant_mask;
 
 			if (mask)
 			{
 				s.pSpecializationInfo = &spec_info[i];
-				spec_info[i].pData = potential_static_state.spec_constants;
-				spec_info[i].dataSize = sizeof(potential_static_state.spec_constants);
+				spec_info[i].pData = compile.potential_static_state.spec_constants;
+				spec_info[i].dataSize = sizeof(compile.potential_static_state.spec_constants);
 				spec_info[i].pMapEntries = spec_entries[i];
 
 				for_each_bit(mask, [&](uint32_t bit) {
@@ -804,9 +813,9 @@ VkPipeline CommandBuffer::build_graphics_pipeline(Hash hash)
 	}
 
 	VkGraphicsPipelineCreateInfo pipe = { VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO };
-	pipe.layout = current_pipeline_layout;
-	pipe.renderPass = compatible_render_pass->get_render_pass();
-	pipe.subpass = current_subpass;
+	pipe.layout = compile.program->get_pipeline_layout()->get_layout();
+	pipe.renderPass = compile.compatible_render_pass->get_render_pass();
+	pipe.subpass = compile.subpass_index;
 
 	pipe.pViewportState = &vp;
 	pipe.pDynamicState = &dyn;
@@ -829,84 +838,135 @@ VkPipeline CommandBuffer::build_graphics_pipeline(Hash hash)
 	if (res != VK_SUCCESS)
 		LOGE("Failed to create graphics pipeline!\n");
 
-	return current_program->add_pipeline(hash, pipeline);
+	return compile.program->add_pipeline(hash, pipeline);
 }
 
 void CommandBuffer::flush_compute_pipeline()
 {
 	Hasher h;
-	h.u64(current_program->get_hash());
+	h.u64(pipeline_state.program->get_hash());
 
 	// Spec constants.
 	auto &layout = current_layout->get_resource_layout();
 	uint32_t combined_spec_constant = layout.combined_spec_constant_mask;
-	combined_spec_constant &= static_state.state.spec_constant_mask;
+	combined_spec_constant &= pipeline_state.static_state.state.spec_constant_mask;
 	h.u32(combined_spec_constant);
 	for_each_bit(combined_spec_constant, [&](uint32_t bit) {
-		h.u32(potential_static_state.spec_constants[bit]);
+		h.u32(pipeline_state.potential_static_state.spec_constants[bit]);
 	});
 
 	auto hash = h.get();
-	current_pipeline = current_program->get_pipeline(hash);
+	current_pipeline = pipeline_state.program->get_pipeline(hash);
 	if (current_pipeline == VK_NULL_HANDLE)
 		current_pipeline = build_compute_pipeline(hash);
 }
 
-void CommandBuffer::flush_graphics_pipeline()
+Hash CommandBuffer::hash_graphics_pipeline(const DeferredPipelineCompile &compile, uint32_t &active_vbos)
 {
 	Hasher h;
 	active_vbos = 0;
-	auto &layout = current_layout->get_resource_layout();
+	auto &layout = compile.program->get_pipeline_layout()->get_resource_layout();
 	for_each_bit(layout.attribute_mask, [&](uint32_t bit) {
 		h.u32(bit);
-		active_vbos |= 1u << attribs[bit].binding;
-		h.u32(attribs[bit].binding);
-		h.u32(attribs[bit].format);
-		h.u32(attribs[bit].offset);
+		active_vbos |= 1u << compile.attribs[bit].binding;
+		h.u32(compile.attribs[bit].binding);
+		h.u32(compile.attribs[bit].format);
+		h.u32(compile.attribs[bit].offset);
 	});
 
 	for_each_bit(active_vbos, [&](uint32_t bit) {
-		h.u32(vbo.input_rates[bit]);
-		h.u32(vbo.strides[bit]);
+		h.u32(compile.input_rates[bit]);
+		h.u32(compile.strides[bit]);
 	});
 
-	h.u64(compatible_render_pass->get_hash());
-	h.u32(current_subpass);
-	h.u64(current_program->get_hash());
-	h.data(static_state.words, sizeof(static_state.words));
+	h.u64(compile.compatible_render_pass->get_hash());
+	h.u32(compile.subpass_index);
+	h.u64(compile.program->get_hash());
+	h.data(compile.static_state.words, sizeof(compile.static_state.words));
 
-	if (static_state.state.blend_enable)
+	if (compile.static_state.state.blend_enable)
 	{
 		const auto needs_blend_constant = [](VkBlendFactor factor) {
 			return factor == VK_BLEND_FACTOR_CONSTANT_COLOR || factor == VK_BLEND_FACTOR_CONSTANT_ALPHA;
 		};
-		bool b0 = needs_blend_constant(static_cast<VkBlendFactor>(static_state.state.src_color_blend));
-		bool b1 = needs_blend_constant(static_cast<VkBlendFactor>(static_state.state.src_alpha_blend));
-		bool b2 = needs_blend_constant(static_cast<VkBlendFactor>(static_state.state.dst_color_blend));
-		bool b3 = needs_blend_constant(static_cast<VkBlendFactor>(static_state.state.dst_alpha_blend));
+		bool b0 = needs_blend_constant(static_cast<VkBlendFactor>(compile.static_state.state.src_color_blend));
+		bool b1 = needs_blend_constant(static_cast<VkBlendFactor>(compile.static_state.state.src_alpha_blend));
+		bool b2 = needs_blend_constant(static_cast<VkBlendFactor>(compile.static_state.state.dst_color_blend));
+		bool b3 = needs_blend_constant(static_cast<VkBlendFactor>(compile.static_state.state.dst_alpha_blend));
 		if (b0 || b1 || b2 || b3)
-			h.data(reinterpret_cast<uint32_t *>(potential_static_state.blend_constants),
-			       sizeof(potential_static_state.blend_constants));
+			h.data(reinterpret_cast<const uint32_t *>(compile.potential_static_state.blend_constants),
+			       sizeof(compile.potential_static_state.blend_constants));
 	}
 
 	// Spec constants.
 	uint32_t combined_spec_constant = layout.combined_spec_constant_mask;
-	combined_spec_constant &= static_state.state.spec_constant_mask;
+	combined_spec_constant &= compile.static_state.state.spec_constant_mask;
 	h.u32(combined_spec_constant);
 	for_each_bit(combined_spec_constant, [&](uint32_t bit) {
-		h.u32(potential_static_state.spec_constants[bit]);
+		h.u32(compile.potential_static_state.spec_constants[bit]);
 	});
 
-	auto hash = h.get();
-	current_pipeline = current_program->get_pipeline(hash);
-	if (current_pipeline == VK_NULL_HANDLE)
-		current_pipeline = build_graphics_pipeline(hash);
+	return h.get();
+}
+
+VkPipeline CommandBuffer::get_fallback_graphics_pipeline()
+{
+	// The fallback must share the pipeline layout, or bound descriptor sets and push constants would be incompatible.
+	auto *fallback = pipeline_state.program->get_fallback_program();
+	if (!fallback || fallback->get_pipeline_layout() != current_layout)
+		return VK_NULL_HANDLE;
+
+	auto compile = pipeline_state;
+	compile.program = fallback;
+	uint32_t fallback_vbos;
+	auto hash = hash_graphics_pipeline(compile, fallback_vbos);
+
+	// Fallbacks are meant to be simple programs which are cheap to compile, so a miss here is compiled inline.
+	auto pipeline = fallback->get_pipeline(hash);
+	if (pipeline == VK_NULL_HANDLE)
+		pipeline = build_graphics_pipeline(device, cache, compile, hash);
+	return pipeline;
+}
+
+bool CommandBuffer::flush_graphics_pipeline()
+{
+	auto hash = hash_graphics_pipeline(pipeline_state, active_vbos);
+	current_pipeline = pipeline_state.program->get_pipeline(hash);
+	if (current_pipeline != VK_NULL_HANDLE)
+		return true;
+
+	if (pipeline_compile_mode == PipelineCompileMode::Synchronous)
+	{
+		current_pipeline = build_graphics_pipeline(device, cache, pipeline_state, hash);
+		return true;
+	}
+
+	// If the device cannot compile in the background, this completes synchronously.
+	device->enqueue_graphics_pipeline_compile(pipeline_state, hash);
+	current_pipeline = pipeline_state.program->get_pipeline(hash);
+	if (current_pipeline != VK_NULL_HANDLE)
+		return true;
+
+	if (pipeline_compile_mode == PipelineCompileMode::AsyncFallback)
+		current_pipeline = get_fallback_graphics_pipeline();
+	return false;
+}
+
+void CommandBuffer::prewarm_graphics_pipeline()
+{
+	VK_ASSERT(pipeline_state.program);
+	VK_ASSERT(pipeline_state.compatible_render_pass);
+
+	uint32_t vbos;
+	auto hash = hash_graphics_pipeline(pipeline_state, vbos);
+	if (pipeline_state.program->get_pipeline(hash) == VK_NULL_HANDLE)
+		device->enqueue_graphics_pipeline_compile(pipeline_state, hash);
 }
 
 void CommandBuffer::flush_compute_state()
 {
 	VK_ASSERT(current_layout);
-	VK_ASSERT(current_program);
+	VK_ASSERT(pipeline_state.program);
 
 	if (get_and_clear(COMMAND_BUFFER_DIRTY_PIPELINE_BIT))
 	{
@@ -931,17 +991,24 @@ void CommandBuffer::flush_compute_state()
 	}
 }
 
-void CommandBuffer::flush_render_state()
+bool CommandBuffer::flush_render_state()
 {
 	VK_ASSERT(current_layout);
-	VK_ASSERT(current_program);
+	VK_ASSERT(pipeline_state.program);
 
 	// We've invalidated pipeline state, update the VkPipeline.
 	if (get_and_clear(COMMAND_BUFFER_DIRTY_STATIC_STATE_BIT | COMMAND_BUFFER_DIRTY_PIPELINE_BIT |
 	                  COMMAND_BUFFER_DIRTY_STATIC_VERTEX_BIT))
 	{
 		VkPipeline old_pipe = current_pipeline;
-		flush_graphics_pipeline();
+
+		// While the real pipeline is being compiled in the background, keep looking for it on every draw.
+		if (!flush_graphics_pipeline())
+			set_dirty(COMMAND_BUFFER_DIRTY_PIPELINE_BIT);
+
+		if (current_pipeline == VK_NULL_HANDLE)
+			return false;
+
 		if (old_pipe != current_pipeline)
 		{
 			vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, current_pipeline);
@@ -967,9 +1034,9 @@ void CommandBuffer::flush_render_state()
 		vkCmdSetViewport(cmd, 0, 1, &viewport);
 	if (get_and_clear(COMMAND_BUFFER_DIRTY_SCISSOR_BIT))
 		vkCmdSetScissor(cmd, 0, 1, &scissor);
-	if (static_state.state.depth_bias_enable && get_and_clear(COMMAND_BUFFER_DIRTY_DEPTH_BIAS_BIT))
+	if (pipeline_state.static_state.state.depth_bias_enable && get_and_clear(COMMAND_BUFFER_DIRTY_DEPTH_BIAS_BIT))
 		vkCmdSetDepthBias(cmd, dynamic_state.depth_bias_constant, 0.0f, dynamic_state.depth_bias_slope);
-	if (static_state.state.stencil_test && get_and_clear(COMMAND_BUFFER_DIRTY_STENCIL_REFERENCE_BIT))
+	if (pipeline_state.static_state.state.stencil_test && get_and_clear(COMMAND_BUFFER_DIRTY_STENCIL_REFERENCE_BIT))
 	{
 		vkCmdSetStencilCompareMask(cmd, VK_STENCIL_FACE_FRONT_BIT, dynamic_state.front_compare_mask);
 		vkCmdSetStencilReference(cmd, VK_STENCIL_FACE_FRONT_BIT, dynamic_state.front_reference);
@@ -988,6 +1055,7 @@ void CommandBuffer::flush_render_state()
 		vkCmdBindVertexBuffers(cmd, binding, binding_count, vbo.buffers + binding, vbo.offsets + binding);
 	});
 	dirty_vbos &= ~update_vbo_mask;
+	return true;
 }
 
 void CommandBuffer::wait_events(unsigned num_events, const VkEvent *events,
@@ -1030,7 +1098,7 @@ void CommandBuffer::set_vertex_attrib(uint32_t attrib, uint32_t binding, VkForma
 	VK_ASSERT(attrib < VULKAN_NUM_VERTEX_ATTRIBS);
 	VK_ASSERT(framebuffer);
 
-	auto &attr = attribs[attrib];
+	auto &attr = pipeline_state.attribs[attrib];
 
 	if (attr.binding != binding || attr.format != format || attr.offset != offset)
 		set_dirty(COMMAND_BUFFER_DIRTY_STATIC_VERTEX_BIT);
@@ -1062,13 +1130,13 @@ void CommandBuffer::set_vertex_binding(uint32_t binding, const Buffer &buffer, V
 	VkBuffer vkbuffer = buffer.get_buffer();
 	if (vbo.buffers[binding] != vkbuffer || vbo.offsets[binding] != offset)
 		dirty_vbos |= 1u << binding;
-	if (vbo.strides[binding] != stride || vbo.input_rates[binding] != step_rate)
+	if (pipeline_state.strides[binding] != stride || pipeline_state.input_rates[binding] != step_rate)
 		set_dirty(COMMAND_BUFFER_DIRTY_STATIC_VERTEX_BIT);
 
 	vbo.buffers[binding] = vkbuffer;
 	vbo.offsets[binding] = offset;
-	vbo.strides[binding] = stride;
-	vbo.input_rates[binding] = step_rate;
+	pipeline_state.strides[binding] = stride;
+	pipeline_state.input_rates[binding] = step_rate;
 }
 
 void CommandBuffer::set_viewport(const VkViewport &viewport)
@@ -1118,14 +1186,14 @@ void CommandBuffer::set_program(const std::string &vertex, const std::string &fr
 
 void CommandBuffer::set_program(Program &program)
 {
-	if (current_program == &program)
+	if (pipeline_state.program == &program)
 		return;
 
-	current_program = &program;
+	pipeline_state.program = &program;
 	current_pipeline = VK_NULL_HANDLE;
 
-	VK_ASSERT((framebuffer && current_program->get_shader(ShaderStage::Vertex)) ||
-	          (!framebuffer && current_program->get_shader(ShaderStage::Compute)));
+	VK_ASSERT((framebuffer && pipeline_state.program->get_shader(ShaderStage::Vertex)) ||
+	          (!framebuffer && pipeline_state.program->get_shader(ShaderStage::Compute)));
 
 	set_dirty(COMMAND_BUFFER_DIRTY_PIPELINE_BIT | COMMAND_BUFFER_DYNAMIC_BITS);
 
@@ -1172,7 +1240,7 @@ void *CommandBuffer::allocate_constant_data(unsigned set, unsigned binding, VkDe
 	auto data = ubo_block.allocate(size);
 	if (!data.host)
 	{
-		device->request_uniform_block(ubo_block, size);
+		device->request_uniform_block_for_thread(thread_index, ubo_block, size);
 		data = ubo_block.allocate(size);
 	}
 	set_uniform_buffer(set, binding, *ubo_block.gpu, data.offset, size);
@@ -1184,7 +1252,7 @@ void *CommandBuffer::allocate_index_data(VkDeviceSize size, VkIndexType index_ty
 	auto data = ibo_block.allocate(size);
 	if (!data.host)
 	{
-		device->request_index_block(ibo_block, size);
+		device->request_index_block_for_thread(thread_index, ibo_block, size);
 		data = ibo_block.allocate(size);
 	}
 	set_index_buffer(*ibo_block.gpu, data.offset, index_type);
@@ -1250,7 +1318,7 @@ void *CommandBuffer::allocate_vertex_data(unsigned binding, VkDeviceSize size, V
 	auto data = vbo_block.allocate(size);
 	if (!data.host)
 	{
-		device->request_vertex_block(vbo_block, size);
+		device->request_vertex_block_for_thread(thread_index, vbo_block, size);
 		data = vbo_block.allocate(size);
 	}
 
@@ -1333,11 +1401,11 @@ void CommandBuffer::set_buffer_view(unsigned set, unsigned binding, const Buffer
 void CommandBuffer::set_input_attachments(unsigned set, unsigned start_binding)
 {
 	VK_ASSERT(set < VULKAN_NUM_DESCRIPTOR_SETS);
-	VK_ASSERT(start_binding + actual_render_pass->get_num_input_attachments(current_subpass) <= VULKAN_NUM_BINDINGS);
-	unsigned num_input_attachments = actual_render_pass->get_num_input_attachments(current_subpass);
+	VK_ASSERT(start_binding + actual_render_pass->get_num_input_attachments(pipeline_state.subpass_index) <= VULKAN_NUM_BINDINGS);
+	unsigned num_input_attachments = actual_render_pass->get_num_input_attachments(pipeline_state.subpass_index);
 	for (unsigned i = 0; i < num_input_attachments; i++)
 	{
-		auto &ref = actual_render_pass->get_input_attachment(current_subpass, i);
+		auto &ref = actual_render_pass->get_input_attachment(pipeline_state.subpass_index, i);
 		if (ref.attachment == VK_ATTACHMENT_UNUSED)
 			continue;
 
@@ -1440,8 +1508,163 @@ void CommandBuffer::set_storage_texture(unsigned set, unsigned binding, const Im
 	            view.get_image().get_layout(VK_IMAGE_LAYOUT_GENERAL), view.get_cookie());
 }
 
+void CommandBuffer::write_descriptor_set_with_template(uint32_t set, VkDescriptorSet desc_set,
+                                                       VkDescriptorUpdateTemplate update_template)
+{
+	auto &set_layout = current_layout->get_resource_layout().sets[set];
+
+	if (set_layout.uniform_buffer_mask)
+	{
+		// Offsets are applied dynamically, so the template must see an offset of 0.
+		ResourceBinding data[VULKAN_NUM_BINDINGS];
+		memcpy(data, bindings.bindings[set], sizeof(data));
+		for_each_bit(set_layout.uniform_buffer_mask, [&](uint32_t binding) {
+			data[binding].buffer.offset = 0;
+		});
+		vkUpdateDescriptorSetWithTemplate(device->get_device(), desc_set, update_template, data);
+	}
+	else
+		vkUpdateDescriptorSetWithTemplate(device->get_device(), desc_set, update_template, bindings.bindings[set]);
+}
+
+void CommandBuffer::write_descriptor_set(uint32_t set, VkDescriptorSet desc_set)
+{
+	auto &set_layout = current_layout->get_resource_layout().sets[set];
+	uint32_t write_count = 0;
+	uint32_t buffer_info_count = 0;
+	VkWriteDescriptorSet writes[VULKAN_NUM_BINDINGS];
+	VkDescriptorBufferInfo buffer_info[VULKAN_NUM_BINDINGS];
+
+	for_each_bit(set_layout.uniform_buffer_mask, [&](uint32_t binding) {
+		auto &write = writes[write_count++];
+		write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		write.pNext = nullptr;
+		write.descriptorCount = 1;
+		write.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+		write.dstArrayElement = 0;
+		write.dstBinding = binding;
+		write.dstSet = desc_set;
+
+		// Offsets are applied dynamically.
+		auto &buffer = buffer_info[buffer_info_count++];
+		buffer = bindings.bindings[set][binding].buffer;
+		buffer.offset = 0;
+		write.pBufferInfo = &buffer;
+	});
+
+	for_each_bit(set_layout.storage_buffer_mask, [&](uint32_t binding) {
+		auto &write = writes[write_count++];
+		write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		write.pNext = nullptr;
+		write.descriptorCount = 1;
+		write.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		write.dstArrayElement = 0;
+		write.dstBinding = binding;
+		write.dstSet = desc_set;
+		write.pBufferInfo = &bindings.bindings[set][binding].buffer;
+	});
+
+	for_each_bit(set_layout.sampled_buffer_mask, [&](uint32_t binding) {
+		auto &write = writes[write_count++];
+		write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		write.pNext = nullptr;
+		write.descriptorCount = 1;
+		write.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_TEXEL_BUFFER;
+		write.dstArrayElement = 0;
+		write.dstBinding = binding;
+		write.dstSet = desc_set;
+		write.pTexelBufferView = &bindings.bindings[set][binding].buffer_view;
+	});
+
+	for_each_bit(set_layout.sampled_image_mask, [&](uint32_t binding) {
+		auto &write = writes[write_count++];
+		write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		write.pNext = nullptr;
+		write.descriptorCount = 1;
+		write.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+		write.dstArrayElement = 0;
+		write.dstBinding = binding;
+		write.dstSet = desc_set;
+
+		if (set_layout.fp_mask & (1u << binding))
+			write.pImageInfo = &bindings.bindings[set][binding].image.fp;
+		else
+			write.pImageInfo = &bindings.bindings[set][binding].image.integer;
+	});
+
+	for_each_bit(set_layout.separate_image_mask, [&](uint32_t binding) {
+		auto &write = writes[write_count++];
+		write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		write.pNext = nullptr;
+		write.descriptorCount = 1;
+		write.descriptorType = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
+		write.dstArrayElement = 0;
+		write.dstBinding = binding;
+		write.dstSet = desc_set;
+
+		if (set_layout.fp_mask & (1u << binding))
+			write.pImageInfo = &bindings.bindings[set][binding].image.fp;
+		else
+			write.pImageInfo = &bindings.bindings[set][binding].image.integer;
+	});
+
+	for_each_bit(set_layout.sampler_mask & ~set_layout.immutable_sampler_mask, [&](uint32_t binding) {
+		auto &write = writes[write_count++];
+		write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		write.pNext = nullptr;
+		write.descriptorCount = 1;
+		write.descriptorType = VK_DESCRIPTOR_TYPE_SAMPLER;
+		write.dstArrayElement = 0;
+		write.dstBinding = binding;
+		write.dstSet = desc_set;
+		write.pImageInfo = &bindings.bindings[set][binding].image.fp;
+	});
+
+	for_each_bit(set_layout.storage_image_mask, [&](uint32_t binding) {
+		auto &write = writes[write_count++];
+		write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		write.pNext = nullptr;
+		write.descriptorCount = 1;
+		write.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+		write.dstArrayElement = 0;
+		write.dstBinding = binding;
+		write.dstSet = desc_set;
+
+		if (set_layout.fp_mask & (1u << binding))
+			write.pImageInfo = &bindings.bindings[set][binding].image.fp;
+		else
+			write.pImageInfo = &bindings.bindings[set][binding].image.integer;
+	});
+
+	for_each_bit(set_layout.input_attachment_mask, [&](uint32_t binding) {
+		auto &write = writes[write_count++];
+		write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		write.pNext = nullptr;
+		write.descriptorCount = 1;
+		write.descriptorType = VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT;
+		write.dstArrayElement = 0;
+		write.dstBinding = binding;
+		write.dstSet = desc_set;
+		if (set_layout.fp_mask & (1u << binding))
+			write.pImageInfo = &bindings.bindings[set][binding].image.fp;
+		else
+			write.pImageInfo = &bindings.bindings[set][binding].image.integer;
+	});
+
+	vkUpdateDescriptorSets(device->get_device(), write_count, writes, 0, nullptr);
+}
+
 void CommandBuffer::flush_descriptor_set(uint32_t set)
 {
+	// Bindless sets are never rewritten, just bind the device-wide table.
+	if (!current_layout->get_allocator(set))
+	{
+		VkDescriptorSet bindless_set = device->get_bindless_texture_table()->get_set();
+		vkCmdBindDescriptorSets(cmd, actual_render_pass ? VK_PIPELINE_BIND_POINT_GRAPHICS : VK_PIPELINE_BIND_POINT_COMPUTE,
+		                        current_pipeline_layout, set, 1, &bindless_set, 0, nullptr);
+		return;
+	}
+
 	auto &layout = current_layout->get_resource_layout();
 	auto &set_layout = layout.sets[set];
 	uint32_t num_dynamic_offsets = 0;
@@ -1513,133 +1736,17 @@ void CommandBuffer::flush_descriptor_set(uint32_t set)
 	});
 
 	Hash hash = h.get();
-	auto allocated = current_layout->get_allocator(set)->find(thread_index, hash);
+	auto *allocator = current_layout->get_allocator(set);
+	auto allocated = allocator->find(thread_index, hash);
 
 	// The descriptor set was not successfully cached, rebuild.
 	if (!allocated.second)
 	{
-		uint32_t write_count = 0;
-		uint32_t buffer_info_count = 0;
-		VkWriteDescriptorSet writes[VULKAN_NUM_BINDINGS];
-		VkDescriptorBufferInfo buffer_info[VULKAN_NUM_BINDINGS];
-
-		for_each_bit(set_layout.uniform_buffer_mask, [&](uint32_t binding) {
-			auto &write = writes[write_count++];
-			write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-			write.pNext = nullptr;
-			write.descriptorCount = 1;
-			write.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
-			write.dstArrayElement = 0;
-			write.dstBinding = binding;
-			write.dstSet = allocated.first;
-
-			// Offsets are applied dynamically.
-			auto &buffer = buffer_info[buffer_info_count++];
-			buffer = bindings.bindings[set][binding].buffer;
-			buffer.offset = 0;
-			write.pBufferInfo = &buffer;
-		});
-
-		for_each_bit(set_layout.storage_buffer_mask, [&](uint32_t binding) {
-			auto &write = writes[write_count++];
-			write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-			write.pNext = nullptr;
-			write.descriptorCount = 1;
-			write.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
-			write.dstArrayElement = 0;
-			write.dstBinding = binding;
-			write.dstSet = allocated.first;
-			write.pBufferInfo = &bindings.bindings[set][binding].buffer;
-		});
-
-		for_each_bit(set_layout.sampled_buffer_mask, [&](uint32_t binding) {
-			auto &write = writes[write_count++];
-			write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-			write.pNext = nullptr;
-			write.descriptorCount = 1;
-			write.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_TEXEL_BUFFER;
-			write.dstArrayElement = 0;
-			write.dstBinding = binding;
-			write.dstSet = allocated.first;
-			write.pTexelBufferView = &bindings.bindings[set][binding].buffer_view;
-		});
-
-		for_each_bit(set_layout.sampled_image_mask, [&](uint32_t binding) {
-			auto &write = writes[write_count++];
-			write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-			write.pNext = nullptr;
-			write.descriptorCount = 1;
-			write.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-			write.dstArrayElement = 0;
-			write.dstBinding = binding;
-			write.dstSet = allocated.first;
-
-			if (set_layout.fp_mask & (1u << binding))
-				write.pImageInfo = &bindings.bindings[set][binding].image.fp;
-			else
-				write.pImageInfo = &bindings.bindings[set][binding].image.integer;
-		});
-
-		for_each_bit(set_layout.separate_image_mask, [&](uint32_t binding) {
-			auto &write = writes[write_count++];
-			write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-			write.pNext = nullptr;
-			write.descriptorCount = 1;
-			write.descriptorType = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
-			write.dstArrayElement = 0;
-			write.dstBinding = binding;
-			write.dstSet = allocated.first;
-
-			if (set_layout.fp_mask & (1u << binding))
-				write.pImageInfo = &bindings.bindings[set][binding].image.fp;
-			else
-				write.pImageInfo = &bindings.bindings[set][binding].image.integer;
-		});
-
-		for_each_bit(set_layout.sampler_mask & ~set_layout.immutable_sampler_mask, [&](uint32_t binding) {
-			auto &write = writes[write_count++];
-			write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-			write.pNext = nullptr;
-			write.descriptorCount = 1;
-			write.descriptorType = VK_DESCRIPTOR_TYPE_SAMPLER;
-			write.dstArrayElement = 0;
-			write.dstBinding = binding;
-			write.dstSet = allocated.first;
-			write.pImageInfo = &bindings.bindings[set][binding].image.fp;
-		});
-
-		for_each_bit(set_layout.storage_image_mask, [&](uint32_t binding) {
-			auto &write = writes[write_count++];
-			write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-			write.pNext = nullptr;
-			write.descriptorCount = 1;
-			write.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
-			write.dstArrayElement = 0;
-			write.dstBinding = binding;
-			write.dstSet = allocated.first;
-
-			if (set_layout.fp_mask & (1u << binding))
-				write.pImageInfo = &bindings.bindings[set][binding].image.fp;
-			else
-				write.pImageInfo = &bindings.bindings[set][binding].image.integer;
-		});
-
-		for_each_bit(set_layout.input_attachment_mask, [&](uint32_t binding) {
-			auto &write = writes[write_count++];
-			write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-			write.pNext = nullptr;
-			write.descriptorCount = 1;
-			write.descriptorType = VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT;
-			write.dstArrayElement = 0;
-			write.dstBinding = binding;
-			write.dstSet = allocated.first;
-			if (set_layout.fp_mask & (1u << binding))
-				write.pImageInfo = &bindings.bindings[set][binding].image.fp;
-			else
-				write.pImageInfo = &bindings.bindings[set][binding].image.integer;
-		});
-
-		vkUpdateDescriptorSets(device->get_device(), write_count, writes, 0, nullptr);
+		auto update_template = allocator->get_update_template();
+		if (update_template != VK_NULL_HANDLE)
+			write_descriptor_set_with_template(set, allocated.first, update_template);
+		else
+			write_descriptor_set(set, allocated.first);
 	}
 
 	vkCmdBindDescriptorSets(cmd, actual_render_pass ? VK_PIPELINE_BIND_POINT_GRAPHICS : VK_PIPELINE_BIND_POINT_COMPUTE,
@@ -1656,43 +1763,51 @@ void CommandBuffer::flush_descriptor_sets()
 
 void CommandBuffer::draw(uint32_t vertex_count, uint32_t instance_count, uint32_t first_vertex, uint32_t first_instance)
 {
-	VK_ASSERT(current_program);
+	VK_ASSERT(pipeline_state.program);
 	VK_ASSERT(!is_compute);
-	flush_render_state();
-	vkCmdDraw(cmd, vertex_count, instance_count, first_vertex, first_instance);
+	if (pipeline_prewarm)
+		prewarm_graphics_pipeline();
+	else if (flush_render_state())
+		vkCmdDraw(cmd, vertex_count, instance_count, first_vertex, first_instance);
 }
 
 void CommandBuffer::draw_indexed(uint32_t index_count, uint32_t instance_count, uint32_t first_index,
                                  int32_t vertex_offset, uint32_t first_instance)
 {
-	VK_ASSERT(current_program);
+	VK_ASSERT(pipeline_state.program);
 	VK_ASSERT(!is_compute);
 	VK_ASSERT(index.buffer != VK_NULL_HANDLE);
-	flush_render_state();
-	vkCmdDrawIndexed(cmd, index_count, instance_count, first_index, vertex_offset, first_instance);
+	if (pipeline_prewarm)
+		prewarm_graphics_pipeline();
+	else if (flush_render_state())
+		vkCmdDrawIndexed(cmd, index_count, instance_count, first_index, vertex_offset, first_instance);
 }
 
 void CommandBuffer::draw_indirect(const Vulkan::Buffer &buffer,
                                   uint32_t offset, uint32_t draw_count, uint32_t stride)
 {
-	VK_ASSERT(current_program);
+	VK_ASSERT(pipeline_state.program);
 	VK_ASSERT(!is_compute);
-	flush_render_state();
-	vkCmdDrawIndirect(cmd, buffer.get_buffer(), offset, draw_count, stride);
+	if (pipeline_prewarm)
+		prewarm_graphics_pipeline();
+	else if (flush_render_state())
+		vkCmdDrawIndirect(cmd, buffer.get_buffer(), offset, draw_count, stride);
 }
 
 void CommandBuffer::draw_indexed_indirect(const Vulkan::Buffer &buffer,
                                           uint32_t offset, uint32_t draw_count, uint32_t stride)
 {
-	VK_ASSERT(current_program);
+	VK_ASSERT(pipeline_state.program);
 	VK_ASSERT(!is_compute);
-	flush_render_state();
-	vkCmdDrawIndexedIndirect(cmd, buffer.get_buffer(), offset, draw_count, stride);
+	if (pipeline_prewarm)
+		prewarm_graphics_pipeline();
+	else if (flush_render_state())
+		vkCmdDrawIndexedIndirect(cmd, buffer.get_buffer(), offset, draw_count, stride);
 }
 
 void CommandBuffer::dispatch_indirect(const Buffer &buffer, uint32_t offset)
 {
-	VK_ASSERT(current_program);
+	VK_ASSERT(pipeline_state.program);
 	VK_ASSERT(is_compute);
 	flush_compute_state();
 	vkCmdDispatchIndirect(cmd, buffer.get_buffer(), offset);
@@ -1700,7 +1815,7 @@ void CommandBuffer::dispatch_indirect(const Buffer &buffer, uint32_t offset)
 
 void CommandBuffer::dispatch(uint32_t groups_x, uint32_t groups_y, uint32_t groups_z)
 {
-	VK_ASSERT(current_program);
+	VK_ASSERT(pipeline_state.program);
 	VK_ASSERT(is_compute);
 	flush_compute_state();
 	vkCmdDispatch(cmd, groups_x, groups_y, groups_z);
@@ -1708,7 +1823,7 @@ void CommandBuffer::dispatch(uint32_t groups_x, uint32_t groups_y, uint32_t grou
 
 void CommandBuffer::set_opaque_state()
 {
-	auto &state = static_state.state;
+	auto &state = pipeline_state.static_state.state;
 	memset(&state, 0, sizeof(state));
 	state.front_face = VK_FRONT_FACE_COUNTER_CLOCKWISE;
 	state.cull_mode = VK_CULL_MODE_BACK_BIT;
@@ -1727,7 +1842,7 @@ void CommandBuffer::set_opaque_state()
 
 void CommandBuffer::set_quad_state()
 {
-	auto &state = static_state.state;
+	auto &state = pipeline_state.static_state.state;
 	memset(&state, 0, sizeof(state));
 	state.front_face = VK_FRONT_FACE_COUNTER_CLOCKWISE;
 	state.cull_mode = VK_CULL_MODE_NONE;
@@ -1741,7 +1856,7 @@ void CommandBuffer::set_quad_state()
 
 void CommandBuffer::set_opaque_sprite_state()
 {
-	auto &state = static_state.state;
+	auto &state = pipeline_state.static_state.state;
 	memset(&state, 0, sizeof(state));
 	state.front_face = VK_FRONT_FACE_COUNTER_CLOCKWISE;
 	state.cull_mode = VK_CULL_MODE_NONE;
@@ -1756,7 +1871,7 @@ void CommandBuffer::set_opaque_sprite_state()
 
 void CommandBuffer::set_transparent_sprite_state()
 {
-	auto &state = static_state.state;
+	auto &state = pipeline_state.static_state.state;
 	memset(&state, 0, sizeof(state));
 	state.front_face = VK_FRONT_FACE_COUNTER_CLOCKWISE;
 	state.cull_mode = VK_CULL_MODE_NONE;
@@ -1815,15 +1930,15 @@ void CommandBuffer::restore_state(const CommandBufferSavedState &state)
 
 	if (state.flags & COMMAND_BUFFER_SAVED_RENDER_STATE_BIT)
 	{
-		if (memcmp(&state.static_state, &static_state, sizeof(static_state)))
+		if (memcmp(&state.static_state, &pipeline_state.static_state, sizeof(pipeline_state.static_state)))
 		{
-			memcpy(&static_state, &state.static_state, sizeof(static_state));
+			memcpy(&pipeline_state.static_state, &state.static_state, sizeof(pipeline_state.static_state));
 			set_dirty(COMMAND_BUFFER_DIRTY_STATIC_STATE_BIT);
 		}
 
-		if (memcmp(&state.potential_static_state, &potential_static_state, sizeof(potential_static_state)))
+		if (memcmp(&state.potential_static_state, &pipeline_state.potential_static_state, sizeof(pipeline_state.potential_static_state)))
 		{
-			memcpy(&potential_static_state, &state.potential_static_state, sizeof(potential_static_state));
+			memcpy(&pipeline_state.potential_static_state, &state.potential_static_state, sizeof(pipeline_state.potential_static_state));
 			set_dirty(COMMAND_BUFFER_DIRTY_STATIC_STATE_BIT);
 		}
 
@@ -1854,8 +1969,8 @@ void CommandBuffer::save_state(CommandBufferSaveStateFlags flags, CommandBufferS
 		state.scissor = scissor;
 	if (flags & COMMAND_BUFFER_SAVED_RENDER_STATE_BIT)
 	{
-		memcpy(&state.static_state, &static_state, sizeof(static_state));
-		state.potential_static_state = potential_static_state;
+		memcpy(&state.static_state, &pipeline_state.static_state, sizeof(pipeline_state.static_state));
+		state.potential_static_state = pipeline_state.potential_static_state;
 		state.dynamic_state = dynamic_state;
 	}
 
@@ -1876,11 +1991,11 @@ void CommandBuffer::end()
 		LOGE("Failed to end command buffer.\n");
 
 	if (vbo_block.mapped)
-		device->request_vertex_block_nolock(vbo_block, 0);
+		device->request_vertex_block_for_thread(thread_index, vbo_block, 0);
 	if (ibo_block.mapped)
-		device->request_index_block_nolock(ibo_block, 0);
+		device->request_index_block_for_thread(thread_index, ibo_block, 0);
 	if (ubo_block.mapped)
-		device->request_uniform_block_nolock(ubo_block, 0);
+		device->request_uniform_block_for_thread(thread_index, ubo_block, 0);
 	if (staging_block.mapped)
 		device->request_staging_block_nolock(staging_block, 0);
 }
@@ -144,10 +144,34 @@ struct VertexBindingState
 {
 	VkBuffer buffers[VULKAN_NUM_VERTEX_BUFFERS];
 	VkDeviceSize offsets[VULKAN_NUM_VERTEX_BUFFERS];
+};
+
+// Everything which goes into a graphics pipeline.
+// Self-contained, so it can be copied and compiled on another thread.
+struct DeferredPipelineCompile
+{
+	Program *program;
+	const RenderPass *compatible_render_pass;
+	unsigned subpass_index;
+
+	PipelineState static_state;
+	PotentialState potential_static_state;
+	VertexAttribState attribs[VULKAN_NUM_VERTEX_ATTRIBS];
 	VkDeviceSize strides[VULKAN_NUM_VERTEX_BUFFERS];
 	VkVertexInputRate input_rates[VULKAN_NUM_VERTEX_BUFFERS];
 };
 
+enum class PipelineCompileMode
+{
+	// Pipelines are created on the recording thread when first used.
+	Synchronous,
+	// Pipelines are created on a worker thread. Draws are skipped until the pipeline is ready.
+	AsyncSkip,
+	// Like AsyncSkip, but the fallback program of the missing program is used until the pipeline is ready.
+	// Draws are only skipped if there is no fallback.
+	AsyncFallback
+};
+
 struct ResourceBinding
 {
 	union {
@@ -264,6 +288,7 @@ public:
 	void copy_buffer(const Buffer &dst, VkDeviceSize dst_offset, const Buffer &src, VkDeviceSize src_offset,
 	                 VkDeviceSize size);
 	void copy_buffer(const Buffer &dst, const Buffer &src);
+	void copy_buffer(const Buffer &dst, const Buffer &src, const VkBufferCopy *copies, size_t count);
 	void copy_image(const Image &dst, const Image &src);
 	void copy_image(const Image &dst, const Image &src,
 	                const VkOffset3D &dst_offset, const VkOffset3D &src_offset,
@@ -328,7 +353,7 @@ public:
 	void submit_secondary(Util::IntrusivePtr<CommandBuffer> secondary);
 	inline unsigned get_current_subpass() const
 	{
-		return current_subpass;
+		return pipeline_state.subpass_index;
 	}
 	Util::IntrusivePtr<CommandBuffer> request_secondary_command_buffer(unsigned thread_index, unsigned subpass);
 	static Util::IntrusivePtr<CommandBuffer> request_secondary_command_buffer(Device &device,
@@ -408,21 +433,21 @@ public:
 #define SET_STATIC_STATE(value)                               \
 	do                                                        \
 	{                                                         \
-		if (static_state.state.value != value)                \
+		if (pipeline_state.static_state.state.value != value) \
 		{                                                     \
-			static_state.state.value = value;                 \
+			pipeline_state.static_state.state.value = value;  \
 			set_dirty(COMMAND_BUFFER_DIRTY_STATIC_STATE_BIT); \
 		}                                                     \
 	} while (0)
 
-#define SET_POTENTIALLY_STATIC_STATE(value)                   \
-	do                                                        \
-	{                                                         \
-		if (potential_static_state.value != value)            \
-		{                                                     \
-			potential_static_state.value = value;             \
-			set_dirty(COMMAND_BUFFER_DIRTY_STATIC_STATE_BIT); \
-		}                                                     \
+#define SET_POTENTIALLY_STATIC_STATE(value)                       \
+	do                                                            \
+	{                                                             \
+		if (pipeline_state.potential_static_state.value != value) \
+		{                                                         \
+			pipeline_state.potential_static_state.value = value;  \
+			set_dirty(COMMAND_BUFFER_DIRTY_STATIC_STATE_BIT);     \
+		}                                                         \
 	} while (0)
 
 	inline void set_depth_test(bool depth_test, bool depth_write)
@@ -557,10 +582,10 @@ public:
 	{
 		VK_ASSERT(index < VULKAN_NUM_SPEC_CONSTANTS);
 		static_assert(sizeof(value) == sizeof(uint32_t), "Spec constant data must be 32-bit.");
-		if (memcmp(&potential_static_state.spec_constants[index], &value, sizeof(value)))
+		if (memcmp(&pipeline_state.potential_static_state.spec_constants[index], &value, sizeof(value)))
 		{
-			memcpy(&potential_static_state.spec_constants[index], &value, sizeof(value));
-			if (static_state.state.spec_constant_mask & (1u << index))
+			memcpy(&pipeline_state.potential_static_state.spec_constants[index], &value, sizeof(value));
+			if (pipeline_state.static_state.state.spec_constant_mask & (1u << index))
 				set_dirty(COMMAND_BUFFER_DIRTY_STATIC_STATE_BIT);
 		}
 	}
@@ -609,6 +634,31 @@ public:
 
 	QueryPoolHandle write_timestamp(VkPipelineStageFlagBits stage);
 
+	// Defaults to Device::get_pipeline_compile_mode(). Compute pipelines are always compiled synchronously.
+	inline void set_pipeline_compile_mode(PipelineCompileMode mode)
+	{
+		pipeline_compile_mode = mode;
+	}
+
+	inline PipelineCompileMode get_pipeline_compile_mode() const
+	{
+		return pipeline_compile_mode;
+	}
+
+	// Compiles the pipeline for the current program, render pass and state in the background without drawing.
+	void prewarm_graphics_pipeline();
+
+	// While enabled, draws record nothing and call prewarm_graphics_pipeline() instead,
+	// so an existing render path can be run once to enumerate the pipelines it needs.
+	inline void set_pipeline_prewarm(bool enable)
+	{
+		pipeline_prewarm = enable;
+	}
+
+	static Util::Hash hash_graphics_pipeline(const DeferredPipelineCompile &compile, uint32_t &active_vbos);
+	static VkPipeline build_graphics_pipeline(Device *device, VkPipelineCache cache,
+	                                          const DeferredPipelineCompile &compile, Util::Hash hash);
+
 	void end();
 
 private:
@@ -622,9 +672,7 @@ private:
 
 	const Framebuffer *framebuffer = nullptr;
 	const RenderPass *actual_render_pass = nullptr;
-	const RenderPass *compatible_render_pass = nullptr;
 
-	VertexAttribState attribs[VULKAN_NUM_VERTEX_ATTRIBS] = {};
 	IndexState index = {};
 	VertexBindingState vbo = {};
 	ResourceBindings bindings;
@@ -632,8 +680,6 @@ private:
 	VkPipeline current_pipeline = VK_NULL_HANDLE;
 	VkPipelineLayout current_pipeline_layout = VK_NULL_HANDLE;
 	PipelineLayout *current_layout = nullptr;
-	Program *current_program = nullptr;
-	unsigned current_subpass = 0;
 	VkSubpassContents current_contents = VK_SUBPASS_CONTENTS_INLINE;
 	unsigned thread_index = 0;
 
@@ -660,22 +706,26 @@ private:
 		return mask;
 	}
 
-	PipelineState static_state;
-	PotentialState potential_static_state = {};
+	DeferredPipelineCompile pipeline_state = {};
+	PipelineCompileMode pipeline_compile_mode;
+	bool pipeline_prewarm = false;
 	DynamicState dynamic_state = {};
 #ifndef _MSC_VER
-	static_assert(sizeof(static_state.words) >= sizeof(static_state.state),
+	static_assert(sizeof(pipeline_state.static_state.words) >= sizeof(pipeline_state.static_state.state),
 	              "Hashable pipeline state is not large enough!");
 #endif
 
-	void flush_render_state();
-	VkPipeline build_graphics_pipeline(Util::Hash hash);
+	bool flush_render_state();
 	VkPipeline build_compute_pipeline(Util::Hash hash);
-	void flush_graphics_pipeline();
+	bool flush_graphics_pipeline();
+	VkPipeline get_fallback_graphics_pipeline();
 	void flush_compute_pipeline();
 	void flush_descriptor_sets();
 	void begin_graphics();
 	void flush_descriptor_set(uint32_t set);
+	void write_descriptor_set(uint32_t set, VkDescriptorSet desc_set);
+	void write_descriptor_set_with_template(uint32_t set, VkDescriptorSet desc_set,
+	                                        VkDescriptorUpdateTemplate update_template);
 	void begin_compute();
 	void begin_context();
 
@@ -41,6 +41,8 @@ public:
 	}
 
 private:
+	// Objects which are relocated get a new cookie, so stale cached state is never hit.
+	friend class Device;
 	uint64_t cookie;
 };
 
@@ -0,0 +1,65 @@
+/* Copyright (c) 2017-2018 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include "deferred_destroy.hpp"
+
+namespace Vulkan
+{
+void DeferredDestroyQueue::init(unsigned num_thread_indices)
+{
+	VK_ASSERT(!queues);
+	num_queues = num_thread_indices ? num_thread_indices : 1;
+	queues.reset(new Queue[num_queues]);
+	for (unsigned i = 0; i < num_queues; i++)
+		queues[i].head.store(nullptr, std::memory_order_relaxed);
+	push_count.store(0, std::memory_order_relaxed);
+}
+
+void DeferredDestroyQueue::push(unsigned thread_index, const DeferredDestroy &destroy)
+{
+	VK_ASSERT(queues);
+	Node *node = node_pool.allocate();
+	node->destroy = destroy;
+
+	// Push-only stacks are immune to ABA since we never dereference the old head,
+	// and drain() takes the entire stack with a single exchange.
+	auto &head = queues[thread_index % num_queues].head;
+	node->next = head.load(std::memory_order_relaxed);
+	while (!head.compare_exchange_weak(node->next, node, std::memory_order_release, std::memory_order_relaxed))
+		;
+
+	push_count.fetch_add(1, std::memory_order_relaxed);
+}
+
+DeferredDestroyQueue::~DeferredDestroyQueue()
+{
+	// The device drains everything before tearing down, anything left here is leaked Vulkan objects.
+	unsigned leaked = 0;
+	drain([&](const DeferredDestroy &) {
+		leaked++;
+	});
+
+	if (leaked)
+		LOGE("%u deferred destroys were never processed.\n", leaked);
+}
+}
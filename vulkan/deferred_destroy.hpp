@@ -0,0 +1,126 @@
+/* Copyright (c) 2017-2018 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#pragma once
+
+#include "vulkan.hpp"
+#include "memory_allocator.hpp"
+#include "object_pool.hpp"
+#include <atomic>
+#include <memory>
+
+namespace Vulkan
+{
+struct DeferredDestroy
+{
+	enum class Type : uint32_t
+	{
+		Buffer,
+		Image,
+		ImageView,
+		BufferView,
+		Pipeline,
+		Sampler,
+		Framebuffer,
+		Semaphore,
+		Event,
+		Allocation
+	};
+
+	Type type;
+	union
+	{
+		VkBuffer buffer;
+		VkImage image;
+		VkImageView image_view;
+		VkBufferView buffer_view;
+		VkPipeline pipeline;
+		VkSampler sampler;
+		VkFramebuffer framebuffer;
+		VkSemaphore semaphore;
+		VkEvent event;
+	};
+	DeviceAllocation allocation;
+};
+
+// Lock-free queues for objects which are destroyed by the application on arbitrary threads.
+// Each thread index pushes to its own intrusive stack with a single CAS, so destroying objects never takes the device lock.
+// The device drains all stacks at frame boundaries and defers the actual destruction
+// until the frame which retired the objects has completed on the GPU.
+class DeferredDestroyQueue
+{
+public:
+	DeferredDestroyQueue() = default;
+	~DeferredDestroyQueue();
+	DeferredDestroyQueue(const DeferredDestroyQueue &) = delete;
+	void operator=(const DeferredDestroyQueue &) = delete;
+
+	void init(unsigned num_thread_indices);
+
+	// Safe to call concurrently from any thread, including concurrently with drain().
+	// Multiple threads may share a thread index.
+	void push(unsigned thread_index, const DeferredDestroy &destroy);
+
+	// Must only be called by one thread at a time.
+	// Objects pushed concurrently with a drain are either drained now or in the next drain.
+	template <typename Func>
+	void drain(const Func &func)
+	{
+		for (unsigned i = 0; i < num_queues; i++)
+		{
+			Node *node = queues[i].head.exchange(nullptr, std::memory_order_acquire);
+			while (node)
+			{
+				Node *next = node->next;
+				func(node->destroy);
+				node_pool.free(node);
+				node = next;
+			}
+		}
+	}
+
+	uint64_t get_push_count() const
+	{
+		return push_count.load(std::memory_order_relaxed);
+	}
+
+private:
+	struct Node
+	{
+		Node *next;
+		DeferredDestroy destroy;
+	};
+
+	// Keep each stack head on its own cache line so threads do not false share.
+	struct Queue
+	{
+		std::atomic<Node *> head;
+		uint8_t padding[64 - sizeof(std::atomic<Node *>)];
+	};
+
+	std::unique_ptr<Queue[]> queues;
+	unsigned num_queues = 0;
+	Util::ThreadSafeObjectPool<Node> node_pool;
+	std::atomic<uint64_t> push_count;
+};
+}
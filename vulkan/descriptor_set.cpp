@@ -23,6 +23,7 @@
 #include "descriptor_set.hpp"
 #include "device.hpp"
 #include <vector>
+#include <stddef.h>
 
 #ifdef GRANITE_VULKAN_MT
 #include "thread_group.hpp"
@@ -48,6 +49,16 @@ DescriptorSetAllocator::DescriptorSetAllocator(Hash hash, Device *device, const
 	VkDescriptorSetLayoutCreateInfo info = { VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO };
 
 	vector<VkDescriptorSetLayoutBinding> bindings;
+	vector<VkDescriptorUpdateTemplateEntry> update_entries;
+
+	// Template entries read from an array of ResourceBinding, see CommandBuffer::flush_descriptor_set.
+	const auto add_update_entry = [&](uint32_t binding, VkDescriptorType type, size_t offset) {
+		update_entries.push_back({ binding, 0, 1, type, binding * sizeof(ResourceBinding) + offset, sizeof(ResourceBinding) });
+	};
+	const auto image_offset = [&](uint32_t binding) -> size_t {
+		return (layout.fp_mask & (1u << binding)) ? offsetof(ResourceBinding, image.fp) : offsetof(ResourceBinding, image.integer);
+	};
+
 	for (unsigned i = 0; i < VULKAN_NUM_BINDINGS; i++)
 	{
 		auto stages = stages_for_binds[i];
@@ -62,49 +73,56 @@ DescriptorSetAllocator::DescriptorSetAllocator(Hash hash, Device *device, const
 				sampler = device->get_stock_sampler(get_immutable_sampler(layout, i)).get_sampler();
 
 			bindings.push_back({ i, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1, stages, sampler != VK_NULL_HANDLE ? &sampler : nullptr });
-			pool_size.push_back({ VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VULKAN_NUM_SETS_PER_POOL });
+			pool_size.push_back({ VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1 });
+			add_update_entry(i, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, image_offset(i));
 			types++;
 		}
 
 		if (layout.sampled_buffer_mask & (1u << i))
 		{
 			bindings.push_back({ i, VK_DESCRIPTOR_TYPE_UNIFORM_TEXEL_BUFFER, 1, stages, nullptr });
-			pool_size.push_back({ VK_DESCRIPTOR_TYPE_UNIFORM_TEXEL_BUFFER, VULKAN_NUM_SETS_PER_POOL });
+			pool_size.push_back({ VK_DESCRIPTOR_TYPE_UNIFORM_TEXEL_BUFFER, 1 });
+			add_update_entry(i, VK_DESCRIPTOR_TYPE_UNIFORM_TEXEL_BUFFER, offsetof(ResourceBinding, buffer_view));
 			types++;
 		}
 
 		if (layout.storage_image_mask & (1u << i))
 		{
 			bindings.push_back({ i, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1, stages, nullptr });
-			pool_size.push_back({ VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, VULKAN_NUM_SETS_PER_POOL });
+			pool_size.push_back({ VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1 });
+			add_update_entry(i, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, image_offset(i));
 			types++;
 		}
 
 		if (layout.uniform_buffer_mask & (1u << i))
 		{
 			bindings.push_back({ i, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, 1, stages, nullptr });
-			pool_size.push_back({ VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, VULKAN_NUM_SETS_PER_POOL });
+			pool_size.push_back({ VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, 1 });
+			add_update_entry(i, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, offsetof(ResourceBinding, buffer));
 			types++;
 		}
 
 		if (layout.storage_buffer_mask & (1u << i))
 		{
 			bindings.push_back({ i, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, stages, nullptr });
-			pool_size.push_back({ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VULKAN_NUM_SETS_PER_POOL });
+			pool_size.push_back({ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1 });
+			add_update_entry(i, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, offsetof(ResourceBinding, buffer));
 			types++;
 		}
 
 		if (layout.input_attachment_mask & (1u << i))
 		{
 			bindings.push_back({ i, VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT, 1, stages, nullptr });
-			pool_size.push_back({ VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT, VULKAN_NUM_SETS_PER_POOL });
+			pool_size.push_back({ VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT, 1 });
+			add_update_entry(i, VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT, image_offset(i));
 			types++;
 		}
 
 		if (layout.separate_image_mask & (1u << i))
 		{
 			bindings.push_back({ i, VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE, 1, stages, nullptr });
-			pool_size.push_back({ VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE, VULKAN_NUM_SETS_PER_POOL });
+			pool_size.push_back({ VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE, 1 });
+			add_update_entry(i, VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE, image_offset(i));
 			types++;
 		}
 
@@ -115,7 +133,9 @@ DescriptorSetAllocator::DescriptorSetAllocator(Hash hash, Device *device, const
 				sampler = device->get_stock_sampler(get_immutable_sampler(layout, i)).get_sampler();
 
 			bindings.push_back({ i, VK_DESCRIPTOR_TYPE_SAMPLER, 1, stages, sampler != VK_NULL_HANDLE ? &sampler : nullptr });
-			pool_size.push_back({ VK_DESCRIPTOR_TYPE_SAMPLER, VULKAN_NUM_SETS_PER_POOL });
+			pool_size.push_back({ VK_DESCRIPTOR_TYPE_SAMPLER, 1 });
+			if (sampler == VK_NULL_HANDLE)
+				add_update_entry(i, VK_DESCRIPTOR_TYPE_SAMPLER, offsetof(ResourceBinding, image.fp));
 			types++;
 		}
 
@@ -138,12 +158,95 @@ DescriptorSetAllocator::DescriptorSetAllocator(Hash hash, Device *device, const
 #ifdef GRANITE_VULKAN_FOSSILIZE
 	device->set_descriptor_set_layout_handle(desc_index, set_layout);
 #endif
+
+	if (device->get_device_features().supports_vulkan_11_device && !update_entries.empty())
+	{
+		VkDescriptorUpdateTemplateCreateInfo template_info = { VK_STRUCTURE_TYPE_DESCRIPTOR_UPDATE_TEMPLATE_CREATE_INFO };
+		template_info.descriptorUpdateEntryCount = update_entries.size();
+		template_info.pDescriptorUpdateEntries = update_entries.data();
+		template_info.templateType = VK_DESCRIPTOR_UPDATE_TEMPLATE_TYPE_DESCRIPTOR_SET;
+		template_info.descriptorSetLayout = set_layout;
+		if (vkCreateDescriptorUpdateTemplate(device->get_device(), &template_info, nullptr, &update_template) != VK_SUCCESS)
+		{
+			LOGE("Failed to create descriptor update template.\n");
+			update_template = VK_NULL_HANDLE;
+		}
+	}
+
+	stats.layout_hash = get_hash();
+	stats.ring_size = VULKAN_DESCRIPTOR_RING_SIZE;
+	stats.uses_update_template = update_template != VK_NULL_HANDLE;
 }
 
 void DescriptorSetAllocator::begin_frame()
 {
 	for (auto &thr : per_thread)
+	{
 		thr->should_begin = true;
+
+		stats.hits += thr->hits;
+		stats.misses += thr->misses;
+		stats.pools_allocated += thr->pools_allocated;
+		stats.sets_allocated += thr->sets_allocated;
+		tuning.hits += thr->hits;
+		tuning.misses += thr->misses;
+
+		thr->hits = 0;
+		thr->misses = 0;
+		thr->pools_allocated = 0;
+		thr->sets_allocated = 0;
+	}
+
+	tune_ring_size();
+}
+
+void DescriptorSetAllocator::tune_ring_size()
+{
+	const unsigned window_frames = 64;
+	const uint64_t min_window_lookups = 256;
+	const double target_hit_rate = 0.9;
+	const double min_improvement = 0.05;
+
+	if (++tuning.frames < window_frames)
+		return;
+
+	uint64_t lookups = tuning.hits + tuning.misses;
+	double hit_rate = lookups ? double(tuning.hits) / double(lookups) : 1.0;
+	tuning.frames = 0;
+	tuning.hits = 0;
+	tuning.misses = 0;
+
+	if (lookups < min_window_lookups)
+		return;
+
+	if (tuning.growth_pending)
+	{
+		tuning.growth_pending = false;
+		if (hit_rate < tuning.hit_rate_before_growth + min_improvement)
+		{
+			// Sets are unique every frame, so keeping them around longer only wastes memory.
+			set_ring_size(stats.ring_size / 2);
+			tuning.saturated = true;
+		}
+	}
+	else if (!tuning.saturated && hit_rate < target_hit_rate && stats.ring_size < VULKAN_MAX_DESCRIPTOR_RING_SIZE)
+	{
+		tuning.hit_rate_before_growth = hit_rate;
+		tuning.growth_pending = true;
+		set_ring_size(stats.ring_size * 2);
+	}
+}
+
+void DescriptorSetAllocator::set_ring_size(unsigned ring_size)
+{
+	stats.ring_size = ring_size;
+	for (auto &thr : per_thread)
+		thr->set_nodes.set_ring_size(ring_size);
+}
+
+DescriptorSetAllocatorStats DescriptorSetAllocator::get_stats() const
+{
+	return stats;
 }
 
 pair<VkDescriptorSet, bool> DescriptorSetAllocator::find(unsigned thread_index, Hash hash)
@@ -157,36 +260,48 @@ pair<VkDescriptorSet, bool> DescriptorSetAllocator::find(unsigned thread_index,
 
 	auto *node = state.set_nodes.request(hash);
 	if (node)
+	{
+		state.hits++;
 		return { node->set, true };
+	}
 
+	state.misses++;
 	node = state.set_nodes.request_vacant(hash);
 	if (node)
 		return { node->set, false };
 
+	unsigned num_sets = state.sets_per_pool;
+	state.sets_per_pool = min(state.sets_per_pool * 2, VULKAN_MAX_SETS_PER_POOL);
+
+	vector<VkDescriptorPoolSize> sizes = pool_size;
+	for (auto &size : sizes)
+		size.descriptorCount *= num_sets;
+
 	VkDescriptorPool pool;
 	VkDescriptorPoolCreateInfo info = { VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO };
-	info.maxSets = VULKAN_NUM_SETS_PER_POOL;
-	if (!pool_size.empty())
+	info.maxSets = num_sets;
+	if (!sizes.empty())
 	{
-		info.poolSizeCount = pool_size.size();
-		info.pPoolSizes = pool_size.data();
+		info.poolSizeCount = sizes.size();
+		info.pPoolSizes = sizes.data();
 	}
 
 	if (vkCreateDescriptorPool(device->get_device(), &info, nullptr, &pool) != VK_SUCCESS)
 		LOGE("Failed to create descriptor pool.\n");
 
-	VkDescriptorSet sets[VULKAN_NUM_SETS_PER_POOL];
-	VkDescriptorSetLayout layouts[VULKAN_NUM_SETS_PER_POOL];
-	fill(begin(layouts), end(layouts), set_layout);
+	vector<VkDescriptorSet> sets(num_sets);
+	vector<VkDescriptorSetLayout> layouts(num_sets, set_layout);
 
 	VkDescriptorSetAllocateInfo alloc = { VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO };
 	alloc.descriptorPool = pool;
-	alloc.descriptorSetCount = VULKAN_NUM_SETS_PER_POOL;
-	alloc.pSetLayouts = layouts;
+	alloc.descriptorSetCount = num_sets;
+	alloc.pSetLayouts = layouts.data();
 
-	if (vkAllocateDescriptorSets(device->get_device(), &alloc, sets) != VK_SUCCESS)
+	if (vkAllocateDescriptorSets(device->get_device(), &alloc, sets.data()) != VK_SUCCESS)
 		LOGE("Failed to allocate descriptor sets.\n");
 	state.pools.push_back(pool);
+	state.pools_allocated++;
+	state.sets_allocated += num_sets;
 
 	for (auto set : sets)
 		state.set_nodes.make_vacant(set);
@@ -210,6 +325,8 @@ void DescriptorSetAllocator::clear()
 
 DescriptorSetAllocator::~DescriptorSetAllocator()
 {
+	if (update_template != VK_NULL_HANDLE)
+		vkDestroyDescriptorUpdateTemplate(device->get_device(), update_template, nullptr);
 	if (set_layout != VK_NULL_HANDLE)
 		vkDestroyDescriptorSetLayout(device->get_device(), set_layout, nullptr);
 	clear();
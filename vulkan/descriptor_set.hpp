@@ -68,8 +68,25 @@ static inline void set_immutable_sampler(DescriptorSetLayout &layout, unsigned b
 	layout.immutable_sampler_mask |= 1u << binding;
 }
 
+// Pools start small and double for every pool a thread allocates, so layouts with many unique sets
+// quickly stop allocating pools.
 static const unsigned VULKAN_NUM_SETS_PER_POOL = 16;
+static const unsigned VULKAN_MAX_SETS_PER_POOL = 1024;
 static const unsigned VULKAN_DESCRIPTOR_RING_SIZE = 8;
+static const unsigned VULKAN_MAX_DESCRIPTOR_RING_SIZE = 64;
+
+struct DescriptorSetAllocatorStats
+{
+	Util::Hash layout_hash = 0;
+	// Lookups which found a cached set, and lookups which had to write a new set.
+	uint64_t hits = 0;
+	uint64_t misses = 0;
+	uint64_t pools_allocated = 0;
+	uint64_t sets_allocated = 0;
+	// Number of frames a set stays cached without being used, tuned from the hit rate.
+	unsigned ring_size = 0;
+	bool uses_update_template = false;
+};
 
 class DescriptorSetAllocator : public HashedObject<DescriptorSetAllocator>
 {
@@ -79,6 +96,8 @@ public:
 	void operator=(const DescriptorSetAllocator &) = delete;
 	DescriptorSetAllocator(const DescriptorSetAllocator &) = delete;
 
+	// Also collects statistics from all threads and retunes the cache ring size,
+	// so it must not be called while command buffers are being recorded.
 	void begin_frame();
 	std::pair<VkDescriptorSet, bool> find(unsigned thread_index, Util::Hash hash);
 
@@ -87,6 +106,16 @@ public:
 		return set_layout;
 	}
 
+	// Writes every binding in the set from an array of ResourceBinding indexed by binding,
+	// or VK_NULL_HANDLE if the device does not support update templates.
+	VkDescriptorUpdateTemplate get_update_template() const
+	{
+		return update_template;
+	}
+
+	// Statistics as of the last begin_frame().
+	DescriptorSetAllocatorStats get_stats() const;
+
 	void clear();
 
 private:
@@ -102,14 +131,41 @@ private:
 
 	Device *device;
 	VkDescriptorSetLayout set_layout = VK_NULL_HANDLE;
+	VkDescriptorUpdateTemplate update_template = VK_NULL_HANDLE;
 
 	struct PerThread
 	{
 		Util::TemporaryHashmap<DescriptorSetNode, VULKAN_DESCRIPTOR_RING_SIZE, true> set_nodes;
 		std::vector<VkDescriptorPool> pools;
+		unsigned sets_per_pool = VULKAN_NUM_SETS_PER_POOL;
 		bool should_begin = true;
+
+		// Collected by begin_frame().
+		uint64_t hits = 0;
+		uint64_t misses = 0;
+		uint64_t pools_allocated = 0;
+		uint64_t sets_allocated = 0;
 	};
 	std::vector<std::unique_ptr<PerThread>> per_thread;
+
+	// Descriptor counts for one set, scaled by the number of sets when creating a pool.
 	std::vector<VkDescriptorPoolSize> pool_size;
+
+	DescriptorSetAllocatorStats stats;
+
+	// The ring size is doubled when the hit rate over a window of frames is poor,
+	// and reverted if the next window shows that caching sets for longer did not help.
+	struct
+	{
+		unsigned frames = 0;
+		uint64_t hits = 0;
+		uint64_t misses = 0;
+		double hit_rate_before_growth = 0.0;
+		bool growth_pending = false;
+		bool saturated = false;
+	} tuning;
+
+	void tune_ring_size();
+	void set_ring_size(unsigned ring_size);
 };
 }
@@ -25,29 +25,43 @@
 #include "type_to_string.hpp"
 #include "quirks.hpp"
 #include "enum_cast.hpp"
+#include "frame_allocator.hpp"
+#include "timer.hpp"
 #include <algorithm>
 #include <string.h>
 
 #ifdef GRANITE_VULKAN_MT
 #include "thread_group.hpp"
-#define LOCK() std::lock_guard<std::mutex> holder__{lock.lock}
+#define LOCK() auto holder__ = lock_device()
 #define DRAIN_FRAME_LOCK() \
-	std::unique_lock<std::mutex> holder__{lock.lock}; \
+	auto holder__ = lock_device(); \
 	lock.cond.wait(holder__, [&]() { \
 		return lock.counter == 0; \
 	})
+#define THREAD_BLOCK_LOCK(pools) auto thread_holder__ = (pools).acquire()
 
 static inline unsigned get_current_thread_index()
 {
 	return Granite::ThreadGroup::get_current_thread_index();
 }
+
+static inline unsigned get_num_thread_indices()
+{
+	return Granite::Global::thread_group()->get_num_threads() + 1;
+}
 #else
 #define LOCK() ((void)0)
 #define DRAIN_FRAME_LOCK() VK_ASSERT(lock.counter == 0)
+#define THREAD_BLOCK_LOCK(pools) ((void)0)
 static inline unsigned get_current_thread_index()
 {
 	return 0;
 }
+
+static inline unsigned get_num_thread_indices()
+{
+	return 1;
+}
 #endif
 
 using namespace std;
@@ -58,6 +72,7 @@ namespace Vulkan
 Device::Device()
     : framebuffer_allocator(this)
     , transient_allocator(this)
+    , upload_manager(this)
 #ifdef GRANITE_VULKAN_FILESYSTEM
 	, shader_manager(this)
 	, texture_manager(this)
@@ -66,6 +81,57 @@ Device::Device()
 #ifdef GRANITE_VULKAN_MT
 	cookie.store(0);
 #endif
+
+	unsigned num_thread_indices = get_num_thread_indices();
+	destroy_queue.init(num_thread_indices);
+	for (unsigned i = 0; i < num_thread_indices; i++)
+		managers.thread_blocks.emplace_back(new ThreadBlockPools);
+}
+
+#ifdef GRANITE_VULKAN_MT
+std::unique_lock<std::mutex> Device::lock_device()
+{
+	std::unique_lock<std::mutex> holder{lock.lock, std::try_to_lock};
+	if (!holder)
+	{
+		auto start = Util::get_current_time_nsecs();
+		holder.lock();
+		lock.contentions++;
+		lock.wait_nsecs += Util::get_current_time_nsecs() - start;
+	}
+	lock.acquisitions++;
+	return holder;
+}
+#endif
+
+DeviceLockStats Device::get_lock_stats()
+{
+	DeviceLockStats stats;
+	{
+		LOCK();
+		stats.lock_acquisitions = lock.acquisitions;
+		stats.lock_contentions = lock.contentions;
+		stats.lock_wait_nsecs = lock.wait_nsecs;
+	}
+
+	for (auto &pools : managers.thread_blocks)
+	{
+		THREAD_BLOCK_LOCK(*pools);
+		stats.thread_block_requests += pools->requests;
+		stats.thread_block_contentions += pools->contentions;
+	}
+
+	stats.deferred_destroys = destroy_queue.get_push_count();
+	return stats;
+}
+
+vector<DescriptorSetAllocatorStats> Device::get_descriptor_set_allocator_stats()
+{
+	LOCK();
+	vector<DescriptorSetAllocatorStats> stats;
+	for (auto &allocator : descriptor_set_allocators)
+		stats.push_back(allocator.get_stats());
+	return stats;
 }
 
 Semaphore Device::request_semaphore()
@@ -302,6 +368,61 @@ Program *Device::request_program(const uint32_t *vertex_data, size_t vertex_size
 	return request_program(vertex, fragment);
 }
 
+void Device::set_pipeline_compile_mode(PipelineCompileMode mode)
+{
+	pipeline_compile.mode = mode;
+}
+
+PipelineCompileMode Device::get_pipeline_compile_mode() const
+{
+	return pipeline_compile.mode;
+}
+
+void Device::enqueue_graphics_pipeline_compile(const DeferredPipelineCompile &compile, Hash hash)
+{
+#ifdef GRANITE_VULKAN_MT
+	{
+		lock_guard<mutex> holder{pipeline_compile.lock};
+		if (!pipeline_compile.pending.insert(hash).second)
+			return;
+	}
+
+	auto task = Granite::Global::thread_group()->create_task([this, compile, hash]() {
+		if (compile.program->get_pipeline(hash) == VK_NULL_HANDLE)
+			CommandBuffer::build_graphics_pipeline(this, pipeline_cache, compile, hash);
+
+		lock_guard<mutex> holder{pipeline_compile.lock};
+		pipeline_compile.pending.erase(hash);
+		pipeline_compile.cond.notify_all();
+	});
+	task->flush();
+#else
+	// Without threading support, there is no background to compile in.
+	if (compile.program->get_pipeline(hash) == VK_NULL_HANDLE)
+		CommandBuffer::build_graphics_pipeline(this, pipeline_cache, compile, hash);
+#endif
+}
+
+void Device::wait_pipeline_compiles()
+{
+#ifdef GRANITE_VULKAN_MT
+	unique_lock<mutex> holder{pipeline_compile.lock};
+	pipeline_compile.cond.wait(holder, [this]() {
+		return pipeline_compile.pending.empty();
+	});
+#endif
+}
+
+unsigned Device::get_num_pending_pipeline_compiles()
+{
+#ifdef GRANITE_VULKAN_MT
+	lock_guard<mutex> holder{pipeline_compile.lock};
+	return unsigned(pipeline_compile.pending.size());
+#else
+	return 0;
+#endif
+}
+
 PipelineLayout *Device::request_pipeline_layout(const CombinedResourceLayout &layout)
 {
 	Hasher h;
@@ -312,6 +433,7 @@ PipelineLayout *Device::request_pipeline_layout(const CombinedResourceLayout &la
 	h.data(layout.spec_constant_mask, sizeof(layout.spec_constant_mask));
 	h.u32(layout.attribute_mask);
 	h.u32(layout.render_target_mask);
+	h.u32(layout.bindless_set_mask);
 
 	auto hash = h.get();
 	auto *ret = pipeline_layouts.find(hash);
@@ -364,6 +486,12 @@ void Device::bake_program(Program &program)
 			layout.sets[set].separate_image_mask |= shader_layout.sets[set].separate_image_mask;
 			layout.sets[set].fp_mask |= shader_layout.sets[set].fp_mask;
 
+			if (shader_layout.bindless_set_mask & (1u << set))
+			{
+				layout.bindless_set_mask |= 1u << set;
+				layout.stages_for_sets[set] |= stage_mask;
+			}
+
 			for_each_bit(shader_layout.sets[set].immutable_sampler_mask, [&](uint32_t binding) {
 				StockSampler sampler = get_immutable_sampler(shader_layout.sets[set], binding);
 
@@ -412,6 +540,16 @@ void Device::bake_program(Program &program)
 	{
 		if (layout.stages_for_sets[i] != 0)
 			layout.descriptor_set_mask |= 1u << i;
+
+		// A bindless set is bound as-is, so it cannot contain regular bindings as well.
+		if ((layout.bindless_set_mask & (1u << i)) &&
+		    (layout.sets[i].sampled_image_mask | layout.sets[i].storage_image_mask |
+		     layout.sets[i].uniform_buffer_mask | layout.sets[i].storage_buffer_mask |
+		     layout.sets[i].sampled_buffer_mask | layout.sets[i].input_attachment_mask |
+		     layout.sets[i].sampler_mask | layout.sets[i].separate_image_mask))
+		{
+			LOGE("Descriptor set %u mixes a bindless texture array with other bindings.\n", i);
+		}
 	}
 
 	Hasher h;
@@ -612,19 +750,39 @@ void Device::set_context(const Context &context)
 
 	managers.memory.init(gpu, device);
 	managers.memory.set_supports_dedicated_allocation(ext.supports_dedicated);
+	managers.memory.set_supports_memory_budget(ext.supports_memory_budget);
+	managers.memory.update_budget();
 	managers.semaphore.init(device);
 	managers.fence.init(device);
 	managers.event.init(this);
-	managers.vbo.init(this, 4 * 1024, 16, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
-	                  ImplementationQuirks::get().staging_need_device_local);
-	managers.ibo.init(this, 4 * 1024, 16, VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
-	                  ImplementationQuirks::get().staging_need_device_local);
-	managers.ubo.init(this, 256 * 1024, std::max<VkDeviceSize>(16u, gpu_props.limits.minUniformBufferOffsetAlignment),
-	                  VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
-	                  ImplementationQuirks::get().staging_need_device_local);
+	for (auto &pools : managers.thread_blocks)
+	{
+		pools->vbo.init(this, 4 * 1024, 16, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+		                ImplementationQuirks::get().staging_need_device_local);
+		pools->ibo.init(this, 4 * 1024, 16, VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
+		                ImplementationQuirks::get().staging_need_device_local);
+		pools->ubo.init(this, 256 * 1024, std::max<VkDeviceSize>(16u, gpu_props.limits.minUniformBufferOffsetAlignment),
+		                VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+		                ImplementationQuirks::get().staging_need_device_local);
+	}
 	managers.staging.init(this, 64 * 1024, std::max<VkDeviceSize>(16u, gpu_props.limits.optimalBufferCopyOffsetAlignment),
 	                      VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
 	                      false);
+
+	if (ext.supports_descriptor_indexing)
+	{
+		unsigned max_textures = std::min(VULKAN_NUM_BINDLESS_TEXTURES,
+		                                 std::min(ext.descriptor_indexing_properties.maxDescriptorSetUpdateAfterBindSampledImages,
+		                                          ext.descriptor_indexing_properties.maxPerStageDescriptorUpdateAfterBindSampledImages));
+		managers.bindless.reset(new BindlessTextureTable(this, max_textures));
+		if (managers.bindless->get_set() == VK_NULL_HANDLE)
+			managers.bindless.reset();
+	}
+}
+
+BindlessTextureTable *Device::get_bindless_texture_table()
+{
+	return managers.bindless.get();
 }
 
 void Device::init_stock_samplers()
@@ -711,21 +869,20 @@ static void request_block(Device &device, BufferBlock &block, VkDeviceSize size,
 	if (block.mapped)
 		device.unmap_host_buffer(*block.cpu, MEMORY_ACCESS_WRITE_BIT);
 
-	if (block.offset == 0)
-	{
-		if (block.size == pool.get_block_size())
-			pool.recycle_block(move(block));
-	}
-	else
+	// Only the per-thread lock is held here, so no block may be destroyed now,
+	// as that pushes into the frame's destroy lists. Oversized blocks are retired along with the others,
+	// and released when the frame begins again under the device lock.
+	if (block.offset == 0 && block.size == pool.get_block_size())
+		pool.recycle_block(move(block));
+	else if (block.cpu)
 	{
-		if (block.cpu != block.gpu)
+		if (block.offset != 0 && block.cpu != block.gpu)
 		{
 			VK_ASSERT(dma);
 			dma->push_back(block);
 		}
 
-		if (block.size == pool.get_block_size())
-			recycle.push_back(block);
+		recycle.push_back(block);
 	}
 
 	if (size)
@@ -734,37 +891,33 @@ static void request_block(Device &device, BufferBlock &block, VkDeviceSize size,
 		block = {};
 }
 
-void Device::request_vertex_block(BufferBlock &block, VkDeviceSize size)
+// Blocks are only requested while a command buffer is being recorded,
+// so the frame context cannot change under us, and the per-thread lock is enough.
+void Device::request_vertex_block_for_thread(unsigned thread_index, BufferBlock &block, VkDeviceSize size)
 {
-	LOCK();
-	request_vertex_block_nolock(block, size);
+	VK_ASSERT(thread_index < managers.thread_blocks.size());
+	auto &pools = *managers.thread_blocks[thread_index];
+	THREAD_BLOCK_LOCK(pools);
+	pools.requests++;
+	request_block(*this, block, size, pools.vbo, &pools.dma_vbo, frame().thread_blocks[thread_index].vbo);
 }
 
-void Device::request_vertex_block_nolock(BufferBlock &block, VkDeviceSize size)
+void Device::request_index_block_for_thread(unsigned thread_index, BufferBlock &block, VkDeviceSize size)
 {
-	request_block(*this, block, size, managers.vbo, &dma.vbo, frame().vbo_blocks);
+	VK_ASSERT(thread_index < managers.thread_blocks.size());
+	auto &pools = *managers.thread_blocks[thread_index];
+	THREAD_BLOCK_LOCK(pools);
+	pools.requests++;
+	request_block(*this, block, size, pools.ibo, &pools.dma_ibo, frame().thread_blocks[thread_index].ibo);
 }
 
-void Device::request_index_block(BufferBlock &block, VkDeviceSize size)
+void Device::request_uniform_block_for_thread(unsigned thread_index, BufferBlock &block, VkDeviceSize size)
 {
-	LOCK();
-	request_index_block_nolock(block, size);
-}
-
-void Device::request_index_block_nolock(BufferBlock &block, VkDeviceSize size)
-{
-	request_block(*this, block, size, managers.ibo, &dma.ibo, frame().ibo_blocks);
-}
-
-void Device::request_uniform_block(BufferBlock &block, VkDeviceSize size)
-{
-	LOCK();
-	request_uniform_block_nolock(block, size);
-}
-
-void Device::request_uniform_block_nolock(BufferBlock &block, VkDeviceSize size)
-{
-	request_block(*this, block, size, managers.ubo, &dma.ubo, frame().ubo_blocks);
+	VK_ASSERT(thread_index < managers.thread_blocks.size());
+	auto &pools = *managers.thread_blocks[thread_index];
+	THREAD_BLOCK_LOCK(pools);
+	pools.requests++;
+	request_block(*this, block, size, pools.ubo, &pools.dma_ubo, frame().thread_blocks[thread_index].ubo);
 }
 
 void Device::request_staging_block(BufferBlock &block, VkDeviceSize size)
@@ -965,12 +1118,17 @@ void Device::submit_staging(CommandBufferHandle &cmd, VkBufferUsageFlags usage,
 {
 	auto access = buffer_usage_to_possible_access(usage);
 	auto stages = buffer_usage_to_possible_stages(usage);
+	submit_staging(cmd, stages, access, flush, nullptr);
+}
 
+void Device::submit_staging(CommandBufferHandle &cmd, VkPipelineStageFlags stages, VkAccessFlags access, bool flush,
+                            Fence *fence)
+{
 	if (transfer_queue == graphics_queue && transfer_queue == compute_queue)
 	{
 		// For single-queue systems, just use a pipeline barrier.
 		cmd->barrier(VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT, stages, access);
-		submit_nolock(cmd, nullptr, 0, nullptr);
+		submit_nolock(cmd, fence, 0, nullptr);
 	}
 	else
 	{
@@ -997,11 +1155,11 @@ void Device::submit_staging(CommandBufferHandle &cmd, VkBufferUsageFlags usage,
 			if (compute_stages != 0)
 			{
 				Semaphore sem;
-				submit_nolock(cmd, nullptr, 1, &sem);
+				submit_nolock(cmd, fence, 1, &sem);
 				add_wait_semaphore_nolock(CommandBuffer::Type::AsyncCompute, sem, compute_stages, flush);
 			}
 			else
-				submit_nolock(cmd, nullptr, 0, nullptr);
+				submit_nolock(cmd, fence, 0, nullptr);
 		}
 		else if (transfer_queue == compute_queue)
 		{
@@ -1011,35 +1169,35 @@ void Device::submit_staging(CommandBufferHandle &cmd, VkBufferUsageFlags usage,
 			if (graphics_stages != 0)
 			{
 				Semaphore sem;
-				submit_nolock(cmd, nullptr, 1, &sem);
+				submit_nolock(cmd, fence, 1, &sem);
 				add_wait_semaphore_nolock(CommandBuffer::Type::Generic, sem, graphics_stages, flush);
 			}
 			else
-				submit_nolock(cmd, nullptr, 0, nullptr);
+				submit_nolock(cmd, fence, 0, nullptr);
 		}
 		else
 		{
 			if (graphics_stages != 0 && compute_stages != 0)
 			{
 				Semaphore semaphores[2];
-				submit_nolock(cmd, nullptr, 2, semaphores);
+				submit_nolock(cmd, fence, 2, semaphores);
 				add_wait_semaphore_nolock(CommandBuffer::Type::Generic, semaphores[0], graphics_stages, flush);
 				add_wait_semaphore_nolock(CommandBuffer::Type::AsyncCompute, semaphores[1], compute_stages, flush);
 			}
 			else if (graphics_stages != 0)
 			{
 				Semaphore sem;
-				submit_nolock(cmd, nullptr, 1, &sem);
+				submit_nolock(cmd, fence, 1, &sem);
 				add_wait_semaphore_nolock(CommandBuffer::Type::Generic, sem, graphics_stages, flush);
 			}
 			else if (compute_stages != 0)
 			{
 				Semaphore sem;
-				submit_nolock(cmd, nullptr, 1, &sem);
+				submit_nolock(cmd, fence, 1, &sem);
 				add_wait_semaphore_nolock(CommandBuffer::Type::AsyncCompute, sem, compute_stages, flush);
 			}
 			else
-				submit_nolock(cmd, nullptr, 0, nullptr);
+				submit_nolock(cmd, fence, 0, nullptr);
 		}
 	}
 }
@@ -1257,12 +1415,36 @@ void Device::submit_queue(CommandBuffer::Type type, VkFence *fence,
 void Device::flush_frame(CommandBuffer::Type type)
 {
 	if (type == CommandBuffer::Type::AsyncTransfer)
+	{
 		sync_buffer_blocks();
+		upload_manager.flush_nolock(get_current_thread_index());
+	}
 	submit_queue(type, nullptr, 0, nullptr);
 }
 
+void Device::flush_uploads()
+{
+	LOCK();
+	upload_manager.flush_nolock(get_current_thread_index());
+}
+
+template <typename T>
+static void move_append(vector<T> &dst, vector<T> &src)
+{
+	dst.insert(end(dst), make_move_iterator(begin(src)), make_move_iterator(end(src)));
+	src.clear();
+}
+
 void Device::sync_buffer_blocks()
 {
+	for (auto &pools : managers.thread_blocks)
+	{
+		THREAD_BLOCK_LOCK(*pools);
+		move_append(dma.vbo, pools->dma_vbo);
+		move_append(dma.ibo, pools->dma_ibo);
+		move_append(dma.ubo, pools->dma_ubo);
+	}
+
 	if (dma.vbo.empty() && dma.ibo.empty() && dma.ubo.empty())
 		return;
 
@@ -1506,6 +1688,7 @@ Device::~Device()
 #ifdef GRANITE_VULKAN_MT
 	Granite::Global::thread_group()->wait_idle();
 #endif
+	upload_manager.teardown();
 	wait_idle();
 
 	wsi.acquire.reset();
@@ -1544,7 +1727,7 @@ void Device::init_frame_contexts(unsigned count)
 
 	for (unsigned i = 0; i < count; i++)
 	{
-		auto frame = unique_ptr<PerFrame>(new PerFrame(this));
+		auto frame = unique_ptr<PerFrame>(new PerFrame(this, destroy_queue));
 		per_frame.emplace_back(move(frame));
 	}
 }
@@ -1609,16 +1792,14 @@ void Device::init_swapchain(const vector<VkImage> &swapchain_images, unsigned wi
 	}
 }
 
-Device::PerFrame::PerFrame(Device *device)
+Device::PerFrame::PerFrame(Device *device, DeferredDestroyQueue &destroy_queue)
     : device(device->get_device())
     , managers(device->managers)
+    , destroy_queue(destroy_queue)
     , query_pool(device)
 {
-#ifdef GRANITE_VULKAN_MT
-	unsigned count = Granite::Global::thread_group()->get_num_threads() + 1;
-#else
-	unsigned count = 1;
-#endif
+	unsigned count = unsigned(device->managers.thread_blocks.size());
+	thread_blocks.resize(count);
 
 	for (unsigned i = 0; i < count; i++)
 	{
@@ -1651,8 +1832,10 @@ static inline bool exists(const T &container, const U &value)
 
 void Device::destroy_pipeline(VkPipeline pipeline)
 {
-	LOCK();
-	destroy_pipeline_nolock(pipeline);
+	DeferredDestroy destroy;
+	destroy.type = DeferredDestroy::Type::Pipeline;
+	destroy.pipeline = pipeline;
+	destroy_queue.push(get_current_thread_index(), destroy);
 }
 
 void Device::reset_fence(VkFence fence)
@@ -1663,38 +1846,50 @@ void Device::reset_fence(VkFence fence)
 
 void Device::destroy_buffer(VkBuffer buffer)
 {
-	LOCK();
-	destroy_buffer_nolock(buffer);
+	DeferredDestroy destroy;
+	destroy.type = DeferredDestroy::Type::Buffer;
+	destroy.buffer = buffer;
+	destroy_queue.push(get_current_thread_index(), destroy);
 }
 
 void Device::destroy_buffer_view(VkBufferView view)
 {
-	LOCK();
-	destroy_buffer_view_nolock(view);
+	DeferredDestroy destroy;
+	destroy.type = DeferredDestroy::Type::BufferView;
+	destroy.buffer_view = view;
+	destroy_queue.push(get_current_thread_index(), destroy);
 }
 
 void Device::destroy_event(VkEvent event)
 {
-	LOCK();
-	destroy_event_nolock(event);
+	DeferredDestroy destroy;
+	destroy.type = DeferredDestroy::Type::Event;
+	destroy.event = event;
+	destroy_queue.push(get_current_thread_index(), destroy);
 }
 
 void Device::destroy_framebuffer(VkFramebuffer framebuffer)
 {
-	LOCK();
-	destroy_framebuffer_nolock(framebuffer);
+	DeferredDestroy destroy;
+	destroy.type = DeferredDestroy::Type::Framebuffer;
+	destroy.framebuffer = framebuffer;
+	destroy_queue.push(get_current_thread_index(), destroy);
 }
 
 void Device::destroy_image(VkImage image)
 {
-	LOCK();
-	destroy_image_nolock(image);
+	DeferredDestroy destroy;
+	destroy.type = DeferredDestroy::Type::Image;
+	destroy.image = image;
+	destroy_queue.push(get_current_thread_index(), destroy);
 }
 
 void Device::destroy_semaphore(VkSemaphore semaphore)
 {
-	LOCK();
-	destroy_semaphore_nolock(semaphore);
+	DeferredDestroy destroy;
+	destroy.type = DeferredDestroy::Type::Semaphore;
+	destroy.semaphore = semaphore;
+	destroy_queue.push(get_current_thread_index(), destroy);
 }
 
 void Device::recycle_semaphore(VkSemaphore semaphore)
@@ -1705,20 +1900,32 @@ void Device::recycle_semaphore(VkSemaphore semaphore)
 
 void Device::free_memory(const DeviceAllocation &alloc)
 {
-	LOCK();
-	free_memory_nolock(alloc);
+	DeferredDestroy destroy;
+	destroy.type = DeferredDestroy::Type::Allocation;
+	destroy.allocation = alloc;
+	destroy_queue.push(get_current_thread_index(), destroy);
 }
 
 void Device::destroy_sampler(VkSampler sampler)
 {
-	LOCK();
-	destroy_sampler_nolock(sampler);
+	DeferredDestroy destroy;
+	destroy.type = DeferredDestroy::Type::Sampler;
+	destroy.sampler = sampler;
+	destroy_queue.push(get_current_thread_index(), destroy);
 }
 
 void Device::destroy_image_view(VkImageView view)
 {
-	LOCK();
-	destroy_image_view_nolock(view);
+	DeferredDestroy destroy;
+	destroy.type = DeferredDestroy::Type::ImageView;
+	destroy.image_view = view;
+	destroy_queue.push(get_current_thread_index(), destroy);
+}
+
+void Device::drain_deferred_destroys_nolock()
+{
+	if (!per_frame.empty())
+		frame().drain_deferred_destroys();
 }
 
 void Device::destroy_pipeline_nolock(VkPipeline pipeline)
@@ -1758,6 +1965,8 @@ void Device::destroy_event_nolock(VkEvent event)
 
 PipelineEvent Device::request_pipeline_event()
 {
+	// Can be called from CommandBuffer::signal_event() on any thread.
+	LOCK();
 	return PipelineEvent(handle_pool.events.allocate(this, managers.event.request_cleared_event()));
 }
 
@@ -1810,6 +2019,7 @@ void Device::wait_idle()
 
 void Device::wait_idle_nolock()
 {
+	drain_deferred_destroys_nolock();
 	if (!per_frame.empty())
 		end_frame_nolock();
 
@@ -1825,15 +2035,21 @@ void Device::wait_idle_nolock()
 	clear_wait_semaphores();
 
 	// Free memory for buffer pools.
-	managers.vbo.reset();
-	managers.ubo.reset();
-	managers.ibo.reset();
+	for (auto &pools : managers.thread_blocks)
+	{
+		pools->vbo.reset();
+		pools->ibo.reset();
+		pools->ubo.reset();
+	}
 	managers.staging.reset();
 	for (auto &frame : per_frame)
 	{
-		frame->vbo_blocks.clear();
-		frame->ibo_blocks.clear();
-		frame->ubo_blocks.clear();
+		for (auto &blocks : frame->thread_blocks)
+		{
+			blocks.vbo.clear();
+			blocks.ibo.clear();
+			blocks.ubo.clear();
+		}
 		frame->staging_blocks.clear();
 	}
 
@@ -1852,8 +2068,14 @@ void Device::wait_idle_nolock()
 
 void Device::next_frame_context()
 {
+	// Completion callbacks may call back into the device.
+	upload_manager.poll();
+
 	DRAIN_FRAME_LOCK();
 
+	// Objects destroyed during this frame might still be used by its submissions.
+	drain_deferred_destroys_nolock();
+
 	// Flush the frame here as we might have pending staging command buffers from init stage.
 	end_frame_nolock();
 
@@ -1861,6 +2083,7 @@ void Device::next_frame_context()
 	transient_allocator.begin_frame();
 	for (auto &allocator : descriptor_set_allocators)
 		allocator.begin_frame();
+	Util::FrameArena::begin_frame();
 
 	VK_ASSERT(!per_frame.empty());
 	frame_context_index++;
@@ -1868,6 +2091,13 @@ void Device::next_frame_context()
 		frame_context_index = 0;
 
 	frame().begin();
+
+	managers.memory.update_budget();
+	defragment_nolock();
+
+#ifdef GRANITE_VULKAN_FOSSILIZE
+	update_pipeline_replay();
+#endif
 }
 
 QueryPoolHandle Device::write_timestamp(VkCommandBuffer cmd, VkPipelineStageFlagBits stage)
@@ -1941,7 +2171,11 @@ void Device::PerFrame::begin()
 	for (auto &pipeline : destroyed_pipelines)
 		vkDestroyPipeline(device, pipeline, nullptr);
 	for (auto &view : destroyed_image_views)
+	{
+		if (managers.bindless)
+			managers.bindless->release_view(view);
 		vkDestroyImageView(device, view, nullptr);
+	}
 	for (auto &view : destroyed_buffer_views)
 		vkDestroyBufferView(device, view, nullptr);
 	for (auto &image : destroyed_images)
@@ -1962,17 +2196,28 @@ void Device::PerFrame::begin()
 	for (auto &alloc : allocations)
 		alloc.free_immediate(managers.memory);
 
-	for (auto &block : vbo_blocks)
-		managers.vbo.recycle_block(move(block));
-	for (auto &block : ibo_blocks)
-		managers.ibo.recycle_block(move(block));
-	for (auto &block : ubo_blocks)
-		managers.ubo.recycle_block(move(block));
+	// No command buffers are being recorded at this point, so the per-thread chains do not need locking.
+	// Oversized blocks are not recycled, and are destroyed here with the device lock held.
+	for (size_t i = 0; i < thread_blocks.size(); i++)
+	{
+		auto &pools = *managers.thread_blocks[i];
+		auto &blocks = thread_blocks[i];
+		for (auto &block : blocks.vbo)
+			if (block.size == pools.vbo.get_block_size())
+				pools.vbo.recycle_block(move(block));
+		for (auto &block : blocks.ibo)
+			if (block.size == pools.ibo.get_block_size())
+				pools.ibo.recycle_block(move(block));
+		for (auto &block : blocks.ubo)
+			if (block.size == pools.ubo.get_block_size())
+				pools.ubo.recycle_block(move(block));
+		blocks.vbo.clear();
+		blocks.ibo.clear();
+		blocks.ubo.clear();
+	}
+
 	for (auto &block : staging_blocks)
 		managers.staging.recycle_block(move(block));
-	vbo_blocks.clear();
-	ibo_blocks.clear();
-	ubo_blocks.clear();
 	staging_blocks.clear();
 
 	destroyed_framebuffers.clear();
@@ -1988,8 +2233,49 @@ void Device::PerFrame::begin()
 	allocations.clear();
 }
 
+void Device::PerFrame::drain_deferred_destroys()
+{
+	destroy_queue.drain([this](const DeferredDestroy &destroy) {
+		switch (destroy.type)
+		{
+		case DeferredDestroy::Type::Buffer:
+			destroyed_buffers.push_back(destroy.buffer);
+			break;
+		case DeferredDestroy::Type::Image:
+			destroyed_images.push_back(destroy.image);
+			break;
+		case DeferredDestroy::Type::ImageView:
+			destroyed_image_views.push_back(destroy.image_view);
+			break;
+		case DeferredDestroy::Type::BufferView:
+			destroyed_buffer_views.push_back(destroy.buffer_view);
+			break;
+		case DeferredDestroy::Type::Pipeline:
+			destroyed_pipelines.push_back(destroy.pipeline);
+			break;
+		case DeferredDestroy::Type::Sampler:
+			destroyed_samplers.push_back(destroy.sampler);
+			break;
+		case DeferredDestroy::Type::Framebuffer:
+			destroyed_framebuffers.push_back(destroy.framebuffer);
+			break;
+		case DeferredDestroy::Type::Semaphore:
+			destroyed_semaphores.push_back(destroy.semaphore);
+			break;
+		case DeferredDestroy::Type::Event:
+			recycled_events.push_back(destroy.event);
+			break;
+		case DeferredDestroy::Type::Allocation:
+			allocations.push_back(destroy.allocation);
+			break;
+		}
+	});
+}
+
 Device::PerFrame::~PerFrame()
 {
+	// Caches which are torn down after the device destructor runs may have queued up more objects.
+	drain_deferred_destroys();
 	begin();
 }
 
@@ -2151,6 +2437,9 @@ static inline VkImageViewType get_image_view_type(const ImageCreateInfo &create_
 
 BufferViewHandle Device::create_buffer_view(const BufferViewCreateInfo &view_info)
 {
+	// The view would dangle once the buffer is relocated.
+	VK_ASSERT((view_info.buffer->get_create_info().misc & BUFFER_MISC_RELOCATABLE_BIT) == 0);
+
 	VkBufferViewCreateInfo info = { VK_STRUCTURE_TYPE_BUFFER_VIEW_CREATE_INFO };
 	info.buffer = view_info.buffer->get_buffer();
 	info.format = view_info.format;
@@ -2356,6 +2645,9 @@ ImageViewHandle Device::create_image_view(const ImageViewCreateInfo &create_info
 	ImageResourceHolder holder(device);
 	auto &image_create_info = create_info.image->get_create_info();
 
+	// The view would dangle once the image is relocated.
+	VK_ASSERT((image_create_info.misc & IMAGE_MISC_RELOCATABLE_BIT) == 0);
+
 	VkFormat format = create_info.format != VK_FORMAT_UNDEFINED ? create_info.format : image_create_info.format;
 
 	VkImageViewCreateInfo view_info = { VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO };
@@ -2622,6 +2914,44 @@ ImageHandle Device::create_image(const ImageCreateInfo &create_info, const Image
 
 ImageHandle Device::create_image_from_staging_buffer(const ImageCreateInfo &create_info,
                                                      const InitialImageBuffer *staging_buffer)
+{
+	return create_image_internal(create_info, staging_buffer, nullptr, 0, nullptr);
+}
+
+bool Device::get_image_memory_requirements(const ImageCreateInfo &create_info, VkMemoryRequirements *reqs)
+{
+	*reqs = {};
+	create_image_internal(create_info, nullptr, nullptr, 0, reqs);
+	return reqs->size != 0;
+}
+
+bool Device::allocate_placement_memory(VkDeviceSize size, uint32_t memory_type_bits, DeviceAllocation *alloc)
+{
+	uint32_t memory_type = find_memory_type(ImageDomain::Physical, memory_type_bits);
+
+	// Placement memory is handed out in one piece, so never sub-allocate it.
+	if (!managers.memory.allocate_global(uint32_t(size), memory_type, alloc))
+	{
+		LOGE("Failed to allocate placement memory (type %u, size: %u).\n", unsigned(memory_type), unsigned(size));
+		return false;
+	}
+	return true;
+}
+
+void Device::free_placement_memory(const DeviceAllocation &alloc)
+{
+	free_memory(alloc);
+}
+
+ImageHandle Device::create_placed_image(const ImageCreateInfo &create_info, const DeviceAllocation &memory,
+                                        VkDeviceSize offset)
+{
+	return create_image_internal(create_info, nullptr, &memory, offset, nullptr);
+}
+
+ImageHandle Device::create_image_internal(const ImageCreateInfo &create_info, const InitialImageBuffer *staging_buffer,
+                                          const DeviceAllocation *placement, VkDeviceSize placement_offset,
+                                          VkMemoryRequirements *query_reqs)
 {
 	ImageResourceHolder holder(device);
 	VkMemoryRequirements reqs;
@@ -2651,7 +2981,7 @@ ImageHandle Device::create_image_from_staging_buffer(const ImageCreateInfo &crea
 	info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
 	if (create_info.domain == ImageDomain::Transient)
 		info.usage |= VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT;
-	if (staging_buffer)
+	if (staging_buffer || (create_info.misc & IMAGE_MISC_RELOCATABLE_BIT))
 		info.usage |= VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
 
 	info.flags = create_info.flags;
@@ -2766,7 +3096,16 @@ ImageHandle Device::create_image_from_staging_buffer(const ImageCreateInfo &crea
 	}
 
 	vkGetImageMemoryRequirements(device, holder.image, &reqs);
-	uint32_t memory_type = find_memory_type(create_info.domain, reqs.memoryTypeBits);
+
+	// Only the requirements were asked for, the holder destroys the image again.
+	if (query_reqs)
+	{
+		*query_reqs = reqs;
+		return ImageHandle(nullptr);
+	}
+
+	uint32_t memory_type = placement ? placement->get_memory_type() :
+	                       find_memory_type(create_info.domain, reqs.memoryTypeBits);
 
 	if (info.tiling == VK_IMAGE_TILING_LINEAR &&
 	    (create_info.misc & IMAGE_MISC_LINEAR_IMAGE_IGNORE_DEVICE_LOCAL_BIT) == 0)
@@ -2776,15 +3115,34 @@ ImageHandle Device::create_image_from_staging_buffer(const ImageCreateInfo &crea
 			return ImageHandle(nullptr);
 	}
 
-	if (!managers.memory.allocate_image_memory(reqs.size, reqs.alignment, memory_type,
-	                                           info.tiling == VK_IMAGE_TILING_OPTIMAL ? ALLOCATION_TILING_OPTIMAL : ALLOCATION_TILING_LINEAR,
-	                                           &holder.allocation, holder.image))
+	// Placed images are bound to memory owned by the caller, so the holder never frees it.
+	DeviceAllocation image_allocation;
+	if (placement)
 	{
-		LOGE("Failed to allocate image memory (type %u, size: %u).\n", unsigned(memory_type), unsigned(reqs.size));
-		return ImageHandle(nullptr);
+		if (staging_buffer ||
+		    (reqs.memoryTypeBits & (1u << memory_type)) == 0 ||
+		    (placement_offset & (reqs.alignment - 1)) != 0 ||
+		    placement_offset + reqs.size > placement->get_size())
+		{
+			LOGE("Image does not fit in placement memory.\n");
+			return ImageHandle(nullptr);
+		}
+
+		image_allocation = DeviceAllocation::make_placed_allocation(*placement, uint32_t(placement_offset), uint32_t(reqs.size));
+	}
+	else
+	{
+		if (!managers.memory.allocate_image_memory(reqs.size, reqs.alignment, memory_type,
+		                                           info.tiling == VK_IMAGE_TILING_OPTIMAL ? ALLOCATION_TILING_OPTIMAL : ALLOCATION_TILING_LINEAR,
+		                                           &holder.allocation, holder.image))
+		{
+			LOGE("Failed to allocate image memory (type %u, size: %u).\n", unsigned(memory_type), unsigned(reqs.size));
+			return ImageHandle(nullptr);
+		}
+		image_allocation = holder.allocation;
 	}
 
-	if (vkBindImageMemory(device, holder.image, holder.allocation.get_memory(), holder.allocation.get_offset()) != VK_SUCCESS)
+	if (vkBindImageMemory(device, holder.image, image_allocation.get_memory(), image_allocation.get_offset()) != VK_SUCCESS)
 	{
 		LOGE("Failed to bind image memory.\n");
 		return ImageHandle(nullptr);
@@ -2802,10 +3160,11 @@ ImageHandle Device::create_image_from_staging_buffer(const ImageCreateInfo &crea
 			return ImageHandle(nullptr);
 	}
 
-	ImageHandle handle(handle_pool.images.allocate(this, holder.image, holder.image_view, holder.allocation, tmpinfo));
+	ImageHandle handle(handle_pool.images.allocate(this, holder.image, holder.image_view, image_allocation, tmpinfo));
 	if (handle)
 	{
 		holder.owned = false;
+		handle->owns_alloc = placement == nullptr;
 		if (has_view)
 		{
 			handle->get_view().set_alt_views(holder.depth_view, holder.stencil_view);
@@ -2817,6 +3176,9 @@ ImageHandle Device::create_image_from_staging_buffer(const ImageCreateInfo &crea
 		// Set possible dstStage and dstAccess.
 		handle->set_stage_flags(image_usage_to_possible_stages(info.usage));
 		handle->set_access_flags(image_usage_to_possible_access(info.usage));
+
+		if (create_info.misc & IMAGE_MISC_RELOCATABLE_BIT)
+			register_relocatable(handle.get(), reqs);
 	}
 
 	// Copy initial data to texture.
@@ -3045,29 +3407,9 @@ BufferHandle Device::create_buffer(const BufferCreateInfo &create_info, const vo
 	VkBufferCreateInfo info = { VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO };
 	info.size = create_info.size;
 	info.usage = create_info.usage | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
-	info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
 
 	uint32_t sharing_indices[3];
-	if (graphics_queue_family_index != compute_queue_family_index ||
-	    graphics_queue_family_index != transfer_queue_family_index)
-	{
-		// For buffers, always just use CONCURRENT access modes,
-		// so we don't have to deal with acquire/release barriers in async compute.
-		info.sharingMode = VK_SHARING_MODE_CONCURRENT;
-
-		sharing_indices[info.queueFamilyIndexCount++] = graphics_queue_family_index;
-
-		if (graphics_queue_family_index != compute_queue_family_index)
-			sharing_indices[info.queueFamilyIndexCount++] = compute_queue_family_index;
-
-		if (graphics_queue_family_index != transfer_queue_family_index &&
-		    compute_queue_family_index != transfer_queue_family_index)
-		{
-			sharing_indices[info.queueFamilyIndexCount++] = transfer_queue_family_index;
-		}
-
-		info.pQueueFamilyIndices = sharing_indices;
-	}
+	fill_buffer_sharing_indices(info, sharing_indices);
 
 	if (vkCreateBuffer(device, &info, nullptr, &buffer) != VK_SUCCESS)
 		return BufferHandle(nullptr);
@@ -3091,7 +3433,14 @@ BufferHandle Device::create_buffer(const BufferCreateInfo &create_info, const vo
 
 	auto tmpinfo = create_info;
 	tmpinfo.usage |= VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+
+	// Host buffers might be persistently mapped by the application, so only device buffers can move.
+	if (create_info.domain != BufferDomain::Device)
+		tmpinfo.misc &= ~BUFFER_MISC_RELOCATABLE_BIT;
+
 	BufferHandle handle(handle_pool.buffers.allocate(this, buffer, allocation, tmpinfo));
+	if (tmpinfo.misc & BUFFER_MISC_RELOCATABLE_BIT)
+		register_relocatable(handle.get(), reqs);
 
 	if (create_info.domain == BufferDomain::Device && (initial || zero_initialize) && !memory_type_is_host_visible(memory_type))
 	{
@@ -3134,6 +3483,34 @@ BufferHandle Device::create_buffer(const BufferCreateInfo &create_info, const vo
 	return handle;
 }
 
+void Device::fill_buffer_sharing_indices(VkBufferCreateInfo &info, uint32_t *sharing_indices)
+{
+	info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+	info.queueFamilyIndexCount = 0;
+	info.pQueueFamilyIndices = nullptr;
+
+	if (graphics_queue_family_index != compute_queue_family_index ||
+	    graphics_queue_family_index != transfer_queue_family_index)
+	{
+		// For buffers, always just use CONCURRENT access modes,
+		// so we don't have to deal with acquire/release barriers in async compute.
+		info.sharingMode = VK_SHARING_MODE_CONCURRENT;
+
+		sharing_indices[info.queueFamilyIndexCount++] = graphics_queue_family_index;
+
+		if (graphics_queue_family_index != compute_queue_family_index)
+			sharing_indices[info.queueFamilyIndexCount++] = compute_queue_family_index;
+
+		if (graphics_queue_family_index != transfer_queue_family_index &&
+		    compute_queue_family_index != transfer_queue_family_index)
+		{
+			sharing_indices[info.queueFamilyIndexCount++] = transfer_queue_family_index;
+		}
+
+		info.pQueueFamilyIndices = sharing_indices;
+	}
+}
+
 bool Device::memory_type_is_device_optimal(uint32_t type) const
 {
 	return (mem_props.memoryTypes[type].propertyFlags & VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT) != 0;
@@ -3415,6 +3792,386 @@ void Device::set_name(const CommandBuffer &cmd, const char *name)
 	}
 }
 
+DeviceAllocatorStats Device::get_memory_stats()
+{
+	return managers.memory.get_stats();
+}
+
+void Device::set_defragmentation_budget(VkDeviceSize max_bytes_per_frame)
+{
+	LOCK();
+	defrag.max_bytes_per_frame = max_bytes_per_frame;
+}
+
+DefragmentationStats Device::get_defragmentation_stats()
+{
+#ifdef GRANITE_VULKAN_MT
+	lock_guard<mutex> holder{defrag.lock};
+#endif
+	auto stats = defrag.stats;
+	stats.num_relocatable_buffers = unsigned(defrag.buffers.size());
+	stats.num_relocatable_images = unsigned(defrag.images.size());
+	return stats;
+}
+
+void Device::register_relocatable(Buffer *buffer, const VkMemoryRequirements &reqs)
+{
+#ifdef GRANITE_VULKAN_MT
+	lock_guard<mutex> holder{defrag.lock};
+#endif
+	defrag.buffers[buffer] = reqs;
+}
+
+void Device::register_relocatable(Image *image, const VkMemoryRequirements &reqs)
+{
+#ifdef GRANITE_VULKAN_MT
+	lock_guard<mutex> holder{defrag.lock};
+#endif
+	defrag.images[image] = reqs;
+}
+
+void Device::unregister_relocatable(Buffer *buffer)
+{
+	// If the buffer is being relocated, this waits until the new handles are in place.
+#ifdef GRANITE_VULKAN_MT
+	lock_guard<mutex> holder{defrag.lock};
+#endif
+	defrag.buffers.erase(buffer);
+}
+
+void Device::unregister_relocatable(Image *image)
+{
+#ifdef GRANITE_VULKAN_MT
+	lock_guard<mutex> holder{defrag.lock};
+#endif
+	defrag.images.erase(image);
+}
+
+bool Device::image_is_relocatable(const Image &image)
+{
+	auto &info = image.get_create_info();
+
+	// Anything which can be written to after creation would need its layout tracked.
+	constexpr VkImageUsageFlags written_usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT |
+	                                            VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT |
+	                                            VK_IMAGE_USAGE_INPUT_ATTACHMENT_BIT |
+	                                            VK_IMAGE_USAGE_STORAGE_BIT |
+	                                            VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT;
+
+	constexpr ImageMiscFlags concurrent_queues = IMAGE_MISC_CONCURRENT_QUEUE_GRAPHICS_BIT |
+	                                             IMAGE_MISC_CONCURRENT_QUEUE_ASYNC_COMPUTE_BIT |
+	                                             IMAGE_MISC_CONCURRENT_QUEUE_ASYNC_GRAPHICS_BIT |
+	                                             IMAGE_MISC_CONCURRENT_QUEUE_ASYNC_TRANSFER_BIT;
+
+	if (info.domain != ImageDomain::Physical || (info.usage & written_usage) != 0 || (info.misc & concurrent_queues) != 0)
+		return false;
+	if ((info.usage & VK_IMAGE_USAGE_SAMPLED_BIT) == 0 || image.get_layout_type() != Layout::Optimal)
+		return false;
+	if (info.initial_layout == VK_IMAGE_LAYOUT_UNDEFINED)
+		return false;
+
+	// Descriptors in the bindless table cannot be rewritten while frames in flight might use them.
+	if (managers.bindless && managers.bindless->is_registered(image.get_view().get_view()))
+		return false;
+
+	return true;
+}
+
+bool Device::relocation_improves_packing(const DeviceAllocation &old_alloc, const DeviceAllocation &new_alloc)
+{
+	if (new_alloc.shares_mini_heap(old_alloc))
+		return false;
+
+	// Moving into a mini-heap which is no fuller than the one we left just shuffles memory around.
+	return managers.memory.get_heap_occupancy(new_alloc) > managers.memory.get_heap_occupancy(old_alloc);
+}
+
+bool Device::relocation_can_improve_packing(const DeviceAllocation &alloc, const VkMemoryRequirements &reqs,
+                                            AllocationTiling tiling)
+{
+	return managers.memory.relocation_improves_packing(uint32_t(reqs.size), uint32_t(reqs.alignment),
+	                                                   alloc.get_memory_type(), tiling, alloc);
+}
+
+bool Device::relocate_buffer_nolock(CommandBuffer &cmd, Buffer &buffer)
+{
+	VkBufferCreateInfo info = { VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO };
+	info.size = buffer.info.size;
+	info.usage = buffer.info.usage;
+
+	uint32_t sharing_indices[3];
+	fill_buffer_sharing_indices(info, sharing_indices);
+
+	VkBuffer new_buffer;
+	if (vkCreateBuffer(device, &info, nullptr, &new_buffer) != VK_SUCCESS)
+		return false;
+
+	VkMemoryRequirements reqs;
+	vkGetBufferMemoryRequirements(device, new_buffer, &reqs);
+
+	DeviceAllocation allocation;
+	uint32_t memory_type = buffer.alloc.get_memory_type();
+	if ((reqs.memoryTypeBits & (1u << memory_type)) == 0 ||
+	    !managers.memory.allocate(reqs.size, reqs.alignment, memory_type, ALLOCATION_TILING_LINEAR, &allocation))
+	{
+		vkDestroyBuffer(device, new_buffer, nullptr);
+		return false;
+	}
+
+	if (!relocation_improves_packing(buffer.alloc, allocation) ||
+	    vkBindBufferMemory(device, new_buffer, allocation.get_memory(), allocation.get_offset()) != VK_SUCCESS)
+	{
+		allocation.free_immediate(managers.memory);
+		vkDestroyBuffer(device, new_buffer, nullptr);
+		return false;
+	}
+
+	VkBufferCopy region = { 0, 0, buffer.info.size };
+	vkCmdCopyBuffer(cmd.get_command_buffer(), buffer.buffer, new_buffer, 1, &region);
+
+	// The old buffer is destroyed when this frame context comes around again, like any other deleted buffer.
+	destroy_buffer_nolock(buffer.buffer);
+	free_memory_nolock(buffer.alloc);
+	buffer.buffer = new_buffer;
+	buffer.alloc = allocation;
+	buffer.cookie = allocate_cookie();
+
+	defrag.stats.relocated_buffers++;
+	defrag.stats.relocated_bytes += buffer.info.size;
+	return true;
+}
+
+bool Device::relocate_image_nolock(CommandBuffer &cmd, Image &image)
+{
+	auto &create_info = image.create_info;
+	ImageResourceHolder holder(device);
+	holder.allocator = &managers.memory;
+
+	VkImageCreateInfo info = { VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO };
+	info.format = create_info.format;
+	info.extent.width = create_info.width;
+	info.extent.height = create_info.height;
+	info.extent.depth = create_info.depth;
+	info.imageType = create_info.type;
+	info.mipLevels = create_info.levels;
+	info.arrayLayers = create_info.layers;
+	info.samples = create_info.samples;
+	info.tiling = VK_IMAGE_TILING_OPTIMAL;
+	info.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	info.usage = create_info.usage;
+	info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+	info.flags = create_info.flags;
+
+	VkImageFormatListCreateInfoKHR format_info = { VK_STRUCTURE_TYPE_IMAGE_FORMAT_LIST_CREATE_INFO_KHR };
+	VkFormat view_formats[2];
+	format_info.pViewFormats = view_formats;
+	format_info.viewFormatCount = 2;
+	bool create_unorm_srgb_views = false;
+
+	if (create_info.misc & IMAGE_MISC_MUTABLE_SRGB_BIT)
+	{
+		info.flags |= VK_IMAGE_CREATE_MUTABLE_FORMAT_BIT;
+		if (fill_image_format_list(view_formats, info.format))
+		{
+			create_unorm_srgb_views = true;
+			if (ext.supports_image_format_list)
+				info.pNext = &format_info;
+		}
+	}
+
+	if (vkCreateImage(device, &info, nullptr, &holder.image) != VK_SUCCESS)
+		return false;
+
+	VkMemoryRequirements reqs;
+	vkGetImageMemoryRequirements(device, holder.image, &reqs);
+
+	uint32_t memory_type = image.alloc.get_memory_type();
+	if ((reqs.memoryTypeBits & (1u << memory_type)) == 0 ||
+	    !managers.memory.allocate(reqs.size, reqs.alignment, memory_type, ALLOCATION_TILING_OPTIMAL, &holder.allocation))
+	{
+		return false;
+	}
+
+	if (!relocation_improves_packing(image.alloc, holder.allocation))
+		return false;
+
+	if (vkBindImageMemory(device, holder.image, holder.allocation.get_memory(), holder.allocation.get_offset()) != VK_SUCCESS)
+		return false;
+
+	if (!holder.create_default_views(create_info, nullptr, create_unorm_srgb_views, view_formats))
+		return false;
+
+	// Read-only images stay in their initial layout after the upload.
+	VkImageLayout layout = create_info.initial_layout;
+	VkImageSubresourceRange range = {};
+	range.aspectMask = format_to_aspect_mask(info.format);
+	range.levelCount = info.mipLevels;
+	range.layerCount = info.arrayLayers;
+
+	VkImageMemoryBarrier barriers[2];
+	barriers[0] = { VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER };
+	barriers[0].image = image.image;
+	barriers[0].oldLayout = layout;
+	barriers[0].newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+	barriers[0].dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+	barriers[0].srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barriers[0].dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barriers[0].subresourceRange = range;
+
+	barriers[1] = barriers[0];
+	barriers[1].image = holder.image;
+	barriers[1].oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	barriers[1].newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+	barriers[1].dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+
+	cmd.barrier(image.get_stage_flags(), VK_PIPELINE_STAGE_TRANSFER_BIT, 0, nullptr, 0, nullptr, 2, barriers);
+
+	VkImageCopy regions[32];
+	for (uint32_t level = 0; level < info.mipLevels; level++)
+	{
+		auto &region = regions[level];
+		region = {};
+		region.srcSubresource.aspectMask = range.aspectMask;
+		region.srcSubresource.mipLevel = level;
+		region.srcSubresource.layerCount = info.arrayLayers;
+		region.dstSubresource = region.srcSubresource;
+		region.extent.width = image.get_width(level);
+		region.extent.height = image.get_height(level);
+		region.extent.depth = image.get_depth(level);
+	}
+
+	vkCmdCopyImage(cmd.get_command_buffer(),
+	               image.image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+	               holder.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+	               info.mipLevels, regions);
+
+	barriers[1].oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+	barriers[1].newLayout = layout;
+	barriers[1].srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	barriers[1].dstAccessMask = image.get_access_flags() & image_layout_to_possible_access(layout);
+	cmd.barrier(VK_PIPELINE_STAGE_TRANSFER_BIT, image.get_stage_flags(), 0, nullptr, 0, nullptr, 1, &barriers[1]);
+
+	// Swap in the new handles. The old ones are destroyed when this frame context comes around again.
+	auto &view = *image.view;
+	destroy_image_view_nolock(view.view);
+	if (view.depth_view != VK_NULL_HANDLE)
+		destroy_image_view_nolock(view.depth_view);
+	if (view.stencil_view != VK_NULL_HANDLE)
+		destroy_image_view_nolock(view.stencil_view);
+	if (view.unorm_view != VK_NULL_HANDLE)
+		destroy_image_view_nolock(view.unorm_view);
+	if (view.srgb_view != VK_NULL_HANDLE)
+		destroy_image_view_nolock(view.srgb_view);
+	for (auto &rt_view : view.render_target_views)
+		destroy_image_view_nolock(rt_view);
+	destroy_image_nolock(image.image);
+	free_memory_nolock(image.alloc);
+
+	view.view = holder.image_view;
+	view.depth_view = holder.depth_view;
+	view.stencil_view = holder.stencil_view;
+	view.unorm_view = holder.unorm_view;
+	view.srgb_view = holder.srgb_view;
+	view.render_target_views = move(holder.rt_views);
+	view.cookie = allocate_cookie();
+
+	image.image = holder.image;
+	image.alloc = holder.allocation;
+	image.cookie = allocate_cookie();
+	holder.owned = false;
+
+	defrag.stats.relocated_images++;
+	defrag.stats.relocated_bytes += reqs.size;
+	return true;
+}
+
+void Device::defragment_nolock()
+{
+	if (!defrag.max_bytes_per_frame)
+		return;
+
+#ifdef GRANITE_VULKAN_MT
+	// Held throughout, so relocatable objects cannot be destroyed while they are being moved.
+	lock_guard<mutex> holder{defrag.lock};
+#endif
+
+	struct Candidate
+	{
+		Buffer *buffer;
+		Image *image;
+		uint32_t occupancy;
+		VkDeviceSize size;
+	};
+	vector<Candidate> candidates;
+
+	// Only bother with mini-heaps which are at most a quarter full.
+	// Moving their allocations elsewhere lets the mini-heap be returned to its parent.
+	constexpr uint32_t max_occupancy = Block::NumSubBlocks / 4;
+
+	// Objects are only picked if the allocator currently has a fuller mini-heap to move them to.
+	// Otherwise every frame would create, allocate, copy and throw away the same replacements again,
+	// e.g. when the only other mini-heaps are full or freshly allocated.
+	for (auto &buffer : defrag.buffers)
+	{
+		auto &alloc = buffer.first->alloc;
+		uint32_t occupancy = managers.memory.get_heap_occupancy(alloc);
+		if (occupancy <= max_occupancy && relocation_can_improve_packing(alloc, buffer.second, ALLOCATION_TILING_LINEAR))
+			candidates.push_back({ buffer.first, nullptr, occupancy, buffer.first->info.size });
+	}
+
+	for (auto &image : defrag.images)
+	{
+		auto &alloc = image.first->alloc;
+		uint32_t occupancy = managers.memory.get_heap_occupancy(alloc);
+		if (occupancy <= max_occupancy && image_is_relocatable(*image.first) &&
+		    relocation_can_improve_packing(alloc, image.second, ALLOCATION_TILING_OPTIMAL))
+		{
+			candidates.push_back({ nullptr, image.first, occupancy, alloc.get_size() });
+		}
+	}
+
+	if (candidates.empty())
+		return;
+
+	// Empty the sparsest mini-heaps first.
+	sort(begin(candidates), end(candidates), [](const Candidate &a, const Candidate &b) {
+		return a.occupancy < b.occupancy;
+	});
+
+	auto cmd = request_command_buffer_nolock(get_current_thread_index(), CommandBuffer::Type::Generic);
+	cmd->begin_region("defragment");
+
+	// Earlier frames might still write to buffers, e.g. through storage buffers.
+	cmd->barrier(VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_ACCESS_MEMORY_WRITE_BIT,
+	             VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_READ_BIT);
+
+	VkDeviceSize relocated = 0;
+	for (auto &candidate : candidates)
+	{
+		if (relocated >= defrag.max_bytes_per_frame)
+			break;
+
+		bool success = candidate.buffer ?
+		               relocate_buffer_nolock(*cmd, *candidate.buffer) :
+		               relocate_image_nolock(*cmd, *candidate.image);
+
+		if (success)
+			relocated += candidate.size;
+		else
+			defrag.stats.failed_relocations++;
+	}
+
+	cmd->barrier(VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT,
+	             VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_ACCESS_MEMORY_READ_BIT | VK_ACCESS_MEMORY_WRITE_BIT);
+	cmd->end_region();
+	submit_nolock(cmd, nullptr, 0, nullptr);
+}
+
+UploadManager &Device::get_upload_manager()
+{
+	return upload_manager;
+}
+
 #ifdef GRANITE_VULKAN_FILESYSTEM
 TextureManager &Device::get_texture_manager()
 {
@@ -38,10 +38,14 @@
 #include "vulkan.hpp"
 #include "query_pool.hpp"
 #include "buffer_pool.hpp"
+#include "deferred_destroy.hpp"
+#include "bindless.hpp"
+#include "upload_manager.hpp"
 #include <memory>
 #include <vector>
 #include <functional>
 #include <unordered_map>
+#include <unordered_set>
 
 #ifdef GRANITE_VULKAN_FILESYSTEM
 #include "shader_manager.hpp"
@@ -57,6 +61,7 @@
 
 #ifdef GRANITE_VULKAN_FOSSILIZE
 #include "fossilize.hpp"
+#include <atomic>
 #endif
 
 #include "quirks.hpp"
@@ -76,6 +81,57 @@ struct InitialImageBuffer
 	std::vector<VkBufferImageCopy> blits;
 };
 
+#ifdef GRANITE_VULKAN_FOSSILIZE
+enum class PipelineReplayMode
+{
+	// Replay on the calling thread while the device is initialized.
+	Serial,
+	// Replay on worker threads, but device initialization waits for it to complete.
+	Parallel,
+	// Replay on worker threads starting with the first frame. Nothing waits for it to complete.
+	Background
+};
+
+struct PipelineReplayProgress
+{
+	unsigned shader_modules = 0;
+	unsigned completed_shader_modules = 0;
+	unsigned programs = 0;
+	unsigned completed_programs = 0;
+	unsigned pipelines = 0;
+	unsigned completed_pipelines = 0;
+	bool done = true;
+};
+#endif
+
+struct DeviceLockStats
+{
+	// The device lock guards submission, frame transitions and object creation.
+	uint64_t lock_acquisitions = 0;
+	// Acquisitions which found the lock held by another thread, and total time spent waiting.
+	uint64_t lock_contentions = 0;
+	uint64_t lock_wait_nsecs = 0;
+	// Vertex, index and uniform block requests served by per-thread chains,
+	// and how many of them had to wait for a submission to collect blocks for DMA.
+	uint64_t thread_block_requests = 0;
+	uint64_t thread_block_contentions = 0;
+	// Objects destroyed through the lock-free deferred destroy queues.
+	uint64_t deferred_destroys = 0;
+};
+
+struct DefragmentationStats
+{
+	// Cumulative counts of objects moved into denser mini-heaps.
+	uint64_t relocated_buffers = 0;
+	uint64_t relocated_images = 0;
+	uint64_t relocated_bytes = 0;
+	// Picked candidates which could not be moved after all, e.g. because allocations changed since they were picked.
+	uint64_t failed_relocations = 0;
+	// Relocatable objects currently known to the device.
+	uint32_t num_relocatable_buffers = 0;
+	uint32_t num_relocatable_images = 0;
+};
+
 struct HandlePool
 {
 	VulkanObjectPool<Buffer> buffers;
@@ -129,6 +185,8 @@ public:
 	friend class RenderPass;
 	friend class Texture;
 	friend class DescriptorSetAllocator;
+	friend class BindlessTextureTable;
+	friend class UploadManager;
 	friend class Shader;
 
 	Device();
@@ -187,6 +245,13 @@ public:
 	Program *request_program(Shader *vertex, Shader *fragment);
 	Program *request_program(Shader *compute);
 
+	// Pipeline compilation. The mode is the default for new command buffers.
+	// Pipelines can be prewarmed on worker threads with CommandBuffer::set_pipeline_prewarm().
+	void set_pipeline_compile_mode(PipelineCompileMode mode);
+	PipelineCompileMode get_pipeline_compile_mode() const;
+	void wait_pipeline_compiles();
+	unsigned get_num_pending_pipeline_compiles();
+
 	// Map and unmap buffer objects.
 	void *map_host_buffer(const Buffer &buffer, MemoryAccessFlags access);
 	void unmap_host_buffer(const Buffer &buffer, MemoryAccessFlags access);
@@ -200,6 +265,13 @@ public:
 	ImageHandle create_image_from_staging_buffer(const ImageCreateInfo &info, const InitialImageBuffer *buffer);
 	LinearHostImageHandle create_linear_host_image(const LinearHostImageCreateInfo &info);
 
+	// Images placed at an offset into memory owned by the caller, so images with disjoint lifetimes can share memory.
+	// Placed images never free their memory. Keep it alive until every image placed in it has been released.
+	bool get_image_memory_requirements(const ImageCreateInfo &info, VkMemoryRequirements *reqs);
+	bool allocate_placement_memory(VkDeviceSize size, uint32_t memory_type_bits, DeviceAllocation *alloc);
+	void free_placement_memory(const DeviceAllocation &alloc);
+	ImageHandle create_placed_image(const ImageCreateInfo &info, const DeviceAllocation &memory, VkDeviceSize offset);
+
 	// Create staging buffers for images.
 	InitialImageBuffer create_image_staging_buffer(const ImageCreateInfo &info, const ImageInitialData *initial);
 	InitialImageBuffer create_image_staging_buffer(const TextureFormatLayout &layout);
@@ -253,6 +325,9 @@ public:
 
 	const Sampler &get_stock_sampler(StockSampler sampler) const;
 
+	// Batched uploads on the transfer queue, for loading many resources without a submission per resource.
+	UploadManager &get_upload_manager();
+
 #ifdef GRANITE_VULKAN_FILESYSTEM
 	ShaderManager &get_shader_manager();
 	TextureManager &get_texture_manager();
@@ -277,6 +352,35 @@ public:
 
 	bool swapchain_touched() const;
 
+	// Shared texture array for shaders which use descriptor indexing, or nullptr if the device does not support it.
+	BindlessTextureTable *get_bindless_texture_table();
+
+	// Counters are cumulative since device creation. Lock counters are only collected with GRANITE_VULKAN_MT.
+	DeviceLockStats get_lock_stats();
+
+	// Allocator statistics per memory type and class, and budget per memory heap.
+	// Budgets come from VK_EXT_memory_budget when supported and are refreshed every frame.
+	DeviceAllocatorStats get_memory_stats();
+
+	// Incremental defragmentation of buffers and images created with the RELOCATABLE misc bits.
+	// Every frame, up to max_bytes_per_frame are copied out of sparsely used mini-heaps on the graphics queue,
+	// so the mini-heaps can be released. 0 disables defragmentation, which is the default.
+	void set_defragmentation_budget(VkDeviceSize max_bytes_per_frame);
+	DefragmentationStats get_defragmentation_stats();
+
+	// Cache statistics for every descriptor set layout, as of the last frame.
+	// Must not be called concurrently with creation of new programs.
+	std::vector<DescriptorSetAllocatorStats> get_descriptor_set_allocator_stats();
+
+#ifdef GRANITE_VULKAN_FOSSILIZE
+	// Replays the pipeline database found in assets:// or cache:// when the context is set.
+	// The mode must be set before set_context().
+	void set_pipeline_replay_mode(PipelineReplayMode mode);
+	bool replay_pipeline_state(const void *data, size_t size);
+	PipelineReplayProgress get_pipeline_replay_progress() const;
+	void wait_pipeline_replay();
+#endif
+
 private:
 	VkInstance instance = VK_NULL_HANDLE;
 	VkPhysicalDevice gpu = VK_NULL_HANDLE;
@@ -294,9 +398,10 @@ private:
 	uint64_t allocate_cookie();
 	void bake_program(Program &program);
 
-	void request_vertex_block(BufferBlock &block, VkDeviceSize size);
-	void request_index_block(BufferBlock &block, VkDeviceSize size);
-	void request_uniform_block(BufferBlock &block, VkDeviceSize size);
+	// Only takes the lock for thread_index, which is normally uncontended.
+	void request_vertex_block_for_thread(unsigned thread_index, BufferBlock &block, VkDeviceSize size);
+	void request_index_block_for_thread(unsigned thread_index, BufferBlock &block, VkDeviceSize size);
+	void request_uniform_block_for_thread(unsigned thread_index, BufferBlock &block, VkDeviceSize size);
 	void request_staging_block(BufferBlock &block, VkDeviceSize size);
 
 	QueryPoolHandle write_timestamp(VkCommandBuffer cmd, VkPipelineStageFlagBits stage);
@@ -318,13 +423,41 @@ private:
 	// Make sure this is deleted last.
 	HandlePool handle_pool;
 
+	// Linear allocator chains for one recording thread, so command buffers recorded on different threads
+	// do not serialize on the device lock when they run out of vertex, index or uniform space.
+	struct ThreadBlockPools
+	{
+		BufferPool vbo, ibo, ubo;
+		// Retired blocks which must be copied from CPU to GPU before submitting graphics or compute work.
+		std::vector<BufferBlock> dma_vbo, dma_ibo, dma_ubo;
+		uint64_t requests = 0;
+		uint64_t contentions = 0;
+
+#ifdef GRANITE_VULKAN_MT
+		// Only contended when a submission collects DMA blocks.
+		std::mutex lock;
+		std::unique_lock<std::mutex> acquire()
+		{
+			std::unique_lock<std::mutex> holder{lock, std::try_to_lock};
+			if (!holder)
+			{
+				holder.lock();
+				contentions++;
+			}
+			return holder;
+		}
+#endif
+	};
+
 	struct Managers
 	{
 		DeviceAllocator memory;
 		FenceManager fence;
 		SemaphoreManager semaphore;
 		EventManager event;
-		BufferPool vbo, ibo, ubo, staging;
+		BufferPool staging;
+		std::vector<std::unique_ptr<ThreadBlockPools>> thread_blocks;
+		std::unique_ptr<BindlessTextureTable> bindless;
 	};
 	Managers managers;
 
@@ -335,29 +468,71 @@ private:
 		std::condition_variable cond;
 #endif
 		unsigned counter = 0;
+		uint64_t acquisitions = 0;
+		uint64_t contentions = 0;
+		uint64_t wait_nsecs = 0;
 	} lock;
 	void add_frame_counter();
 	void decrement_frame_counter();
+#ifdef GRANITE_VULKAN_MT
+	std::unique_lock<std::mutex> lock_device();
+#endif
+
+	struct
+	{
+#ifdef GRANITE_VULKAN_MT
+		std::mutex lock;
+#endif
+		// Memory requirements are identical for objects created with the same create info,
+		// so the ones seen at creation tell whether a relocation can help before anything is created.
+		std::unordered_map<Buffer *, VkMemoryRequirements> buffers;
+		std::unordered_map<Image *, VkMemoryRequirements> images;
+		VkDeviceSize max_bytes_per_frame = 0;
+		DefragmentationStats stats;
+	} defrag;
+	void register_relocatable(Buffer *buffer, const VkMemoryRequirements &reqs);
+	void register_relocatable(Image *image, const VkMemoryRequirements &reqs);
+	void unregister_relocatable(Buffer *buffer);
+	void unregister_relocatable(Image *image);
+	void defragment_nolock();
+	bool image_is_relocatable(const Image &image);
+	bool relocation_improves_packing(const DeviceAllocation &old_alloc, const DeviceAllocation &new_alloc);
+	bool relocation_can_improve_packing(const DeviceAllocation &alloc, const VkMemoryRequirements &reqs,
+	                                    AllocationTiling tiling);
+	bool relocate_buffer_nolock(CommandBuffer &cmd, Buffer &buffer);
+	bool relocate_image_nolock(CommandBuffer &cmd, Image &image);
+	void fill_buffer_sharing_indices(VkBufferCreateInfo &info, uint32_t *sharing_indices);
+
+	// Must outlive the per frame structures, which drain it on destruction.
+	DeferredDestroyQueue destroy_queue;
+	void drain_deferred_destroys_nolock();
 
 	struct PerFrame
 	{
-		PerFrame(Device *device);
+		PerFrame(Device *device, DeferredDestroyQueue &destroy_queue);
 		~PerFrame();
 		void operator=(const PerFrame &) = delete;
 		PerFrame(const PerFrame &) = delete;
 
 		void begin();
+		void drain_deferred_destroys();
 
 		VkDevice device;
 		Managers &managers;
+		DeferredDestroyQueue &destroy_queue;
 		std::vector<CommandPool> graphics_cmd_pool;
 		std::vector<CommandPool> compute_cmd_pool;
 		std::vector<CommandPool> transfer_cmd_pool;
 		QueryPool query_pool;
 
-		std::vector<BufferBlock> vbo_blocks;
-		std::vector<BufferBlock> ibo_blocks;
-		std::vector<BufferBlock> ubo_blocks;
+		// Blocks retired by each recording thread, recycled into that thread's chains.
+		struct ThreadBlocks
+		{
+			std::vector<BufferBlock> vbo;
+			std::vector<BufferBlock> ibo;
+			std::vector<BufferBlock> ubo;
+		};
+		std::vector<ThreadBlocks> thread_blocks;
 		std::vector<BufferBlock> staging_blocks;
 
 		std::vector<VkFence> wait_fences;
@@ -399,7 +574,7 @@ private:
 		bool need_fence = false;
 	} graphics, compute, transfer;
 
-	// Pending buffers which need to be copied from CPU to GPU before submitting graphics or compute work.
+	// Blocks collected from all threads which need to be copied from CPU to GPU before submitting graphics or compute work.
 	struct
 	{
 		std::vector<BufferBlock> vbo;
@@ -430,6 +605,10 @@ private:
 	uint32_t compute_queue_family_index = 0;
 	uint32_t transfer_queue_family_index = 0;
 
+	ImageHandle create_image_internal(const ImageCreateInfo &info, const InitialImageBuffer *buffer,
+	                                  const DeviceAllocation *placement, VkDeviceSize placement_offset,
+	                                  VkMemoryRequirements *query_reqs);
+
 	uint32_t find_memory_type(BufferDomain domain, uint32_t mask);
 	uint32_t find_memory_type(ImageDomain domain, uint32_t mask);
 	bool memory_type_is_device_optimal(uint32_t type) const;
@@ -456,12 +635,15 @@ private:
 	std::vector<CommandBufferHandle> &get_queue_submissions(CommandBuffer::Type type);
 	void clear_wait_semaphores();
 	void submit_staging(CommandBufferHandle &cmd, VkBufferUsageFlags usage, bool flush);
+	void submit_staging(CommandBufferHandle &cmd, VkPipelineStageFlags stages, VkAccessFlags access, bool flush,
+	                    Fence *fence);
 	PipelineEvent request_pipeline_event();
 
 	std::function<void ()> queue_lock_callback;
 	std::function<void ()> queue_unlock_callback;
 	void flush_frame(CommandBuffer::Type type);
 	void sync_buffer_blocks();
+	void flush_uploads();
 	void submit_empty_inner(CommandBuffer::Type type, VkFence *fence,
 	                        unsigned semaphore_count,
 	                        Semaphore *semaphore);
@@ -502,9 +684,6 @@ private:
 	void add_wait_semaphore_nolock(CommandBuffer::Type type, Semaphore semaphore, VkPipelineStageFlags stages,
 	                               bool flush);
 
-	void request_vertex_block_nolock(BufferBlock &block, VkDeviceSize size);
-	void request_index_block_nolock(BufferBlock &block, VkDeviceSize size);
-	void request_uniform_block_nolock(BufferBlock &block, VkDeviceSize size);
 	void request_staging_block_nolock(BufferBlock &block, VkDeviceSize size);
 
 	CommandBufferHandle request_secondary_command_buffer_for_thread(unsigned thread_index,
@@ -519,6 +698,8 @@ private:
 
 	Fence request_fence();
 
+	UploadManager upload_manager;
+
 #ifdef GRANITE_VULKAN_FILESYSTEM
 	ShaderManager shader_manager;
 	TextureManager texture_manager;
@@ -526,6 +707,17 @@ private:
 
 	std::string get_pipeline_cache_string() const;
 
+	struct
+	{
+#ifdef GRANITE_VULKAN_MT
+		std::mutex lock;
+		std::condition_variable cond;
+		std::unordered_set<Util::Hash> pending;
+#endif
+		PipelineCompileMode mode = PipelineCompileMode::Synchronous;
+	} pipeline_compile;
+	void enqueue_graphics_pipeline_compile(const DeferredPipelineCompile &compile, Util::Hash hash);
+
 #ifdef GRANITE_VULKAN_FOSSILIZE
 	Fossilize::StateRecorder state_recorder;
 	std::mutex state_recorder_lock;
@@ -552,14 +744,60 @@ private:
 	void set_pipeline_layout_handle(unsigned index, VkPipelineLayout layout);
 	void set_shader_module_handle(unsigned index, VkShaderModule module);
 
-	struct
+	// Replay only records create infos while parsing, and hands out placeholder handles.
+	// The objects are then created in three stages, each depending on the previous one:
+	// shader modules, programs (which own the pipeline layouts) and pipelines.
+	struct PipelineReplayStage
 	{
-		std::unordered_map<VkShaderModule, Shader *> shader_map;
-		std::unordered_map<VkRenderPass, RenderPass *> render_pass_map;
+		unsigned total = 0;
+		std::atomic<unsigned> completed;
+		std::atomic<int64_t> task_nsecs;
+		std::atomic<int64_t> start_nsecs;
+		std::atomic<int64_t> end_nsecs;
+	};
+
+	enum
+	{
+		PipelineReplayStageShaderModules = 0,
+		PipelineReplayStagePrograms,
+		PipelineReplayStagePipelines,
+		PipelineReplayStageCount
+	};
+
+	struct PipelineReplay
+	{
+		PipelineReplay();
+
+		// Create infos point into memory owned by the replayer and the JSON,
+		// so both are kept alive until replay completes.
+		std::unique_ptr<Fossilize::StateReplayer> replayer;
+		std::vector<char> json;
+
+		std::vector<std::pair<Fossilize::Hash, const VkShaderModuleCreateInfo *>> shader_modules;
+		std::vector<Shader *> shaders;
+		// Pairs of shader indices. Compute programs use ~0u for the second shader.
+		std::vector<std::pair<unsigned, unsigned>> programs;
+		std::vector<std::pair<Fossilize::Hash, const VkGraphicsPipelineCreateInfo *>> graphics_pipelines;
+		std::vector<std::pair<Fossilize::Hash, const VkComputePipelineCreateInfo *>> compute_pipelines;
+
+		PipelineReplayStage stages[PipelineReplayStageCount];
+		int64_t start_nsecs = 0;
+		bool serial = false;
+		bool started = false;
+		std::atomic<bool> done;
 #ifdef GRANITE_VULKAN_MT
-		Granite::TaskGroup pipeline_group;
+		Granite::TaskGroup completion;
 #endif
-	} replayer_state;
+	};
+	std::unique_ptr<PipelineReplay> pipeline_replay;
+	PipelineReplayMode pipeline_replay_mode = PipelineReplayMode::Parallel;
+
+	Shader *get_replayed_shader(VkShaderModule module) const;
+	void add_replayed_program(VkShaderModule vertex, VkShaderModule fragment);
+	void start_pipeline_replay();
+	void run_pipeline_replay_task(unsigned stage, unsigned index);
+	void complete_pipeline_replay();
+	void update_pipeline_replay();
 
 	void init_pipeline_state();
 	void flush_pipeline_state();
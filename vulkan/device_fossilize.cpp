@@ -22,6 +22,7 @@
 
 #include "device.hpp"
 #include "timer.hpp"
+#include <algorithm>
 
 using namespace std;
 
@@ -87,23 +88,48 @@ unsigned Device::register_render_pass(Fossilize::Hash hash, const VkRenderPassCr
 	return state_recorder.register_render_pass(hash, info);
 }
 
+Device::PipelineReplay::PipelineReplay()
+{
+	for (auto &stage : stages)
+	{
+		stage.completed.store(0, memory_order_relaxed);
+		stage.task_nsecs.store(0, memory_order_relaxed);
+		stage.start_nsecs.store(0, memory_order_relaxed);
+		stage.end_nsecs.store(0, memory_order_relaxed);
+	}
+	done.store(false, memory_order_relaxed);
+}
+
+// Placeholder handles given to the replayer are just shader indices, offset by one to avoid VK_NULL_HANDLE.
+static VkShaderModule get_placeholder_shader_module(size_t index)
+{
+	return (VkShaderModule) uint64_t(index + 1);
+}
+
+static size_t get_placeholder_shader_index(VkShaderModule module)
+{
+	return size_t((uint64_t) module - 1);
+}
+
 bool Device::enqueue_create_shader_module(Fossilize::Hash hash, unsigned, const VkShaderModuleCreateInfo *create_info, VkShaderModule *module)
 {
-	auto *ret = shaders.emplace_yield(hash, hash, this, create_info->pCode, create_info->codeSize);
-	*module = ret->get_module();
-	replayer_state.shader_map[*module] = ret;
+	auto &replay = *pipeline_replay;
+	*module = get_placeholder_shader_module(replay.shader_modules.size());
+	replay.shader_modules.emplace_back(hash, create_info);
 	return true;
 }
 
 void Device::wait_enqueue()
 {
-#ifdef GRANITE_VULKAN_MT
-	if (replayer_state.pipeline_group)
-	{
-		replayer_state.pipeline_group->wait();
-		replayer_state.pipeline_group.reset();
-	}
-#endif
+	// Nothing is created while parsing, see start_pipeline_replay().
+}
+
+Shader *Device::get_replayed_shader(VkShaderModule module) const
+{
+	size_t index = get_placeholder_shader_index(module);
+	if (index >= pipeline_replay->shaders.size())
+		return nullptr;
+	return pipeline_replay->shaders[index];
 }
 
 VkPipeline Device::fossilize_create_graphics_pipeline(Fossilize::Hash hash, VkGraphicsPipelineCreateInfo &info)
@@ -115,21 +141,22 @@ VkPipeline Device::fossilize_create_graphics_pipeline(Fossilize::Hash hash, VkGr
 	if (info.pStages[1].stage != VK_SHADER_STAGE_FRAGMENT_BIT)
 		return VK_NULL_HANDLE;
 
-	// Find the Shader* associated with this VkShaderModule and just use that.
-	auto vertex_itr = replayer_state.shader_map.find(info.pStages[0].module);
-	if (vertex_itr == end(replayer_state.shader_map))
-		return VK_NULL_HANDLE;
-
-	// Find the Shader* associated with this VkShaderModule and just use that.
-	auto fragment_itr = replayer_state.shader_map.find(info.pStages[1].module);
-	if (fragment_itr == end(replayer_state.shader_map))
+	auto *vertex = get_replayed_shader(info.pStages[0].module);
+	auto *fragment = get_replayed_shader(info.pStages[1].module);
+	if (!vertex || !fragment)
 		return VK_NULL_HANDLE;
 
-	auto *ret = request_program(vertex_itr->second, fragment_itr->second);
+	auto *ret = request_program(vertex, fragment);
 
 	// The layout is dummy, resolve it here.
 	info.layout = ret->get_pipeline_layout()->get_layout();
 
+	// The shader modules are placeholders, resolve them here.
+	VkPipelineShaderStageCreateInfo stages[2] = { info.pStages[0], info.pStages[1] };
+	stages[0].module = vertex->get_module();
+	stages[1].module = fragment->get_module();
+	info.pStages = stages;
+
 	register_graphics_pipeline(hash, info);
 
 	LOGI("Creating graphics pipeline.\n");
@@ -142,15 +169,15 @@ VkPipeline Device::fossilize_create_graphics_pipeline(Fossilize::Hash hash, VkGr
 
 VkPipeline Device::fossilize_create_compute_pipeline(Fossilize::Hash hash, VkComputePipelineCreateInfo &info)
 {
-	// Find the Shader* associated with this VkShaderModule and just use that.
-	auto itr = replayer_state.shader_map.find(info.stage.module);
-	if (itr == end(replayer_state.shader_map))
+	auto *shader = get_replayed_shader(info.stage.module);
+	if (!shader)
 		return VK_NULL_HANDLE;
 
-	auto *ret = request_program(itr->second);
+	auto *ret = request_program(shader);
 
 	// The layout is dummy, resolve it here.
 	info.layout = ret->get_pipeline_layout()->get_layout();
+	info.stage.module = shader->get_module();
 
 	register_compute_pipeline(hash, info);
 
@@ -162,49 +189,44 @@ VkPipeline Device::fossilize_create_compute_pipeline(Fossilize::Hash hash, VkCom
 	return ret->add_pipeline(hash, pipeline);
 }
 
+void Device::add_replayed_program(VkShaderModule vertex, VkShaderModule fragment)
+{
+	auto program = make_pair(unsigned(get_placeholder_shader_index(vertex)),
+	                         fragment != VK_NULL_HANDLE ? unsigned(get_placeholder_shader_index(fragment)) : ~0u);
+
+	auto &programs = pipeline_replay->programs;
+	if (find(begin(programs), end(programs), program) == end(programs))
+		programs.push_back(program);
+}
+
 bool Device::enqueue_create_graphics_pipeline(Fossilize::Hash hash, unsigned,
                                               const VkGraphicsPipelineCreateInfo *create_info, VkPipeline *pipeline)
 {
-#ifdef GRANITE_VULKAN_MT
-	if (!replayer_state.pipeline_group)
-		replayer_state.pipeline_group = Granite::Global::thread_group()->create_task();
-
-	replayer_state.pipeline_group->enqueue_task([this, info = *create_info, hash, pipeline]() mutable {
-		*pipeline = fossilize_create_graphics_pipeline(hash, info);
-	});
+	auto &replay = *pipeline_replay;
+	if (create_info->stageCount == 2)
+		add_replayed_program(create_info->pStages[0].module, create_info->pStages[1].module);
 
+	replay.graphics_pipelines.emplace_back(hash, create_info);
+	// Nothing can refer to pipelines, so any non-null handle will do.
+	*pipeline = (VkPipeline) uint64_t(-1);
 	return true;
-#else
-	auto info = *create_info;
-	*pipeline = fossilize_create_graphics_pipeline(hash, info);
-	return *pipeline != VK_NULL_HANDLE;
-#endif
 }
 
 bool Device::enqueue_create_compute_pipeline(Fossilize::Hash hash, unsigned,
                                              const VkComputePipelineCreateInfo *create_info, VkPipeline *pipeline)
 {
-#ifdef GRANITE_VULKAN_MT
-	if (!replayer_state.pipeline_group)
-		replayer_state.pipeline_group = Granite::Global::thread_group()->create_task();
-
-	replayer_state.pipeline_group->enqueue_task([this, info = *create_info, hash, pipeline]() mutable {
-		*pipeline = fossilize_create_compute_pipeline(hash, info);
-	});
-
+	auto &replay = *pipeline_replay;
+	add_replayed_program(create_info->stage.module, VK_NULL_HANDLE);
+	replay.compute_pipelines.emplace_back(hash, create_info);
+	*pipeline = (VkPipeline) uint64_t(-1);
 	return true;
-#else
-	auto info = *create_info;
-	*pipeline = fossilize_create_compute_pipeline(hash, info);
-	return *pipeline != VK_NULL_HANDLE;
-#endif
 }
 
 bool Device::enqueue_create_render_pass(Fossilize::Hash hash, unsigned, const VkRenderPassCreateInfo *create_info, VkRenderPass *render_pass)
 {
+	// Render passes are cheap and referred to by real handle in the pipelines, so create them right away.
 	auto *ret = render_passes.emplace_yield(hash, hash, this, *create_info);
 	*render_pass = ret->get_render_pass();
-	replayer_state.render_pass_map[*render_pass] = ret;
 	return true;
 }
 
@@ -228,36 +250,237 @@ bool Device::enqueue_create_pipeline_layout(Fossilize::Hash, unsigned, const VkP
 	return true;
 }
 
-void Device::init_pipeline_state()
+void Device::run_pipeline_replay_task(unsigned stage_index, unsigned index)
 {
-	auto file = Granite::Global::filesystem()->open("assets://pipelines.json", Granite::FileMode::ReadOnly);
-	if (!file)
-		file = Granite::Global::filesystem()->open("cache://pipelines.json", Granite::FileMode::ReadOnly);
+	auto &replay = *pipeline_replay;
+	auto &stage = replay.stages[stage_index];
 
-	if (!file)
-		return;
+	auto start = Util::get_current_time_nsecs();
+	int64_t expected = 0;
+	stage.start_nsecs.compare_exchange_strong(expected, start, memory_order_relaxed);
 
-	void *mapped = file->map();
-	if (!mapped)
+	switch (stage_index)
 	{
-		LOGE("Failed to map pipelines.json.\n");
+	case PipelineReplayStageShaderModules:
+	{
+		auto &module = replay.shader_modules[index];
+		replay.shaders[index] = shaders.emplace_yield(module.first, module.first, this,
+		                                               module.second->pCode, module.second->codeSize);
+		break;
+	}
+
+	case PipelineReplayStagePrograms:
+	{
+		auto &program = replay.programs[index];
+		if (program.first >= replay.shaders.size())
+			break;
+
+		if (program.second == ~0u)
+			request_program(replay.shaders[program.first]);
+		else if (program.second < replay.shaders.size())
+			request_program(replay.shaders[program.first], replay.shaders[program.second]);
+		break;
+	}
+
+	case PipelineReplayStagePipelines:
+	{
+		if (index < replay.graphics_pipelines.size())
+		{
+			auto info = *replay.graphics_pipelines[index].second;
+			fossilize_create_graphics_pipeline(replay.graphics_pipelines[index].first, info);
+		}
+		else
+		{
+			index -= unsigned(replay.graphics_pipelines.size());
+			auto info = *replay.compute_pipelines[index].second;
+			fossilize_create_compute_pipeline(replay.compute_pipelines[index].first, info);
+		}
+		break;
+	}
+
+	default:
+		break;
+	}
+
+	auto end = Util::get_current_time_nsecs();
+	stage.task_nsecs.fetch_add(end - start, memory_order_relaxed);
+	if (stage.completed.fetch_add(1, memory_order_acq_rel) + 1 == stage.total)
+		stage.end_nsecs.store(end, memory_order_relaxed);
+}
+
+void Device::complete_pipeline_replay()
+{
+	auto &replay = *pipeline_replay;
+	static const char *stage_names[PipelineReplayStageCount] = { "shader modules", "programs", "pipelines" };
+
+	int64_t total_task_nsecs = 0;
+	for (unsigned i = 0; i < PipelineReplayStageCount; i++)
+	{
+		auto &stage = replay.stages[i];
+		int64_t wall = stage.total ? stage.end_nsecs.load() - stage.start_nsecs.load() : 0;
+		total_task_nsecs += stage.task_nsecs.load();
+		LOGI("Replayed %u %s in %.3f ms (%.3f ms of work).\n", stage.total, stage_names[i],
+		     wall * 1e-6, stage.task_nsecs.load() * 1e-6);
+	}
+
+	auto total_wall = Util::get_current_time_nsecs() - replay.start_nsecs;
+	LOGI("Completed %s pipeline replay in %.3f ms, %.3f ms of work (%.2fx).\n",
+	     replay.serial ? "serial" : "parallel",
+	     total_wall * 1e-6, total_task_nsecs * 1e-6,
+	     total_wall ? double(total_task_nsecs) / double(total_wall) : 1.0);
+
+	replay.done.store(true, memory_order_release);
+}
+
+void Device::start_pipeline_replay()
+{
+	auto &replay = *pipeline_replay;
+	replay.started = true;
+	replay.start_nsecs = Util::get_current_time_nsecs();
+	replay.shaders.resize(replay.shader_modules.size());
+
+	replay.stages[PipelineReplayStageShaderModules].total = unsigned(replay.shader_modules.size());
+	replay.stages[PipelineReplayStagePrograms].total = unsigned(replay.programs.size());
+	replay.stages[PipelineReplayStagePipelines].total =
+			unsigned(replay.graphics_pipelines.size() + replay.compute_pipelines.size());
+
+	LOGI("Replaying %u shader modules, %u programs and %u pipelines.\n",
+	     replay.stages[PipelineReplayStageShaderModules].total,
+	     replay.stages[PipelineReplayStagePrograms].total,
+	     replay.stages[PipelineReplayStagePipelines].total);
+
+#ifdef GRANITE_VULKAN_MT
+	if (!replay.serial)
+	{
+		auto &workers = *Granite::Global::thread_group();
+		Granite::TaskGroup groups[PipelineReplayStageCount];
+		for (unsigned stage = 0; stage < PipelineReplayStageCount; stage++)
+		{
+			groups[stage] = workers.create_task();
+			for (unsigned i = 0; i < replay.stages[stage].total; i++)
+				groups[stage]->enqueue_task([this, stage, i]() { run_pipeline_replay_task(stage, i); });
+		}
+
+		replay.completion = workers.create_task([this]() { complete_pipeline_replay(); });
+		workers.add_dependency(groups[PipelineReplayStagePrograms], groups[PipelineReplayStageShaderModules]);
+		workers.add_dependency(groups[PipelineReplayStagePipelines], groups[PipelineReplayStagePrograms]);
+		workers.add_dependency(replay.completion, groups[PipelineReplayStagePipelines]);
+
+		for (auto &group : groups)
+			workers.submit(group);
+		replay.completion->flush();
 		return;
 	}
+#endif
+
+	for (unsigned stage = 0; stage < PipelineReplayStageCount; stage++)
+		for (unsigned i = 0; i < replay.stages[stage].total; i++)
+			run_pipeline_replay_task(stage, i);
+	complete_pipeline_replay();
+}
+
+void Device::update_pipeline_replay()
+{
+	if (!pipeline_replay)
+		return;
+
+	if (!pipeline_replay->started)
+		start_pipeline_replay();
+	else if (pipeline_replay->done.load(memory_order_acquire))
+		pipeline_replay.reset();
+}
+
+void Device::wait_pipeline_replay()
+{
+	if (!pipeline_replay)
+		return;
+
+	if (!pipeline_replay->started)
+		start_pipeline_replay();
+
+#ifdef GRANITE_VULKAN_MT
+	if (pipeline_replay->completion)
+		pipeline_replay->completion->wait();
+#endif
+
+	pipeline_replay.reset();
+}
+
+PipelineReplayProgress Device::get_pipeline_replay_progress() const
+{
+	PipelineReplayProgress progress;
+	if (!pipeline_replay)
+		return progress;
+
+	auto &stages = pipeline_replay->stages;
+	progress.shader_modules = unsigned(pipeline_replay->shader_modules.size());
+	progress.completed_shader_modules = stages[PipelineReplayStageShaderModules].completed.load(memory_order_relaxed);
+	progress.programs = unsigned(pipeline_replay->programs.size());
+	progress.completed_programs = stages[PipelineReplayStagePrograms].completed.load(memory_order_relaxed);
+	progress.pipelines = unsigned(pipeline_replay->graphics_pipelines.size() + pipeline_replay->compute_pipelines.size());
+	progress.completed_pipelines = stages[PipelineReplayStagePipelines].completed.load(memory_order_relaxed);
+	progress.done = pipeline_replay->done.load(memory_order_acquire);
+	return progress;
+}
+
+void Device::set_pipeline_replay_mode(PipelineReplayMode mode)
+{
+	pipeline_replay_mode = mode;
+}
+
+bool Device::replay_pipeline_state(const void *data, size_t size)
+{
+	// Only one replay can be in flight.
+	wait_pipeline_replay();
+
+	pipeline_replay.reset(new PipelineReplay);
+	pipeline_replay->replayer.reset(new Fossilize::StateReplayer);
+#ifdef GRANITE_VULKAN_MT
+	pipeline_replay->serial = pipeline_replay_mode == PipelineReplayMode::Serial;
+#else
+	pipeline_replay->serial = true;
+#endif
 
 	try
 	{
 		LOGI("Replaying cached state.\n");
-		Fossilize::StateReplayer replayer;
 		auto start = Util::get_current_time_nsecs();
-		replayer.parse(*this, static_cast<const char *>(mapped), file->get_size());
+		auto &json = pipeline_replay->json;
+		json.assign(static_cast<const char *>(data), static_cast<const char *>(data) + size);
+		pipeline_replay->replayer->parse(*this, json.data(), json.size());
 		auto end = Util::get_current_time_nsecs();
-		LOGI("Completed replaying cached state in %.3f ms.\n", (end - start) * 1e-6);
-		replayer_state = {};
+		LOGI("Parsed cached state in %.3f ms.\n", (end - start) * 1e-6);
 	}
 	catch (const exception &e)
 	{
 		LOGE("Exception caught while parsing pipeline state: %s.\n", e.what());
+		pipeline_replay.reset();
+		return false;
+	}
+
+	// Background replay is kicked off by the first next_frame_context().
+	if (pipeline_replay_mode != PipelineReplayMode::Background)
+		wait_pipeline_replay();
+	return true;
+}
+
+void Device::init_pipeline_state()
+{
+	auto file = Granite::Global::filesystem()->open("assets://pipelines.json", Granite::FileMode::ReadOnly);
+	if (!file)
+		file = Granite::Global::filesystem()->open("cache://pipelines.json", Granite::FileMode::ReadOnly);
+
+	if (!file)
+		return;
+
+	void *mapped = file->map();
+	if (!mapped)
+	{
+		LOGE("Failed to map pipelines.json.\n");
+		return;
 	}
+
+	replay_pipeline_state(mapped, file->get_size());
 }
 
 void Device::flush_pipeline_state()
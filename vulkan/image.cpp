@@ -111,17 +111,22 @@ Image::Image(Device *device, VkImage image, VkImageView default_view, const Devi
 
 Image::~Image()
 {
+	if (create_info.misc & IMAGE_MISC_RELOCATABLE_BIT)
+		device->unregister_relocatable(this);
+
 	if (alloc.get_memory())
 	{
 		if (internal_sync)
 		{
 			device->destroy_image_nolock(image);
-			device->free_memory_nolock(alloc);
+			if (owns_alloc)
+				device->free_memory_nolock(alloc);
 		}
 		else
 		{
 			device->destroy_image(image);
-			device->free_memory(alloc);
+			if (owns_alloc)
+				device->free_memory(alloc);
 		}
 	}
 }
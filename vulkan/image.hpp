@@ -159,7 +159,11 @@ enum ImageMiscFlagBits
 	IMAGE_MISC_CONCURRENT_QUEUE_ASYNC_GRAPHICS_BIT = 1 << 5,
 	IMAGE_MISC_CONCURRENT_QUEUE_ASYNC_TRANSFER_BIT = 1 << 6,
 	IMAGE_MISC_VERIFY_FORMAT_FEATURE_SAMPLED_LINEAR_FILTER_BIT = 1 << 7,
-	IMAGE_MISC_LINEAR_IMAGE_IGNORE_DEVICE_LOCAL_BIT = 1 << 8
+	IMAGE_MISC_LINEAR_IMAGE_IGNORE_DEVICE_LOCAL_BIT = 1 << 8,
+	// The device may move the image to a new allocation when defragmenting.
+	// Only read-only sampled images are moved, and only the views owned by the image are recreated,
+	// so the VkImage must not be kept across frames, and no other views can be created.
+	IMAGE_MISC_RELOCATABLE_BIT = 1 << 9
 };
 using ImageMiscFlags = uint32_t;
 
@@ -284,6 +288,7 @@ public:
 	}
 
 private:
+	friend class Device;
 	Device *device;
 	VkImageView view;
 	std::vector<VkImageView> render_target_views;
@@ -515,8 +520,15 @@ public:
 		return alloc;
 	}
 
+	// False for images placed in memory owned by someone else, see Device::create_placed_image().
+	bool owns_memory() const
+	{
+		return owns_alloc;
+	}
+
 private:
 	friend class Util::ObjectPool<Image>;
+	friend class Device;
 
 	Image(Device *device, VkImage image, VkImageView default_view, const DeviceAllocation &alloc,
 	      const ImageCreateInfo &info);
@@ -531,6 +543,7 @@ private:
 	VkPipelineStageFlags stage_flags = 0;
 	VkAccessFlags access_flags = 0;
 	VkImageLayout swapchain_layout = VK_IMAGE_LAYOUT_UNDEFINED;
+	bool owns_alloc = true;
 };
 
 using ImageHandle = Util::IntrusivePtr<Image>;
@@ -32,4 +32,5 @@ static const unsigned VULKAN_NUM_VERTEX_BUFFERS = 4;
 static const unsigned VULKAN_PUSH_CONSTANT_SIZE = 128;
 static const unsigned VULKAN_UBO_SIZE = 16 * 1024;
 static const unsigned VULKAN_NUM_SPEC_CONSTANTS = 8;
+static const unsigned VULKAN_NUM_BINDLESS_TEXTURES = 16 * 1024;
 }
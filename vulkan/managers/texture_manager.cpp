@@ -25,6 +25,10 @@
 #include "stb_image.h"
 #include "memory_mapped_texture.hpp"
 #include "texture_files.hpp"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <string.h>
 
 #ifdef GRANITE_VULKAN_MT
 #include "thread_group.hpp"
@@ -34,14 +38,16 @@ using namespace std;
 
 namespace Vulkan
 {
-Texture::Texture(Device *device, const std::string &path, VkFormat format, const VkComponentMapping &swizzle)
-	: VolatileSource(path), device(device), format(format), swizzle(swizzle)
+Texture::Texture(Device *device, const std::string &path, VkFormat format, const VkComponentMapping &swizzle,
+                 bool streamable)
+	: VolatileSource(path), device(device), format(format), swizzle(swizzle), streamable(streamable), screen_coverage(0),
+	  upload_generation(0)
 {
 	init();
 }
 
 Texture::Texture(Device *device)
-	: device(device), format(VK_FORMAT_UNDEFINED)
+	: device(device), format(VK_FORMAT_UNDEFINED), screen_coverage(0), upload_generation(0)
 {
 }
 
@@ -63,7 +69,12 @@ void Texture::update(std::unique_ptr<Granite::File> file)
 		if (size && mapped)
 		{
 			if (Granite::SceneFormats::MemoryMappedTexture::is_header(mapped, size))
-				update_gtx(move(file), mapped);
+			{
+				if (streamable && device->get_texture_manager().streaming_enabled())
+					update_gtx_streaming(move(file), mapped);
+				else
+					update_gtx(move(file), mapped);
+			}
 			else
 				update_other(mapped, size);
 			device->get_texture_manager().notify_updated_texture(path, *this);
@@ -109,15 +120,65 @@ void Texture::update_checkerboard()
 	replace_image(image);
 }
 
-void Texture::update_gtx(const Granite::SceneFormats::MemoryMappedTexture &mapped_file)
+// Mip levels are laid out in order with the same alignment rules, so the chain from any level is a suffix of the file.
+static bool build_mip_chain_layout(const TextureFormatLayout &layout, unsigned base_level, TextureFormatLayout &chain)
 {
-	if (mapped_file.empty())
+	unsigned levels = layout.get_levels() - base_level;
+	switch (layout.get_image_type())
 	{
-		update_checkerboard();
+	case VK_IMAGE_TYPE_1D:
+		chain.set_1d(layout.get_format(), layout.get_width(base_level), layout.get_layers(), levels);
+		break;
+	case VK_IMAGE_TYPE_2D:
+		chain.set_2d(layout.get_format(), layout.get_width(base_level), layout.get_height(base_level),
+		             layout.get_layers(), levels);
+		break;
+	case VK_IMAGE_TYPE_3D:
+		chain.set_3d(layout.get_format(), layout.get_width(base_level), layout.get_height(base_level),
+		             layout.get_depth(base_level), levels);
+		break;
+	default:
+		return false;
+	}
+
+	if (chain.get_required_size() != layout.get_required_size() - layout.get_mip_info(base_level).offset)
+		return false;
+
+	chain.set_buffer(layout.data(0, base_level), chain.get_required_size());
+	return true;
+}
+
+bool Texture::prepare_async_upload(const Granite::SceneFormats::MemoryMappedTexture &mapped_file)
+{
+	auto &manager = device->get_texture_manager();
+	if (!streamable || !manager.async_uploads_enabled())
+		return false;
+
+	// The placeholder is a plain 2D image, and mipmap generation needs the graphics queue.
+	if (mapped_file.get_flags() & (Granite::SceneFormats::MEMORY_MAPPED_TEXTURE_CUBE_MAP_COMPATIBLE_BIT |
+	                               Granite::SceneFormats::MEMORY_MAPPED_TEXTURE_GENERATE_MIPMAP_ON_LOAD_BIT))
+	{
+		return false;
+	}
+
+	// Nothing may block in get_image() while the upload is in flight.
+	if (!handle.get_nowait())
+		replace_image(manager.get_placeholder_image());
+	return true;
+}
+
+void Texture::create_gtx_image(const Granite::SceneFormats::MemoryMappedTexture &mapped_file, unsigned base_level,
+                               bool async_upload, std::function<void (ImageHandle)> on_ready)
+{
+	TextureFormatLayout chain;
+	if (base_level && !build_mip_chain_layout(mapped_file.get_layout(), base_level, chain))
+	{
+		LOGE("Failed to build mip chain for %s.\n", path.c_str());
+		on_ready(ImageHandle(nullptr));
 		return;
 	}
 
-	auto &layout = mapped_file.get_layout();
+	auto &layout = base_level ? chain : mapped_file.get_layout();
 
 	ImageCreateInfo info = {};
 	info.width = layout.get_width();
@@ -134,7 +195,7 @@ void Texture::update_gtx(const Granite::SceneFormats::MemoryMappedTexture &mappe
 	info.swizzle = swizzle;
 	info.flags = (mapped_file.get_flags() & Granite::SceneFormats::MEMORY_MAPPED_TEXTURE_CUBE_MAP_COMPATIBLE_BIT) ?
 	             VK_IMAGE_CREATE_CUBE_COMPATIBLE_BIT : 0;
-	info.misc = 0;
+	info.misc = IMAGE_MISC_RELOCATABLE_BIT;
 
 	if (info.levels == 1 &&
 	    (mapped_file.get_flags() & Granite::SceneFormats::MEMORY_MAPPED_TEXTURE_GENERATE_MIPMAP_ON_LOAD_BIT) != 0 &&
@@ -148,6 +209,24 @@ void Texture::update_gtx(const Granite::SceneFormats::MemoryMappedTexture &mappe
 	if (!device->image_format_is_supported(info.format, VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT))
 	{
 		LOGE("Format (%u) is not supported!\n", unsigned(info.format));
+		on_ready(ImageHandle(nullptr));
+		return;
+	}
+
+	if (async_upload)
+	{
+		info.initial_layout = VK_IMAGE_LAYOUT_UNDEFINED;
+		auto image = device->create_image(info, nullptr);
+		if (!image)
+		{
+			on_ready(ImageHandle(nullptr));
+			return;
+		}
+
+		device->set_name(*image, path.c_str());
+		device->get_upload_manager().upload_image(image, layout, [image, on_ready]() {
+			on_ready(image);
+		});
 		return;
 	}
 
@@ -155,7 +234,112 @@ void Texture::update_gtx(const Granite::SceneFormats::MemoryMappedTexture &mappe
 	auto image = device->create_image_from_staging_buffer(info, &staging);
 	if (image)
 		device->set_name(*image, path.c_str());
-	replace_image(image);
+	on_ready(move(image));
+}
+
+void Texture::update_gtx(const Granite::SceneFormats::MemoryMappedTexture &mapped_file)
+{
+	if (mapped_file.empty())
+	{
+		update_checkerboard();
+		return;
+	}
+
+	uint64_t generation = ++upload_generation;
+	create_gtx_image(mapped_file, 0, prepare_async_upload(mapped_file), [this, generation](ImageHandle image) {
+		if (image && generation == upload_generation.load())
+			replace_image(move(image));
+	});
+}
+
+// Textures start out with every mip level at or below this size.
+static const unsigned StreamingTailSize = 128;
+
+void Texture::update_gtx_streaming(unique_ptr<Granite::File> file, void *mapped)
+{
+	// Any streaming or upload in flight refers to the old file.
+	auto &manager = device->get_texture_manager();
+	manager.unregister_streaming_texture(this);
+	++upload_generation;
+
+	auto state = make_shared<StreamingState>();
+	state->file.reset(new Granite::SceneFormats::MemoryMappedTexture);
+	auto &mapped_file = *state->file;
+	if (!mapped_file.map_read(move(file), mapped))
+	{
+		LOGE("Failed to read texture.\n");
+		return;
+	}
+
+	if (mapped_file.empty())
+	{
+		update_checkerboard();
+		return;
+	}
+
+	auto &layout = mapped_file.get_layout();
+	unsigned levels = layout.get_levels();
+	unsigned tail_level = 0;
+	while (tail_level + 1 < levels &&
+	       std::max(layout.get_width(tail_level), layout.get_height(tail_level)) > StreamingTailSize)
+	{
+		tail_level++;
+	}
+
+	if (tail_level == 0)
+	{
+		update_gtx(mapped_file);
+		return;
+	}
+
+	state->tail_level = tail_level;
+	state->resident_level = tail_level;
+	state->desired_level = tail_level;
+	state->resident_size = get_streaming_size(*state, tail_level);
+	state->pending = true;
+
+	// The tail completes like any other streaming request, so it is dropped if the texture is reloaded meanwhile.
+	bool async_upload = prepare_async_upload(mapped_file);
+	manager.register_streaming_texture(this, state);
+	create_gtx_image(mapped_file, tail_level, async_upload, [this, state, tail_level](ImageHandle image) {
+		device->get_texture_manager().complete_streaming(this, state.get(), tail_level, move(image));
+	});
+}
+
+VkDeviceSize Texture::get_streaming_size(const StreamingState &state, unsigned level) const
+{
+	auto &layout = state.file->get_layout();
+	return layout.get_required_size() - layout.get_mip_info(level).offset;
+}
+
+void Texture::stream_levels(shared_ptr<StreamingState> state, unsigned level)
+{
+	auto work = [this, state, level]() {
+		create_gtx_image(*state->file, level, prepare_async_upload(*state->file), [this, state, level](ImageHandle image) {
+			device->get_texture_manager().complete_streaming(this, state.get(), level, move(image));
+		});
+	};
+
+#ifdef GRANITE_VULKAN_MT
+	auto &workers = *Granite::Global::thread_group();
+	auto task = workers.create_task(move(work));
+	task->flush();
+#else
+	work();
+#endif
+}
+
+void Texture::report_screen_coverage(float coverage)
+{
+	if (!streamable || !(coverage > 0.0f))
+		return;
+
+	uint32_t bits;
+	memcpy(&bits, &coverage, sizeof(bits));
+	uint32_t current = screen_coverage.load(memory_order_relaxed);
+	while (current < bits && !screen_coverage.compare_exchange_weak(current, bits, memory_order_relaxed))
+	{
+	}
 }
 
 void Texture::update_gtx(unique_ptr<Granite::File> file, void *mapped)
@@ -191,6 +375,8 @@ void Texture::load()
 void Texture::unload()
 {
 	deinit();
+	device->get_texture_manager().unregister_streaming_texture(this);
+	++upload_generation;
 	handle.reset();
 }
 
@@ -222,6 +408,18 @@ TextureManager::TextureManager(Device *device)
 }
 
 Texture *TextureManager::request_texture(const std::string &path, VkFormat format, const VkComponentMapping &mapping)
+{
+	return request_texture_internal(path, format, mapping, false);
+}
+
+Texture *TextureManager::request_streamed_texture(const std::string &path, VkFormat format,
+                                                  const VkComponentMapping &mapping)
+{
+	return request_texture_internal(path, format, mapping, true);
+}
+
+Texture *TextureManager::request_texture_internal(const std::string &path, VkFormat format,
+                                                  const VkComponentMapping &mapping, bool streamable)
 {
 	Util::Hasher hasher;
 	hasher.string(path);
@@ -231,6 +429,7 @@ Texture *TextureManager::request_texture(const std::string &path, VkFormat forma
 	hasher.u32(mapping.g);
 	hasher.u32(mapping.b);
 	hasher.u32(mapping.a);
+	hasher.u32(streamable);
 	auto hash = hasher.get();
 
 	auto *ret = deferred_textures.find(deferred_hash);
@@ -241,10 +440,204 @@ Texture *TextureManager::request_texture(const std::string &path, VkFormat forma
 	if (ret)
 		return ret;
 
-	ret = textures.emplace_yield(hash, device, path, format, mapping);
+	ret = textures.emplace_yield(hash, device, path, format, mapping, streamable);
 	return ret;
 }
 
+void TextureManager::enable_streaming(bool enable)
+{
+	enabled_streaming = enable;
+}
+
+void TextureManager::enable_async_uploads(bool enable)
+{
+	enabled_async_uploads = enable;
+}
+
+ImageHandle TextureManager::get_placeholder_image()
+{
+	lock_guard<mutex> holder{placeholder_lock};
+	if (!placeholder)
+	{
+		static const uint32_t grey = 0xff808080u;
+		ImageInitialData initial = {};
+		initial.data = &grey;
+		auto info = ImageCreateInfo::immutable_2d_image(1, 1, VK_FORMAT_R8G8B8A8_UNORM, false);
+		placeholder = device->create_image(info, &initial);
+		if (placeholder)
+			device->set_name(*placeholder, "texture-placeholder");
+	}
+	return placeholder;
+}
+
+void TextureManager::set_streaming_budget(VkDeviceSize budget, VkDeviceSize max_upload_per_frame)
+{
+	lock_guard<mutex> holder{streaming_lock};
+	streaming_budget = budget;
+	streaming_max_upload_per_frame = max_upload_per_frame;
+}
+
+void TextureManager::register_streaming_texture(Texture *texture, shared_ptr<Texture::StreamingState> state)
+{
+	lock_guard<mutex> holder{streaming_lock};
+	texture->streaming = move(state);
+	texture->streaming->last_used_frame = streaming_frame;
+	if (find(begin(streaming_textures), end(streaming_textures), texture) == end(streaming_textures))
+		streaming_textures.push_back(texture);
+}
+
+void TextureManager::unregister_streaming_texture(Texture *texture)
+{
+	lock_guard<mutex> holder{streaming_lock};
+	texture->streaming.reset();
+	auto itr = find(begin(streaming_textures), end(streaming_textures), texture);
+	if (itr != end(streaming_textures))
+		streaming_textures.erase(itr);
+}
+
+void TextureManager::complete_streaming(Texture *texture, const Texture::StreamingState *state, unsigned level,
+                                        ImageHandle image)
+{
+	lock_guard<mutex> holder{streaming_lock};
+
+	// The texture was reloaded or unloaded while we were busy.
+	if (texture->streaming.get() != state)
+		return;
+
+	auto &streaming = *texture->streaming;
+	streaming.pending = false;
+	if (!image)
+		return;
+
+	if (level < streaming.resident_level)
+		streaming_stats.streamed_in_levels += streaming.resident_level - level;
+	else
+		streaming_stats.evicted_levels += level - streaming.resident_level;
+
+	streaming.resident_level = level;
+	streaming.resident_size = texture->get_streaming_size(streaming, level);
+	texture->replace_image(move(image));
+}
+
+bool TextureManager::device_over_budget()
+{
+	auto stats = device->get_memory_stats();
+	for (auto &heap : stats.heaps)
+		if (heap.usage > heap.budget)
+			return true;
+	return false;
+}
+
+TextureStreamingStats TextureManager::get_streaming_stats()
+{
+	lock_guard<mutex> holder{streaming_lock};
+	return streaming_stats;
+}
+
+void TextureManager::update_streaming(unsigned viewport_height)
+{
+	// Uploads are kicked off after the lock is released, since they complete inline without threading.
+	vector<StreamingRequest> requests;
+	{
+		lock_guard<mutex> holder{streaming_lock};
+		plan_streaming(viewport_height, requests);
+	}
+
+	for (auto &request : requests)
+		request.texture->stream_levels(move(request.state), request.level);
+}
+
+void TextureManager::plan_streaming(unsigned viewport_height, vector<StreamingRequest> &requests)
+{
+	streaming_frame++;
+
+	VkDeviceSize resident_size = 0;
+	unsigned pending_uploads = 0;
+
+	for (auto *texture : streaming_textures)
+	{
+		auto &state = *texture->streaming;
+		resident_size += state.resident_size;
+		if (state.pending)
+			pending_uploads++;
+
+		uint32_t bits = texture->screen_coverage.exchange(0, memory_order_relaxed);
+		float coverage;
+		memcpy(&coverage, &bits, sizeof(coverage));
+		if (!(coverage > 0.0f))
+			continue;
+
+		// Pick the mip level where one texel covers about one pixel.
+		auto &layout = state.file->get_layout();
+		float texels = coverage * float(viewport_height);
+		float size = float(std::max(layout.get_width(), layout.get_height()));
+		unsigned level = 0;
+		if (size > texels)
+			level = unsigned(std::log2(size / std::max(texels, 1.0f)));
+
+		state.desired_level = std::min(level, state.tail_level);
+		state.last_used_frame = streaming_frame;
+	}
+
+	streaming_stats.streaming_textures = unsigned(streaming_textures.size());
+	streaming_stats.pending_uploads = pending_uploads;
+	streaming_stats.resident_size = resident_size;
+
+	VkDeviceSize budget = streaming_budget ? streaming_budget : numeric_limits<VkDeviceSize>::max();
+	bool device_over = device_over_budget();
+	bool over_budget = resident_size > budget || device_over;
+
+	// Least recently used first.
+	vector<Texture *> sorted = streaming_textures;
+	sort(begin(sorted), end(sorted), [](const Texture *a, const Texture *b) {
+		return a->streaming->last_used_frame < b->streaming->last_used_frame;
+	});
+
+	if (over_budget)
+	{
+		// Drop the top mip of textures which were not used this frame until we are back under budget.
+		// If the device is over budget, we cannot tell how much we need to free, so evict everything we can.
+		for (auto *texture : sorted)
+		{
+			auto &state = *texture->streaming;
+			if (state.last_used_frame == streaming_frame)
+				break;
+			if (state.pending || state.resident_level >= state.tail_level)
+				continue;
+
+			unsigned level = state.resident_level + 1;
+			resident_size -= state.resident_size - texture->get_streaming_size(state, level);
+			state.pending = true;
+			requests.push_back({ texture, texture->streaming, level });
+
+			if (resident_size <= budget && !device_over)
+				break;
+		}
+		return;
+	}
+
+	// Stream in the most recently used textures first, as long as it fits in the budget.
+	VkDeviceSize uploaded = 0;
+	for (auto itr = sorted.rbegin(); itr != sorted.rend(); ++itr)
+	{
+		auto *texture = *itr;
+		auto &state = *texture->streaming;
+		if (state.pending || state.desired_level >= state.resident_level)
+			continue;
+
+		VkDeviceSize size = texture->get_streaming_size(state, state.desired_level);
+		if (resident_size - state.resident_size + size > budget)
+			continue;
+		if (uploaded && uploaded + size > streaming_max_upload_per_frame)
+			break;
+
+		resident_size += size - state.resident_size;
+		uploaded += size;
+		state.pending = true;
+		requests.push_back({ texture, texture->streaming, state.desired_level });
+	}
+}
+
 void TextureManager::register_texture_update_notification(const std::string &modified_path,
                                                           std::function<void(Texture &)> func)
 {
@@ -25,6 +25,10 @@
 #include "volatile_source.hpp"
 #include "image.hpp"
 #include "async_object_sink.hpp"
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
 
 namespace Granite
 {
@@ -36,18 +40,22 @@ class MemoryMappedTexture;
 
 namespace Vulkan
 {
+class TextureManager;
+
 class Texture : public Util::VolatileSource<Texture>,
                 public Util::IntrusiveHashMapEnabled<Texture>
 {
 public:
 	friend class Util::VolatileSource<Texture>;
+	friend class TextureManager;
 
 	Texture(Device *device, const std::string &path, VkFormat format = VK_FORMAT_UNDEFINED,
 	        const VkComponentMapping &swizzle = {
 			        VK_COMPONENT_SWIZZLE_R,
 			        VK_COMPONENT_SWIZZLE_G,
 			        VK_COMPONENT_SWIZZLE_B,
-			        VK_COMPONENT_SWIZZLE_A });
+			        VK_COMPONENT_SWIZZLE_A },
+	        bool streamable = false);
 
 	Texture(Device *device);
 	void set_path(const std::string &path);
@@ -57,6 +65,11 @@ public:
 	void replace_image(ImageHandle handle);
 	void set_enable_notification(bool enable);
 
+	// Renderables report the fraction of the viewport height the texture is stretched over.
+	// Streamed textures use the largest coverage reported since the last TextureManager::update_streaming().
+	// Safe to call from any thread.
+	void report_screen_coverage(float coverage);
+
 private:
 	Device *device;
 	Util::AsyncObjectSink<ImageHandle> handle;
@@ -66,6 +79,34 @@ private:
 	void update_gtx(std::unique_ptr<Granite::File> file, void *mapped);
 	void update_gtx(const Granite::SceneFormats::MemoryMappedTexture &texture);
 	void update_checkerboard();
+	// With async_upload, on_ready is called once the upload manager has uploaded the image,
+	// otherwise it is called before returning.
+	void create_gtx_image(const Granite::SceneFormats::MemoryMappedTexture &mapped_file, unsigned base_level,
+	                      bool async_upload, std::function<void (ImageHandle)> on_ready);
+	bool prepare_async_upload(const Granite::SceneFormats::MemoryMappedTexture &mapped_file);
+
+	// The file stays mapped while streaming, so any range of mip levels can be uploaded again.
+	// Only the mip levels from resident_level and down are in the image.
+	struct StreamingState
+	{
+		std::unique_ptr<Granite::SceneFormats::MemoryMappedTexture> file;
+		unsigned tail_level = 0;
+		unsigned resident_level = 0;
+		unsigned desired_level = 0;
+		VkDeviceSize resident_size = 0;
+		uint64_t last_used_frame = 0;
+		bool pending = false;
+	};
+	std::shared_ptr<StreamingState> streaming;
+	bool streamable = false;
+	// Float bits, which order like unsigned integers for non-negative floats.
+	std::atomic<uint32_t> screen_coverage;
+	// Bumped on every load, so uploads which complete after a reload are dropped.
+	std::atomic<uint64_t> upload_generation;
+
+	void update_gtx_streaming(std::unique_ptr<Granite::File> file, void *mapped);
+	void stream_levels(std::shared_ptr<StreamingState> state, unsigned level);
+	VkDeviceSize get_streaming_size(const StreamingState &state, unsigned level) const;
 
 	void load();
 	void unload();
@@ -73,9 +114,21 @@ private:
 	bool enable_notification = true;
 };
 
+struct TextureStreamingStats
+{
+	unsigned streaming_textures = 0;
+	unsigned pending_uploads = 0;
+	// Estimated from the texture layouts, so it does not account for alignment.
+	VkDeviceSize resident_size = 0;
+	uint64_t streamed_in_levels = 0;
+	uint64_t evicted_levels = 0;
+};
+
 class TextureManager
 {
 public:
+	friend class Texture;
+
 	TextureManager(Device *device);
 	Texture *request_texture(const std::string &path, VkFormat format = VK_FORMAT_UNDEFINED,
 	                         const VkComponentMapping &swizzle = {
@@ -84,6 +137,38 @@ public:
 			                         VK_COMPONENT_SWIZZLE_B,
 			                         VK_COMPONENT_SWIZZLE_A });
 
+	// Like request_texture(), but the texture is streamed if streaming is enabled when it loads.
+	// Streamed textures start out with only their smallest mips, and must get screen coverage reported
+	// by whoever renders them, or they never stream in higher mips.
+	Texture *request_streamed_texture(const std::string &path, VkFormat format = VK_FORMAT_UNDEFINED,
+	                                  const VkComponentMapping &swizzle = {
+			                                  VK_COMPONENT_SWIZZLE_R,
+			                                  VK_COMPONENT_SWIZZLE_G,
+			                                  VK_COMPONENT_SWIZZLE_B,
+			                                  VK_COMPONENT_SWIZZLE_A });
+
+	// Textures from request_streamed_texture() are uploaded in batches through the device's UploadManager.
+	// They show a placeholder until their first upload has completed.
+	void enable_async_uploads(bool enable);
+	bool async_uploads_enabled() const
+	{
+		return enabled_async_uploads;
+	}
+
+	void enable_streaming(bool enable);
+	bool streaming_enabled() const
+	{
+		return enabled_streaming;
+	}
+
+	// Mips are evicted from the least recently used textures while the resident size is above budget,
+	// or while any memory heap is over the budget reported by the device. A budget of 0 only uses the device budget.
+	void set_streaming_budget(VkDeviceSize budget, VkDeviceSize max_upload_per_frame);
+
+	// Call once per frame. The viewport height converts reported screen coverage to texels.
+	void update_streaming(unsigned viewport_height);
+	TextureStreamingStats get_streaming_stats();
+
 	Texture *register_deferred_texture(const std::string &path);
 
 	void register_texture_update_notification(const std::string &modified_path,
@@ -98,5 +183,32 @@ private:
 	VulkanCache<Texture> deferred_textures;
 
 	std::unordered_map<std::string, std::vector<std::function<void (Texture &)>>> notifications;
+
+	std::mutex streaming_lock;
+	std::vector<Texture *> streaming_textures;
+	TextureStreamingStats streaming_stats;
+	VkDeviceSize streaming_budget = 0;
+	VkDeviceSize streaming_max_upload_per_frame = 16 * 1024 * 1024;
+	uint64_t streaming_frame = 0;
+	bool enabled_streaming = false;
+	bool enabled_async_uploads = false;
+
+	std::mutex placeholder_lock;
+	ImageHandle placeholder;
+	ImageHandle get_placeholder_image();
+
+	Texture *request_texture_internal(const std::string &path, VkFormat format, const VkComponentMapping &swizzle,
+	                                  bool streamable);
+	void register_streaming_texture(Texture *texture, std::shared_ptr<Texture::StreamingState> state);
+	void unregister_streaming_texture(Texture *texture);
+	void complete_streaming(Texture *texture, const Texture::StreamingState *state, unsigned level, ImageHandle image);
+	struct StreamingRequest
+	{
+		Texture *texture;
+		std::shared_ptr<Texture::StreamingState> state;
+		unsigned level;
+	};
+	bool device_over_budget();
+	void plan_streaming(unsigned viewport_height, std::vector<StreamingRequest> &requests);
 };
 }
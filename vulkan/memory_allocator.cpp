@@ -114,6 +114,7 @@ void ClassAllocator::suballocate(uint32_t num_blocks, uint32_t tiling, uint32_t
 	alloc->memory_type = memory_type;
 	alloc->alloc = this;
 	alloc->size = num_blocks << sub_block_size_log2;
+	used_bytes += alloc->size;
 }
 
 bool ClassAllocator::allocate(uint32_t size, AllocationTiling tiling, DeviceAllocation *alloc, bool hierarchical)
@@ -161,6 +162,7 @@ bool ClassAllocator::allocate(uint32_t size, AllocationTiling tiling, DeviceAllo
 	auto *node = object_pool.allocate();
 	if (!node)
 		return false;
+	num_heaps++;
 
 	auto &heap = *node;
 	uint32_t alloc_size = sub_block_size * Block::NumSubBlocks;
@@ -171,6 +173,7 @@ bool ClassAllocator::allocate(uint32_t size, AllocationTiling tiling, DeviceAllo
 		if (!parent->allocate(alloc_size, tiling, &heap.allocation, true))
 		{
 			object_pool.free(node);
+			num_heaps--;
 			return false;
 		}
 	}
@@ -181,6 +184,7 @@ bool ClassAllocator::allocate(uint32_t size, AllocationTiling tiling, DeviceAllo
 		                                VK_NULL_HANDLE))
 		{
 			object_pool.free(node);
+			num_heaps--;
 			return false;
 		}
 	}
@@ -232,6 +236,7 @@ void ClassAllocator::free(DeviceAllocation *alloc)
 
 	unsigned index = block.get_longest_run() - 1;
 	block.free(alloc->mask);
+	used_bytes -= uint64_t(popcount32(alloc->mask)) << sub_block_size_log2;
 	unsigned new_index = block.get_longest_run() - 1;
 
 	if (block.empty())
@@ -252,6 +257,7 @@ void ClassAllocator::free(DeviceAllocation *alloc)
 		}
 
 		object_pool.free(heap);
+		num_heaps--;
 	}
 	else if (was_full)
 	{
@@ -267,6 +273,54 @@ void ClassAllocator::free(DeviceAllocation *alloc)
 	}
 }
 
+void ClassAllocator::get_stats(MemoryClassStats &stats)
+{
+	ALLOCATOR_LOCK();
+	uint32_t availability_mask = 0;
+	for (auto &m : tiling_modes)
+		availability_mask |= m.heap_availability_mask;
+
+	// Heaps are bucketed by their longest free run, so the highest bucket in use has the largest run.
+	uint32_t largest_run = 32 - leading_zeroes(availability_mask);
+
+	stats.used = used_bytes;
+	stats.num_heaps = num_heaps;
+	stats.committed = uint64_t(num_heaps) * sub_block_size * Block::NumSubBlocks;
+	stats.largest_free_run = uint64_t(largest_run) << sub_block_size_log2;
+
+	uint64_t free_bytes = stats.committed - stats.used;
+	if (free_bytes)
+		stats.fragmentation = 1.0f - float(double(stats.largest_free_run) / double(free_bytes));
+	else
+		stats.fragmentation = 0.0f;
+}
+
+uint32_t ClassAllocator::get_heap_occupancy(const DeviceAllocation &alloc)
+{
+	ALLOCATOR_LOCK();
+	return (*alloc.heap).heap.get_num_used_blocks();
+}
+
+// Mirrors the mini-heap selection in allocate().
+// Returns 0 if the allocation would go to a new mini-heap or the one alloc already lives in.
+uint32_t ClassAllocator::get_target_heap_occupancy(uint32_t size, AllocationTiling tiling, const DeviceAllocation &alloc)
+{
+	ALLOCATOR_LOCK();
+	unsigned num_blocks = (size + sub_block_size - 1) >> sub_block_size_log2;
+	uint32_t size_mask = (1u << (num_blocks - 1)) - 1;
+	auto &m = tiling_modes[tiling_mask & tiling];
+
+	uint32_t index = trailing_zeroes(m.heap_availability_mask & ~size_mask);
+	if (index >= Block::NumSubBlocks)
+		return 0;
+
+	auto itr = m.heaps[index].begin();
+	if (alloc.alloc == this && alloc.heap == itr)
+		return 0;
+
+	return itr->heap.get_num_used_blocks() + num_blocks;
+}
+
 bool Allocator::allocate_global(uint32_t size, DeviceAllocation *alloc)
 {
 	// Fall back to global allocation, do not recycle.
@@ -300,6 +354,18 @@ DeviceAllocation DeviceAllocation::make_imported_allocation(VkDeviceMemory memor
 	return alloc;
 }
 
+DeviceAllocation DeviceAllocation::make_placed_allocation(const DeviceAllocation &parent, uint32_t offset, uint32_t size)
+{
+	DeviceAllocation alloc = {};
+	alloc.base = parent.base;
+	alloc.host_base = parent.host_base ? parent.host_base + offset : nullptr;
+	alloc.offset = parent.offset + offset;
+	alloc.size = size;
+	alloc.tiling = parent.tiling;
+	alloc.memory_type = parent.memory_type;
+	return alloc;
+}
+
 bool Allocator::allocate(uint32_t size, uint32_t alignment, AllocationTiling mode, DeviceAllocation *alloc)
 {
 	for (auto &c : classes)
@@ -331,6 +397,29 @@ bool Allocator::allocate(uint32_t size, uint32_t alignment, AllocationTiling mod
 	return allocate_global(size, alloc);
 }
 
+uint32_t Allocator::get_target_heap_occupancy(uint32_t size, uint32_t alignment, AllocationTiling tiling,
+                                               const DeviceAllocation &alloc)
+{
+	for (auto &c : classes)
+	{
+		if (size <= c.sub_block_size * Block::NumSubBlocks)
+		{
+			if (alignment > c.sub_block_size)
+			{
+				size_t padded_size = size + (alignment - c.sub_block_size);
+				if (padded_size <= c.sub_block_size * Block::NumSubBlocks)
+					size = padded_size;
+				else
+					continue;
+			}
+
+			return c.get_target_heap_occupancy(size, tiling, alloc);
+		}
+	}
+
+	return 0;
+}
+
 Allocator::Allocator()
 {
 	for (unsigned i = 0; i < MEMORY_CLASS_COUNT - 1; i++)
@@ -350,8 +439,9 @@ Allocator::Allocator()
 	    .set_sub_block_size(64 * Block::NumSubBlocks * Block::NumSubBlocks * Block::NumSubBlocks); // 2M
 }
 
-void DeviceAllocator::init(VkPhysicalDevice gpu, VkDevice vkdevice)
+void DeviceAllocator::init(VkPhysicalDevice vkgpu, VkDevice vkdevice)
 {
+	gpu = vkgpu;
 	device = vkdevice;
 	vkGetPhysicalDeviceMemoryProperties(gpu, &mem_props);
 
@@ -363,6 +453,9 @@ void DeviceAllocator::init(VkPhysicalDevice gpu, VkDevice vkdevice)
 	allocators.clear();
 
 	heaps.resize(mem_props.memoryHeapCount);
+	for (unsigned i = 0; i < mem_props.memoryHeapCount; i++)
+		heaps[i].budget = mem_props.memoryHeaps[i].size;
+
 	for (unsigned i = 0; i < mem_props.memoryTypeCount; i++)
 	{
 		allocators.emplace_back(new Allocator);
@@ -411,6 +504,22 @@ void DeviceAllocator::Heap::garbage_collect(VkDevice device)
 		vkFreeMemory(device, block.memory, nullptr);
 		size -= block.size;
 	}
+	blocks.clear();
+}
+
+uint64_t DeviceAllocator::Heap::get_recycled_size() const
+{
+	uint64_t recycled = 0;
+	for (auto &block : blocks)
+		recycled += block.size;
+	return recycled;
+}
+
+uint64_t DeviceAllocator::Heap::get_estimated_usage() const
+{
+	// Other processes might have allocated since the query, but that is the best we can do.
+	int64_t delta = int64_t(size) - int64_t(size_at_query);
+	return uint64_t(std::max<int64_t>(int64_t(usage) + delta, 0));
 }
 
 DeviceAllocator::~DeviceAllocator()
@@ -443,6 +552,80 @@ void DeviceAllocator::garbage_collect()
 		heap.garbage_collect(device);
 }
 
+void DeviceAllocator::update_budget()
+{
+	VkPhysicalDeviceMemoryBudgetPropertiesEXT budget_props = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_BUDGET_PROPERTIES_EXT };
+	if (use_budget)
+	{
+		VkPhysicalDeviceMemoryProperties2KHR props = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_PROPERTIES_2_KHR };
+		props.pNext = &budget_props;
+		vkGetPhysicalDeviceMemoryProperties2KHR(gpu, &props);
+	}
+
+	ALLOCATOR_LOCK();
+	for (unsigned i = 0; i < heaps.size(); i++)
+	{
+		auto &heap = heaps[i];
+		heap.size_at_query = heap.size;
+		if (use_budget)
+		{
+			heap.budget = budget_props.heapBudget[i];
+			heap.usage = budget_props.heapUsage[i];
+		}
+		else
+			heap.usage = heap.size;
+
+		// Recycled blocks are the cheapest memory to give back.
+		if (heap.get_estimated_usage() > heap.budget && !heap.blocks.empty())
+		{
+			LOGI("Memory heap %u is over budget, releasing %u recycled blocks.\n", i, unsigned(heap.blocks.size()));
+			heap.garbage_collect(device);
+		}
+	}
+}
+
+bool DeviceAllocator::is_over_budget(uint32_t heap_index)
+{
+	ALLOCATOR_LOCK();
+	auto &heap = heaps[heap_index];
+	return heap.get_estimated_usage() > heap.budget;
+}
+
+uint32_t DeviceAllocator::get_heap_occupancy(const DeviceAllocation &alloc)
+{
+	if (!alloc.alloc)
+		return Block::NumSubBlocks;
+	return alloc.alloc->get_heap_occupancy(alloc);
+}
+
+bool DeviceAllocator::relocation_improves_packing(uint32_t size, uint32_t alignment, uint32_t memory_type,
+                                                  AllocationTiling tiling, const DeviceAllocation &alloc)
+{
+	// Query the current mini-heap first, so no two class allocator locks are ever held at once.
+	uint32_t occupancy = get_heap_occupancy(alloc);
+	return allocators[memory_type]->get_target_heap_occupancy(size, alignment, tiling, alloc) > occupancy;
+}
+
+DeviceAllocatorStats DeviceAllocator::get_stats()
+{
+	DeviceAllocatorStats stats;
+	stats.types.resize(allocators.size());
+	for (unsigned i = 0; i < allocators.size(); i++)
+		for (unsigned c = 0; c < MEMORY_CLASS_COUNT; c++)
+			allocators[i]->get_class_allocator(MemoryClass(c)).get_stats(stats.types[i].classes[c]);
+
+	ALLOCATOR_LOCK();
+	stats.heaps.resize(heaps.size());
+	for (unsigned i = 0; i < heaps.size(); i++)
+	{
+		stats.heaps[i].allocated = heaps[i].size;
+		stats.heaps[i].recycled = heaps[i].get_recycled_size();
+		stats.heaps[i].budget = heaps[i].budget;
+		stats.heaps[i].usage = heaps[i].get_estimated_usage();
+	}
+	return stats;
+}
+
 void *DeviceAllocator::map_memory(const DeviceAllocation &alloc, MemoryAccessFlags flags)
 {
 	// This will only happen if the memory type is device local only, which we cannot possibly map.
@@ -506,6 +689,11 @@ bool DeviceAllocator::allocate(uint32_t size, uint32_t memory_type, VkDeviceMemo
 		return true;
 	}
 
+	// Going over budget risks the driver paging memory out behind our back,
+	// so release recycled blocks before making a new allocation.
+	if (heap.get_estimated_usage() + size > heap.budget && !heap.blocks.empty())
+		heap.garbage_collect(device);
+
 	VkMemoryAllocateInfo info = { VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO, nullptr, size, memory_type };
 	VkMemoryDedicatedAllocateInfoKHR dedicated = { VK_STRUCTURE_TYPE_MEMORY_DEDICATED_ALLOCATE_INFO_KHR };
 	if (dedicated_image != VK_NULL_HANDLE)
@@ -69,6 +69,43 @@ enum MemoryAccessFlag
 };
 using MemoryAccessFlags = uint32_t;
 
+struct MemoryClassStats
+{
+	// Bytes handed out from mini-heaps, including alignment padding.
+	// Mini-heaps of the class below are allocations in this class, so they count as used here.
+	uint64_t used = 0;
+	// Bytes owned by live mini-heaps of this class.
+	uint64_t committed = 0;
+	// Largest contiguous free range in any mini-heap of this class.
+	uint64_t largest_free_run = 0;
+	uint32_t num_heaps = 0;
+	// 0 when all free space is one contiguous run, approaching 1 as free space is scattered.
+	float fragmentation = 0.0f;
+};
+
+struct MemoryTypeStats
+{
+	MemoryClassStats classes[MEMORY_CLASS_COUNT];
+};
+
+struct MemoryHeapStats
+{
+	// Bytes currently allocated with vkAllocateMemory, including recycled blocks.
+	uint64_t allocated = 0;
+	// Bytes held in freed blocks which are kept around for reuse.
+	uint64_t recycled = 0;
+	// Budget and process usage from VK_EXT_memory_budget.
+	// Without the extension, the budget is the heap size and usage is what we have allocated.
+	uint64_t budget = 0;
+	uint64_t usage = 0;
+};
+
+struct DeviceAllocatorStats
+{
+	std::vector<MemoryTypeStats> types;
+	std::vector<MemoryHeapStats> heaps;
+};
+
 struct DeviceAllocation;
 class DeviceAllocator;
 
@@ -107,6 +144,11 @@ public:
 		return free_blocks[0] == AllFree;
 	}
 
+	inline uint32_t get_num_used_blocks() const
+	{
+		return NumSubBlocks - popcount32(free_blocks[0]);
+	}
+
 	inline uint32_t get_longest_run() const
 	{
 		return longest_run;
@@ -170,11 +212,25 @@ public:
 		return mask;
 	}
 
+	inline uint32_t get_memory_type() const
+	{
+		return memory_type;
+	}
+
+	// True if both allocations are sub-allocated from the same mini-heap.
+	inline bool shares_mini_heap(const DeviceAllocation &other) const
+	{
+		return alloc && alloc == other.alloc && heap == other.heap;
+	}
+
 	void free_immediate();
 	void free_immediate(DeviceAllocator &allocator);
 
 	static DeviceAllocation make_imported_allocation(VkDeviceMemory memory, VkDeviceSize size, uint32_t memory_type);
 
+	// A range of another allocation. The range does not own any memory and must never be freed.
+	static DeviceAllocation make_placed_allocation(const DeviceAllocation &parent, uint32_t offset, uint32_t size);
+
 private:
 	VkDeviceMemory base = VK_NULL_HANDLE;
 	uint8_t *host_base = nullptr;
@@ -224,6 +280,10 @@ public:
 	bool allocate(uint32_t size, AllocationTiling tiling, DeviceAllocation *alloc, bool hierarchical);
 	void free(DeviceAllocation *alloc);
 
+	void get_stats(MemoryClassStats &stats);
+	uint32_t get_heap_occupancy(const DeviceAllocation &alloc);
+	uint32_t get_target_heap_occupancy(uint32_t size, AllocationTiling tiling, const DeviceAllocation &alloc);
+
 private:
 	ClassAllocator() = default;
 	struct AllocationTilingHeaps
@@ -240,6 +300,8 @@ private:
 	uint32_t sub_block_size_log2 = 0;
 	uint32_t tiling_mask = ~0u;
 	uint32_t memory_type = 0;
+	uint64_t used_bytes = 0;
+	uint32_t num_heaps = 0;
 #ifdef GRANITE_VULKAN_MT
 	std::mutex lock;
 #endif
@@ -274,6 +336,8 @@ public:
 	bool allocate(uint32_t size, uint32_t alignment, AllocationTiling tiling, DeviceAllocation *alloc);
 	bool allocate_global(uint32_t size, DeviceAllocation *alloc);
 	bool allocate_dedicated(uint32_t size, DeviceAllocation *alloc, VkImage image);
+	uint32_t get_target_heap_occupancy(uint32_t size, uint32_t alignment, AllocationTiling tiling,
+	                                   const DeviceAllocation &alloc);
 	inline ClassAllocator &get_class_allocator(MemoryClass clazz)
 	{
 		return classes[static_cast<unsigned>(clazz)];
@@ -313,6 +377,11 @@ public:
 		use_dedicated = enable;
 	}
 
+	void set_supports_memory_budget(bool enable)
+	{
+		use_budget = enable;
+	}
+
 	~DeviceAllocator();
 
 	bool allocate(uint32_t size, uint32_t alignment, uint32_t memory_type, AllocationTiling tiling,
@@ -330,8 +399,24 @@ public:
 	void free(uint32_t size, uint32_t memory_type, VkDeviceMemory memory, uint8_t *host_memory);
 	void free_no_recycle(uint32_t size, uint32_t memory_type, VkDeviceMemory memory, uint8_t *host_memory);
 
+	// Queries VK_EXT_memory_budget if supported. Called once per frame.
+	// Recycled blocks are released if a heap has gone over budget.
+	void update_budget();
+	bool is_over_budget(uint32_t heap_index);
+	DeviceAllocatorStats get_stats();
+
+	// Number of used sub-blocks in the mini-heap the allocation lives in.
+	// Allocations which are not sub-allocated report Block::NumSubBlocks, as there is nothing to compact.
+	uint32_t get_heap_occupancy(const DeviceAllocation &alloc);
+
+	// True if allocate() would currently place an allocation with these requirements in a different mini-heap,
+	// which ends up fuller than the one alloc lives in. Nothing is allocated.
+	bool relocation_improves_packing(uint32_t size, uint32_t alignment, uint32_t memory_type, AllocationTiling tiling,
+	                                 const DeviceAllocation &alloc);
+
 private:
 	std::vector<std::unique_ptr<Allocator>> allocators;
+	VkPhysicalDevice gpu = VK_NULL_HANDLE;
 	VkDevice device = VK_NULL_HANDLE;
 	VkPhysicalDeviceMemoryProperties mem_props;
 	VkDeviceSize atom_alignment = 1;
@@ -339,6 +424,7 @@ private:
 	std::mutex lock;
 #endif
 	bool use_dedicated = false;
+	bool use_budget = false;
 
 	struct Allocation
 	{
@@ -352,7 +438,14 @@ private:
 	{
 		uint64_t size = 0;
 		std::vector<Allocation> blocks;
+		uint64_t budget = 0;
+		uint64_t usage = 0;
+		// Our own allocated size when usage was queried, so usage can be estimated between queries.
+		uint64_t size_at_query = 0;
+
 		void garbage_collect(VkDevice device);
+		uint64_t get_recycled_size() const;
+		uint64_t get_estimated_usage() const;
 	};
 
 	std::vector<Heap> heaps;
@@ -43,8 +43,17 @@ PipelineLayout::PipelineLayout(Hash hash, Device *device, const CombinedResource
 	unsigned num_sets = 0;
 	for (unsigned i = 0; i < VULKAN_NUM_DESCRIPTOR_SETS; i++)
 	{
-		set_allocators[i] = device->request_descriptor_set_allocator(layout.sets[i], layout.stages_for_bindings[i]);
-		layouts[i] = set_allocators[i]->get_layout();
+		auto *bindless = device->get_bindless_texture_table();
+		if ((layout.bindless_set_mask & (1u << i)) && bindless)
+			layouts[i] = bindless->get_layout();
+		else
+		{
+			if (layout.bindless_set_mask & (1u << i))
+				LOGE("Shader uses a bindless texture array, but the device does not support descriptor indexing.\n");
+			set_allocators[i] = device->request_descriptor_set_allocator(layout.sets[i], layout.stages_for_bindings[i]);
+			layouts[i] = set_allocators[i]->get_layout();
+		}
+
 		if (layout.descriptor_set_mask & (1u << i))
 			num_sets = i + 1;
 	}
@@ -154,6 +163,17 @@ Shader::Shader(Hash hash, Device *device, const uint32_t *data, size_t size)
 	{
 		auto set = compiler.get_decoration(image.id, spv::DecorationDescriptorSet);
 		auto binding = compiler.get_decoration(image.id, spv::DecorationBinding);
+
+		// Runtime sized arrays are only supported as bindless texture tables.
+		auto &array_type = compiler.get_type(image.type_id);
+		if (!array_type.array.empty() && array_type.array.front() == 0)
+		{
+			if (binding != 0)
+				LOGE("Bindless texture array must be declared at binding 0.\n");
+			layout.bindless_set_mask |= 1u << set;
+			continue;
+		}
+
 		auto &type = compiler.get_type(image.base_type_id);
 		if (type.image.dim == spv::DimBuffer)
 			layout.sets[set].sampled_buffer_mask |= 1u << binding;
@@ -317,7 +337,18 @@ VkPipeline Program::get_pipeline(Hash hash) const
 
 VkPipeline Program::add_pipeline(Hash hash, VkPipeline pipeline)
 {
-	return pipelines.emplace_yield(hash, pipeline)->get();
+	auto ret = pipelines.emplace_yield(hash, pipeline)->get();
+
+	// Another thread created the same pipeline first.
+	if (ret != pipeline && pipeline != VK_NULL_HANDLE)
+	{
+		if (internal_sync)
+			device->destroy_pipeline_nolock(pipeline);
+		else
+			device->destroy_pipeline(pipeline);
+	}
+
+	return ret;
 }
 
 Program::~Program()
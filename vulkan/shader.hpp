@@ -51,6 +51,8 @@ struct ResourceLayout
 	uint32_t output_mask = 0;
 	uint32_t push_constant_size = 0;
 	uint32_t spec_constant_mask = 0;
+	// Sets which only contain a runtime sized sampler array at binding 0, backed by the BindlessTextureTable.
+	uint32_t bindless_set_mask = 0;
 	DescriptorSetLayout sets[VULKAN_NUM_DESCRIPTOR_SETS];
 };
 
@@ -63,6 +65,7 @@ struct CombinedResourceLayout
 	uint32_t stages_for_sets[VULKAN_NUM_DESCRIPTOR_SETS] = {};
 	VkPushConstantRange push_constant_range = {};
 	uint32_t descriptor_set_mask = 0;
+	uint32_t bindless_set_mask = 0;
 	uint32_t spec_constant_mask[Util::ecast(ShaderStage::Count)] = {};
 	uint32_t combined_spec_constant_mask = 0;
 	Util::Hash push_constant_layout_hash = 0;
@@ -84,6 +87,7 @@ public:
 		return pipe_layout;
 	}
 
+	// nullptr for bindless sets.
 	DescriptorSetAllocator *get_allocator(unsigned set) const
 	{
 		return set_allocators[set];
@@ -145,11 +149,24 @@ public:
 	VkPipeline get_pipeline(Util::Hash hash) const;
 	VkPipeline add_pipeline(Util::Hash hash, VkPipeline pipeline);
 
+	// Used in place of this program while its pipelines are compiled asynchronously.
+	// The fallback must end up with the same pipeline layout as this program.
+	void set_fallback_program(Program *program)
+	{
+		fallback = program;
+	}
+
+	Program *get_fallback_program() const
+	{
+		return fallback;
+	}
+
 private:
 	void set_shader(ShaderStage stage, Shader *handle);
 	Device *device;
 	Shader *shaders[Util::ecast(ShaderStage::Count)] = {};
 	PipelineLayout *layout = nullptr;
+	Program *fallback = nullptr;
 	VulkanCache<Util::IntrusivePODWrapper<VkPipeline>> pipelines;
 };
 }
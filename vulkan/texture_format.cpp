@@ -28,6 +28,19 @@ using namespace std;
 
 namespace Vulkan
 {
+static uint32_t least_common_multiple(uint32_t a, uint32_t b)
+{
+	uint32_t x = a;
+	uint32_t y = b;
+	while (y)
+	{
+		uint32_t t = x % y;
+		x = y;
+		y = t;
+	}
+	return (a / x) * b;
+}
+
 uint32_t TextureFormatLayout::num_miplevels(uint32_t width, uint32_t height, uint32_t depth)
 {
 	uint32_t size = unsigned(max(max(width, height), depth));
@@ -152,6 +165,13 @@ uint32_t TextureFormatLayout::format_block_size(VkFormat format)
 	fmt(R8G8B8_UINT, 3);
 	fmt(R8G8B8_SINT, 3);
 	fmt(R8G8B8_SRGB, 3);
+	fmt(B8G8R8_UNORM, 3);
+	fmt(B8G8R8_SNORM, 3);
+	fmt(B8G8R8_USCALED, 3);
+	fmt(B8G8R8_SSCALED, 3);
+	fmt(B8G8R8_UINT, 3);
+	fmt(B8G8R8_SINT, 3);
+	fmt(B8G8R8_SRGB, 3);
 	fmt(R8G8B8A8_UNORM, 4);
 	fmt(R8G8B8A8_SNORM, 4);
 	fmt(R8G8B8A8_USCALED, 4);
@@ -425,6 +445,11 @@ uint32_t TextureFormatLayout::get_block_stride() const
 	return block_stride;
 }
 
+uint32_t TextureFormatLayout::get_required_buffer_alignment() const
+{
+	return least_common_multiple(4, block_stride);
+}
+
 uint32_t TextureFormatLayout::get_levels() const
 {
 	return mip_levels;
@@ -59,6 +59,10 @@ public:
 
 	size_t get_required_size() const;
 
+	// Alignment for the start of the layout in a staging buffer.
+	// Copy offsets must be multiples of both 4 and the block size, which is 3, 6 or 12 for some formats.
+	uint32_t get_required_buffer_alignment() const;
+
 	size_t row_byte_stride(uint32_t row_length) const;
 	size_t layer_byte_stride(uint32_t row_length, size_t row_byte_stride) const;
 
@@ -0,0 +1,520 @@
+/* Copyright (c) 2017-2018 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include "upload_manager.hpp"
+#include "device.hpp"
+#include <algorithm>
+#include <string.h>
+
+using namespace std;
+
+namespace Vulkan
+{
+UploadManager::UploadManager(Device *device)
+	: device(device)
+{
+	pending.ticket = 1;
+}
+
+UploadManager::~UploadManager()
+{
+	teardown();
+}
+
+void UploadManager::set_ring_size(VkDeviceSize size)
+{
+	lock_guard<mutex> holder{lock};
+	VK_ASSERT(!ring);
+	ring_size = (size + 255) & ~VkDeviceSize(255);
+}
+
+bool UploadManager::create_ring()
+{
+	BufferCreateInfo info = {};
+	info.domain = BufferDomain::Host;
+	info.size = ring_size;
+	info.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+	auto buffer = device->create_buffer(info, nullptr);
+	if (!buffer)
+		return false;
+
+	device->set_name(*buffer, "upload-ring");
+	auto *mapped = static_cast<uint8_t *>(device->map_host_buffer(*buffer, MEMORY_ACCESS_WRITE_BIT));
+
+	lock_guard<mutex> holder{lock};
+	if (!ring)
+	{
+		ring = move(buffer);
+		ring_mapped = mapped;
+	}
+	return true;
+}
+
+bool UploadManager::allocate_ring(VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize &offset)
+{
+	// Restart from the beginning when possible, so we do not have to wrap.
+	if (ring_read == ring_write)
+	{
+		ring_write = ((ring_write + ring_size - 1) / ring_size) * ring_size;
+		ring_read = ring_write;
+	}
+
+	// Image copies need alignments which are not powers of two.
+	VkDeviceSize ring_offset = ring_write % ring_size;
+	VkDeviceSize aligned_offset = ((ring_offset + alignment - 1) / alignment) * alignment;
+	uint64_t position = ring_write + (aligned_offset - ring_offset);
+	if (aligned_offset + size > ring_size)
+		position = ring_write + (ring_size - ring_offset);
+
+	if (position + size - ring_read > ring_size)
+		return false;
+
+	offset = position % ring_size;
+	ring_write = position + size;
+	return true;
+}
+
+template <typename WriteFunc, typename RecordFunc>
+UploadManager::Ticket UploadManager::stage(VkDeviceSize size, VkDeviceSize alignment,
+                                           const WriteFunc &write, const RecordFunc &record)
+{
+	// Large uploads would keep most of the ring busy, so give them their own staging buffer.
+	if (size > ring_size / 2)
+	{
+		BufferCreateInfo info = {};
+		info.domain = BufferDomain::Host;
+		info.size = size;
+		info.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+		auto buffer = device->create_buffer(info, nullptr);
+		if (!buffer)
+		{
+			LOGE("Failed to allocate staging buffer for upload.\n");
+			return 0;
+		}
+
+		device->set_name(*buffer, "upload-dedicated-staging");
+		write(static_cast<uint8_t *>(device->map_host_buffer(*buffer, MEMORY_ACCESS_WRITE_BIT)));
+		device->unmap_host_buffer(*buffer, MEMORY_ACCESS_WRITE_BIT);
+
+		lock_guard<mutex> holder{lock};
+		record(pending, Staging{ buffer.get(), 0 });
+		pending.dedicated_staging.push_back(move(buffer));
+		stats.dedicated_staging_uploads++;
+		return pending.ticket;
+	}
+
+	bool has_ring;
+	{
+		lock_guard<mutex> holder{lock};
+		has_ring = bool(ring);
+	}
+
+	if (!has_ring && !create_ring())
+	{
+		LOGE("Failed to allocate upload ring.\n");
+		return 0;
+	}
+
+	VkDeviceSize offset;
+	uint8_t *mapped;
+	for (;;)
+	{
+		Ticket oldest;
+		{
+			lock_guard<mutex> holder{lock};
+			if (allocate_ring(size, alignment, offset))
+			{
+				pending_ring_writes++;
+				mapped = ring_mapped;
+				break;
+			}
+
+			stats.ring_stalls++;
+			oldest = completed_ticket + 1;
+		}
+
+		// The ring is full, so submit what we have and wait for the oldest batch to free up its space.
+		wait(oldest);
+	}
+
+	// The range is ours, so other threads can stage while we copy.
+	write(mapped + offset);
+
+	Ticket ticket;
+	{
+		lock_guard<mutex> holder{lock};
+		record(pending, Staging{ ring.get(), offset });
+		ticket = pending.ticket;
+		pending_ring_writes--;
+	}
+	write_cond.notify_all();
+	return ticket;
+}
+
+BufferHandle UploadManager::create_buffer(const BufferCreateInfo &info, const void *initial)
+{
+	if (!initial || info.domain != BufferDomain::Device)
+		return device->create_buffer(info, initial);
+
+	auto buffer = device->create_buffer(info, nullptr);
+	if (!buffer)
+		return buffer;
+
+	// Device memory might be host visible, in which case there is nothing to stage.
+	void *mapped = device->map_host_buffer(*buffer, MEMORY_ACCESS_WRITE_BIT);
+	if (mapped)
+	{
+		memcpy(mapped, initial, info.size);
+		device->unmap_host_buffer(*buffer, MEMORY_ACCESS_WRITE_BIT);
+	}
+	else
+		upload_buffer(buffer, 0, initial, info.size);
+
+	return buffer;
+}
+
+UploadManager::Ticket UploadManager::upload_buffer(const BufferHandle &buffer, VkDeviceSize offset, const void *data,
+                                                   VkDeviceSize size, Callback on_complete)
+{
+	VK_ASSERT(offset + size <= buffer->get_create_info().size);
+	return stage(size, 4, [&](uint8_t *mapped) {
+		memcpy(mapped, data, size);
+	}, [&](Batch &batch, const Staging &staging) {
+		batch.buffer_copies.push_back({ buffer, staging.buffer, { staging.offset, offset, size } });
+		if (on_complete)
+			batch.callbacks.push_back(move(on_complete));
+		stats.buffer_uploads++;
+		stats.uploaded_bytes += size;
+	});
+}
+
+UploadManager::Ticket UploadManager::upload_image(const ImageHandle &image, const TextureFormatLayout &layout,
+                                                  Callback on_complete)
+{
+	VK_ASSERT(image->get_create_info().initial_layout == VK_IMAGE_LAYOUT_UNDEFINED);
+	vector<VkBufferImageCopy> blits;
+	layout.build_buffer_image_copies(blits);
+
+	// The layout only aligns mips to 16 bytes, but copy offsets must also be a multiple of the block size,
+	// so repack every mip level in the staging buffer.
+	VkDeviceSize alignment = layout.get_required_buffer_alignment();
+	vector<VkDeviceSize> mip_sizes(blits.size());
+	VkDeviceSize size = 0;
+	for (size_t level = 0; level < blits.size(); level++)
+	{
+		auto &mip = layout.get_mip_info(uint32_t(level));
+		mip_sizes[level] = VkDeviceSize(mip.block_row_length) * mip.block_image_height * mip.depth *
+		                   layout.get_layers() * layout.get_block_stride();
+
+		size = ((size + alignment - 1) / alignment) * alignment;
+		blits[level].bufferOffset = size;
+		size += mip_sizes[level];
+	}
+
+	return stage(size, alignment, [&](uint8_t *mapped) {
+		for (size_t level = 0; level < blits.size(); level++)
+		{
+			memcpy(mapped + blits[level].bufferOffset,
+			       static_cast<const uint8_t *>(layout.data()) + layout.get_mip_info(uint32_t(level)).offset,
+			       mip_sizes[level]);
+		}
+	}, [&](Batch &batch, const Staging &staging) {
+		for (auto &blit : blits)
+			blit.bufferOffset += staging.offset;
+		batch.image_copies.push_back({ image, staging.buffer, move(blits) });
+		if (on_complete)
+			batch.callbacks.push_back(move(on_complete));
+		stats.image_uploads++;
+		stats.uploaded_bytes += size;
+	});
+}
+
+UploadManager::Ticket UploadManager::flush()
+{
+	device->flush_uploads();
+	lock_guard<mutex> holder{lock};
+	return pending.ticket - 1;
+}
+
+void UploadManager::poll()
+{
+	retire(0);
+}
+
+void UploadManager::wait(Ticket ticket)
+{
+	bool need_flush;
+	{
+		lock_guard<mutex> holder{lock};
+		need_flush = ticket >= pending.ticket;
+	}
+
+	if (need_flush)
+		flush();
+	retire(ticket);
+}
+
+bool UploadManager::is_complete(Ticket ticket)
+{
+	poll();
+	lock_guard<mutex> holder{lock};
+	return ticket <= completed_ticket;
+}
+
+UploadManagerStats UploadManager::get_stats()
+{
+	lock_guard<mutex> holder{lock};
+	auto ret = stats;
+	ret.in_flight_batches = unsigned(in_flight.size());
+	return ret;
+}
+
+void UploadManager::retire(Ticket wait_ticket)
+{
+	vector<Batch> retired;
+	vector<Callback> callbacks;
+
+	for (;;)
+	{
+		Fence fence;
+		{
+			lock_guard<mutex> holder{lock};
+			if (in_flight.empty())
+				break;
+
+			auto &batch = in_flight.front();
+			if (batch.fence->wait_timeout(0))
+			{
+				ring_read = std::max(ring_read, batch.ring_end);
+				completed_ticket = batch.ticket;
+				for (auto &callback : batch.callbacks)
+					callbacks.push_back(move(callback));
+				retired.push_back(move(batch));
+				in_flight.pop_front();
+				continue;
+			}
+			else if (batch.ticket > wait_ticket)
+				break;
+
+			fence = batch.fence;
+		}
+
+		fence->wait();
+	}
+
+	// Fences and staging buffers call into the device when they are released.
+	retired.clear();
+	for (auto &callback : callbacks)
+		callback();
+}
+
+void UploadManager::flush_nolock(unsigned thread_index)
+{
+	// Writers never take the device lock, so they cannot be waiting on us.
+	unique_lock<mutex> holder{lock};
+	write_cond.wait(holder, [this]() {
+		return pending_ring_writes == 0;
+	});
+
+	if (pending.buffer_copies.empty() && pending.image_copies.empty())
+		return;
+
+	auto cmd = device->request_command_buffer_nolock(thread_index, CommandBuffer::Type::AsyncTransfer);
+	CommandBufferHandle acquire_cmd;
+	VkPipelineStageFlags stages = 0;
+	VkAccessFlags access = 0;
+
+	cmd->begin_region("upload-batch");
+	record_buffer_copies(*cmd, stages, access);
+	record_image_copies(*cmd, acquire_cmd, thread_index, stages, access);
+	cmd->end_region();
+
+	// The ring stays mapped, so make sure the writes are visible to the device.
+	if (ring)
+		device->unmap_host_buffer(*ring, MEMORY_ACCESS_WRITE_BIT);
+
+	device->submit_staging(cmd, stages, access, false, &pending.fence);
+	if (acquire_cmd)
+		device->submit_nolock(move(acquire_cmd), nullptr, 0, nullptr);
+
+	Ticket ticket = pending.ticket;
+	pending.ring_end = ring_write;
+	in_flight.push_back(move(pending));
+	pending = {};
+	pending.ticket = ticket + 1;
+	stats.submitted_batches++;
+}
+
+void UploadManager::record_buffer_copies(CommandBuffer &cmd, VkPipelineStageFlags &stages, VkAccessFlags &access)
+{
+	auto &copies = pending.buffer_copies;
+
+	// Group by destination and source, but keep the order uploads were made in.
+	stable_sort(begin(copies), end(copies), [](const BufferCopy &a, const BufferCopy &b) {
+		if (a.dst.get() != b.dst.get())
+			return a.dst.get() < b.dst.get();
+		return a.src < b.src;
+	});
+
+	vector<VkBufferCopy> regions;
+	size_t i = 0;
+	while (i < copies.size())
+	{
+		auto &dst = *copies[i].dst;
+		auto *src = copies[i].src;
+		regions.clear();
+
+		for (; i < copies.size() && copies[i].dst.get() == &dst && copies[i].src == src; i++)
+		{
+			auto &region = copies[i].region;
+			if (!region.size)
+				continue;
+
+			// Uploads which were staged back to back into a contiguous range become one region.
+			if (!regions.empty() &&
+			    regions.back().srcOffset + regions.back().size == region.srcOffset &&
+			    regions.back().dstOffset + regions.back().size == region.dstOffset)
+			{
+				regions.back().size += region.size;
+			}
+			else
+				regions.push_back(region);
+		}
+
+		if (!regions.empty())
+			cmd.copy_buffer(dst, *src, regions.data(), regions.size());
+		stats.buffer_copy_regions += regions.size();
+
+		auto usage = dst.get_create_info().usage;
+		stages |= buffer_usage_to_possible_stages(usage);
+		access |= buffer_usage_to_possible_access(usage);
+	}
+}
+
+void UploadManager::record_image_copies(CommandBuffer &cmd, CommandBufferHandle &acquire_cmd, unsigned thread_index,
+                                        VkPipelineStageFlags &stages, VkAccessFlags &access)
+{
+	auto &copies = pending.image_copies;
+	if (copies.empty())
+		return;
+
+	vector<VkImageMemoryBarrier> barriers;
+	barriers.reserve(copies.size());
+	for (auto &copy : copies)
+	{
+		auto &info = copy.dst->get_create_info();
+		VkImageMemoryBarrier barrier = { VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER };
+		barrier.image = copy.dst->get_image();
+		barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+		barrier.newLayout = copy.dst->get_layout(VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+		barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		barrier.subresourceRange.aspectMask = format_to_aspect_mask(info.format);
+		barrier.subresourceRange.levelCount = info.levels;
+		barrier.subresourceRange.layerCount = info.layers;
+		barriers.push_back(barrier);
+	}
+
+	cmd.barrier(VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+	            0, nullptr, 0, nullptr, unsigned(barriers.size()), barriers.data());
+
+	for (auto &copy : copies)
+		cmd.copy_buffer_to_image(*copy.dst, *copy.src, unsigned(copy.blits.size()), copy.blits.data());
+
+	// With a dedicated transfer queue, the final transition happens there,
+	// and the semaphore which graphics waits on makes the writes visible.
+	bool single_queue = device->transfer_queue == device->graphics_queue;
+	VkPipelineStageFlags release_stages = single_queue ? 0 : VkPipelineStageFlags(VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT);
+	VkPipelineStageFlags acquire_stages = 0;
+	vector<VkImageMemoryBarrier> acquires;
+
+	for (size_t i = 0; i < copies.size(); i++)
+	{
+		auto &image = *copies[i].dst;
+		auto &barrier = barriers[i];
+		VkAccessFlags dst_access = image.get_access_flags() &
+		                           image_layout_to_possible_access(VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+
+		barrier.oldLayout = barrier.newLayout;
+		barrier.newLayout = image.get_layout(VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+		barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		barrier.dstAccessMask = single_queue ? dst_access : 0;
+
+		bool concurrent = (image.get_create_info().misc & (IMAGE_MISC_CONCURRENT_QUEUE_GRAPHICS_BIT |
+		                                                   IMAGE_MISC_CONCURRENT_QUEUE_ASYNC_COMPUTE_BIT |
+		                                                   IMAGE_MISC_CONCURRENT_QUEUE_ASYNC_GRAPHICS_BIT |
+		                                                   IMAGE_MISC_CONCURRENT_QUEUE_ASYNC_TRANSFER_BIT)) != 0;
+
+		if (!single_queue && !concurrent &&
+		    device->transfer_queue_family_index != device->graphics_queue_family_index)
+		{
+			// Exclusive images need their ownership released here and acquired on the graphics queue.
+			barrier.srcQueueFamilyIndex = device->transfer_queue_family_index;
+			barrier.dstQueueFamilyIndex = device->graphics_queue_family_index;
+
+			auto acquire = barrier;
+			acquire.srcAccessMask = 0;
+			acquire.dstAccessMask = dst_access;
+			acquires.push_back(acquire);
+			acquire_stages |= image.get_stage_flags();
+		}
+
+		if (single_queue)
+			release_stages |= image.get_stage_flags();
+		stages |= image.get_stage_flags();
+		access |= dst_access;
+	}
+
+	cmd.barrier(VK_PIPELINE_STAGE_TRANSFER_BIT, release_stages,
+	            0, nullptr, 0, nullptr, unsigned(barriers.size()), barriers.data());
+
+	if (!acquires.empty())
+	{
+		acquire_cmd = device->request_command_buffer_nolock(thread_index, CommandBuffer::Type::Generic);
+		acquire_cmd->barrier(acquire_stages, acquire_stages,
+		                     0, nullptr, 0, nullptr, unsigned(acquires.size()), acquires.data());
+	}
+}
+
+void UploadManager::teardown()
+{
+	deque<Batch> batches;
+	BufferHandle old_ring;
+	{
+		lock_guard<mutex> holder{lock};
+		batches = move(in_flight);
+		in_flight.clear();
+		auto ticket = pending.ticket;
+		pending = {};
+		pending.ticket = ticket;
+		old_ring = move(ring);
+		ring_mapped = nullptr;
+		ring_read = ring_write;
+	}
+
+	// Callbacks might refer to objects which are torn down along with the device, so they are dropped.
+	for (auto &batch : batches)
+		batch.fence->wait();
+}
+}
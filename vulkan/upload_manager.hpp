@@ -0,0 +1,166 @@
+/* Copyright (c) 2017-2018 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#pragma once
+
+#include "buffer.hpp"
+#include "command_buffer.hpp"
+#include "image.hpp"
+#include "fence.hpp"
+#include "texture_format.hpp"
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+namespace Vulkan
+{
+class Device;
+
+struct UploadManagerStats
+{
+	uint64_t submitted_batches = 0;
+	uint64_t buffer_uploads = 0;
+	uint64_t image_uploads = 0;
+	// Copy regions recorded after merging uploads which are adjacent in both source and destination.
+	uint64_t buffer_copy_regions = 0;
+	uint64_t uploaded_bytes = 0;
+	// Uploads which were too large for the ring and got a staging buffer of their own.
+	uint64_t dedicated_staging_uploads = 0;
+	// Number of times an upload had to wait for the GPU to free up ring space.
+	uint64_t ring_stalls = 0;
+	unsigned in_flight_batches = 0;
+};
+
+// Batches uploads through a persistently mapped ring staging buffer, and submits them together on the transfer queue.
+// Every upload returns a ticket. Tickets increase monotonically and complete in order,
+// so waiting for a ticket also waits for every upload queued before it.
+// Pending uploads are submitted by flush(), and whenever graphics or compute work is submitted,
+// so any command buffer submitted after an upload was queued will observe its data.
+// Completion callbacks are called from poll(), wait() and Device::next_frame_context().
+class UploadManager
+{
+public:
+	using Ticket = uint64_t;
+	using Callback = std::function<void ()>;
+
+	explicit UploadManager(Device *device);
+	~UploadManager();
+	UploadManager(const UploadManager &) = delete;
+	void operator=(const UploadManager &) = delete;
+
+	// Must be called before the first upload.
+	void set_ring_size(VkDeviceSize size);
+
+	// Creates a buffer and queues its initial data, without any submission of its own.
+	// Buffers in host visible memory are written directly.
+	BufferHandle create_buffer(const BufferCreateInfo &info, const void *initial);
+
+	// Uploads to overlapping ranges of a buffer are not ordered against each other if they end up in the same batch.
+	Ticket upload_buffer(const BufferHandle &buffer, VkDeviceSize offset, const void *data, VkDeviceSize size,
+	                     Callback on_complete = {});
+
+	// The image must be created without initial data and with an undefined initial layout.
+	// All levels and layers in the layout are uploaded, and the image ends up in SHADER_READ_ONLY_OPTIMAL.
+	// If the transfer queue is in another queue family, the graphics queue only owns the image
+	// once the upload has completed, so do not use it before then.
+	Ticket upload_image(const ImageHandle &image, const TextureFormatLayout &layout, Callback on_complete = {});
+
+	// Returns the last submitted ticket.
+	Ticket flush();
+
+	// Call completion callbacks for batches which have completed.
+	// Callbacks can call into the device, so these must not be called with the device lock held.
+	void poll();
+	void wait(Ticket ticket);
+	bool is_complete(Ticket ticket);
+
+	UploadManagerStats get_stats();
+
+private:
+	friend class Device;
+	Device *device;
+
+	struct BufferCopy
+	{
+		BufferHandle dst;
+		const Buffer *src;
+		VkBufferCopy region;
+	};
+
+	struct ImageCopy
+	{
+		ImageHandle dst;
+		const Buffer *src;
+		std::vector<VkBufferImageCopy> blits;
+	};
+
+	struct Batch
+	{
+		Ticket ticket = 0;
+		Fence fence;
+		uint64_t ring_end = 0;
+		std::vector<BufferCopy> buffer_copies;
+		std::vector<ImageCopy> image_copies;
+		std::vector<BufferHandle> dedicated_staging;
+		std::vector<Callback> callbacks;
+	};
+
+	struct Staging
+	{
+		const Buffer *buffer;
+		VkDeviceSize offset;
+	};
+
+	std::mutex lock;
+	// Ring ranges which have been allocated, but not yet written and recorded.
+	// Batches are not submitted until these are done, so a batch never reads a range which is still being written.
+	std::condition_variable write_cond;
+	unsigned pending_ring_writes = 0;
+	Batch pending;
+	std::deque<Batch> in_flight;
+	Ticket completed_ticket = 0;
+	UploadManagerStats stats;
+
+	BufferHandle ring;
+	uint8_t *ring_mapped = nullptr;
+	VkDeviceSize ring_size = 32 * 1024 * 1024;
+	// Monotonic positions, the ring offset is the position modulo the ring size.
+	uint64_t ring_write = 0;
+	uint64_t ring_read = 0;
+
+	bool allocate_ring(VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize &offset);
+	bool create_ring();
+	template <typename WriteFunc, typename RecordFunc>
+	Ticket stage(VkDeviceSize size, VkDeviceSize alignment, const WriteFunc &write, const RecordFunc &record);
+	void retire(Ticket wait_ticket);
+
+	// Called by the device with its lock held, before graphics or compute work is submitted.
+	void flush_nolock(unsigned thread_index);
+	void record_buffer_copies(CommandBuffer &cmd, VkPipelineStageFlags &stages, VkAccessFlags &access);
+	void record_image_copies(CommandBuffer &cmd, CommandBufferHandle &acquire_cmd, unsigned thread_index,
+	                         VkPipelineStageFlags &stages, VkAccessFlags &access);
+	void teardown();
+};
+}
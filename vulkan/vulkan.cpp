@@ -502,6 +502,14 @@ bool Context::create_device(VkPhysicalDevice gpu, VkSurfaceKHR surface, const ch
 		ppNext = &ext.subgroup_properties.pNext;
 	}
 
+	ext.descriptor_indexing_properties = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_PROPERTIES_EXT };
+	if (ext.supports_vulkan_11_instance && ext.supports_vulkan_11_device &&
+	    has_extension(VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME))
+	{
+		*ppNext = &ext.descriptor_indexing_properties;
+		ppNext = &ext.descriptor_indexing_properties.pNext;
+	}
+
 	if (ext.supports_vulkan_11_instance && ext.supports_vulkan_11_device)
 		vkGetPhysicalDeviceProperties2(gpu, &props);
 
@@ -660,6 +668,12 @@ bool Context::create_device(VkPhysicalDevice gpu, VkSurfaceKHR surface, const ch
 		enabled_extensions.push_back(VK_GOOGLE_DISPLAY_TIMING_EXTENSION_NAME);
 	}
 
+	if (ext.supports_physical_device_properties2 && has_extension(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME))
+	{
+		ext.supports_memory_budget = true;
+		enabled_extensions.push_back(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+	}
+
 #ifdef _WIN32
 	ext.supports_external = false;
 #else
@@ -683,6 +697,7 @@ bool Context::create_device(VkPhysicalDevice gpu, VkSurfaceKHR surface, const ch
 	ext.storage_8bit_features = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_8BIT_STORAGE_FEATURES_KHR };
 	ext.storage_16bit_features = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_16BIT_STORAGE_FEATURES_KHR };
 	ext.float16_int8_features = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FLOAT16_INT8_FEATURES_KHR };
+	ext.descriptor_indexing_features = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES_EXT };
 	ppNext = &features.pNext;
 
 	if (has_extension(VK_KHR_STORAGE_BUFFER_STORAGE_CLASS_EXTENSION_NAME))
@@ -709,11 +724,32 @@ bool Context::create_device(VkPhysicalDevice gpu, VkSurfaceKHR surface, const ch
 		ppNext = &ext.float16_int8_features.pNext;
 	}
 
+	// Properties are only queried through the Vulkan 1.1 path, so require that as well.
+	bool has_descriptor_indexing = ext.supports_vulkan_11_instance && ext.supports_vulkan_11_device &&
+	                               has_extension(VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME) &&
+	                               has_extension(VK_KHR_MAINTENANCE3_EXTENSION_NAME);
+	if (ext.supports_physical_device_properties2 && has_descriptor_indexing)
+	{
+		enabled_extensions.push_back(VK_KHR_MAINTENANCE3_EXTENSION_NAME);
+		enabled_extensions.push_back(VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME);
+		*ppNext = &ext.descriptor_indexing_features;
+		ppNext = &ext.descriptor_indexing_features.pNext;
+	}
+
 	if (ext.supports_physical_device_properties2)
 		vkGetPhysicalDeviceFeatures2KHR(gpu, &features);
 	else
 		vkGetPhysicalDeviceFeatures(gpu, &features.features);
 
+	// Everything the bindless texture table relies on.
+	auto &indexing = ext.descriptor_indexing_features;
+	ext.supports_descriptor_indexing = ext.supports_physical_device_properties2 && has_descriptor_indexing &&
+	                                   indexing.runtimeDescriptorArray &&
+	                                   indexing.descriptorBindingPartiallyBound &&
+	                                   indexing.descriptorBindingSampledImageUpdateAfterBind &&
+	                                   indexing.descriptorBindingUpdateUnusedWhilePending &&
+	                                   indexing.shaderSampledImageArrayNonUniformIndexing;
+
 	// Enable device features we might care about.
 	{
 		VkPhysicalDeviceFeatures enabled_features = *required_features;
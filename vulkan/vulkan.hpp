@@ -49,6 +49,20 @@
 	} while (0)
 
 
+// Older headers do not know about VK_EXT_memory_budget.
+#ifndef VK_EXT_memory_budget
+#define VK_EXT_memory_budget 1
+#define VK_EXT_MEMORY_BUDGET_EXTENSION_NAME "VK_EXT_memory_budget"
+#define VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_BUDGET_PROPERTIES_EXT VkStructureType(1000237000)
+typedef struct VkPhysicalDeviceMemoryBudgetPropertiesEXT
+{
+	VkStructureType sType;
+	void *pNext;
+	VkDeviceSize heapBudget[VK_MAX_MEMORY_HEAPS];
+	VkDeviceSize heapUsage[VK_MAX_MEMORY_HEAPS];
+} VkPhysicalDeviceMemoryBudgetPropertiesEXT;
+#endif
+
 #ifdef VULKAN_DEBUG
 #define VK_ASSERT(x)                                             \
 	do                                                           \
@@ -87,10 +101,14 @@ struct DeviceFeatures
 	bool supports_google_display_timing = false;
 	bool supports_vulkan_11_instance = false;
 	bool supports_vulkan_11_device = false;
+	bool supports_descriptor_indexing = false;
+	bool supports_memory_budget = false;
 	VkPhysicalDeviceSubgroupProperties subgroup_properties = {};
+	VkPhysicalDeviceDescriptorIndexingPropertiesEXT descriptor_indexing_properties = {};
 	VkPhysicalDevice8BitStorageFeaturesKHR storage_8bit_features = {};
 	VkPhysicalDevice16BitStorageFeaturesKHR storage_16bit_features = {};
 	VkPhysicalDeviceFloat16Int8FeaturesKHR float16_int8_features = {};
+	VkPhysicalDeviceDescriptorIndexingFeaturesEXT descriptor_indexing_features = {};
 	VkPhysicalDeviceFeatures enabled_features = {};
 };
 
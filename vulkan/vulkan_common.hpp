@@ -24,7 +24,7 @@
 
 #include "intrusive.hpp"
 #include "object_pool.hpp"
-#include "intrusive_hash_map.hpp"
+#include "flat_hash_map.hpp"
 
 namespace Vulkan
 {
@@ -38,11 +38,11 @@ using HandleCounter = Util::SingleThreadCounter;
 template <typename T>
 using VulkanObjectPool = Util::ThreadSafeObjectPool<T>;
 template <typename T>
-using VulkanCache = Util::ThreadSafeIntrusiveHashMap<T>;
+using VulkanCache = Util::ThreadSafeFlatHashMap<T>;
 #else
 template <typename T>
 using VulkanObjectPool = Util::ObjectPool<T>;
 template <typename T>
-using VulkanCache = Util::IntrusiveHashMap<T>;
+using VulkanCache = Util::FlatHashMap<T>;
 #endif
 }
\ No newline at end of file